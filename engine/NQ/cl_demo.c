@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "client.h"
 #include "cmd.h"
 #include "console.h"
+#include "fisheye.h"
 #include "host.h"
 #include "net.h"
 #include "protocol.h"
@@ -66,6 +67,8 @@ CL_StopPlayback(void)
 
     if (cls.timedemo)
 	CL_FinishTimeDemo();
+
+    F_DemoStopped();
 }
 
 /*
@@ -294,6 +297,7 @@ CL_PlayDemo_f(void)
     if (err) {
 	Con_Printf("Error: demo filename too long\n");
 	cls.demonum = -1;	/* stop demo loop */
+	F_DemoFailed();
 	return;
     }
 
@@ -302,6 +306,7 @@ CL_PlayDemo_f(void)
     if (!cls.demofile) {
 	Con_Printf("ERROR: couldn't open.\n");
 	cls.demonum = -1;	/* stop demo loop */
+	F_DemoFailed();
 	return;
     }
 
@@ -342,6 +347,7 @@ CL_PlayDemo_f(void)
     fclose(cls.demofile);
     cls.demofile = NULL;
     cls.demonum = -1;
+    F_DemoFailed();
 }
 
 struct stree_root *
@@ -10,15 +10,32 @@
 #include "fisheye.h"
 #include "fishlens.h"
 #include "fishScript.h"
+#include "fishmath.h"
 
 // c->lua (c functions for use in lua)
 static int CtoLUA_latlon_to_ray(lua_State *L);
 static int CtoLUA_ray_to_latlon(lua_State *L);
 static int CtoLUA_plate_to_ray(lua_State *L);
+static int CtoLUA_latlon_to_ray_batch(lua_State *L);
+static int CtoLUA_ray_to_latlon_batch(lua_State *L);
+static int CtoLUA_plate_to_ray_batch(lua_State *L);
+static int lua_checkarrays(lua_State *L, int first, int count);
+static float* lua_tofloats(lua_State *L, int index, int n, float *values);
+static void lua_pushfloats(lua_State *L, const float *values, int n);
 
 // lua helpers
 static qboolean lua_func_exists(const char* name);
 static qboolean lua_loadAPlate(int i, struct _globe* globe);
+static void lua_getlensvar(const struct _lens *lens, const char *name);
+static qboolean lua_runlens(int errcode, struct _lens *lens, struct _zoom *zoom, int numplates);
+static qboolean lua_runglobe(int errcode, struct _globe *globe);
+static int lua_writechunk(lua_State *L, const void *p, size_t size, void *data);
+
+// a compiled script, as lua_dump writes it
+struct _chunk {
+   char *bytes;
+   size_t size;
+};
 
 // the Lua state pointer
 static lua_State *lua;
@@ -76,6 +93,16 @@ void F_scriptInit() {
 
    lua_pushcfunction(lua, CtoLUA_plate_to_ray);
    lua_setglobal(lua, "plate_to_ray");
+
+   // whole-array versions of the above (arrays in, arrays out)
+   lua_pushcfunction(lua, CtoLUA_latlon_to_ray_batch);
+   lua_setglobal(lua, "latlon_to_ray_batch");
+
+   lua_pushcfunction(lua, CtoLUA_ray_to_latlon_batch);
+   lua_setglobal(lua, "ray_to_latlon_batch");
+
+   lua_pushcfunction(lua, CtoLUA_plate_to_ray_batch);
+   lua_setglobal(lua, "plate_to_ray_batch");
 }
 
 void F_scriptShutdown(void) {
@@ -134,6 +161,113 @@ static int CtoLUA_plate_to_ray(lua_State *L)
    return 3;
 }
 
+// xs, ys, zs = latlon_to_ray_batch(lats, lons)
+static int CtoLUA_latlon_to_ray_batch(lua_State *L)
+{
+   int n = lua_checkarrays(L, 1, 2);
+   float *buf = malloc(5*n*sizeof(*buf) + 1);
+   if (NULL == buf) {
+      return luaL_error(L, "out of memory");
+   }
+   float *lat = lua_tofloats(L, 1, n, buf), *lon = lua_tofloats(L, 2, n, buf+n);
+   float *x = buf+2*n, *y = buf+3*n, *z = buf+4*n;
+
+   latlon_to_ray_batch(lat, lon, x, y, z, n);
+
+   lua_pushfloats(L, x, n);
+   lua_pushfloats(L, y, n);
+   lua_pushfloats(L, z, n);
+   free(buf);
+   return 3;
+}
+
+// lats, lons = ray_to_latlon_batch(xs, ys, zs)
+static int CtoLUA_ray_to_latlon_batch(lua_State *L)
+{
+   int n = lua_checkarrays(L, 1, 3);
+   float *buf = malloc(5*n*sizeof(*buf) + 1);
+   if (NULL == buf) {
+      return luaL_error(L, "out of memory");
+   }
+   float *x = lua_tofloats(L, 1, n, buf), *y = lua_tofloats(L, 2, n, buf+n);
+   float *z = lua_tofloats(L, 3, n, buf+2*n);
+   float *lat = buf+3*n, *lon = buf+4*n;
+
+   ray_to_latlon_batch(x, y, z, lat, lon, n);
+
+   lua_pushfloats(L, lat, n);
+   lua_pushfloats(L, lon, n);
+   free(buf);
+   return 2;
+}
+
+// xs, ys, zs = plate_to_ray_batch(plate, us, vs)
+static int CtoLUA_plate_to_ray_batch(lua_State *L)
+{
+   struct _globe* globe = F_getGlobe();
+   int plate_index = luaL_checknumber(L,1);
+   int n = lua_checkarrays(L, 2, 2);
+   if (plate_index < 0 || plate_index >= globe->numplates) {
+      lua_pushnil(L);
+      return 1;
+   }
+
+   float *buf = malloc(5*n*sizeof(*buf) + 1);
+   if (NULL == buf) {
+      return luaL_error(L, "out of memory");
+   }
+   float *u = lua_tofloats(L, 2, n, buf), *v = lua_tofloats(L, 3, n, buf+n);
+   float *x = buf+2*n, *y = buf+3*n, *z = buf+4*n;
+
+   plate_uv_to_ray_batch(globe, plate_index, u, v, x, y, z, n);
+
+   lua_pushfloats(L, x, n);
+   lua_pushfloats(L, y, n);
+   lua_pushfloats(L, z, n);
+   free(buf);
+   return 3;
+}
+
+// checks for count arrays of the same length from the first argument on,
+// returning their length
+static int lua_checkarrays(lua_State *L, int first, int count)
+{
+   int i, n = 0;
+   for (i=first; i<first+count; ++i) {
+      luaL_checktype(L, i, LUA_TTABLE);
+      int len = lua_rawlen(L, i);
+      if (i == first) {
+         n = len;
+      }
+      else {
+         luaL_argcheck(L, len == n, i, "arrays must have the same length");
+      }
+   }
+   return n;
+}
+
+// copies a Lua array of numbers into values (non-numbers become 0)
+static float* lua_tofloats(lua_State *L, int index, int n, float *values)
+{
+   int i;
+   for (i=0; i<n; ++i) {
+      lua_rawgeti(L, index, i+1);
+      values[i] = lua_tonumber(L, -1);
+      lua_pop(L, 1);
+   }
+   return values;
+}
+
+static void lua_pushfloats(lua_State *L, const float *values, int n)
+{
+   int i;
+   lua_createtable(L, n, 0);
+   for (i=0; i<n; ++i) {
+      lua_pushnumber(L, values[i]);
+      lua_rawseti(L, -2, i+1);
+   }
+}
+
 // -------------------------------------------------------------------------------- 
 // |                                                                              |
 // |                 Lua->C (lua functions for use in c)                          |
@@ -293,6 +427,14 @@ static qboolean lua_func_exists(const char* name)
    return exists;
 }
 
+// pushes a variable defined by the given lens' script
+static void lua_getlensvar(const struct _lens *lens, const char *name)
+{
+   lua_rawgeti(lua, LUA_REGISTRYINDEX, lens->script.env);
+   lua_getfield(lua, -1, name);
+   lua_remove(lua, -2); // remove env
+}
+
 // -------------------------------------------------------------------------------- 
 // |                                                                              |
 // |                    Lua state management functions                            |
@@ -301,34 +443,96 @@ static qboolean lua_func_exists(const char* name)
 
 qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, int numplates)
 {
-   // clear Lua variables
-   F_clear_lens(numplates);
-
    // set full filename
    char filename[0x100];
    snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua",
       com_basedir, name);
 
-      int errcode = 0;
-   if ((errcode=luaL_loadfile(lua, filename))) {
-      Con_Printf("could not loadfile (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
-      lua_pop(lua,1); // pop error message
+   // compiled first, so the lens can keep the chunk
+   char error[256];
+   size_t size;
+   void *chunk = F_compile_script(filename, &size, error, sizeof(error));
+   if (NULL == chunk) {
+      Con_Printf("could not loadfile \nERROR: %s\n", error);
+      return false;
+   }
+
+   qboolean loaded = F_load_lens_chunk(name, chunk, size, lens, zoom, numplates);
+   free(chunk);
+   return loaded;
+}
+
+qboolean F_load_lens_chunk(const char *name, const void *chunk, size_t size,
+      struct _lens *lens, struct _zoom *zoom, int numplates)
+{
+   // run it into a copy, so a broken script leaves the current lens alone
+   struct _lens staged = *lens;
+   struct _zoom staged_zoom = *zoom;
+   staged.script.env = staged.script.forward = staged.script.inverse = LUA_NOREF;
+   staged.script.chunk = NULL;
+   staged.script.chunk_size = 0;
+
+   F_clear_lens(numplates);
+   if (!lua_runlens(luaL_loadbufferx(lua, chunk, size, name, "b"),
+            &staged, &staged_zoom, numplates)) {
+      F_release_lens(&staged);
+      F_bind_lens(lens);
       return false;
    }
+
+   // keep the chunk (unless it is the one the lens already keeps)
+   if (chunk == lens->script.chunk) {
+      lens->script.chunk = NULL;
+      staged.script.chunk = (void*)chunk;
+   }
    else {
-      if ((errcode=lua_pcall(lua, 0, 0, 0))) {
-         Con_Printf("could not pcall (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
-         lua_pop(lua,1); // pop error message
-         return false;
+      staged.script.chunk = malloc(size);
+      if (staged.script.chunk) {
+         memcpy(staged.script.chunk, chunk, size);
       }
    }
+   staged.script.chunk_size = staged.script.chunk ? size : 0;
+
+   F_release_lens(lens);
+   *lens = staged;
+   *zoom = staged_zoom;
+   return true;
+}
+
+// runs a loaded lens chunk (on top of the stack) and reads its variables
+// (errcode is what loading it returned)
+static qboolean lua_runlens(int errcode, struct _lens *lens, struct _zoom *zoom, int numplates)
+{
+   lens->script.numplates = numplates;
+   if (errcode) {
+      Con_Printf("could not loadfile (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+      lua_pop(lua,1); // pop error message
+      return false;
+   }
+
+   // run the script in its own environment (falling back to the globals),
+   // so lenses loaded side by side don't overwrite each other's variables
+   lua_newtable(lua); // env
+   lua_newtable(lua); // env metatable
+   lua_pushglobaltable(lua);
+   lua_setfield(lua, -2, "__index");
+   lua_setmetatable(lua, -2);
+   lua_pushvalue(lua, -1);
+   lens->script.env = luaL_ref(lua, LUA_REGISTRYINDEX); // pop env copy
+   lua_setupvalue(lua, -2, 1); // pop env into the chunk's _ENV
+
+   if ((errcode=lua_pcall(lua, 0, 0, 0))) {
+      Con_Printf("could not pcall (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
+      lua_pop(lua,1); // pop error message
+      return false;
+   }
 
    // clear current maps
    lens->map_type = MAP_NONE;
    scriptRef.lens_forward = scriptRef.lens_inverse = -1;
 
    // check if the inverse map function is provided
-   lua_getglobal(lua, "lens_inverse");
+   lua_getlensvar(lens, "lens_inverse");
    if (!lua_isfunction(lua,-1)) {
       // Con_Printf("lens_inverse is not found\n");
       lua_pop(lua,1); // pop lens_inverse
@@ -339,7 +543,7 @@ qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, i
    }
 
    // check if the forward map function is provided
-   lua_getglobal(lua, "lens_forward");
+   lua_getlensvar(lens, "lens_forward");
    if (!lua_isfunction(lua,-1)) {
       // Con_Printf("lens_forward is not found\n");
       lua_pop(lua,1); // pop lens_forward
@@ -350,9 +554,11 @@ qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, i
          lens->map_type = MAP_FORWARD;
       }
    }
+   lens->script.forward = scriptRef.lens_forward;
+   lens->script.inverse = scriptRef.lens_inverse;
 
    // get map function preference if provided
-   lua_getglobal(lua, "map");
+   lua_getlensvar(lens, "map");
    if (lua_isstring(lua, -1))
    {
       // get desired map function name
@@ -373,25 +579,70 @@ qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, i
    }
    lua_pop(lua,1); // pop map
 
-   lua_getglobal(lua, "max_fov");
+   lua_getlensvar(lens, "max_fov");
    zoom->max_fov = (int)lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
    lua_pop(lua,1); // pop max_fov
 
-   lua_getglobal(lua, "max_vfov");
+   lua_getlensvar(lens, "max_vfov");
    zoom->max_vfov = (int)lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
    lua_pop(lua,1); // pop max_vfov
 
-   lua_getglobal(lua, "lens_width");
+   lua_getlensvar(lens, "lens_width");
    lens->width = lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
    lua_pop(lua,1); // pop lens_width
 
-   lua_getglobal(lua, "lens_height");
+   lua_getlensvar(lens, "lens_height");
    lens->height = lua_isnumber(lua,-1) ? lua_tonumber(lua,-1) : 0;
    lua_pop(lua,1); // pop lens_height
 
    return true;
 }
 
+// releases the script references and the chunk held by a lens
+void F_release_lens(struct _lens *lens)
+{
+   if (lens->script.env > 0) {
+      luaL_unref(lua, LUA_REGISTRYINDEX, lens->script.env);
+   }
+   if (lens->script.forward > 0) {
+      luaL_unref(lua, LUA_REGISTRYINDEX, lens->script.forward);
+   }
+   if (lens->script.inverse > 0) {
+      luaL_unref(lua, LUA_REGISTRYINDEX, lens->script.inverse);
+   }
+   lens->script.env = lens->script.forward = lens->script.inverse = LUA_NOREF;
+   free(lens->script.chunk);
+   lens->script.chunk = NULL;
+   lens->script.chunk_size = 0;
+}
+
+// points the lens_forward/lens_inverse calls at the given lens' functions
+void F_bind_lens(const struct _lens *lens)
+{
+   scriptRef.lens_forward = lens->script.env > 0 ? lens->script.forward : -1;
+   scriptRef.lens_inverse = lens->script.env > 0 ? lens->script.inverse : -1;
+}
+
+// the lens' "onload" command string, or NULL if it has none
+const char* F_lens_onload(const struct _lens *lens)
+{
+   static char onload[256];
+   const char *retval = NULL;
+
+   if (lens->script.env <= 0) {
+      return NULL;
+   }
+
+   lua_getlensvar(lens, "onload");
+   if (lua_isstring(lua, -1)) {
+      qsnprintf(onload, sizeof(onload), "%s", lua_tostring(lua, -1));
+      retval = onload;
+   }
+   lua_pop(lua, 1); // pop onload
+
+   return retval;
+}
+
 qboolean F_load_globe(const char *name, struct _globe *globe) {
    // clear Lua variables
    F_clear_globe();
@@ -401,9 +652,22 @@ qboolean F_load_globe(const char *name, struct _globe *globe) {
    snprintf(filename, sizeof(filename), "%s/lua-scripts/globes/%s.lua",
       com_basedir, name);
 
+   return lua_runglobe(luaL_loadfile(lua, filename), globe);
+}
+
+qboolean F_load_globe_chunk(const char *name, const void *chunk, size_t size,
+      struct _globe *globe) {
+   // clear Lua variables
+   F_clear_globe();
+
+   return lua_runglobe(luaL_loadbufferx(lua, chunk, size, name, "b"), globe);
+}
+
+// runs a loaded globe chunk (on top of the stack) and reads its plates
+// (errcode is what loading it returned)
+static qboolean lua_runglobe(int errcode, struct _globe *globe) {
    // check if loaded correctly
-   int errcode = 0;
-   if ((errcode=luaL_loadfile(lua, filename))) {
+   if (errcode) {
       Con_Printf("could not loadfile (%d) \nERROR: %s", errcode, lua_tostring(lua,-1));
       lua_pop(lua,1); // pop error message
       return false;
@@ -416,14 +680,6 @@ qboolean F_load_globe(const char *name, struct _globe *globe) {
       }
    }
 
-   // check for the globe_plate function
-   scriptRef.globe_plate = -1;
-   if (lua_func_exists("globe_plate"))
-   {
-      lua_getglobal(lua, "globe_plate");
-      scriptRef.globe_plate = luaL_ref(lua, LUA_REGISTRYINDEX);
-   }
-
    // load plates array
    lua_getglobal(lua, "plates");
    if (!lua_istable(lua,-1) || lua_rawlen(lua,-1) < 1)
@@ -432,6 +688,12 @@ qboolean F_load_globe(const char *name, struct _globe *globe) {
       lua_pop(lua, 1); // pop plates
       return false;
    }
+   if (lua_rawlen(lua,-1) > MAX_PLATES)
+   {
+      Con_Printf("plates can have at most %d elements\n", MAX_PLATES);
+      lua_pop(lua, 1); // pop plates
+      return false;
+   }
    
    // iterate plates
    int i = 0;
@@ -443,9 +705,58 @@ qboolean F_load_globe(const char *name, struct _globe *globe) {
 
    globe->numplates = i;
 
+   // check for the globe_plate function
+   // (only once the plates are good, a broken globe keeps the old one)
+   scriptRef.globe_plate = -1;
+   if (lua_func_exists("globe_plate"))
+   {
+      lua_getglobal(lua, "globe_plate");
+      scriptRef.globe_plate = luaL_ref(lua, LUA_REGISTRYINDEX);
+   }
+
    return true;
 }
 
+// appends dumped bytecode to a growing chunk
+static int lua_writechunk(lua_State *L, const void *p, size_t size, void *data)
+{
+   struct _chunk *chunk = data;
+   char *bytes = realloc(chunk->bytes, chunk->size + size);
+   (void)L;
+   if (NULL == bytes) {
+      return 1;
+   }
+   memcpy(bytes + chunk->size, p, size);
+   chunk->bytes = bytes;
+   chunk->size += size;
+   return 0;
+}
+
+void* F_compile_script(const char *filename, size_t *size, char *error, size_t errsize)
+{
+   struct _chunk chunk = { NULL, 0 };
+
+   // a state of its own, this runs on the loader threads
+   lua_State *L = luaL_newstate();
+   if (NULL == L) {
+      snprintf(error, errsize, "out of memory");
+      return NULL;
+   }
+
+   if (luaL_loadfile(L, filename)) {
+      snprintf(error, errsize, "%s", lua_tostring(L,-1));
+   }
+   else if (lua_dump(L, lua_writechunk, &chunk, 0)) {
+      snprintf(error, errsize, "could not dump %s", filename);
+      free(chunk.bytes);
+      chunk.bytes = NULL;
+   }
+   lua_close(L);
+
+   *size = chunk.size;
+   return chunk.bytes;
+}
+
 static qboolean lua_loadAPlate(int i, struct _globe* globe) {
    // get forward vector
    lua_rawgeti(lua, -1, 1);
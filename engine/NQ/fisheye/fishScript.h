@@ -1,4 +1,5 @@
 // a reusable interface for the accessing a script interpreter
+#include <stddef.h>
 #include "fisheye.h"
 #include "fishlens.h"
 
@@ -19,6 +20,26 @@ qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, i
 
 qboolean F_load_globe(const char *name, struct _globe *globe);
 
+// the same from a chunk made by F_compile_script
+// (the lens version leaves lens and zoom untouched if the script fails, and
+// keeps a copy of the chunk in lens->script to run again, see F_load_lens_chunk
+// with lens->script.chunk; F_load_lens compiles its file the same way)
+qboolean F_load_lens_chunk(const char *name, const void *chunk, size_t size,
+      struct _lens *lens, struct _zoom *zoom, int numplates);
+
+qboolean F_load_globe_chunk(const char *name, const void *chunk, size_t size,
+      struct _globe *globe);
+
+// compiles a script file in a private Lua state (safe from any thread)
+// returns the malloc'd chunk, or NULL with a message in error
+void* F_compile_script(const char *filename, size_t *size, char *error, size_t errsize);
+
+void F_release_lens(struct _lens *lens);
+
+void F_bind_lens(const struct _lens *lens);
+
+const char* F_lens_onload(const struct _lens *lens);
+
 void F_clear_lens(int numplates);
 
 void F_clear_globe(void);
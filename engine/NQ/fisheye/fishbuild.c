@@ -0,0 +1,326 @@
+#include <stdlib.h>
+#include <string.h>
+#include "qtypes.h"
+#include "mathlib.h"
+#include "fishbuild.h"
+#include "fishmath.h"
+
+// The lens builders convert a row at a time with the fishmath batch functions.
+// (grown as needed, shared by every build since they run one at a time)
+static struct {
+   float *x, *y, *z, *u, *v;
+   int *plate, *lx;
+   int size;
+} row;
+
+static qboolean resume_lensmap_inverse(const struct _lensmap_build *build);
+static qboolean resume_lensmap_forward(const struct _lensmap_build *build);
+static void plot_from_plate_uv(const struct _lensmap_build *build, int lx, int ly, double u, double v, int plate_index);
+static void plot_from_ray(const struct _lensmap_build *build, int lx, int ly, double sx, double sy, double sz);
+static qboolean plate_row_to_screen(const struct state_paq *state, int plate_index, double v, int *points);
+static qboolean reserve_row(int size);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           LENS CREATORS                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void start_lensmap_build(const struct _lensmap_build *build)
+{
+   struct _lens_builder *builder = build->builder;
+   int platesize = build->state.globe->platesize;
+
+   // initialize progress state
+   if (build->state.lens->map_type == MAP_FORWARD) {
+      builder->forward_state.top = malloc((platesize+1)*sizeof(int[2]));
+      builder->forward_state.bot = malloc((platesize+1)*sizeof(int[2]));
+      builder->forward_state.py = platesize-1;
+      builder->forward_state.plate_index = 0;
+   }
+   else if (build->state.lens->map_type == MAP_INVERSE) {
+      builder->inverse_state.ly = build->state.lens->height_px-1;
+   }
+
+   resume_lensmap_build(build);
+}
+
+void resume_lensmap_build(const struct _lensmap_build *build)
+{
+   if (build->state.lens->map_type == MAP_FORWARD) {
+      build->builder->working = resume_lensmap_forward(build);
+   }
+   else if (build->state.lens->map_type == MAP_INVERSE) {
+      build->builder->working = resume_lensmap_inverse(build);
+   }
+   else {
+      build->builder->working = false;
+   }
+}
+
+void free_lensmap_rows(void)
+{
+   free(row.x);
+   memset(&row, 0, sizeof(row));
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           LENS BUILDER RESUMERS                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean resume_lensmap_inverse(const struct _lensmap_build *build)
+{
+   const struct _lens *lens = build->state.lens;
+   struct _lens_builder *builder = build->builder;
+
+   // image coordinates
+   double x,y;
+
+   // lens coordinates
+   int lx, *ly, i;
+
+   if (!reserve_row(lens->width_px)) {
+      return false;
+   }
+
+   start_lens_builder_clock_(builder);
+   for(ly = &(builder->inverse_state.ly); *ly >= 0; --(*ly))
+   {
+      // pause building if we have exceeded time allowed per frame
+      if (is_lens_builder_time_up_(builder)) {
+         return true;
+      }
+
+      y = -(*ly-lens->height_px/2) * lens->scale;
+
+      // calculate all the pixels in this row
+      int count = 0;
+      qboolean nonsense = false;
+      for(lx = 0;lx<lens->width_px;++lx)
+      {
+         x = (lx-lens->width_px/2) * lens->scale;
+
+         // determine which light ray to follow
+         vec3_u ray = build->state.inverse((vec2_u){{x,y}});
+         fisheye_status status = F_getLastStatus();
+         if (status == NO_VALUE_RETURNED) {
+            continue;
+         }
+         else if (status == NONSENSE_VALUE) {
+            nonsense = true;
+            break;
+         }
+
+         // get the pixel belonging to the light ray
+         // (with the default plate choice the row is projected together below)
+         if (NULL == build->globe_plate) {
+            row.x[count] = ray.vec[0];
+            row.y[count] = ray.vec[1];
+            row.z[count] = ray.vec[2];
+            row.lx[count] = lx;
+            count++;
+         }
+         else {
+            plot_from_ray(build,lx,*ly,ray.vec[0],ray.vec[1],ray.vec[2]);
+         }
+      }
+
+      ray_to_plate_uv_batch(build->state.globe, row.x, row.y, row.z, row.plate, row.u, row.v, count);
+      for (i=0; i<count; ++i) {
+         if (row.plate[i] >= 0) {
+            plot_from_plate_uv(build,row.lx[i],*ly,row.u[i],row.v[i],row.plate[i]);
+         }
+      }
+
+      if (nonsense) {
+         return false;
+      }
+   }
+
+   // done building lens
+   return false;
+}
+
+static qboolean resume_lensmap_forward(const struct _lensmap_build *build)
+{
+   const struct _globe *globe = build->state.globe;
+   struct _lens_builder *builder = build->builder;
+   int *top = builder->forward_state.top;
+   int *bot = builder->forward_state.bot;
+   int *py = &(builder->forward_state.py);
+   int *plate_index = &(builder->forward_state.plate_index);
+   int platesize = globe->platesize;
+
+   if (!reserve_row(platesize+1)) {
+      return false;
+   }
+
+   start_lens_builder_clock_(builder);
+   for (; *plate_index < globe->numplates; ++(*plate_index))
+   {
+      int px;
+      for (; *py >=0; --(*py)) {
+
+         // pause building if we have exceeded time allowed per frame
+         if (is_lens_builder_time_up_(builder)) {
+            return true;
+         }
+
+         // FIND ALL DESTINATION SCREEN COORDINATES FOR THIS TEXTURE ROW ********************
+
+         // compute lower points
+         if (*py == platesize-1) {
+            if (!plate_row_to_screen(&build->state, *plate_index, (*py + 0.5) / platesize, bot)) {
+               return false;
+            }
+         }
+         else {
+            // swap references so that the previous bottom becomes our current top
+            int *temp = top;
+            top = bot;
+            bot = temp;
+         }
+
+         // compute upper points
+         if (!plate_row_to_screen(&build->state, *plate_index, (*py - 0.5) / platesize, top)) {
+            return false;
+         }
+
+         // DRAW QUAD FOR EACH PIXEL IN THIS TEXTURE ROW ***********************************
+
+         // skip overlapping region of texture
+         double v = ((double)*py)/platesize;
+         for (px = 0; px < platesize; ++px) {
+            row.u[px] = ((double)px)/platesize;
+            row.v[px] = v;
+         }
+         plate_uv_to_ray_batch(globe, *plate_index, row.u, row.v, row.x, row.y, row.z, platesize);
+         if (NULL == build->globe_plate) {
+            ray_to_plate_index_batch(globe, row.x, row.y, row.z, row.plate, platesize);
+         }
+         else {
+            for (px = 0; px < platesize; ++px) {
+               vec3_t ray = {row.x[px], row.y[px], row.z[px]};
+               row.plate[px] = build->globe_plate(ray);
+            }
+         }
+
+         for (px = 0; px < platesize; ++px) {
+            if (*plate_index != row.plate[px]) {
+               continue;
+            }
+
+            int index = 2*px;
+            draw_quad_(&top[index], &top[index+2], &bot[index], &bot[index+2],
+                  *plate_index, px, *py, build->plot, build->data);
+         }
+
+      }
+
+      // reset row position
+      // (we have to do it here because it cannot be reset until it is done iterating)
+      // (we cannot do it at the beginning because the function could be resumed at some middle row)
+      *py = platesize-1;
+   }
+
+   free(top);
+   free(bot);
+
+   // done building lens
+   return false;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           BUILDER HELPERS                                    |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// plot a lens pixel from plate uv coordinates
+static void plot_from_plate_uv(const struct _lensmap_build *build, int lx, int ly, double u, double v, int plate_index)
+{
+   // convert to plate coordinates
+   int platesize = build->state.globe->platesize;
+   int px = (int)(u*platesize);
+   int py = (int)(v*platesize);
+
+   build->plot(build->data,lx,ly,px,py,plate_index);
+}
+
+// plot the (lx,ly) lens pixel from the (sx,sy,sz) view vector
+static void plot_from_ray(const struct _lensmap_build *build, int lx, int ly, double sx, double sy, double sz)
+{
+   vec3_t ray = {sx,sy,sz};
+
+   // get plate index
+   int plate_index = build->globe_plate(ray);
+   if (plate_index < 0) {
+      return;
+   }
+
+   // get texture coordinates
+   double u,v;
+   if (!ray_to_plate_uv_(build->state.globe, plate_index, ray, &u, &v)) {
+      return;
+   }
+
+   // map lens pixel to plate pixel
+   plot_from_plate_uv(build,lx,ly,u,v,plate_index);
+}
+
+// screen points of the plate row at v, for u = (k-0.5)/platesize, k = 0..platesize
+// (stored as x,y pairs; false if the lens gives a nonsense value)
+static qboolean plate_row_to_screen(const struct state_paq *state, int plate_index, double v, int *points)
+{
+   int platesize = state->globe->platesize;
+   int k;
+
+   for (k=0; k<=platesize; ++k) {
+      row.u[k] = (k - 0.5) / platesize;
+      row.v[k] = v;
+   }
+   plate_uv_to_ray_batch(state->globe, plate_index, row.u, row.v, row.x, row.y, row.z, platesize+1);
+
+   for (k=0; k<=platesize; ++k) {
+      vec3_u ray = {.vec = {row.x[k], row.y[k], row.z[k]}};
+      vec2_u lens_uv = state->forward(ray);
+      fisheye_status status = F_getLastStatus();
+      if (status == NO_VALUE_RETURNED) {
+         continue;
+      }
+      else if (status == NONSENSE_VALUE) {
+         return false;
+      }
+      point2d pt = lens_uv_to_screen(state->lens, lens_uv);
+      points[2*k] = pt.xy.x;
+      points[2*k+1] = pt.xy.y;
+   }
+   return true;
+}
+
+// makes room for a row of size in the row buffers
+static qboolean reserve_row(int size)
+{
+   if (size <= row.size) {
+      return true;
+   }
+
+   // one block for all of them
+   byte *block = realloc(row.x, size*(5*sizeof(float) + 2*sizeof(int)));
+   if (NULL == block) {
+      return false;
+   }
+   row.x = (float*)block;
+   row.y = row.x + size;
+   row.z = row.y + size;
+   row.u = row.z + size;
+   row.v = row.u + size;
+   row.plate = (int*)(row.v + size);
+   row.lx = row.plate + size;
+   row.size = size;
+   return true;
+}
+
+// vim: et:ts=3:sts=3:sw=3
@@ -0,0 +1,33 @@
+#include "fisheye.h"
+#include "fishlens.h"
+
+#ifndef FISHBUILD_H_
+#define FISHBUILD_H_
+
+// The lens builders, a row at a time for as long as the builder's clock allows
+// (see struct _lens_builder).  They don't own a lensmap: every lens pixel they
+// find is handed to plot along with the plate pixel it shows, so the engine's
+// views and the offline lensmap generator can share them.
+struct _lensmap_build {
+   struct _lens_builder *builder;
+
+   // lens functions, the lens being built and the globe it looks at
+   struct state_paq state;
+
+   // plate for a ray from the globe script, NULL for the plate facing it
+   ray_to_plate_index_t globe_plate;
+
+   quad_plot_t plot;
+   void *data;
+};
+
+// starts building the lens from scratch
+void start_lensmap_build(const struct _lensmap_build *build);
+
+// keeps building where the last call stopped (builder->working is cleared when done)
+void resume_lensmap_build(const struct _lensmap_build *build);
+
+// frees the builders' scratch rows
+void free_lensmap_rows(void);
+
+#endif
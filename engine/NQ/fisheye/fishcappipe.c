@@ -0,0 +1,27 @@
+#include <stdio.h>
+
+#include "fishcapture.h"
+
+// Raw captures write their frames down a pipe to a shell command, such as an
+// encoder reading RGB24 from stdin.  POSIX popen only takes "r" or "w" (and
+// never translates anything), while Windows needs "b" to keep its C runtime
+// from turning each 0x0a byte into 0x0d 0x0a.
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define PIPE_WRITE_MODE "wb"
+#else
+#define PIPE_WRITE_MODE "w"
+#endif
+
+FILE* F_OpenCapturePipe(const char *command)
+{
+   return popen(command, PIPE_WRITE_MODE);
+}
+
+int F_CloseCapturePipe(FILE *pipe)
+{
+   return pclose(pipe);
+}
+
+// vim: et:ts=3:sts=3:sw=3
@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+#include <SDL_cpuinfo.h>
+#include <SDL_surface.h>
+#include <SDL_image.h>
+
+#include "client.h"
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "host.h"
+#include "vid.h"
+
+#include "imageutil.h"
+#include "fishcapture.h"
+
+// frames that can be with the encoders at once
+#define MAX_CAPTURE_FRAMES 16
+#define MAX_CAPTURE_THREADS 8
+
+typedef enum {
+   FRAME_FREE,     // available to the renderer
+   FRAME_FILLING,  // being filled by the renderer
+   FRAME_QUEUED,   // waiting for an encoder
+   FRAME_ENCODING, // with an encoder
+   FRAME_ENCODED   // raw only: converted, waiting for its turn on the pipe
+} frame_state;
+
+struct _capture_frame {
+   frame_state state;
+   int number;
+
+   // count images of width x height 8-bit pixels
+   int width, height, count;
+   byte *pixels;
+   int pixels_size;
+   byte palette[768];
+
+   // raw only: the frame converted to RGB24
+   byte *rgb;
+   int rgb_size;
+};
+
+qboolean fisheye_capturing = false;
+
+static struct {
+   capture_format format;
+   capture_source source;
+   char name[MAX_OSPATH];
+   FILE *pipe;
+   float old_framerate;
+
+   int next_number; // next frame the renderer will fill
+   int next_write;  // raw only: next frame to go down the pipe
+   qboolean writing;
+   int errors;
+
+   int numthreads;
+   SDL_Thread *threads[MAX_CAPTURE_THREADS];
+   SDL_mutex *lock;
+   SDL_cond *queued;  // a frame was queued, or the encoders should quit
+   SDL_cond *freed;   // a frame went back to the renderer
+   qboolean quit;
+
+   struct _capture_frame frames[MAX_CAPTURE_FRAMES];
+   struct _capture_frame *filling;
+} capture;
+
+static int capture_worker(void *data);
+static struct _capture_frame* next_queued_frame(void);
+static qboolean encode_png(struct _capture_frame *frame);
+static void encode_rgb(struct _capture_frame *frame);
+static void write_encoded_frames(void);
+static void free_frame(struct _capture_frame *frame);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           CAPTURE CONTROL                                    |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_StartCapture(const char *demo, const char *name, int fps,
+      capture_format format, capture_source source)
+{
+   if (fisheye_capturing) {
+      F_StopCapture();
+   }
+   if (fps <= 0) {
+      Con_Printf("capture fps must be positive\n");
+      return false;
+   }
+
+   memset(&capture, 0, sizeof(capture));
+   capture.format = format;
+   capture.source = source;
+   qsnprintf(capture.name, sizeof(capture.name), "%s", name);
+
+   if (format == CAPTURE_RAW) {
+      capture.pipe = F_OpenCapturePipe(name);
+      if (NULL == capture.pipe) {
+         Con_Printf("could not open a pipe to \"%s\"\n", name);
+         return false;
+      }
+   }
+
+   capture.lock = SDL_CreateMutex();
+   capture.queued = SDL_CreateCond();
+   capture.freed = SDL_CreateCond();
+
+   // leave a core for the renderer
+   int numthreads = SDL_GetCPUCount() - 1;
+   if (numthreads < 1) numthreads = 1;
+   if (numthreads > MAX_CAPTURE_THREADS) numthreads = MAX_CAPTURE_THREADS;
+
+   int i;
+   for (i=0; i<numthreads; ++i) {
+      capture.threads[i] = SDL_CreateThread(capture_worker, "fishcapture", NULL);
+      if (NULL == capture.threads[i]) {
+         break;
+      }
+   }
+   capture.numthreads = i;
+   if (capture.numthreads == 0) {
+      Con_Printf("could not start any capture encoders\n");
+      if (capture.pipe) {
+         F_CloseCapturePipe(capture.pipe);
+      }
+      SDL_DestroyCond(capture.freed);
+      SDL_DestroyCond(capture.queued);
+      SDL_DestroyMutex(capture.lock);
+      memset(&capture, 0, sizeof(capture));
+      return false;
+   }
+
+   // play the demo at a fixed timestep, as fast as we can encode it
+   capture.old_framerate = Cvar_VariableValue("host_framerate");
+   Cvar_SetValue("host_framerate", 1.0f / fps);
+
+   fisheye_enabled = true;
+   vid.recalc_refdef = true;
+   fisheye_capturing = true;
+
+   Con_Printf("capturing %s at %d fps with %d encoders\n", demo, fps, capture.numthreads);
+   Cbuf_AddText("playdemo %s\n", demo);
+   return true;
+}
+
+void F_StopCapture(void)
+{
+   int i;
+
+   if (!fisheye_capturing) {
+      return;
+   }
+   fisheye_capturing = false;
+
+   // let the encoders drain the queue, then quit
+   SDL_LockMutex(capture.lock);
+   capture.quit = true;
+   SDL_CondBroadcast(capture.queued);
+   SDL_UnlockMutex(capture.lock);
+   for (i=0; i<capture.numthreads; ++i) {
+      SDL_WaitThread(capture.threads[i], NULL);
+   }
+
+   for (i=0; i<MAX_CAPTURE_FRAMES; ++i) {
+      free(capture.frames[i].pixels);
+      free(capture.frames[i].rgb);
+   }
+   if (capture.pipe) {
+      F_CloseCapturePipe(capture.pipe);
+   }
+   SDL_DestroyCond(capture.freed);
+   SDL_DestroyCond(capture.queued);
+   SDL_DestroyMutex(capture.lock);
+
+   Cvar_SetValue("host_framerate", capture.old_framerate);
+
+   Con_Printf("captured %d frames", capture.next_number);
+   if (capture.errors) {
+      Con_Printf(" (%d could not be written)", capture.errors);
+   }
+   Con_Printf("\n");
+   memset(&capture, 0, sizeof(capture));
+}
+
+// ends a capture when its demo stops playing
+void F_CaptureDemoEnded(void)
+{
+   // ignore whatever demo was playing before ours started
+   if (fisheye_capturing && capture.next_number > 0) {
+      F_StopCapture();
+   }
+}
+
+// ends a capture whose demo never started, which would otherwise wait for
+// frames that never come
+void F_CaptureDemoFailed(void)
+{
+   if (fisheye_capturing && capture.next_number == 0) {
+      Con_Printf("capture demo could not be played\n");
+      F_StopCapture();
+   }
+}
+
+capture_source F_CaptureSource(void)
+{
+   return capture.source;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           RENDERER SIDE                                      |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+byte* F_BeginCaptureFrame(int width, int height, int count)
+{
+   int i;
+   struct _capture_frame *frame = NULL;
+
+   if (!fisheye_capturing || capture.filling) {
+      return NULL;
+   }
+
+   // wait for a free frame (only when the encoders are a full queue behind)
+   SDL_LockMutex(capture.lock);
+   while (NULL == frame) {
+      for (i=0; i<MAX_CAPTURE_FRAMES; ++i) {
+         if (capture.frames[i].state == FRAME_FREE) {
+            frame = &capture.frames[i];
+            break;
+         }
+      }
+      if (NULL == frame) {
+         SDL_CondWait(capture.freed, capture.lock);
+      }
+   }
+   frame->state = FRAME_FILLING;
+   SDL_UnlockMutex(capture.lock);
+
+   int size = width * height * count;
+   if (size > frame->pixels_size) {
+      byte *pixels = realloc(frame->pixels, size);
+      if (NULL == pixels) {
+         free_frame(frame);
+         return NULL;
+      }
+      frame->pixels = pixels;
+      frame->pixels_size = size;
+   }
+
+   frame->number = capture.next_number;
+   frame->width = width;
+   frame->height = height;
+   frame->count = count;
+   memcpy(frame->palette, host_basepal, sizeof(frame->palette));
+
+   capture.filling = frame;
+   return frame->pixels;
+}
+
+void F_SubmitCaptureFrame(void)
+{
+   struct _capture_frame *frame = capture.filling;
+   if (NULL == frame) {
+      return;
+   }
+   capture.filling = NULL;
+   capture.next_number++;
+
+   SDL_LockMutex(capture.lock);
+   frame->state = FRAME_QUEUED;
+   SDL_CondSignal(capture.queued);
+   SDL_UnlockMutex(capture.lock);
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           ENCODERS                                           |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static int capture_worker(void *data)
+{
+   (void)data;
+
+   SDL_LockMutex(capture.lock);
+   for (;;) {
+      struct _capture_frame *frame = next_queued_frame();
+      if (NULL == frame) {
+         if (capture.quit) {
+            break;
+         }
+         SDL_CondWait(capture.queued, capture.lock);
+         continue;
+      }
+      frame->state = FRAME_ENCODING;
+      SDL_UnlockMutex(capture.lock);
+
+      if (capture.format == CAPTURE_PNG) {
+         qboolean ok = encode_png(frame);
+         SDL_LockMutex(capture.lock);
+         if (!ok) {
+            capture.errors++;
+         }
+         frame->state = FRAME_FREE;
+         SDL_CondSignal(capture.freed);
+      }
+      else {
+         encode_rgb(frame);
+         SDL_LockMutex(capture.lock);
+         frame->state = FRAME_ENCODED;
+         write_encoded_frames();
+      }
+   }
+   SDL_UnlockMutex(capture.lock);
+   return 0;
+}
+
+// oldest frame waiting for an encoder (lock held)
+static struct _capture_frame* next_queued_frame(void)
+{
+   struct _capture_frame *oldest = NULL;
+   int i;
+   for (i=0; i<MAX_CAPTURE_FRAMES; ++i) {
+      struct _capture_frame *frame = &capture.frames[i];
+      if (frame->state == FRAME_QUEUED &&
+            (NULL == oldest || frame->number < oldest->number)) {
+         oldest = frame;
+      }
+   }
+   return oldest;
+}
+
+// write each image of the frame to its own numbered PNG
+static qboolean encode_png(struct _capture_frame *frame)
+{
+   char filename[MAX_OSPATH];
+   qboolean ok = true;
+   int area = frame->width * frame->height;
+   int i;
+
+   SDL_Palette *pal = makePaddedPalette(frame->palette);
+   for (i=0; i<frame->count; ++i) {
+      if (capture.source == CAPTURE_PLATES) {
+         qsnprintf(filename, sizeof(filename), "%s%05d_%d.png", capture.name, frame->number, i);
+      }
+      else {
+         qsnprintf(filename, sizeof(filename), "%s%05d.png", capture.name, frame->number);
+      }
+
+      SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom(frame->pixels + i*area,
+            frame->width, frame->height, 8, frame->width, SDL_PIXELFORMAT_INDEX8);
+      if (NULL == surf) {
+         ok = false;
+         continue;
+      }
+      SDL_SetSurfacePalette(surf, pal);
+      if (IMG_SavePNG(surf, filename)) {
+         ok = false;
+      }
+      SDL_FreeSurface(surf);
+   }
+   SDL_FreePalette(pal);
+   return ok;
+}
+
+// convert the frame to RGB24 for the pipe
+static void encode_rgb(struct _capture_frame *frame)
+{
+   int size = frame->width * frame->height * frame->count;
+   if (3*size > frame->rgb_size) {
+      byte *rgb = realloc(frame->rgb, 3*size);
+      if (NULL == rgb) {
+         frame->rgb_size = 0;
+         return;
+      }
+      frame->rgb = rgb;
+      frame->rgb_size = 3*size;
+   }
+
+   const byte *src = frame->pixels;
+   byte *dest = frame->rgb;
+   int i;
+   for (i=0; i<size; ++i, dest+=3) {
+      const byte *color = frame->palette + 3*src[i];
+      dest[0] = color[0];
+      dest[1] = color[1];
+      dest[2] = color[2];
+   }
+}
+
+// send encoded frames down the pipe in order (lock held)
+// (one encoder writes at a time, the others keep converting meanwhile)
+static void write_encoded_frames(void)
+{
+   if (capture.writing) {
+      return;
+   }
+   capture.writing = true;
+
+   for (;;) {
+      struct _capture_frame *frame = NULL;
+      int i;
+      for (i=0; i<MAX_CAPTURE_FRAMES; ++i) {
+         if (capture.frames[i].state == FRAME_ENCODED &&
+               capture.frames[i].number == capture.next_write) {
+            frame = &capture.frames[i];
+            break;
+         }
+      }
+      if (NULL == frame) {
+         break;
+      }
+
+      SDL_UnlockMutex(capture.lock);
+      size_t size = (size_t)frame->width * frame->height * frame->count * 3;
+      qboolean ok = frame->rgb_size > 0 && fwrite(frame->rgb, 1, size, capture.pipe) == size;
+      SDL_LockMutex(capture.lock);
+
+      if (!ok) {
+         capture.errors++;
+      }
+      capture.next_write++;
+      frame->state = FRAME_FREE;
+      SDL_CondSignal(capture.freed);
+   }
+
+   capture.writing = false;
+}
+
+// give a frame the renderer could not fill back
+static void free_frame(struct _capture_frame *frame)
+{
+   SDL_LockMutex(capture.lock);
+   frame->state = FRAME_FREE;
+   SDL_UnlockMutex(capture.lock);
+}
+
+// vim: et:ts=3:sts=3:sw=3
@@ -0,0 +1,38 @@
+#include "fisheye.h"
+
+#ifndef FISHCAPTURE_H_
+#define FISHCAPTURE_H_
+
+typedef enum {
+   CAPTURE_PNG,   // numbered PNGs
+   CAPTURE_RAW    // RGB24 frames down a pipe
+} capture_format;
+
+typedef enum {
+   CAPTURE_LENS,  // the main lens image
+   CAPTURE_PLATES // every globe plate
+} capture_source;
+
+qboolean F_StartCapture(const char *demo, const char *name, int fps,
+      capture_format format, capture_source source);
+
+// called when a demo stops playing, ends a capture once it has frames
+void F_CaptureDemoEnded(void);
+
+// called when a demo could not be started, ends a capture waiting for it
+void F_CaptureDemoFailed(void);
+
+capture_source F_CaptureSource(void);
+
+// opens a pipe to a shell command to write raw frames to (NULL if it can't),
+// and closes it again, returning how the command exited (fishcappipe.c)
+FILE* F_OpenCapturePipe(const char *command);
+int F_CloseCapturePipe(FILE *pipe);
+
+// returns an 8-bit buffer for count images of width x height to fill in,
+// then hand it over with F_SubmitCaptureFrame
+// (only waits if every frame buffer is still with the encoders)
+byte* F_BeginCaptureFrame(int width, int height, int count);
+void F_SubmitCaptureFrame(void);
+
+#endif
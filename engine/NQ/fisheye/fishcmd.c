@@ -1,4 +1,3 @@
-#include <lua.h> //unwanted dependency
 #include <stdio.h>
 
 #include "cmd.h"
@@ -11,6 +10,9 @@
 #include "imageutil.h"
 #include "fisheye.h"
 #include "fishScript.h"
+#include "fishload.h"
+#include "fishcapture.h"
+#include "fishtimedemo.h"
 #include "fishcmd.h"
 
 
@@ -30,6 +32,13 @@ static void cmd_saveglobe(void);
 static void cmd_shortcutkeys(void);
 static void cmd_saverubix(void);
 static void cmd_savelens(void);
+static void cmd_inset(void);
+static void cmd_capture(void);
+static void cmd_timedemo(void);
+
+// background script loading callbacks
+static void lens_ready(const char *name, const void *chunk, size_t size);
+static void globe_ready(const char *name, const void *chunk, size_t size);
 
 // console autocomplete helpers
 static struct stree_root * cmdarg_lens(const char *arg);
@@ -40,7 +49,6 @@ static struct _zoom *zoom = NULL;
 static struct _lens *lens = NULL;
 static struct _globe *globe = NULL;
 static struct _rubix *rubix = NULL;
-static lua_State *lua = NULL;
 
 qboolean shortcutkeys_enabled;
 
@@ -52,9 +60,7 @@ void F_init_commands(
    rubix = rubix_;
    lens = F_getLens();
    globe = F_getGlobe();
-   
-   lua = (lua_State*)F_getStateHolder(); // thanks, I hate it
-   
+
    Cmd_AddCommand("fisheye", cmd_fisheye);
    Cmd_AddCommand("f_help", cmd_help);
    Cmd_AddCommand("f_dumppal", cmd_dumppal);
@@ -72,6 +78,10 @@ void F_init_commands(
    Cmd_AddCommand("f_shortcutkeys", cmd_shortcutkeys);
    Cmd_AddCommand("f_saverubix", cmd_saverubix);
    Cmd_AddCommand("f_dumplens", cmd_savelens);
+   Cmd_AddCommand("f_inset", cmd_inset);
+   Cmd_SetCompletion("f_inset", cmdarg_lens);
+   Cmd_AddCommand("f_capture", cmd_capture);
+   Cmd_AddCommand("f_timedemo", cmd_timedemo);
 }
 
 static void clear_zoom(void)
@@ -212,29 +222,34 @@ static void cmd_lens(void)
       return;
    }
 
-   // trigger change
-   (*lens).changed = true;
-
-   // get name
-   const char* name = Cmd_Argv(1);
-   strncpy((*lens).name, name, sizeof(lens->name));
+   // load lens
+   // (the current one stays until the new one is compiled, see lens_ready)
+   if (!F_RequestScript(SCRIPT_LENS, Cmd_Argv(1), lens_ready)) {
+      Con_Printf("could not start loading lens %s\n", Cmd_Argv(1));
+   }
+}
 
+// runs a lens compiled in the background
+static void lens_ready(const char *name, const void *chunk, size_t size)
+{
    // Display name
    Con_Printf("f_lens %s", name);
 
-   // load lens
-   (*lens).valid = F_load_lens(name, lens, zoom, (*globe).numplates);
-   if (!(*lens).valid) {
-      strcpy((*lens).name,"");
+   if (!F_load_lens_chunk(name, chunk, size, lens, zoom, (*globe).numplates)) {
       Con_Printf("not a valid lens\n");
+      return;
    }
 
+   // trigger change
+   (*lens).valid = true;
+   (*lens).changed = true;
+   strncpy((*lens).name, name, sizeof(lens->name));
+
    // execute the lens' onload command string if given
    // (this is to provide a user-friendly default view of the lens (e.g. "f_fov 180"))
-   lua_getglobal(lua, "onload");
-   if (lua_isstring(lua, -1))
+   const char* onload = F_lens_onload(lens);
+   if (onload)
    {
-      const char* onload = lua_tostring(lua, -1);
       Cmd_ExecuteString(onload, src_command);
 
       // display onload
@@ -246,7 +261,104 @@ static void cmd_lens(void)
       // 2. onload is not a string
       Con_Printf("\n");
    }
-   lua_pop(lua, 1); // pop "onload"
+}
+
+// inset command
+// (shows a second lens of the same globe in a corner of the screen)
+static int inset_view = -1;
+
+static void cmd_inset(void)
+{
+   if (Cmd_Argc() < 2) { // no lens name given
+      Con_Printf("f_inset <name> [width height [x y]]: show a second lens\n");
+      Con_Printf("f_inset off: hide it\n");
+      struct _lens *inset = inset_view > 0 ? F_getLensView(inset_view) : NULL;
+      Con_Printf("Currently: %s\n", inset ? inset->name : "off");
+      return;
+   }
+
+   if (inset_view > 0) {
+      F_CloseLensView(inset_view);
+      inset_view = -1;
+   }
+
+   const char* name = Cmd_Argv(1);
+   if (!strcmp(name, "off") || !strcmp(name, "0")) {
+      return;
+   }
+
+   // default to a quarter of the screen width at 2:1, in the top right corner
+   int width = vid.width / 4;
+   int height = width / 2;
+   if (Cmd_Argc() >= 4) {
+      width = Q_atoi(Cmd_Argv(2));
+      height = Q_atoi(Cmd_Argv(3));
+   }
+   int x = vid.width - width;
+   int y = 0;
+   if (Cmd_Argc() >= 6) {
+      x = Q_atoi(Cmd_Argv(4));
+      y = Q_atoi(Cmd_Argv(5));
+   }
+
+   inset_view = F_OpenLensView(name, width, height);
+   if (inset_view < 0) {
+      Con_Printf("could not open inset\n");
+      return;
+   }
+   F_MoveLensView(inset_view, x, y);
+   if (!F_getLensView(inset_view)->valid) {
+      Con_Printf("not a valid lens\n");
+   }
+}
+
+// capture command
+// (plays a demo headless at a fixed timestep, encoding every frame)
+static void cmd_capture(void)
+{
+   if (Cmd_Argc() == 2 && !strcmp(Cmd_Argv(1), "stop")) {
+      F_StopCapture();
+      return;
+   }
+   if (Cmd_Argc() < 3) {
+      Con_Printf("f_capture <demo> <name> [fps=30] [png|raw] [lens|plates]\n");
+      Con_Printf("   png: writes <name>00000.png, ... (<name>00000_<plate>.png for plates)\n");
+      Con_Printf("   raw: pipes RGB24 frames to the command <name>\n");
+      Con_Printf("f_capture stop: end the capture early\n");
+      Con_Printf("Currently: %s\n", fisheye_capturing ? "capturing" : "off");
+      return;
+   }
+
+   int fps = Cmd_Argc() >= 4 ? Q_atoi(Cmd_Argv(3)) : 30;
+
+   capture_format format = CAPTURE_PNG;
+   if (Cmd_Argc() >= 5 && !strcmp(Cmd_Argv(4), "raw")) {
+      format = CAPTURE_RAW;
+   }
+
+   capture_source source = CAPTURE_LENS;
+   if (Cmd_Argc() >= 6 && !strcmp(Cmd_Argv(5), "plates")) {
+      source = CAPTURE_PLATES;
+   }
+
+   F_StartCapture(Cmd_Argv(1), Cmd_Argv(2), fps, format, source);
+}
+
+// timedemo matrix command
+// (times a demo for every lens x globe x resolution, see fishtimedemo.h)
+static void cmd_timedemo(void)
+{
+   if (Cmd_Argc() < 3) {
+      Con_Printf("f_timedemo <demo> <file.csv> [lens,...] [globe,...] [WxH,...]\n");
+      Con_Printf("   defaults: every lens in panini,stereographic,equirect,quincuncial\n");
+      Con_Printf("   with every globe in cube,cube_edge,trism,tetra,fast at the current mode\n");
+      return;
+   }
+
+   F_StartTimedemo(Cmd_Argv(1), Cmd_Argv(2),
+         Cmd_Argc() >= 4 ? Cmd_Argv(3) : NULL,
+         Cmd_Argc() >= 5 ? Cmd_Argv(4) : NULL,
+         Cmd_Argc() >= 6 ? Cmd_Argv(5) : NULL);
 }
 
 // autocompletion for lens names
@@ -353,22 +465,32 @@ static void cmd_globe(void)
       return;
    }
 
-   // trigger change
-   (*globe).changed = true;
-
-   // get name
-   const char* name = Cmd_Argv(1);
-   strncpy((*globe).name, name, sizeof(globe->name));
+   // load globe
+   // (the current one stays until the new one is compiled, see globe_ready)
+   if (!F_RequestScript(SCRIPT_GLOBE, Cmd_Argv(1), globe_ready)) {
+      Con_Printf("could not start loading globe %s\n", Cmd_Argv(1));
+   }
+}
 
+// runs a globe compiled in the background
+static void globe_ready(const char *name, const void *chunk, size_t size)
+{
    // display name
    Con_Printf("f_globe %s\n", name);
 
-   // load globe
-   (*globe).valid = F_load_globe((*globe).name, globe);
-   if (!(*globe).valid) {
-      strcpy((*globe).name,"");
+   // read the plates into a copy, so a broken globe keeps the current one
+   struct _globe staged = *globe;
+   if (!F_load_globe_chunk(name, chunk, size, &staged)) {
       Con_Printf("not a valid globe\n");
+      return;
    }
+
+   // trigger change
+   memcpy((*globe).plates, staged.plates, sizeof(globe->plates));
+   (*globe).numplates = staged.numplates;
+   (*globe).valid = true;
+   (*globe).changed = true;
+   strncpy((*globe).name, name, sizeof(globe->name));
 }
 
 // autocompletion for globe names
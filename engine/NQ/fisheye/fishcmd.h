@@ -1,4 +1,3 @@
-#include <lua.h>
 #include "fisheye.h"
 
 #ifndef FISHCMD_H_
@@ -15,15 +15,26 @@
 #include "r_local.h"
 #include "screen.h"
 #include "sys.h"
+#include "vid.h"
 #include "view.h"
 
 #include "fisheye.h"
+#include "fishbuild.h"
 #include "fishmem.h"
 #include "fishlens.h"
 #include "fishScript.h"
 #include "fishcmd.h"
+#include "fishload.h"
+#include "fishmap.h"
+#include "fishpipe.h"
+#include "fishcapture.h"
+#include "fishspeeds.h"
+#include "fishtimedemo.h"
 #include "fishzoom.h"
 #include "imageutil.h"
+#ifdef FISHEYE_GL
+#include "fishgl.h"
+#endif
 
 #include <time.h>
 
@@ -42,22 +53,119 @@ qboolean fisheye_enabled;
 // camera view that we render.
 double fisheye_plate_fov;
 
-// Lens computation is slow, so we don't want to block the game while its busy.
-// Instead of dealing with threads, we are just limiting the time that the
-// lens builder can work each frame.  It keeps track of its work between frames
-// so it can resume without problems.  This allows the user to watch the lens
-// pixels become visible as they are calculated.
-static struct _lens_builder lens_builder;
+// Likewise for d_mipscale, which is scaled by this for each plate so that
+// plates the lenses shrink render with smaller mips.
+double fisheye_plate_mipscale = 1;
 
 static struct _globe globe;
 
-static struct _lens lens;
+static struct _rubix rubix;
 
-static struct _zoom zoom;
+// A lens view: one lens and its lensmap, built from the shared globe.
+struct _lensview {
 
-static struct _rubix rubix;
+   struct _lens lens;
+
+   struct _zoom zoom;
+
+   // Lens computation is slow, so we don't want to block the game while its busy.
+   // Instead of dealing with threads, we are just limiting the time that the
+   // lens builder can work each frame.  It keeps track of its work between frames
+   // so it can resume without problems.  This allows the user to watch the lens
+   // pixels become visible as they are calculated.
+   struct _lens_builder builder;
+
+   // the plates this lens samples from
+   // (each frame the globe renders the plates used by any view)
+   qboolean plate_used[MAX_PLATES];
+
+   // how much the finished lensmap shrinks each plate
+   // (see lensmap_plate_minification, valid once the builder is done)
+   float minification[MAX_PLATES];
+   qboolean minification_valid;
 
-static struct state_paq arg_consolidator;
+   // the lensmap changed since it was last uploaded for f_gllens
+   qboolean gl_stale;
+
+   // extra views only: drawn as an inset at (x,y) on the screen,
+   // or into target when one is given
+   qboolean active;
+   int x, y;
+   byte *target;
+   int target_rowbytes;
+};
+
+// views[0] is the main view drawn in place of the normal refresh,
+// the rest are extra views sharing the same globe
+static struct _lensview views[MAX_LENSVIEWS];
+
+// plate that each globe pixel belongs to, for masking out plate margins
+// (only needed when the globe script decides it; kept until the globe changes)
+static byte *plate_owner = NULL;
+static qboolean plate_owner_valid = false;
+
+// When the video driver supports it, the lens is resolved straight into the
+// driver's 32-bit texture during VID_Update instead of being written to the
+// 8-bit vid buffer and expanded again afterwards.  The lens area of the vid
+// buffer is left TRANSPARENT_COLOR so the HUD and console still draw over it.
+// (screenshots read the 8-bit vid buffer, so F_ScreenShotLens resolves the
+// last fused lens into it the unfused way before one is taken)
+static cvar_t f_fusedblit = { "f_fusedblit", "1", CVAR_CONFIG };
+
+// what the video driver resolved the last frame's main lens from, if anything
+static enum { FUSED_NONE, FUSED_LENS, FUSED_FRAME } fused_source = FUSED_NONE;
+
+#ifdef FISHEYE_GL
+// With f_gllens 1 the main lens is resolved by fishgl.c's shader in a hidden
+// GL context instead of by resolve_lensmap_8bit.  The plates go up as palette
+// indices, so what comes back is the same 8-bit lens, written to the vid buffer
+// like any other.  Turns itself off if there is no GL context to be had.
+static cvar_t f_gllens = { "f_gllens", "0", CVAR_CONFIG };
+static qboolean render_lensmap_gl(struct _lensview *view, byte *dest, int rowbytes);
+#endif
+
+// Stereo renders the globe once per eye, each eye f_ipd/2 units to the side of
+// the view origin, and draws the main lens for each eye in half of the screen.
+// The lensmap, dynamic lights and PVS don't depend on the eye, so they are
+// shared by both eyes (see render_eyes).
+#define STEREO_OFF 0
+#define STEREO_SIDE_BY_SIDE 1
+#define STEREO_TOP_BOTTOM 2
+static cvar_t f_stereo = { "f_stereo", "0", CVAR_CONFIG };
+static cvar_t f_ipd = { "f_ipd", "2", CVAR_CONFIG };
+
+// How much the lenses' minification of a plate raises its mip levels.  The
+// plate's mip scale is its minification to the power of f_mipbias, so 1 picks
+// mips for the size the plate is shown at and 0 turns this off.
+static cvar_t f_mipbias = { "f_mipbias", "1", CVAR_CONFIG };
+
+// mip scale of each plate this frame (see F_RenderView)
+static double plate_mipscale[MAX_PLATES];
+
+// Frame pipelining: with f_pipeline 1 the globe has two sets of plates, and
+// while the plates of a frame render into one of them, the worker in fishpipe.c
+// resolves the main lens from the other, which holds the frame before.  The main
+// lens is shown a frame late (never more); extra views, captures and saved
+// globes stay on the current frame.  Any frame where a lensmap or the globe
+// changes is resolved right after its plates instead, since the plates of the
+// frame before may not cover the new lensmap.
+static cvar_t f_pipeline = { "f_pipeline", "0", CVAR_CONFIG };
+static struct _pipebuffers pipebuf;
+
+// the other set of plates holds a frame that can be resolved
+static qboolean pipe_primed = false;
+
+// what the worker resolves: a copy of the globe pointing at the other plates
+static struct {
+   struct _lensview *view;
+   struct _globe globe;
+   int stereo;
+   int width, height;  // of the frame, both eyes in stereo
+} frame_job;
+
+// while rendering the eyes, the renderer finds the PVS from here instead of
+// from each eye's origin (NULL otherwise)
+const float *fisheye_pvs_origin;
 
 // -------------------------------------------------------------------------------- 
 // |                                                                              |
@@ -79,38 +187,46 @@ struct _lens* F_getLens(void);
 static void create_palmap(void);
 
 // lens pixel setters
-static void set_lensmap_grid(int lx, int ly, int px, int py, int plate_index);
-static void set_lensmap_from_plate(int lx, int ly, int px, int py, int plate_index);
-static void set_lensmap_from_plate_uv(int lx, int ly, double u, double v, int plate_index);
-static void set_lensmap_from_ray(int lx, int ly, double sx, double sy, double sz);
+static void set_lensmap_grid(struct _lensview *view, int lx, int ly, int px, int py, int plate_index);
+static void set_lensmap_from_plate(struct _lensview *view, int lx, int ly, int px, int py, int plate_index);
 
 // globe plate getters
 static int ray_to_plate_index(vec3_t ray);
-static qboolean ray_to_plate_uv(int plate_index, vec3_t ray, double *u, double *v);
 
-// forward map getter/setter helpers
-static void draw_quad(int *tl, int *tr, int *bl, int *br, int plate_index, int px, int py);
-
-// lens builder resumers
-static void resume_lensmap(void);
-static qboolean resume_lensmap_inverse(void);
-static qboolean resume_lensmap_forward(void);
+// lens builder helpers
+static void plot_quad_pixel(void *data, int lx, int ly, int px, int py, int plate_index);
+static void lensview_build(struct _lensview *view, struct _lensmap_build *build);
 
 // lens creators
-static void create_lensmap_inverse(void);
-static void create_lensmap_forward(void);
-static void create_lensmap(void);
+static qboolean load_lensmap(struct _lensview *view);
+static void create_lensmap(struct _lensview *view);
 
-// renderers
-static void render_lensmap(void);
-static void render_lensmap_8bit(void);
-static void render_lensmap_8bit_rubix(void);
+// lens view helpers
+static void update_lensview(struct _lensview *view, qboolean globe_changed);
+static double lens_plate_mipscale(int plate_index);
+static qboolean size_lensview(struct _lensview *view, int width, int height);
 
-static void render_plate(int plate_index, vec3_t forward, vec3_t right, vec3_t up);
+// renderers
+static void render_lensmap(struct _lensview *view, byte *dest, int rowbytes);
+static void render_lensmap_8bit(struct _lensview *view, byte *dest, int rowbytes);
+static void render_lensmap_8bit_rubix(struct _lensview *view, byte *dest, int rowbytes);
+static void render_lensview(struct _lensview *view);
+static void render_stereo(struct _lensview *view, int stereo,
+      const struct _globe *left_eye, byte *dest, int rowbytes);
+static qboolean render_lensmap_fused(void);
+static void resolve_frame(void *unused);
+static void show_frame(void);
+static void fill_framerow_32(int x, int y, int width, unsigned *dest, const unsigned *palette);
+static void fill_lensrow_32(int x, int y, int width, unsigned *dest, const unsigned *palette);
+static void fill_lensrow_32_rubix(int x, int y, int width, unsigned *dest, const unsigned *palette);
+
+static void render_eyes(int stereo, vrect_t *vrect);
+static void render_plate(int plate_index, byte *eye_pixels, vec3_t forward, vec3_t right, vec3_t up);
+static void capture_frame(void);
 
 
 // globe saver functions
-static void WritePNGplate(char *filename, int plate_index, int with_margins);
+static byte* get_plate_owners(void);
 static void save_globe(void);
 
 //externalize exception throwing
@@ -131,7 +247,6 @@ fisheye_status F_getLastStatus(){
 
 // retrieves a pointer to a pixel in the video buffer
 #define VBUFFER(x,y) (vid.buffer + (x) + (y)*vid.rowbytes)
-#define VBUFFER_(start, stride, x, y) (start + x + y*stride)
 
 // -------------------------------------------------------------------------------- 
 // |                                                                              |
@@ -141,20 +256,28 @@ fisheye_status F_getLastStatus(){
 
 void F_Init(void)
 {
-   arg_consolidator = (struct state_paq){
-        .forward = scriptToC_lens_forward,
-        .inverse = scriptToC_lens_inverse, //currently unused from here
-        .globe = &globe,
-        .lens = &lens
-   };
-   lens_builder.working = false;
-   lens_builder.seconds_per_frame = 1.0f / 60;
+   int i;
+   for (i=0; i<MAX_LENSVIEWS; ++i) {
+      views[i].builder.working = false;
+      views[i].builder.seconds_per_frame = 1.0f / 60;
+   }
+   views[0].active = true;
 
    rubix.enabled = false;
 
+   Cvar_RegisterVariable(&f_fusedblit);
+   Cvar_RegisterVariable(&f_stereo);
+   Cvar_RegisterVariable(&f_ipd);
+   Cvar_RegisterVariable(&f_mipbias);
+   Cvar_RegisterVariable(&f_pipeline);
+#ifdef FISHEYE_GL
+   Cvar_RegisterVariable(&f_gllens);
+#endif
+   F_SpeedsInit();
+
    F_scriptInit();
 
-   F_init_commands(&zoom, &rubix);
+   F_init_commands(&views[0].zoom, &rubix);
 
    // create palette maps
    create_palmap();
@@ -162,18 +285,35 @@ void F_Init(void)
 
 void F_Shutdown(void)
 {
+   int i;
+   F_PipeShutdown();
+#ifdef FISHEYE_GL
+   F_GL_CloseOffscreen();
+#endif
+   F_StopCapture();
+   FinishGlobeSaves();
+   for (i=1; i<MAX_LENSVIEWS; ++i) {
+      F_CloseLensView(i);
+   }
+   F_DropScripts();
    F_scriptShutdown();
+   free_lensmap_rows();
 }
 
 void F_WriteConfig(FILE* f)
 {
+   struct _lensview *view = &views[0];
+
+   // save the lens and globe that were asked for, even if not shown yet
+   F_PollScripts(true);
+
    fprintf(f,"fisheye %d\n", fisheye_enabled);
-   fprintf(f,"f_lens \"%s\"\n", lens.name);
+   fprintf(f,"f_lens \"%s\"\n", view->lens.name);
    fprintf(f,"f_globe \"%s\"\n", globe.name);
    fprintf(f,"f_rubixgrid %d %f %f\n", rubix.numcells, rubix.cell_size, rubix.pad_size);
-   switch (zoom.type) {
-      case ZOOM_FOV:     fprintf(f,"f_fov %d\n", zoom.fov); break;
-      case ZOOM_VFOV:    fprintf(f,"f_vfov %d\n", zoom.fov); break;
+   switch (view->zoom.type) {
+      case ZOOM_FOV:     fprintf(f,"f_fov %d\n", view->zoom.fov); break;
+      case ZOOM_VFOV:    fprintf(f,"f_vfov %d\n", view->zoom.fov); break;
       case ZOOM_COVER:   fprintf(f,"f_cover\n"); break;
       case ZOOM_CONTAIN: fprintf(f,"f_contain\n"); break;
       default: break;
@@ -182,42 +322,84 @@ void F_WriteConfig(FILE* f)
 
 void F_RenderView(void)
 {
-   static int pwidth = -1;
-   static int pheight = -1;
+   struct _lensview *view = &views[0];
+   double t;
+
+   F_SpeedsBeginFrame();
+   fused_source = FUSED_NONE;
+
+   // switch to any lens or globe that finished loading
+   F_PollScripts(false);
 
    // update screen size
-   lens.width_px = scr_vrect.width;
-   lens.height_px = scr_vrect.height;
+   // (in stereo each eye's lens gets half of the screen)
+   int stereo = (int)f_stereo.value;
+   if (stereo != STEREO_SIDE_BY_SIDE && stereo != STEREO_TOP_BOTTOM) {
+      stereo = STEREO_OFF;
+   }
+   view->lens.width_px = stereo == STEREO_SIDE_BY_SIDE ? scr_vrect.width/2 : scr_vrect.width;
+   view->lens.height_px = stereo == STEREO_TOP_BOTTOM ? scr_vrect.height/2 : scr_vrect.height;
    #define MIN(a,b) ((a) < (b) ? (a) : (b))
-   int platesize = globe.platesize = MIN(lens.height_px, lens.width_px);
-   int area = lens.width_px * lens.height_px;
+   int platesize = globe.platesize = MIN(view->lens.height_px, view->lens.width_px);
+   int area = view->lens.width_px * view->lens.height_px;
+
+   // (a capture wants every frame as it was played)
+   qboolean pipelined = f_pipeline.value > 0 && !fisheye_capturing;
    
-   qboolean needNewBuffers = hasResizedOrRestarted(lens.width_px, lens.height_px);
+   qboolean needNewBuffers = hasResizedOrRestarted(view->lens.width_px, view->lens.height_px,
+         globe.numplates, stereo, pipelined);
    if(needNewBuffers){
-      createOrReallocBuffers(&globe, &lens, area, platesize);
-   }
-   // recalculate lens
-   if (needNewBuffers || zoom.changed || lens.changed || globe.changed) {
-      memset(lens.pixels, 0, area*sizeof(*lens.pixels));
-      memset(lens.pixel_tints, 255, area*sizeof(byte));
-
-      // load lens again
-      // (NOTE: this will be the second time this lens will be loaded in this frame if it has just changed)
-      // (I'm just trying to force re-evaluation of lens variables that are dependent on globe variables (e.g. "lens_width = numplates" in debug.lua))
-      lens.valid = F_load_lens(lens.name, &lens, &zoom, globe.numplates);
-      if (!lens.valid) {
-         strcpy(lens.name,"");
-         Con_Printf("not a valid lens\n");
-      }
-      create_lensmap();
+      createOrReallocBuffers(&globe, &view->lens, area, platesize, stereo,
+            pipelined ? &pipebuf : NULL);
+      pipe_primed = false;
    }
-   else if (lens_builder.working) {
-      resume_lensmap();
+   if (NULL == globe.right_pixels) {
+      stereo = STEREO_OFF;
    }
 
-   // get the orientations required to render the plates
-   vec3_t forward, right, up;
-   AngleVectors(r_refdef.viewangles, forward, right, up);
+   // this frame renders over the plates of the frame before last, while the
+   // frame before is resolved from the other set
+   if (pipelined) {
+      byte *pixels = globe.pixels, *right_pixels = globe.right_pixels;
+      globe.pixels = pipebuf.pixels;
+      globe.right_pixels = pipebuf.right_pixels;
+      pipebuf.pixels = pixels;
+      pipebuf.right_pixels = right_pixels;
+   }
+
+   // recalculate lenses
+   // (every lensmap indexes into the globe, so all of them follow a new globe)
+   int i;
+   qboolean globe_changed = needNewBuffers || globe.changed;
+   if (globe_changed) {
+      plate_owner_valid = false;
+   }
+   qboolean lenses_settled = !globe_changed;
+   t = Sys_DoubleTime();
+   for (i=0; i<MAX_LENSVIEWS; ++i) {
+      if (views[i].active) {
+         if (views[i].lens.changed || views[i].zoom.changed || views[i].builder.working) {
+            lenses_settled = false;
+         }
+         update_lensview(&views[i], globe_changed);
+      }
+   }
+   F_SpeedsStage(FSPEEDS_BUILD, Sys_DoubleTime() - t);
+
+   // only render the plates that some lens is using
+   // (or all of them when saving or capturing the plates themselves)
+   qboolean all_plates = globe.save.should ||
+      (fisheye_capturing && F_CaptureSource() == CAPTURE_PLATES);
+   for (i=0; i<globe.numplates; ++i) {
+      int j;
+      globe.plates[i].display = all_plates;
+      for (j=0; j<MAX_LENSVIEWS; ++j) {
+         if (views[j].active && views[j].plate_used[i]) {
+            globe.plates[i].display = 1;
+         }
+      }
+      plate_mipscale[i] = all_plates ? 1 : lens_plate_mipscale(i);
+   }
 
    // do not do this every frame?
    extern int sb_lines;
@@ -229,39 +411,24 @@ void F_RenderView(void)
    vrect.height = vid.height;
    R_SetVrect(&vrect, &scr_vrect, sb_lines);
 
-   // render plates
-   int i;
-   for (i=0; i<globe.numplates; ++i)
-   {
-      if (globe.plates[i].display) {
-
-         // set view to change plate FOV
-         fisheye_plate_fov = globe.plates[i].fov;
-         R_ViewChanged(&vrect, sb_lines, vid.aspect);
-
-         // compute absolute view vectors
-         // right = x
-         // top = y
-         // forward = z
-
-         vec3_t r = { 0,0,0};
-         VectorMA(r, globe.plates[i].right[0], right, r);
-         VectorMA(r, globe.plates[i].right[1], up, r);
-         VectorMA(r, globe.plates[i].right[2], forward, r);
-
-         vec3_t u = { 0,0,0};
-         VectorMA(u, globe.plates[i].up[0], right, u);
-         VectorMA(u, globe.plates[i].up[1], up, u);
-         VectorMA(u, globe.plates[i].up[2], forward, u);
-
-         vec3_t f = { 0,0,0};
-         VectorMA(f, globe.plates[i].forward[0], right, f);
-         VectorMA(f, globe.plates[i].forward[1], up, f);
-         VectorMA(f, globe.plates[i].forward[2], forward, f);
-
-         render_plate(i, f, r, u);
+   // resolve the frame before while the plates render
+   qboolean resolving = pipelined && pipe_primed && lenses_settled;
+   if (resolving) {
+      frame_job.view = view;
+      frame_job.globe = globe;
+      frame_job.globe.pixels = pipebuf.pixels;
+      frame_job.globe.right_pixels = pipebuf.right_pixels;
+      frame_job.stereo = stereo;
+      frame_job.width = stereo == STEREO_SIDE_BY_SIDE ? 2*view->lens.width_px : view->lens.width_px;
+      frame_job.height = stereo == STEREO_TOP_BOTTOM ? 2*view->lens.height_px : view->lens.height_px;
+      if (!F_PipeStart(resolve_frame, NULL)) {
+         resolve_frame(NULL);
       }
    }
+   pipe_primed = pipelined;
+
+   // render plates
+   render_eyes(stereo, &vrect);
 
    // save plates upon request from the "saveglobe" command
    if (globe.save.should) {
@@ -269,15 +436,224 @@ void F_RenderView(void)
    }
 
    // render our view
+   t = Sys_DoubleTime();
    Draw_TileClear(0, 0, vid.width, vid.height);
-   render_lensmap();
+   F_SpeedsStage(FSPEEDS_TILECLEAR, Sys_DoubleTime() - t);
+
+   t = Sys_DoubleTime();
+   if (resolving) {
+      F_PipeFinish();
+      show_frame();
+   }
+   else if (stereo) {
+      render_stereo(view, stereo, &globe, VBUFFER(scr_vrect.x, scr_vrect.y), vid.rowbytes);
+   }
+   else {
+      render_lensmap(view, VBUFFER(scr_vrect.x, scr_vrect.y), vid.rowbytes);
+   }
+
+   // then any extra views over it (or into their own targets)
+   for (i=1; i<MAX_LENSVIEWS; ++i) {
+      if (views[i].active) {
+         render_lensview(&views[i]);
+      }
+   }
+   F_SpeedsStage(FSPEEDS_LENSMAP, Sys_DoubleTime() - t);
+
+   // hand the frame to the capture encoders
+   if (fisheye_capturing) {
+      capture_frame();
+   }
 
-   // store current values for change detection
-   pwidth = lens.width_px;
-   pheight = lens.height_px;
+   // report finished globe saves
+   PollGlobeSaves();
+
+   F_SpeedsDraw();
+   F_SpeedsEndFrame((stereo ? 2 : 1) * view->lens.width_px * view->lens.height_px);
+   F_TimedemoFrame(view->builder.working || F_ScriptsPending());
 
    // reset change flags
-   lens.changed = globe.changed = zoom.changed = false;
+   globe.changed = false;
+}
+
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS VIEWS                                         |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// rebuild the view's lensmap if anything it depends on changed,
+// otherwise keep building it if it is not done yet
+static void update_lensview(struct _lensview *view, qboolean globe_changed)
+{
+   // the lens callbacks evaluate this view's script functions
+   F_bind_lens(&view->lens);
+
+   if (globe_changed || view->zoom.changed || view->lens.changed) {
+      int area = view->lens.width_px * view->lens.height_px;
+      memset(view->lens.pixels, 0, area*sizeof(*view->lens.pixels));
+      memset(view->lens.pixel_tints, 255, area*sizeof(byte));
+
+      // run the lens script again if it was run for another number of plates
+      // (lens variables can depend on globe variables (e.g. "lens_width = numplates" in debug.lua))
+      // from the chunk the lens kept, so the file isn't read and compiled again here
+      if (view->lens.valid && view->lens.script.numplates != globe.numplates) {
+         view->lens.valid = view->lens.script.chunk
+            && F_load_lens_chunk(view->lens.name, view->lens.script.chunk,
+                  view->lens.script.chunk_size, &view->lens, &view->zoom, globe.numplates);
+         if (!view->lens.valid) {
+            strcpy(view->lens.name,"");
+            Con_Printf("not a valid lens\n");
+         }
+      }
+      view->minification_valid = false;
+      view->gl_stale = true;
+      create_lensmap(view);
+
+      view->lens.changed = view->zoom.changed = false;
+   }
+   else if (view->builder.working) {
+      struct _lensmap_build build;
+      lensview_build(view, &build);
+      resume_lensmap_build(&build);
+      view->gl_stale = true;
+   }
+
+   if (!view->builder.working && !view->minification_valid) {
+      lensmap_plate_minification(&view->lens, globe.platesize, globe.numplates,
+            view->minification);
+      view->minification_valid = true;
+   }
+}
+
+// the mip scale for a plate, from the view that shrinks it the least
+// (full detail while any view using it is still being built)
+static double lens_plate_mipscale(int plate_index)
+{
+   double minification = 0;
+   int i;
+
+   for (i=0; i<MAX_LENSVIEWS; ++i) {
+      const struct _lensview *view = &views[i];
+      if (!view->active || !view->plate_used[plate_index]) {
+         continue;
+      }
+      if (!view->minification_valid) {
+         return 1;
+      }
+      if (minification == 0 || view->minification[plate_index] < minification) {
+         minification = view->minification[plate_index];
+      }
+   }
+   return minification > 0 ? pow(minification, f_mipbias.value) : 1;
+}
+
+// (re)allocate an extra view's lensmap for the given size
+static qboolean size_lensview(struct _lensview *view, int width, int height)
+{
+   int area = width * height;
+   uint32_t *pixels = realloc(view->lens.pixels, area*sizeof(*pixels));
+   if (NULL == pixels) {
+      return false;
+   }
+   view->lens.pixels = pixels;
+
+   byte *tints = realloc(view->lens.pixel_tints, area*sizeof(byte));
+   if (NULL == tints) {
+      return false;
+   }
+   view->lens.pixel_tints = tints;
+
+   view->lens.width_px = width;
+   view->lens.height_px = height;
+   view->lens.changed = true;
+   return true;
+}
+
+// open an extra view of the given lens, returns its index or -1
+int F_OpenLensView(const char *name, int width, int height)
+{
+   int i;
+   if (width <= 0 || height <= 0) {
+      return -1;
+   }
+   for (i=1; i<MAX_LENSVIEWS; ++i) {
+      if (!views[i].active) {
+         break;
+      }
+   }
+   if (i == MAX_LENSVIEWS) {
+      Con_Printf("no more than %d lens views\n", MAX_LENSVIEWS-1);
+      return -1;
+   }
+
+   struct _lensview *view = &views[i];
+   if (!size_lensview(view, width, height)) {
+      Con_Printf("could not allocate a %dx%d lens view\n", width, height);
+      F_CloseLensView(i);
+      return -1;
+   }
+   strncpy(view->lens.name, name, sizeof(view->lens.name)-1);
+   view->lens.name[sizeof(view->lens.name)-1] = 0;
+
+   // fit the whole lens image if it has boundaries, otherwise use its widest fov
+   view->lens.valid = F_load_lens(view->lens.name, &view->lens, &view->zoom, globe.numplates);
+   if (view->lens.width > 0 || view->lens.height > 0) {
+      view->zoom.type = ZOOM_CONTAIN;
+   }
+   else {
+      view->zoom.type = ZOOM_FOV;
+      view->zoom.fov = view->zoom.max_fov;
+   }
+
+   view->x = view->y = 0;
+   view->target = NULL;
+   view->active = true;
+   return i;
+}
+
+// place an extra view's inset on the screen
+void F_MoveLensView(int i, int x, int y)
+{
+   if (i > 0 && i < MAX_LENSVIEWS) {
+      views[i].x = x;
+      views[i].y = y;
+   }
+}
+
+// send an extra view to an 8-bit buffer instead of the screen
+// (NULL goes back to drawing it as an inset)
+void F_SetLensViewTarget(int i, byte *buffer, int rowbytes)
+{
+   if (i > 0 && i < MAX_LENSVIEWS) {
+      views[i].target = buffer;
+      views[i].target_rowbytes = rowbytes;
+   }
+}
+
+void F_CloseLensView(int i)
+{
+   if (i <= 0 || i >= MAX_LENSVIEWS) {
+      return;
+   }
+   struct _lensview *view = &views[i];
+   if (view->builder.working && view->lens.map_type == MAP_FORWARD) {
+      free(view->builder.forward_state.top);
+      free(view->builder.forward_state.bot);
+   }
+   F_release_lens(&view->lens);
+   free(view->lens.pixels);
+   free(view->lens.pixel_tints);
+   memset(view, 0, sizeof(*view));
+   view->builder.seconds_per_frame = 1.0f / 60;
+}
+
+struct _lens* F_getLensView(int i)
+{
+   if (i < 0 || i >= MAX_LENSVIEWS || !views[i].active) {
+      return NULL;
+   }
+   return &views[i].lens;
 }
 
 // -------------------------------------------------------------------------------- 
@@ -299,31 +675,48 @@ static void create_palmap(void){
 // |                                                                              |
 // --------------------------------------------------------------------------------
 
-// write a plate 
-static void WritePNGplate(char *filename, int plate_index, int with_margins){
-   const byte *palette = host_basepal;
-   WritePNGplate_(&globe, ray_to_plate_index, palette, filename, plate_index, with_margins);
+static byte* get_plate_owners(void)
+{
+   int platesize = globe.platesize;
+   int area = platesize*platesize;
+
+   if (!plate_owner_valid) {
+      byte *owner = realloc(plate_owner, globe.numplates*area);
+      if (NULL == owner) {
+         return NULL;
+      }
+      plate_owner = owner;
+
+      int i,x,y;
+      for (i=0; i<globe.numplates; ++i) {
+         for (y=0; y<platesize; ++y) {
+            for (x=0; x<platesize; ++x) {
+               const vec2_u uv = {.k = { (float)x/platesize, ((float)y)/platesize}};
+               vec3_u ray = plate_uv_to_ray(&globe, i, uv);
+               *owner++ = ray_to_plate_index(ray.vec);
+            }
+         }
+      }
+      plate_owner_valid = true;
+   }
+   return plate_owner;
 }
 
+// hand a snapshot of the plates to a background saver
 static void save_globe(void)
 {
-   int i;
-   char pngname[32];
-
    globe.save.should = false;
 
-    D_EnableBackBufferAccess();	// enable direct drawing of console to back
-
-   for (i=0; i<globe.numplates; ++i) 
-   {
-      qsnprintf(pngname, 32, "%s%d.png", globe.save.name, i);
-      WritePNGplate(pngname, i, globe.save.with_margins);
-
-    Con_Printf("Wrote %s\n", pngname);
+   // the globe script can only be asked from here, anything else is worked out by the saver
+   const byte *owner = NULL;
+   if (!globe.save.with_margins && F_getScriptRef()->globe_plate != -1) {
+      owner = get_plate_owners();
    }
 
-    D_DisableBackBufferAccess();	// for adapters that can't stay mapped in
-    //  for linear writes all the time
+   const byte *palette = host_basepal;
+   if (!SaveGlobeAsync(&globe, owner, palette, globe.save.name, globe.save.with_margins)) {
+      Con_Printf("could not save %s\n", globe.save.name);
+   }
 }
 
 // -------------------------------------------------------------------------------- 
@@ -332,7 +725,7 @@ static void save_globe(void)
 // |                                                                              |
 // --------------------------------------------------------------------------------
 
-static void set_lensmap_grid(int lx, int ly, int px, int py, int plate_index)
+static void set_lensmap_grid(struct _lensview *view, int lx, int ly, int px, int py, int plate_index)
 {
    // designate the palette for this pixel
    // This will set the palette index map such that a grid is shown
@@ -369,14 +762,14 @@ static void set_lensmap_grid(int lx, int ly, int px, int py, int plate_index)
       fmod(uy,block_size) < rubix.pad_size;
 
    if (!ongrid)
-      *LENSPIXELTINT(lx,ly) = plate_index;
+      *LENSPIXELTINT(&view->lens,lx,ly) = plate_index;
 }
 
 // set a pixel on the lensmap from plate coordinates
-static void set_lensmap_from_plate(int lx, int ly, int px, int py, int plate_index)
+static void set_lensmap_from_plate(struct _lensview *view, int lx, int ly, int px, int py, int plate_index)
 {
    // check valid lens coordinates
-   if (lx < 0 || lx >= lens.width_px || ly < 0 || ly >= lens.height_px) {
+   if (lx < 0 || lx >= view->lens.width_px || ly < 0 || ly >= view->lens.height_px) {
       return;
    }
 
@@ -385,44 +778,13 @@ static void set_lensmap_from_plate(int lx, int ly, int px, int py, int plate_ind
       return;
    }
 
-   // increase the number of times this side is used
-   globe.plates[plate_index].display = 1;
+   // mark this side as used by the view
+   view->plate_used[plate_index] = true;
 
    // map the lens pixel to this cubeface pixel
-   *LENSPIXEL(lx,ly) = RELATIVE_GLOBEPIXEL(plate_index,px,py);
-
-   set_lensmap_grid(lx,ly,px,py,plate_index);
-}
-
-// set a pixel on the lensmap from plate uv coordinates
-static void set_lensmap_from_plate_uv(int lx, int ly, double u, double v, int plate_index)
-{
-   // convert to plate coordinates
-   int px = (int)(u*globe.platesize);
-   int py = (int)(v*globe.platesize);
-   
-   set_lensmap_from_plate(lx,ly,px,py,plate_index);
-}
-
-// set the (lx,ly) pixel on the lensmap to the (sx,sy,sz) view vector
-static void set_lensmap_from_ray(int lx, int ly, double sx, double sy, double sz)
-{
-   vec3_t ray = {sx,sy,sz};
-
-   // get plate index
-   int plate_index = ray_to_plate_index(ray);
-   if (plate_index < 0) {
-      return;
-   }
-
-   // get texture coordinates
-   double u,v;
-   if (!ray_to_plate_uv(plate_index, ray, &u, &v)) {
-      return;
-   }
+   *LENSPIXEL(&view->lens,lx,ly) = RELATIVE_GLOBEPIXEL(plate_index,px,py);
 
-   // map lens pixel to plate pixel
-   set_lensmap_from_plate_uv(lx,ly,u,v,plate_index);
+   set_lensmap_grid(view,lx,ly,px,py,plate_index);
 }
 
 
@@ -435,7 +797,6 @@ static void set_lensmap_from_ray(int lx, int ly, double sx, double sy, double sz
 // retrieves the plate closest to the given ray
 static int ray_to_plate_index(vec3_t ray)
 {
-   int plate_index = 0;
    script_refs lua_refs = *F_getScriptRef();
    vec3_u ray_;
    VectorCopy(ray, ray_.vec);
@@ -449,405 +810,408 @@ static int ray_to_plate_index(vec3_t ray)
       return NONSENSE_VALUE; //TODO: don't use index for state
    }
 
-   // maximum dotproduct 
-   //  = minimum acos(dotproduct) 
-   //  = minimum angle between vectors
-   double max_dp = -2;
-
-   int i;
-   for (i=0; i<globe.numplates; ++i) {
-      double dp = DotProduct(ray, globe.plates[i].forward);
-      if (dp > max_dp) {
-         max_dp = dp;
-         plate_index = i;
-      }
-   }
-
-   return plate_index;
-}
-
-static qboolean ray_to_plate_uv(int plate_index, vec3_t ray, double *u, double *v)
-{
-   // get ray in the plate's relative view frame
-   double x = DotProduct(globe.plates[plate_index].right, ray);
-   double y = DotProduct(globe.plates[plate_index].up, ray);
-   double z = DotProduct(globe.plates[plate_index].forward, ray);
-
-   // project ray to the texture
-   double dist = globe.plates[plate_index].dist;
-   *u = x/z*dist + 0.5;
-   *v = -y/z*dist + 0.5;
-
-   // return true if valid texture coordinates
-   return *u>=0 && *u<=1 && *v>=0 && *v<=1;
+   return ray_to_plate_index_(&globe, ray);
 }
 
 // -------------------------------------------------------------------------------- 
 // |                                                                              |
-// |                           LENS BUILDER RESUMERS                              |
+// |                           LENS CREATORS                                      |
 // |                                                                              |
 // --------------------------------------------------------------------------------
 
-static void resume_lensmap(void)
+// the builder hooks for a view's lens (see fishbuild.h)
+static void lensview_build(struct _lensview *view, struct _lensmap_build *build)
 {
-   if (lens.map_type == MAP_FORWARD) {
-      lens_builder.working = resume_lensmap_forward();
-   }
-   else if (lens.map_type == MAP_INVERSE) {
-      lens_builder.working = resume_lensmap_inverse();
-   }
+   build->builder = &view->builder;
+   build->state = (struct state_paq){
+      .forward = scriptToC_lens_forward,
+      .inverse = scriptToC_lens_inverse,
+      .globe = &globe,
+      .lens = &view->lens
+   };
+   build->globe_plate = F_getScriptRef()->globe_plate != -1 ? ray_to_plate_index : NULL;
+   build->plot = plot_quad_pixel;
+   build->data = view;
 }
 
-static qboolean resume_lensmap_inverse(void)
+// fills a lens pixel covered by a plate pixel
+static void plot_quad_pixel(void *data, int lx, int ly, int px, int py, int plate_index)
 {
-   // image coordinates
-   double x,y;
-
-   // lens coordinates
-   int lx, *ly;
-
-   start_lens_builder_clock_(&lens_builder);
-   for(ly = &(lens_builder.inverse_state.ly); *ly >= 0; --(*ly))
-   {
-      // pause building if we have exceeded time allowed per frame
-      if (is_lens_builder_time_up_(&lens_builder)) {
-         return true; 
-      }
+   set_lensmap_from_plate(data, lx, ly, px, py, plate_index);
+}
 
-      y = -(*ly-lens.height_px/2) * lens.scale;
+// reads a precomputed lensmap for the view, if one matches it exactly
+// (the rubix tints aren't stored, they follow from the plate pixels)
+static qboolean load_lensmap(struct _lensview *view)
+{
+   struct _lensmap_key key;
+   char dir[MAX_OSPATH], filename[MAX_OSPATH];
+   int platesize = globe.platesize;
+   int area = platesize*platesize;
+   int lx, ly;
 
-      // calculate all the pixels in this row
-      for(lx = 0;lx<lens.width_px;++lx)
-      {
-         x = (lx-lens.width_px/2) * lens.scale;
+   F_LensmapKey(&key, com_basedir, &view->lens, &view->zoom, &globe);
+   if (snprintf(dir, sizeof(dir), "%s/lensmaps", com_basedir) >= (int)sizeof(dir)) {
+      return false;
+   }
+   F_LensmapFilename(&key, dir, filename, sizeof(filename));
+   if (!F_ReadLensmap(filename, &key, view->lens.pixels, view->plate_used)) {
+      return false;
+   }
 
-         // determine which light ray to follow
-         vec3_u ray = scriptToC_lens_inverse((vec2_u){{x,y}});
-         if (last_status == NO_VALUE_RETURNED) {
-            continue;
-         }
-         else if (last_status == NONSENSE_VALUE) {
-            return false;
+   for (ly=0; ly<view->lens.height_px; ++ly) {
+      for (lx=0; lx<view->lens.width_px; ++lx) {
+         uint32_t index = *LENSPIXEL(&view->lens,lx,ly);
+         if (index) {
+            int p = index % area;
+            set_lensmap_grid(view, lx, ly, p % platesize, p / platesize, index / area);
          }
-
-         // get the pixel belonging to the light ray
-         set_lensmap_from_ray(lx,*ly,ray.vec[0],ray.vec[1],ray.vec[2]);
       }
    }
-
-   // done building lens
-   return false;
+   return true;
 }
 
-static qboolean resume_lensmap_forward(void)
+static void create_lensmap(struct _lensview *view)
 {
-   int *top = lens_builder.forward_state.top;
-   int *bot = lens_builder.forward_state.bot;
-   int *py = &(lens_builder.forward_state.py);
-   int *plate_index = &(lens_builder.forward_state.plate_index);
-   int platesize = globe.platesize;
-
-   start_lens_builder_clock_(&lens_builder);
-   for (; *plate_index < globe.numplates; ++(*plate_index))
-   {
-      int px;
-      for (; *py >=0; --(*py)) {
+   view->builder.working = false;
 
-         // pause building if we have exceeded time allowed per frame
-         if (is_lens_builder_time_up_(&lens_builder)) {
-            return true; 
-         }
+   // render nothing if current lens or globe is invalid
+   if (!view->lens.valid || !globe.valid)
+      return;
 
-         // FIND ALL DESTINATION SCREEN COORDINATES FOR THIS TEXTURE ROW ********************
-
-         // compute lower points
-         if (*py == platesize-1) {
-            double v = (*py + 0.5) / platesize;
-            for (px = 0; px < platesize; ++px) {
-               // compute left point
-               if (px == 0) {
-                  double u = (px - 0.5) / platesize;
-                  point2d bot_ = uv_to_screen(arg_consolidator, *plate_index, (vec2_u){{u,v}});
-                  bot[0] = bot_.xy.x; bot[1] = bot_.xy.y;
-                   if (last_status == NO_VALUE_RETURNED){ continue;}
-                   else if (last_status == NONSENSE_VALUE){ return false;}
-               }
-               // compute right point
-               double u = (px + 0.5) / platesize;
-               int index = 2*(px+1);
-               point2d bot_ = uv_to_screen(arg_consolidator, *plate_index, (vec2_u){{u,v}});
-               bot[index] = bot_.xy.x; bot[index+1] = bot_.xy.y;
-                if (last_status == NO_VALUE_RETURNED) {continue;}
-                else if (last_status == NONSENSE_VALUE) {return false;}
-            }
-         }
-         else {
-            // swap references so that the previous bottom becomes our current top
-            int *temp = top;
-            top = bot;
-            bot = temp;
-         }
+   // test if this lens can support the current fov
+   if (!calc_zoom(&view->lens, &view->zoom)) {
+      Con_Printf("This lens could not be initialized.\n");
+      return;
+   }
 
-         // compute upper points
-         double v = (*py - 0.5) / platesize;
-         for (px = 0; px < platesize; ++px) {
-            // compute left point
-            if (px == 0) {
-               double u = (px - 0.5) / platesize;
-               point2d top_ = uv_to_screen(arg_consolidator, *plate_index, (vec2_u){{u,v}});
-               top[0] = top_.xy.x; top[1] = top_.xy.y;
-               if (last_status == NO_VALUE_RETURNED) {continue;}
-                else if (last_status == NONSENSE_VALUE) {return false;}
-            }
-            // compute right point
-            double u = (px + 0.5) / platesize;
-            int index = 2*(px+1);
-            point2d top_ = uv_to_screen(arg_consolidator, *plate_index, (vec2_u){{u,v}});
-            top[index] = top_.xy.x; top[index+1] = top_.xy.y;
-             if (last_status == NO_VALUE_RETURNED) {continue;}
-             else if (last_status == NONSENSE_VALUE) {return false;}
-         }
+   // clear the sides used by this view
+   memset(view->plate_used, 0, sizeof(view->plate_used));
 
-         // DRAW QUAD FOR EACH PIXEL IN THIS TEXTURE ROW ***********************************
+   // take a lensmap made by fish_lensmapgen if there is one for this view
+   if (load_lensmap(view)) {
+      return;
+   }
 
-         v = ((double)*py)/platesize;
-         for (px = 0; px < platesize; ++px) {
-            
-            // skip overlapping region of texture
-            double u = ((double)px)/platesize;
-            vec3_u ray = plate_uv_to_ray(&globe, *plate_index, (vec2_u){{u,v}});
-            if (*plate_index != ray_to_plate_index(ray.vec)) {
-               continue;
-            }
+   // create lensmap
+   if (view->lens.map_type == MAP_NONE) {
+      Con_Printf("no inverse or forward map being used\n");
+      return;
+   }
+   struct _lensmap_build build;
+   lensview_build(view, &build);
+   start_lensmap_build(&build);
+}
 
-            int index = 2*px;
-            draw_quad(&top[index], &top[index+2], &bot[index], &bot[index+2], *plate_index,px,*py);
-         }
+// -------------------------------------------------------------------------------- 
+// |                                                                              |
+// |                           LENS RENDERERS                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
 
+// draw the lensmap to the given 8-bit buffer
+static void render_lensmap(struct _lensview *view, byte *dest, int rowbytes)
+{
+   if(NULL != view->lens.pixels){
+      if (view == &views[0] && f_fusedblit.value && render_lensmap_fused()) {
+         return;
+      }
+#ifdef FISHEYE_GL
+      if (view == &views[0] && f_gllens.value && render_lensmap_gl(view, dest, rowbytes)) {
+         return;
+      }
+#endif
+      if (rubix.enabled) {
+         render_lensmap_8bit(view, dest, rowbytes);
+      } else {
+         render_lensmap_8bit_rubix(view, dest, rowbytes);
       }
-
-      // reset row position
-      // (we have to do it here because it cannot be reset until it is done iterating)
-      // (we cannot do it at the beginning because the function could be resumed at some middle row)
-      *py = platesize-1;
    }
+}
 
-   free(top);
-   free(bot);
+static void render_lensmap_8bit(struct _lensview *view, byte *dest, int rowbytes){
+   resolve_lensmap_8bit(&view->lens, &globe, dest, rowbytes);
+}
 
-   // done building lens
-   return false;
+static void render_lensmap_8bit_rubix(struct _lensview *view, byte *dest, int rowbytes){
+   resolve_lensmap_8bit_tinted(&view->lens, &globe, dest, rowbytes);
 }
 
-// fills a quad on the lensmap using the given plate coordinate
-static void draw_quad(int *tl, int *tr, int *bl, int *br,
-      int plate_index, int px, int py)
+#ifdef FISHEYE_GL
+static qboolean render_lensmap_gl(struct _lensview *view, byte *dest, int rowbytes)
 {
-   // array for quad corners in clockwise order
-   int *p[] = { tl, tr, br, bl };
-
-   // get bounds
-   int x = tl[0], y = tl[1];
-   int miny=y, maxy=y;
-   int minx=x, maxx=x;
-   int i;
-   for (i=1; i<4; i++) {
-      int tx = p[i][0];
-      if (tx < minx) { minx = tx; }
-      else if (tx > maxx) { maxx = tx; }
-
-      int ty = p[i][1];
-      if (ty < miny) { miny = ty; }
-      else if (ty > maxy) { maxy = ty; }
-   }
-
-   // temp solution for keeping quads from wrapping around
-   //    the boundaries of the image. I guess that quads
-   //    will not get very big unless they're doing wrapping.
-   // actual clipping will require knowledge of the boundary.
-   const int maxdiff = 20;
-   if (abs(minx-maxx) > maxdiff || abs(miny-maxy) > maxdiff) {
-      return;
+   static unsigned index_palette[256];
+   static unsigned *rgba = NULL;
+   static int rgba_area = 0;
+   static int tinted_upload = -1;
+   int width = view->lens.width_px, height = view->lens.height_px;
+   int i, x, y;
+
+   // the same choice of tint as render_lensmap's
+   qboolean tinted = !rubix.enabled;
+
+   if (!F_GL_OpenOffscreen() || !F_GL_SetGlobe(globe.platesize, globe.numplates)) {
+      Con_Printf("f_gllens: no GL lens, back to the software one\n");
+      Cvar_SetValue("f_gllens", 0);
+      return false;
    }
 
-   // pixel
-   if (miny == maxy && minx == maxx) {
-      set_lensmap_from_plate(x,y,px,py,plate_index);
-      return;
-   }
-
-   // horizontal line
-   if (miny == maxy) {
-      int tx;
-      for (tx=minx; tx<=maxx; ++tx) {
-         set_lensmap_from_plate(tx,miny,px,py,plate_index);
+   if (!index_palette[0]) {
+      for (i=0; i<256; ++i) {
+         byte *color = (byte*)&index_palette[i];
+         color[0] = i;
+         color[3] = 255;
       }
-      return;
    }
+   F_GL_UploadPlates(&globe, index_palette);
 
-   // vertical line
-   if (minx == maxx) {
-      int ty;
-      for (ty=miny; ty<=maxy; ++ty) {
-         set_lensmap_from_plate(x,ty,px,py,plate_index);
-      }
-      return;
+   if (view->gl_stale || (int)tinted != tinted_upload) {
+      F_GL_SetLensmap(&view->lens, tinted);
+      view->gl_stale = false;
+      tinted_upload = tinted;
    }
 
-   // quad
-   for (y=miny; y<=maxy; ++y) {
-
-      // get x points
-      int tx[2] = {minx,maxx};
-      int txi=0; // tx index
-      int j=3;
-      for (i=0; i<4; ++i) {
-         int ix = p[i][0], iy = p[i][1];
-         int jx = p[j][0], jy = p[j][1];
-         if ((iy < y && y <= jy) || (jy < y && y <= iy)) {
-            double dy = jy-iy;
-            double dx = jx-ix;
-            tx[txi] = (int)(ix + (y-iy)/dy*dx);
-            if (++txi == 2) break;
-         }
-         j=i;
-      }
-
-      // order x points
-      if (tx[0] > tx[1]) {
-         int temp = tx[0];
-         tx[0] = tx[1];
-         tx[1] = temp;
-      }
-
-      // sanity check on distance
-      if (tx[1] - tx[0] > maxdiff)
-      {
-         Con_Printf("%d > maxdiff\n", tx[1]-tx[0]);
-         return;
+   if (width*height > rgba_area) {
+      unsigned *grown = realloc(rgba, width*height*sizeof(*rgba));
+      if (NULL == grown) {
+         return false;
       }
+      rgba = grown;
+      rgba_area = width*height;
+   }
+   if (!F_GL_ResolveLens(rgba)) {
+      return false;
+   }
 
-      // draw horizontal line between x points
-      for (x=tx[0]; x<=tx[1]; ++x) {
-         set_lensmap_from_plate(x,y,px,py,plate_index);
+   for (y=0; y<height; ++y) {
+      const byte *src = (const byte*)(rgba + y*width);
+      byte *row = dest + y*rowbytes;
+      for (x=0; x<width; ++x) {
+         row[x] = src[4*x];
       }
    }
+   return true;
 }
+#endif
 
-// -------------------------------------------------------------------------------- 
-// |                                                                              |
-// |                           LENS CREATORS                                      |
-// |                                                                              |
-// --------------------------------------------------------------------------------
-
-static void create_lensmap_inverse(void)
+// draw an extra view into its target, or as an inset on the screen
+static void render_lensview(struct _lensview *view)
 {
-   // initialize progress state
-   lens_builder.inverse_state.ly = lens.height_px-1;
+   if (view->target) {
+      render_lensmap(view, view->target, view->target_rowbytes);
+      return;
+   }
 
-   resume_lensmap();
+   // insets must fit on the screen
+   if (view->x < 0 || view->y < 0 ||
+       view->x + view->lens.width_px > vid.width ||
+       view->y + view->lens.height_px > vid.height) {
+      return;
+   }
+   render_lensmap(view, VBUFFER(view->x, view->y), vid.rowbytes);
 }
 
-static void create_lensmap_forward(void)
+// draw the main lens once for each eye, left then right, side by side or top
+// and bottom (the lensmap is shared, only the globe pixels differ)
+static void render_stereo(struct _lensview *view, int stereo,
+      const struct _globe *left_eye, byte *dest, int rowbytes)
 {
-   // initialize progress state
-   int *rowa = malloc((globe.platesize+1)*sizeof(int[2]));
-   int *rowb = malloc((globe.platesize+1)*sizeof(int[2]));
-   lens_builder.forward_state.top = rowa;
-   lens_builder.forward_state.bot = rowb;
-   lens_builder.forward_state.py = globe.platesize-1;
-   lens_builder.forward_state.plate_index = 0;
+   struct _globe right_eye = *left_eye;
+   right_eye.pixels = left_eye->right_pixels;
 
-   resume_lensmap();
+   byte *left = dest;
+   byte *right = stereo == STEREO_SIDE_BY_SIDE
+      ? dest + view->lens.width_px
+      : dest + view->lens.height_px*rowbytes;
+
+   if (NULL == view->lens.pixels) {
+      return;
+   }
+   if (rubix.enabled) {
+      resolve_lensmap_8bit(&view->lens, left_eye, left, rowbytes);
+      resolve_lensmap_8bit(&view->lens, &right_eye, right, rowbytes);
+   } else {
+      resolve_lensmap_8bit_tinted(&view->lens, left_eye, left, rowbytes);
+      resolve_lensmap_8bit_tinted(&view->lens, &right_eye, right, rowbytes);
+   }
 }
 
-static void create_lensmap(void)
+// resolves the main lens of the frame before into the pipeline's frame
+// (on the pipeline's worker, see f_pipeline)
+static void resolve_frame(void *unused)
 {
-   lens_builder.working = false;
+   struct _lensview *view = frame_job.view;
+   int stereo = frame_job.stereo;
+   int rowbytes = frame_job.width;
 
-   // render nothing if current lens or globe is invalid
-   if (!lens.valid || !globe.valid)
-      return;
+   (void)unused;
 
-   // test if this lens can support the current fov
-   if (!calc_zoom(&lens, &zoom)) {
-      Con_Printf("This lens could not be initialized.\n");
-      return;
+   if (stereo) {
+      render_stereo(view, stereo, &frame_job.globe, pipebuf.frame, rowbytes);
    }
-
-   // clear the side counts
-   int i;
-   for (i=0; i<globe.numplates; i++) {
-      globe.plates[i].display = 0;
+   else if (rubix.enabled) {
+      resolve_lensmap_8bit(&view->lens, &frame_job.globe, pipebuf.frame, rowbytes);
    }
-
-   // create lensmap
-   if (lens.map_type == MAP_FORWARD) {
-      create_lensmap_forward();
+   else {
+      resolve_lensmap_8bit_tinted(&view->lens, &frame_job.globe, pipebuf.frame, rowbytes);
    }
-   else if (lens.map_type == MAP_INVERSE) {
-      create_lensmap_inverse();
+}
+
+// puts the resolved frame on the screen, through the video driver's 32-bit
+// texture like render_lensmap_fused when it can
+static void show_frame(void)
+{
+   vrect_t rect;
+   rect.x = scr_vrect.x;
+   rect.y = scr_vrect.y;
+   rect.width = frame_job.width;
+   rect.height = frame_job.height;
+   rect.pnext = NULL;
+
+   qboolean fused = f_fusedblit.value && VID_SetDirectSource(&rect, fill_framerow_32);
+   if (fused) {
+      fused_source = FUSED_FRAME;
    }
-   else { // MAP_NONE
-      Con_Printf("no inverse or forward map being used\n");
+   int y;
+   for (y=0; y<rect.height; y++) {
+      if (fused) {
+         memset(VBUFFER(rect.x, rect.y+y), TRANSPARENT_COLOR, rect.width);
+      }
+      else {
+         memcpy(VBUFFER(rect.x, rect.y+y), pipebuf.frame + y*rect.width, rect.width);
+      }
    }
 }
 
-// -------------------------------------------------------------------------------- 
-// |                                                                              |
-// |                           LENS RENDERERS                                     |
-// |                                                                              |
-// --------------------------------------------------------------------------------
+static void fill_framerow_32(int x, int y, int width, unsigned *dest, const unsigned *palette)
+{
+   const byte *frame = pipebuf.frame + x + y*frame_job.width;
+   int i;
+   for (i=0; i<width; i++) {
+      dest[i] = palette[frame[i]];
+   }
+}
 
-// draw the lensmap to the vidbuffer
-static void render_lensmap(void)
+// hand the lensmap to the video driver, which resolves it into its 32-bit
+// texture in VID_Update; the vid buffer under the lens only keeps overlays
+static qboolean render_lensmap_fused(void)
 {
-   if(NULL != lens.pixels){
-      if (rubix.enabled) {
-         render_lensmap_8bit();
-      } else {
-         render_lensmap_8bit_rubix();
-      }
+   vrect_t rect;
+   rect.x = scr_vrect.x;
+   rect.y = scr_vrect.y;
+   rect.width = views[0].lens.width_px;
+   rect.height = views[0].lens.height_px;
+   rect.pnext = NULL;
+
+   vid_fillrow32_t fillrow = rubix.enabled ? fill_lensrow_32 : fill_lensrow_32_rubix;
+   if (!VID_SetDirectSource(&rect, fillrow)) {
+      return false;
+   }
+   fused_source = FUSED_LENS;
+
+   int y;
+   for (y=0; y<rect.height; y++) {
+      memset(VBUFFER(rect.x, rect.y+y), TRANSPARENT_COLOR, rect.width);
    }
+   return true;
 }
 
-static void render_lensmap_8bit(void){
-   int x,y;
-   
-   uint32_t *lmap = lens.pixels;
-   byte *pmap = lens.pixel_tints;
-   for(y=0; y<lens.height_px; y++){
-      for(x=0; x<lens.width_px; x++,lmap++,pmap++){
-         int lx = x+scr_vrect.x;
-         int ly = y+scr_vrect.y;
-         byte* pixAddr = globe.pixels + *lmap;
-         *VBUFFER(lx,ly) = *pixAddr;
-      }
+static void fill_lensrow_32(int x, int y, int width, unsigned *dest, const unsigned *palette)
+{
+   const uint32_t *lmap = LENSPIXEL(&views[0].lens,x,y);
+   const byte *gmap = globe.pixels;
+   int i;
+   for (i=0; i<width; i++) {
+      dest[i] = palette[gmap[lmap[i]]];
    }
 }
 
-static void render_lensmap_8bit_rubix(void){
-   int x,y;
-   
-   uint32_t *lmap = lens.pixels;
-   byte *pmap = lens.pixel_tints;
-   for(y=0; y<lens.height_px; y++){
-      for(x=0; x<lens.width_px; x++,lmap++,pmap++){
-         int lx = x+scr_vrect.x;
-         int ly = y+scr_vrect.y;
-         byte* pixAddr = globe.pixels + *lmap;
-         int i = *pmap;
-         *VBUFFER(lx,ly) = i != 255 ? globe.plates[i].palette[*pixAddr] : *pixAddr;
-      }
+static void fill_lensrow_32_rubix(int x, int y, int width, unsigned *dest, const unsigned *palette)
+{
+   const uint32_t *lmap = LENSPIXEL(&views[0].lens,x,y);
+   const byte *pmap = LENSPIXELTINT(&views[0].lens,x,y);
+   const byte *gmap = globe.pixels;
+   int i;
+   for (i=0; i<width; i++) {
+      byte pix = gmap[lmap[i]];
+      int t = pmap[i];
+      dest[i] = palette[t != 255 ? globe.plates[t].palette[pix] : pix];
    }
 }
 
+// render the displayed plates for each eye
+// (the right eye, in stereo, goes to the globe's right_pixels)
+static void render_eyes(int stereo, vrect_t *vrect)
+{
+   extern int sb_lines;
+   int platesize = globe.platesize;
+   int eye, i;
+   double t;
+
+   // get the orientations required to render the plates
+   vec3_t forward, right, up;
+   AngleVectors(r_refdef.viewangles, forward, right, up);
 
+   // The dynamic lights are marked once for every plate of both eyes, which
+   // lets plates share dynamically lit surface caches (see D_CacheSurface).
+   // The eyes are close enough to see what the view origin sees, so they
+   // share its PVS rather than each marking surfaces for their own leaf.
+   vec3_t head;
+   VectorCopy(r_refdef.vieworg, head);
+   R_PushDlights();
+   fisheye_pvs_origin = head;
+
+   for (eye=0; eye < (stereo ? 2 : 1); ++eye) {
+      byte *eye_pixels = eye ? globe.right_pixels : globe.pixels;
+      if (stereo) {
+         VectorMA(head, (eye ? 0.5f : -0.5f) * f_ipd.value, right, r_refdef.vieworg);
+      }
+
+      for (i=0; i<globe.numplates; ++i)
+      {
+         if (globe.plates[i].display) {
+
+            // set view to change plate FOV
+            fisheye_plate_fov = globe.plates[i].fov;
+            R_ViewChanged(vrect, sb_lines, vid.aspect);
+
+            // compute absolute view vectors
+            // right = x
+            // top = y
+            // forward = z
+
+            vec3_t r = { 0,0,0};
+            VectorMA(r, globe.plates[i].right[0], right, r);
+            VectorMA(r, globe.plates[i].right[1], up, r);
+            VectorMA(r, globe.plates[i].right[2], forward, r);
+
+            vec3_t u = { 0,0,0};
+            VectorMA(u, globe.plates[i].up[0], right, u);
+            VectorMA(u, globe.plates[i].up[1], up, u);
+            VectorMA(u, globe.plates[i].up[2], forward, u);
+
+            vec3_t f = { 0,0,0};
+            VectorMA(f, globe.plates[i].forward[0], right, f);
+            VectorMA(f, globe.plates[i].forward[1], up, f);
+            VectorMA(f, globe.plates[i].forward[2], forward, f);
+
+            fisheye_plate_mipscale = plate_mipscale[i];
+            t = Sys_DoubleTime();
+            render_plate(i, eye_pixels, f, r, u);
+            F_SpeedsPlate(i, Sys_DoubleTime() - t, platesize*platesize, fisheye_plate_mipscale);
+         }
+      }
+   }
+
+   VectorCopy(head, r_refdef.vieworg);
+   fisheye_pvs_origin = NULL;
+   fisheye_plate_mipscale = 1;
+}
 
 // render a specific plate
-static void render_plate(int plate_index, vec3_t forward, vec3_t right, vec3_t up) 
+static void render_plate(int plate_index, byte *eye_pixels, vec3_t forward, vec3_t right, vec3_t up) 
 {
-    byte *pixels = globe.pixels + RELATIVE_GLOBEPIXEL(plate_index, 0, 0);
+    byte *pixels = eye_pixels + RELATIVE_GLOBEPIXEL(plate_index, 0, 0);
 
    // set camera orientation
    VectorCopy(forward, r_refdef.forward);
@@ -855,7 +1219,6 @@ static void render_plate(int plate_index, vec3_t forward, vec3_t right, vec3_t u
    VectorCopy(up, r_refdef.up);
 
    // render view
-   R_PushDlights();
    R_RenderView();
 
    // copy from vid buffer to cubeface, row by row
@@ -870,16 +1233,97 @@ static void render_plate(int plate_index, vec3_t forward, vec3_t right, vec3_t u
    }
 }
 
+// copy the plates or the main lens image into a capture frame
+static void capture_frame(void)
+{
+   struct _lensview *view = &views[0];
+   int platesize = globe.platesize;
+
+   if (F_CaptureSource() == CAPTURE_PLATES) {
+      byte *dest = F_BeginCaptureFrame(platesize, platesize, globe.numplates);
+      if (dest) {
+         memcpy(dest, globe.pixels, globe.numplates*platesize*platesize);
+      }
+   }
+   else {
+      byte *dest = F_BeginCaptureFrame(view->lens.width_px, view->lens.height_px, 1);
+      if (dest && rubix.enabled) {
+         render_lensmap_8bit(view, dest, view->lens.width_px);
+      }
+      else if (dest) {
+         render_lensmap_8bit_rubix(view, dest, view->lens.width_px);
+      }
+   }
+   F_SubmitCaptureFrame();
+}
+
+// The screenshot command saves the 8-bit vid buffer, which has only the
+// overlays where the last main lens was fused into the video driver's texture.
+// This resolves that lens into it as the unfused path would have, leaving
+// whatever was drawn over the lens in place.
+void F_ScreenShotLens(void)
+{
+   struct _lensview *view = &views[0];
+   const byte *src;
+   byte *lens = NULL, *dest;
+   int width, height, x, y;
+
+   if (fused_source == FUSED_FRAME) {
+      width = frame_job.width;
+      height = frame_job.height;
+      src = pipebuf.frame;
+   }
+   else if (fused_source == FUSED_LENS) {
+      width = view->lens.width_px;
+      height = view->lens.height_px;
+      lens = malloc(width*height);
+      if (NULL == lens) {
+         return;
+      }
+      if (rubix.enabled) {
+         render_lensmap_8bit(view, lens, width);
+      }
+      else {
+         render_lensmap_8bit_rubix(view, lens, width);
+      }
+      src = lens;
+   }
+   else {
+      return;
+   }
+
+   for (y=0; y<height; y++) {
+      dest = VBUFFER(scr_vrect.x, scr_vrect.y+y);
+      for (x=0; x<width; x++) {
+         if (dest[x] == TRANSPARENT_COLOR) {
+            dest[x] = src[x + y*width];
+         }
+      }
+   }
+   free(lens);
+}
+
+void F_DemoStopped(void)
+{
+   F_CaptureDemoEnded();
+   F_TimedemoDemoEnded();
+}
+
+void F_DemoFailed(void)
+{
+   F_CaptureDemoFailed();
+}
+
 //Introspection function implementations
 struct _globe* F_getGlobe(void){
 	return &globe;
 }
 
 struct _lens* F_getLens(void){
-	return &lens;
+	return &views[0].lens;
 }
 
 struct _lens_builder* F_getStatus(void){
-   return &lens_builder;
+   return &views[0].builder;
 }
 // vim: et:ts=3:sts=3:sw=3
@@ -0,0 +1,574 @@
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifdef APPLE_OPENGL
+#include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include "console.h"
+#include "fishgl.h"
+
+// GL 2.0 and framebuffer object entry points, looked up by F_GL_Init
+#define FISHGL_PROCS \
+   PROC(PFNGLACTIVETEXTUREPROC, glActiveTexture) \
+   PROC(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+   PROC(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+   PROC(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+   PROC(PFNGLFRAMEBUFFERTEXTURE2DPROC, glFramebufferTexture2D) \
+   PROC(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
+   PROC(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers) \
+   PROC(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers) \
+   PROC(PFNGLBINDRENDERBUFFERPROC, glBindRenderbuffer) \
+   PROC(PFNGLRENDERBUFFERSTORAGEPROC, glRenderbufferStorage) \
+   PROC(PFNGLFRAMEBUFFERRENDERBUFFERPROC, glFramebufferRenderbuffer) \
+   PROC(PFNGLCREATESHADERPROC, glCreateShader) \
+   PROC(PFNGLDELETESHADERPROC, glDeleteShader) \
+   PROC(PFNGLSHADERSOURCEPROC, glShaderSource) \
+   PROC(PFNGLCOMPILESHADERPROC, glCompileShader) \
+   PROC(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+   PROC(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+   PROC(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+   PROC(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+   PROC(PFNGLATTACHSHADERPROC, glAttachShader) \
+   PROC(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+   PROC(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+   PROC(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+   PROC(PFNGLUSEPROGRAMPROC, glUseProgram) \
+   PROC(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+   PROC(PFNGLUNIFORM1IPROC, glUniform1i) \
+   PROC(PFNGLUNIFORM1FPROC, glUniform1f) \
+   PROC(PFNGLUNIFORM2FPROC, glUniform2f)
+
+#define PROC(type, name) static type q##name;
+FISHGL_PROCS
+#undef PROC
+
+static struct {
+   qboolean ready;
+
+   // the hidden window and context F_GL_OpenOffscreen made, if any
+   qboolean video;
+   SDL_Window *window;
+   SDL_GLContext context;
+
+   // the lens shader
+   GLuint program;
+   GLint u_plates, u_lensmap, u_platesize, u_atlas;
+
+   // the plates, one above the other, platesize texels wide
+   // (plate 0 at the bottom, each plate bottom up like GL draws it)
+   // with their tinted copies beside them, see F_GL_UploadPlates
+   GLuint plates, depth, framebuffer;
+   int platesize, numplates;
+
+   // the plate pixel for every lens pixel, see F_GL_SetLensmap
+   GLuint lensmap;
+   int lens_width, lens_height;
+
+   // what F_GL_ResolveLens draws the lens into
+   GLuint lens_color, lens_framebuffer;
+
+   // conversion buffer for uploads (grown as needed)
+   byte *scratch;
+   size_t scratch_size;
+} gl;
+
+static const char *lens_vertex_shader =
+   "#version 110\n"
+   "varying vec2 lens_uv;\n"
+   "void main()\n"
+   "{\n"
+   "   // lensmap rows are top down, GL's are bottom up\n"
+   "   lens_uv = vec2(gl_MultiTexCoord0.x, 1.0 - gl_MultiTexCoord0.y);\n"
+   "   gl_Position = gl_Vertex;\n"
+   "}\n";
+
+static const char *lens_fragment_shader =
+   "#version 110\n"
+   "uniform sampler2D plates;\n"
+   "uniform sampler2D lensmap;\n"
+   "uniform float platesize;\n"
+   "uniform vec2 atlas;\n"
+   "varying vec2 lens_uv;\n"
+   "void main()\n"
+   "{\n"
+   "   // plate pixel packed as x in red and green, y in blue and alpha,\n"
+   "   // with the top bit of green set to take the tinted copy\n"
+   "   vec4 m = floor(texture2D(lensmap, lens_uv) * 255.0 + 0.5);\n"
+   "   float tinted = floor(m.g / 128.0);\n"
+   "   float x = m.r + 256.0*(m.g - 128.0*tinted) + tinted*platesize;\n"
+   "   float y = m.b + 256.0*m.a;\n"
+   "\n"
+   "   // the lensmap counts plate rows top down\n"
+   "   float plate = floor((y + 0.5) / platesize);\n"
+   "   y = plate*platesize + (platesize - 1.0) - (y - plate*platesize);\n"
+   "   gl_FragColor = texture2D(plates, (vec2(x, y) + 0.5) / atlas);\n"
+   "}\n";
+
+static qboolean load_procs(fishgl_getproc_t getproc);
+static GLuint compile_shader(GLenum type, const char *source);
+static GLuint link_program(GLuint vertex, GLuint fragment);
+static void delete_globe(void);
+static void delete_lens(void);
+
+static byte *reserve_scratch(size_t size);
+static void set_nearest(void);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           SETUP                                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_GL_Init(fishgl_getproc_t getproc)
+{
+   if (gl.ready) {
+      return true;
+   }
+   if (!load_procs(getproc)) {
+      return false;
+   }
+
+   GLuint vertex = compile_shader(GL_VERTEX_SHADER, lens_vertex_shader);
+   GLuint fragment = compile_shader(GL_FRAGMENT_SHADER, lens_fragment_shader);
+   if (vertex && fragment) {
+      gl.program = link_program(vertex, fragment);
+   }
+   if (vertex) {
+      qglDeleteShader(vertex);
+   }
+   if (fragment) {
+      qglDeleteShader(fragment);
+   }
+   if (!gl.program) {
+      return false;
+   }
+
+   gl.u_plates = qglGetUniformLocation(gl.program, "plates");
+   gl.u_lensmap = qglGetUniformLocation(gl.program, "lensmap");
+   gl.u_platesize = qglGetUniformLocation(gl.program, "platesize");
+   gl.u_atlas = qglGetUniformLocation(gl.program, "atlas");
+
+   glGenTextures(1, &gl.lensmap);
+   gl.ready = true;
+   return true;
+}
+
+void F_GL_Shutdown(void)
+{
+   if (!gl.ready) {
+      return;
+   }
+   delete_globe();
+   delete_lens();
+   glDeleteTextures(1, &gl.lensmap);
+   qglDeleteProgram(gl.program);
+   free(gl.scratch);
+   gl.ready = false;
+   gl.program = gl.lensmap = 0;
+   gl.lens_width = gl.lens_height = 0;
+   gl.scratch = NULL;
+   gl.scratch_size = 0;
+}
+
+qboolean F_GL_OpenOffscreen(void)
+{
+   if (gl.context) {
+      return F_GL_MakeCurrent();
+   }
+   if (SDL_InitSubSystem(SDL_INIT_VIDEO)) {
+      Con_Printf("fisheye GL: %s\n", SDL_GetError());
+      return false;
+   }
+   gl.video = true;
+
+   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 1);
+   gl.window = SDL_CreateWindow("fisheye GL", 0, 0, 16, 16,
+         SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+   if (gl.window) {
+      gl.context = SDL_GL_CreateContext(gl.window);
+   }
+   if (NULL == gl.context) {
+      Con_Printf("fisheye GL: no context (%s)\n", SDL_GetError());
+      F_GL_CloseOffscreen();
+      return false;
+   }
+   if (!F_GL_Init((fishgl_getproc_t)SDL_GL_GetProcAddress)) {
+      F_GL_CloseOffscreen();
+      return false;
+   }
+   return true;
+}
+
+qboolean F_GL_MakeCurrent(void)
+{
+   return gl.context && !SDL_GL_MakeCurrent(gl.window, gl.context);
+}
+
+void F_GL_CloseOffscreen(void)
+{
+   if (gl.context) {
+      SDL_GL_MakeCurrent(gl.window, gl.context);
+      F_GL_Shutdown();
+      SDL_GL_DeleteContext(gl.context);
+   }
+   if (gl.window) {
+      SDL_DestroyWindow(gl.window);
+   }
+   if (gl.video) {
+      SDL_QuitSubSystem(SDL_INIT_VIDEO);
+   }
+   gl.context = NULL;
+   gl.window = NULL;
+   gl.video = false;
+}
+
+qboolean F_GL_SetGlobe(int platesize, int numplates)
+{
+   if (!gl.ready) {
+      return false;
+   }
+   if (platesize == gl.platesize && numplates == gl.numplates) {
+      return true;
+   }
+   delete_globe();
+
+   // the whole globe, and its tinted copy, has to fit in one texture
+   GLint max_size;
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+   if (2*platesize > max_size || platesize*numplates > max_size) {
+      Con_Printf("fisheye GL: %d plates of %d pixels don't fit in a %d texture\n",
+            numplates, platesize, max_size);
+      return false;
+   }
+
+   glGenTextures(1, &gl.plates);
+   glBindTexture(GL_TEXTURE_2D, gl.plates);
+   set_nearest();
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2*platesize, platesize*numplates, 0,
+         GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+   qglGenRenderbuffers(1, &gl.depth);
+   qglBindRenderbuffer(GL_RENDERBUFFER, gl.depth);
+   qglRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 2*platesize, platesize*numplates);
+
+   qglGenFramebuffers(1, &gl.framebuffer);
+   qglBindFramebuffer(GL_FRAMEBUFFER, gl.framebuffer);
+   qglFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gl.plates, 0);
+   qglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, gl.depth);
+   GLenum status = qglCheckFramebufferStatus(GL_FRAMEBUFFER);
+   qglBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+   if (status != GL_FRAMEBUFFER_COMPLETE) {
+      Con_Printf("fisheye GL: incomplete plate framebuffer (0x%x)\n", status);
+      delete_globe();
+      return false;
+   }
+
+   gl.platesize = platesize;
+   gl.numplates = numplates;
+   return true;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           PLATES                                             |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_GL_BeginPlate(int plate_index)
+{
+   int platesize = gl.platesize;
+
+   qglBindFramebuffer(GL_FRAMEBUFFER, gl.framebuffer);
+   glViewport(0, plate_index*platesize, platesize, platesize);
+
+   // keep clears from reaching the other plates
+   glScissor(0, plate_index*platesize, platesize, platesize);
+   glEnable(GL_SCISSOR_TEST);
+}
+
+void F_GL_EndPlate(void)
+{
+   glDisable(GL_SCISSOR_TEST);
+   qglBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void F_GL_UploadPlates(const struct _globe *globe, const unsigned *palette)
+{
+   int platesize = gl.platesize;
+   int i, x, y;
+
+   unsigned *rgba = (unsigned*)reserve_scratch(platesize*platesize*sizeof(unsigned));
+   if (NULL == rgba) {
+      return;
+   }
+
+   glBindTexture(GL_TEXTURE_2D, gl.plates);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   for (i=0; i<gl.numplates; ++i) {
+      const byte *pixels = globe->pixels + i*platesize*platesize;
+      const byte *tint = globe->plates[i].palette;
+
+      // flip the rows, to match plates that GL renders
+      for (y=0; y<platesize; ++y) {
+         const byte *src = pixels + (platesize-1-y)*platesize;
+         unsigned *dest = rgba + y*platesize;
+         for (x=0; x<platesize; ++x) {
+            dest[x] = palette[src[x]];
+         }
+      }
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, i*platesize, platesize, platesize,
+            GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+      // then the copy tinted by the plate's palette map
+      for (y=0; y<platesize; ++y) {
+         const byte *src = pixels + (platesize-1-y)*platesize;
+         unsigned *dest = rgba + y*platesize;
+         for (x=0; x<platesize; ++x) {
+            dest[x] = palette[tint[src[x]]];
+         }
+      }
+      glTexSubImage2D(GL_TEXTURE_2D, 0, platesize, i*platesize, platesize, platesize,
+            GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+   }
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           LENS                                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_GL_SetLensmap(const struct _lens *lens, qboolean tinted)
+{
+   int area = lens->width_px * lens->height_px;
+   int platesize = gl.platesize;
+   int i;
+
+   if (!gl.ready || !platesize) {
+      return;
+   }
+   byte *packed = reserve_scratch(area*4);
+   if (NULL == packed) {
+      return;
+   }
+
+   // a globe pixel index is a column and a row of the atlas, counted top down
+   for (i=0; i<area; ++i) {
+      uint32_t index = lens->pixels[i];
+      unsigned x = index % platesize;
+      unsigned y = index / platesize;
+      qboolean tint = tinted && lens->pixel_tints[i] != 255;
+      packed[4*i] = x & 0xff;
+      packed[4*i+1] = (x >> 8) | (tint ? 0x80 : 0);
+      packed[4*i+2] = y & 0xff;
+      packed[4*i+3] = y >> 8;
+   }
+
+   glBindTexture(GL_TEXTURE_2D, gl.lensmap);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   if (lens->width_px != gl.lens_width || lens->height_px != gl.lens_height) {
+      set_nearest();
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lens->width_px, lens->height_px, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, packed);
+      gl.lens_width = lens->width_px;
+      gl.lens_height = lens->height_px;
+      delete_lens();
+   }
+   else {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, lens->width_px, lens->height_px,
+            GL_RGBA, GL_UNSIGNED_BYTE, packed);
+   }
+}
+
+void F_GL_DrawLens(int x, int y)
+{
+   if (!gl.ready || !gl.plates || !gl.lens_width) {
+      return;
+   }
+
+   glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_TEXTURE_BIT);
+   glDisable(GL_DEPTH_TEST);
+   glDisable(GL_BLEND);
+   glDisable(GL_ALPHA_TEST);
+   glDisable(GL_CULL_FACE);
+   glViewport(x, y, gl.lens_width, gl.lens_height);
+
+   qglActiveTexture(GL_TEXTURE1);
+   glBindTexture(GL_TEXTURE_2D, gl.lensmap);
+   qglActiveTexture(GL_TEXTURE0);
+   glBindTexture(GL_TEXTURE_2D, gl.plates);
+
+   qglUseProgram(gl.program);
+   qglUniform1i(gl.u_plates, 0);
+   qglUniform1i(gl.u_lensmap, 1);
+   qglUniform1f(gl.u_platesize, gl.platesize);
+   qglUniform2f(gl.u_atlas, 2*gl.platesize, gl.platesize*gl.numplates);
+
+   // one quad over the whole lens
+   glBegin(GL_QUADS);
+   glTexCoord2f(0, 0); glVertex2f(-1, -1);
+   glTexCoord2f(1, 0); glVertex2f(1, -1);
+   glTexCoord2f(1, 1); glVertex2f(1, 1);
+   glTexCoord2f(0, 1); glVertex2f(-1, 1);
+   glEnd();
+
+   qglUseProgram(0);
+   glPopAttrib();
+}
+
+qboolean F_GL_ResolveLens(unsigned *rgba)
+{
+   int y;
+
+   if (!gl.ready || !gl.plates || !gl.lens_width) {
+      return false;
+   }
+
+   // the lens gets a framebuffer of its own, so nothing else is read back
+   if (!gl.lens_framebuffer) {
+      qglGenRenderbuffers(1, &gl.lens_color);
+      qglBindRenderbuffer(GL_RENDERBUFFER, gl.lens_color);
+      qglRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, gl.lens_width, gl.lens_height);
+      qglGenFramebuffers(1, &gl.lens_framebuffer);
+      qglBindFramebuffer(GL_FRAMEBUFFER, gl.lens_framebuffer);
+      qglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gl.lens_color);
+      GLenum status = qglCheckFramebufferStatus(GL_FRAMEBUFFER);
+      qglBindFramebuffer(GL_FRAMEBUFFER, 0);
+      if (status != GL_FRAMEBUFFER_COMPLETE) {
+         Con_Printf("fisheye GL: incomplete lens framebuffer (0x%x)\n", status);
+         delete_lens();
+         return false;
+      }
+   }
+
+   qglBindFramebuffer(GL_FRAMEBUFFER, gl.lens_framebuffer);
+   F_GL_DrawLens(0, 0);
+
+   // GL's rows are bottom up
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   for (y=0; y<gl.lens_height; ++y) {
+      glReadPixels(0, gl.lens_height-1-y, gl.lens_width, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+            rgba + y*gl.lens_width);
+   }
+   qglBindFramebuffer(GL_FRAMEBUFFER, 0);
+   return glGetError() == GL_NO_ERROR;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           HELPERS                                            |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean load_procs(fishgl_getproc_t getproc)
+{
+#define PROC(type, name) \
+   q##name = (type)getproc(#name); \
+   if (NULL == q##name) { \
+      Con_Printf("fisheye GL: no %s\n", #name); \
+      return false; \
+   }
+   FISHGL_PROCS
+#undef PROC
+   return true;
+}
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+   GLint ok;
+   char log[512];
+
+   GLuint shader = qglCreateShader(type);
+   qglShaderSource(shader, 1, &source, NULL);
+   qglCompileShader(shader);
+   qglGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+   if (!ok) {
+      qglGetShaderInfoLog(shader, sizeof(log), NULL, log);
+      Con_Printf("fisheye GL: lens shader: %s\n", log);
+      qglDeleteShader(shader);
+      return 0;
+   }
+   return shader;
+}
+
+static GLuint link_program(GLuint vertex, GLuint fragment)
+{
+   GLint ok;
+   char log[512];
+
+   GLuint program = qglCreateProgram();
+   qglAttachShader(program, vertex);
+   qglAttachShader(program, fragment);
+   qglLinkProgram(program);
+   qglGetProgramiv(program, GL_LINK_STATUS, &ok);
+   if (!ok) {
+      qglGetProgramInfoLog(program, sizeof(log), NULL, log);
+      Con_Printf("fisheye GL: lens program: %s\n", log);
+      qglDeleteProgram(program);
+      return 0;
+   }
+   return program;
+}
+
+static void delete_globe(void)
+{
+   if (gl.framebuffer) {
+      qglDeleteFramebuffers(1, &gl.framebuffer);
+   }
+   if (gl.depth) {
+      qglDeleteRenderbuffers(1, &gl.depth);
+   }
+   if (gl.plates) {
+      glDeleteTextures(1, &gl.plates);
+   }
+   gl.framebuffer = gl.depth = gl.plates = 0;
+   gl.platesize = gl.numplates = 0;
+}
+
+static void delete_lens(void)
+{
+   if (gl.lens_framebuffer) {
+      qglDeleteFramebuffers(1, &gl.lens_framebuffer);
+   }
+   if (gl.lens_color) {
+      qglDeleteRenderbuffers(1, &gl.lens_color);
+   }
+   gl.lens_framebuffer = gl.lens_color = 0;
+}
+
+static byte *reserve_scratch(size_t size)
+{
+   if (size > gl.scratch_size) {
+      byte *scratch = realloc(gl.scratch, size);
+      if (NULL == scratch) {
+         return NULL;
+      }
+      gl.scratch = scratch;
+      gl.scratch_size = size;
+   }
+   return gl.scratch;
+}
+
+// lensmap and plate texels are looked up exactly, never blended
+static void set_nearest(void)
+{
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// vim: et:ts=3:sts=3:sw=3
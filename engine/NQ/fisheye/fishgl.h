@@ -0,0 +1,55 @@
+#include "fisheye.h"
+
+#ifndef FISHGL_H_
+#define FISHGL_H_
+
+// The fisheye lens on OpenGL.  The plates are rendered by GL into one atlas
+// texture behind a framebuffer object, laid out like the software globe (plate
+// after plate, platesize texels wide), so a lensmap made by the lens builders
+// indexes it directly.  The lensmap is kept in a second texture and the lens is
+// resolved by a shader in a single draw covering the lens.
+//
+// Everything needs a current GL 2.0 context with framebuffer objects (GL 3.0 or
+// ARB_framebuffer_object); Mesa's llvmpipe is enough.  The software renderer
+// has none of its own, so with f_gllens it resolves the lens through a hidden
+// context made by F_GL_OpenOffscreen (see render_lensmap_gl in fisheye.c).
+
+typedef void *(*fishgl_getproc_t)(const char *name);
+
+// looks up the GL entry points and compiles the lens shader (false if the
+// context can't do it, with the reason on the console)
+qboolean F_GL_Init(fishgl_getproc_t getproc);
+void F_GL_Shutdown(void);
+
+// makes a hidden window with a context of its own and runs F_GL_Init in it
+// (false if there can't be one); F_GL_MakeCurrent takes the context back from
+// whatever else on the thread uses GL, e.g. SDL's renderer
+qboolean F_GL_OpenOffscreen(void);
+qboolean F_GL_MakeCurrent(void);
+void F_GL_CloseOffscreen(void);
+
+// (re)creates the plate atlas for the globe's size
+qboolean F_GL_SetGlobe(int platesize, int numplates);
+
+// renders to a plate: binds the atlas and limits drawing to the plate
+// (GL draws bottom up, which the lens shader accounts for)
+void F_GL_BeginPlate(int plate_index);
+void F_GL_EndPlate(void);
+
+// fills the atlas from 8-bit plates instead, e.g. from the software renderer
+// (palette is laid out like d_8to24table), along with a copy of each plate
+// through its palette map (globe->plates[i].palette) for tinted lens pixels
+void F_GL_UploadPlates(const struct _globe *globe, const unsigned *palette);
+
+// uploads a lensmap for the current atlas (call again whenever it changes);
+// when tinted, lens pixels with a tint take the tinted copy of their plate,
+// as resolve_lensmap_8bit_tinted does (only for uploaded plates)
+void F_GL_SetLensmap(const struct _lens *lens, qboolean tinted);
+
+// draws the lens with its lower left corner at (x,y) on the current framebuffer
+void F_GL_DrawLens(int x, int y);
+
+// draws the lens off the screen and reads it back, rows top down
+qboolean F_GL_ResolveLens(unsigned *rgba);
+
+#endif
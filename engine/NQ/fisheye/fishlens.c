@@ -1,6 +1,8 @@
 #include "qtypes.h"
 #include <math.h>
+#include <stdlib.h>
 #include <time.h>
+#include "console.h"
 #include "fishlens.h"
 
 struct _lens_builder * start_lens_builder_clock_(
@@ -91,12 +93,231 @@ vec2_u lens_to_screen_uv(lens_forward_t forward,
 point2d uv_to_screen(const struct state_paq state,
       int plate_index, const vec2_u uv)
 {
-   struct _lens lens = *state.lens;
    vec2_u out_uv = lens_to_screen_uv(state.forward, state.globe, plate_index, uv);
+   return lens_uv_to_screen(state.lens, out_uv);
+}
+
+point2d lens_uv_to_screen(const struct _lens *lens, const vec2_u uv)
+{
    point2d pt = {.k = {
-          (int)(out_uv.uv.u/lens.scale + lens.width_px/2),
-          (int)(-out_uv.uv.v/lens.scale + lens.height_px/2)
+          (int)(uv.uv.u/lens->scale + lens->width_px/2),
+          (int)(-uv.uv.v/lens->scale + lens->height_px/2)
    }};
 
    return pt;
 }
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           GLOBE PIXEL GETTERS                                |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+int ray_to_plate_index_(const struct _globe *globe, const vec3_t ray)
+{
+   int plate_index = 0;
+
+   // maximum dotproduct 
+   //  = minimum acos(dotproduct) 
+   //  = minimum angle between vectors
+   double max_dp = -2;
+
+   int i;
+   for (i=0; i<globe->numplates; ++i) {
+      double dp = DotProduct(ray, globe->plates[i].forward);
+      if (dp > max_dp) {
+         max_dp = dp;
+         plate_index = i;
+      }
+   }
+
+   return plate_index;
+}
+
+qboolean ray_to_plate_uv_(const struct _globe *globe, int plate_index,
+      const vec3_t ray, double *u, double *v)
+{
+   // get ray in the plate's relative view frame
+   double x = DotProduct(globe->plates[plate_index].right, ray);
+   double y = DotProduct(globe->plates[plate_index].up, ray);
+   double z = DotProduct(globe->plates[plate_index].forward, ray);
+
+   // project ray to the texture
+   double dist = globe->plates[plate_index].dist;
+   *u = x/z*dist + 0.5;
+   *v = -y/z*dist + 0.5;
+
+   // return true if valid texture coordinates
+   return *u>=0 && *u<=1 && *v>=0 && *v<=1;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           LENS PIXEL KERNELS                                 |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void draw_quad_(int *tl, int *tr, int *bl, int *br,
+      int plate_index, int px, int py, quad_plot_t plot, void *data)
+{
+   // array for quad corners in clockwise order
+   int *p[] = { tl, tr, br, bl };
+
+   // get bounds
+   int x = tl[0], y = tl[1];
+   int miny=y, maxy=y;
+   int minx=x, maxx=x;
+   int i;
+   for (i=1; i<4; i++) {
+      int tx = p[i][0];
+      if (tx < minx) { minx = tx; }
+      else if (tx > maxx) { maxx = tx; }
+
+      int ty = p[i][1];
+      if (ty < miny) { miny = ty; }
+      else if (ty > maxy) { maxy = ty; }
+   }
+
+   // temp solution for keeping quads from wrapping around
+   //    the boundaries of the image. I guess that quads
+   //    will not get very big unless they're doing wrapping.
+   // actual clipping will require knowledge of the boundary.
+   const int maxdiff = 20;
+   if (abs(minx-maxx) > maxdiff || abs(miny-maxy) > maxdiff) {
+      return;
+   }
+
+   // pixel
+   if (miny == maxy && minx == maxx) {
+      plot(data,x,y,px,py,plate_index);
+      return;
+   }
+
+   // horizontal line
+   if (miny == maxy) {
+      int tx;
+      for (tx=minx; tx<=maxx; ++tx) {
+         plot(data,tx,miny,px,py,plate_index);
+      }
+      return;
+   }
+
+   // vertical line
+   if (minx == maxx) {
+      int ty;
+      for (ty=miny; ty<=maxy; ++ty) {
+         plot(data,x,ty,px,py,plate_index);
+      }
+      return;
+   }
+
+   // quad
+   for (y=miny; y<=maxy; ++y) {
+
+      // get x points
+      int tx[2] = {minx,maxx};
+      int txi=0; // tx index
+      int j=3;
+      for (i=0; i<4; ++i) {
+         int ix = p[i][0], iy = p[i][1];
+         int jx = p[j][0], jy = p[j][1];
+         if ((iy < y && y <= jy) || (jy < y && y <= iy)) {
+            double dy = jy-iy;
+            double dx = jx-ix;
+            tx[txi] = (int)(ix + (y-iy)/dy*dx);
+            if (++txi == 2) break;
+         }
+         j=i;
+      }
+
+      // order x points
+      if (tx[0] > tx[1]) {
+         int temp = tx[0];
+         tx[0] = tx[1];
+         tx[1] = temp;
+      }
+
+      // sanity check on distance
+      if (tx[1] - tx[0] > maxdiff)
+      {
+         Con_Printf("%d > maxdiff\n", tx[1]-tx[0]);
+         return;
+      }
+
+      // draw horizontal line between x points
+      for (x=tx[0]; x<=tx[1]; ++x) {
+         plot(data,x,y,px,py,plate_index);
+      }
+   }
+}
+
+void resolve_lensmap_8bit(const struct _lens *lens, const struct _globe *globe,
+      byte *dest, int rowbytes)
+{
+   int x,y;
+
+   const uint32_t *lmap = lens->pixels;
+   for(y=0; y<lens->height_px; y++){
+      byte *row = dest + y*rowbytes;
+      for(x=0; x<lens->width_px; x++,lmap++){
+         row[x] = globe->pixels[*lmap];
+      }
+   }
+}
+
+void resolve_lensmap_8bit_tinted(const struct _lens *lens, const struct _globe *globe,
+      byte *dest, int rowbytes)
+{
+   int x,y;
+
+   const uint32_t *lmap = lens->pixels;
+   const byte *pmap = lens->pixel_tints;
+   for(y=0; y<lens->height_px; y++){
+      byte *row = dest + y*rowbytes;
+      for(x=0; x<lens->width_px; x++,lmap++,pmap++){
+         const byte* pixAddr = globe->pixels + *lmap;
+         int i = *pmap;
+         row[x] = i != 255 ? globe->plates[i].palette[*pixAddr] : *pixAddr;
+      }
+   }
+}
+
+void lensmap_plate_minification(const struct _lens *lens, int platesize,
+      int numplates, float *minification)
+{
+   double log_sum[MAX_PLATES] = {0};
+   int count[MAX_PLATES] = {0};
+   uint32_t platearea = platesize*platesize;
+   int x,y,i;
+
+   for (y=0; y+1<lens->height_px; y++) {
+      const uint32_t *lmap = LENSPIXEL(lens,0,y);
+      for (x=0; x+1<lens->width_px; x++) {
+         // pixels outside the lens are left at 0
+         uint32_t here = lmap[x];
+         uint32_t right = lmap[x+1];
+         uint32_t below = lmap[x+lens->width_px];
+         if (!here || !right || !below) {
+            continue;
+         }
+
+         // like a mip selection, the longer of the two steps counts
+         uint32_t plate = here / platearea;
+         if (plate >= (uint32_t)numplates || right / platearea != plate || below / platearea != plate) {
+            continue;
+         }
+         int px = here % platesize, py = (here % platearea) / platesize;
+         int rx = right % platesize - px, ry = (right % platearea) / platesize - py;
+         int bx = below % platesize - px, by = (below % platearea) / platesize - py;
+         int step = rx*rx + ry*ry > bx*bx + by*by ? rx*rx + ry*ry : bx*bx + by*by;
+         if (step > 1) {
+            log_sum[plate] += 0.5 * log2(step);
+         }
+         count[plate]++;
+      }
+   }
+
+   for (i=0; i<numplates; ++i) {
+      minification[i] = count[i] ? exp2(log_sum[i] / count[i]) : 1;
+   }
+}
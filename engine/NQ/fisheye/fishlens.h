@@ -82,4 +82,33 @@ vec3_u plate_uv_to_ray(const struct _globe *globe,
 point2d uv_to_screen(const struct state_paq state,
       int plate_index, const vec2_u uv);
 
+// maps a lens coordinate (as returned by lens_forward) to a screen pixel
+point2d lens_uv_to_screen(const struct _lens *lens, const vec2_u uv);
+
+// plate facing the ray, ignoring any globe_plate script
+int ray_to_plate_index_(const struct _globe *globe, const vec3_t ray);
+
+// projects a ray onto a plate, false if it lands outside of it
+qboolean ray_to_plate_uv_(const struct _globe *globe, int plate_index,
+      const vec3_t ray, double *u, double *v);
+
+// receives every lens pixel covered by a quad
+typedef void (*quad_plot_t)(void *data, int lx, int ly, int px, int py, int plate_index);
+
+// fills the quad between four lens points with the given plate pixel
+void draw_quad_(int *tl, int *tr, int *bl, int *br,
+      int plate_index, int px, int py, quad_plot_t plot, void *data);
+
+// resolves a lensmap through the globe into an 8-bit buffer
+// (the tinted version uses the plate palettes of the pixel tints)
+void resolve_lensmap_8bit(const struct _lens *lens, const struct _globe *globe,
+      byte *dest, int rowbytes);
+void resolve_lensmap_8bit_tinted(const struct _lens *lens, const struct _globe *globe,
+      byte *dest, int rowbytes);
+
+// how far apart, in plate pixels, neighboring lens pixels land on each plate
+// (geometric mean per plate, never below 1; 1 for plates the lens doesn't use)
+void lensmap_plate_minification(const struct _lens *lens, int platesize,
+      int numplates, float *minification);
+
 #endif
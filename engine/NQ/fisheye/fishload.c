@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+
+#include "common.h"
+#include "console.h"
+
+#include "fishScript.h"
+#include "fishload.h"
+
+// a script being compiled by a worker
+struct _script_job {
+   script_kind kind;
+   char name[50];
+   char filename[0x100];
+   script_ready_t ready;
+   qboolean dropped;     // replaced by a later request, don't hand it over
+
+   // filled in by the worker
+   void *chunk;          // NULL if it did not compile
+   size_t size;
+   char error[256];
+   SDL_atomic_t done;
+   SDL_Thread *thread;
+
+   struct _script_job *next;
+};
+
+// requests, oldest first
+static struct _script_job *jobs = NULL;
+
+static int compile_worker(void *data);
+static void finish_job(struct _script_job *job);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           REQUESTS                                           |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_RequestScript(script_kind kind, const char *name, script_ready_t ready)
+{
+   struct _script_job *job = calloc(1, sizeof(*job));
+   if (NULL == job) {
+      return false;
+   }
+   job->kind = kind;
+   job->ready = ready;
+   snprintf(job->name, sizeof(job->name), "%s", name);
+   snprintf(job->filename, sizeof(job->filename), "%s/lua-scripts/%s/%s.lua",
+      com_basedir, kind == SCRIPT_LENS ? "lenses" : "globes", name);
+   SDL_AtomicSet(&job->done, 0);
+
+   job->thread = SDL_CreateThread(compile_worker, "fishload", job);
+   if (NULL == job->thread) {
+      free(job);
+      return false;
+   }
+
+   // only the latest lens (or globe) is worth running
+   struct _script_job **link = &jobs;
+   for (; *link; link = &(*link)->next) {
+      if ((*link)->kind == kind) {
+         (*link)->dropped = true;
+      }
+   }
+   *link = job;
+   return true;
+}
+
+void F_PollScripts(qboolean wait)
+{
+   // keep the order, a lens may be requested for the globe before it
+   while (jobs && (wait || SDL_AtomicGet(&jobs->done))) {
+      struct _script_job *job = jobs;
+      jobs = job->next;
+      finish_job(job);
+   }
+}
+
+qboolean F_ScriptsPending(void)
+{
+   return NULL != jobs;
+}
+
+void F_DropScripts(void)
+{
+   while (jobs) {
+      struct _script_job *job = jobs;
+      jobs = job->next;
+      job->dropped = true;
+      finish_job(job);
+   }
+}
+
+// hand the chunk over (unless it was replaced) and free the job
+static void finish_job(struct _script_job *job)
+{
+   SDL_WaitThread(job->thread, NULL);
+   if (!job->dropped) {
+      if (job->chunk) {
+         job->ready(job->name, job->chunk, job->size);
+      }
+      else {
+         Con_Printf("could not load %s\nERROR: %s\n", job->name, job->error);
+      }
+   }
+   free(job->chunk);
+   free(job);
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           WORKER                                             |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static int compile_worker(void *data)
+{
+   struct _script_job *job = data;
+   job->chunk = F_compile_script(job->filename, &job->size, job->error, sizeof(job->error));
+   SDL_AtomicSet(&job->done, 1);
+   return 0;
+}
+
+// vim: et:ts=3:sts=3:sw=3
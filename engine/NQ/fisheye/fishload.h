@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include "fisheye.h"
+
+#ifndef FISHLOAD_H_
+#define FISHLOAD_H_
+
+// Lens and globe scripts are read and compiled on a worker thread, so changing
+// lenses doesn't stall the game on the disk or the Lua compiler.  The compiled
+// chunk is still run on the main thread (the Lua state is not thread safe),
+// once, when it is handed to the request's callback.  Until then the current
+// lens and globe stay in use.
+
+typedef enum { SCRIPT_LENS, SCRIPT_GLOBE } script_kind;
+
+// gets a compiled chunk on the main thread
+typedef void (*script_ready_t)(const char *name, const void *chunk, size_t size);
+
+// compiles lua-scripts/lenses/<name>.lua (or globes/) in the background
+// (replaces any request of the same kind that has not been handed over yet)
+qboolean F_RequestScript(script_kind kind, const char *name, script_ready_t ready);
+
+// hands finished chunks to their callbacks in the order they were requested,
+// waiting for the unfinished ones if asked to; call from the main thread
+void F_PollScripts(qboolean wait);
+
+// true while some request has not been handed over
+qboolean F_ScriptsPending(void);
+
+// waits for every worker and drops what they compiled
+void F_DropScripts(void);
+
+#endif
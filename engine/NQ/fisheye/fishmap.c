@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "fishmap.h"
+
+// header offsets, see fishmap.h
+#define HEADER_PLATES_USED 40
+#define HEADER_NAMES 44
+#define HEADER_SIZE (HEADER_NAMES + 2*LENSMAP_NAMELEN)
+
+// pixels converted per write or read
+#define PIXEL_CHUNK 4096
+
+static void pack_header(byte *header, const struct _lensmap_key *key, uint32_t plates_used);
+static uint32_t hash_file(const char *filename);
+static void put_u32(byte *p, uint32_t value);
+static uint32_t get_u32(const byte *p);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           KEYS                                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_LensmapKey(struct _lensmap_key *key, const char *basedir,
+      const struct _lens *lens, const struct _zoom *zoom, const struct _globe *globe)
+{
+   char filename[0x100];
+
+   memset(key, 0, sizeof(*key));
+   snprintf(key->lens, sizeof(key->lens), "%s", lens->name);
+   snprintf(key->globe, sizeof(key->globe), "%s", globe->name);
+   key->zoom_type = zoom->type;
+   key->fov = zoom->type == ZOOM_FOV || zoom->type == ZOOM_VFOV ? zoom->fov : 0;
+   key->width = lens->width_px;
+   key->height = lens->height_px;
+   key->platesize = globe->platesize;
+   key->numplates = globe->numplates;
+
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/lenses/%s.lua", basedir, lens->name);
+   key->lens_hash = hash_file(filename);
+   snprintf(filename, sizeof(filename), "%s/lua-scripts/globes/%s.lua", basedir, globe->name);
+   key->globe_hash = hash_file(filename);
+}
+
+void F_LensmapFilename(const struct _lensmap_key *key, const char *dir,
+      char *filename, size_t size)
+{
+   static const char *zooms[] = { "none", "fov", "vfov", "cover", "contain" };
+   const char *zoom = key->zoom_type >= 0 && key->zoom_type <= ZOOM_CONTAIN
+      ? zooms[key->zoom_type] : "none";
+
+   if (key->fov) {
+      snprintf(filename, size, "%s/%s_%s_%s%d_%dx%d.lmp", dir, key->lens,
+            key->globe, zoom, key->fov, key->width, key->height);
+   }
+   else {
+      snprintf(filename, size, "%s/%s_%s_%s_%dx%d.lmp", dir, key->lens,
+            key->globe, zoom, key->width, key->height);
+   }
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           FILES                                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_WriteLensmap(const char *filename, const struct _lensmap_key *key,
+      const uint32_t *pixels, const qboolean *plate_used)
+{
+   byte header[HEADER_SIZE];
+   byte chunk[4*PIXEL_CHUNK];
+   uint32_t plates = 0;
+   int area = key->width * key->height;
+   int i, j;
+
+   for (i=0; i<key->numplates; ++i) {
+      plates |= plate_used[i] ? 1u << i : 0;
+   }
+   pack_header(header, key, plates);
+
+   FILE *f = fopen(filename, "wb");
+   if (NULL == f) {
+      return false;
+   }
+   qboolean ok = fwrite(header, sizeof(header), 1, f) == 1;
+   for (i=0; ok && i<area; i+=PIXEL_CHUNK) {
+      int n = area-i < PIXEL_CHUNK ? area-i : PIXEL_CHUNK;
+      for (j=0; j<n; ++j) {
+         put_u32(chunk + 4*j, pixels[i+j]);
+      }
+      ok = fwrite(chunk, 4, n, f) == (size_t)n;
+   }
+   ok = fclose(f) == 0 && ok;
+
+   if (!ok) {
+      remove(filename);
+   }
+   return ok;
+}
+
+qboolean F_ReadLensmap(const char *filename, const struct _lensmap_key *key,
+      uint32_t *pixels, qboolean *plate_used)
+{
+   byte header[HEADER_SIZE], expected[HEADER_SIZE];
+   byte chunk[4*PIXEL_CHUNK];
+   uint32_t limit = (uint32_t)key->numplates * key->platesize * key->platesize;
+   int area = key->width * key->height;
+   int i, j;
+
+   FILE *f = fopen(filename, "rb");
+   if (NULL == f) {
+      return false;
+   }
+
+   // everything but the plates used has to match
+   qboolean ok = fread(header, sizeof(header), 1, f) == 1;
+   pack_header(expected, key, 0);
+   ok = ok && !memcmp(header, expected, HEADER_PLATES_USED)
+      && !memcmp(header + HEADER_NAMES, expected + HEADER_NAMES, HEADER_SIZE - HEADER_NAMES);
+
+   for (i=0; ok && i<area; i+=PIXEL_CHUNK) {
+      int n = area-i < PIXEL_CHUNK ? area-i : PIXEL_CHUNK;
+      ok = fread(chunk, 4, n, f) == (size_t)n;
+      for (j=0; ok && j<n; ++j) {
+         pixels[i+j] = get_u32(chunk + 4*j);
+         ok = pixels[i+j] < limit;
+      }
+   }
+   fclose(f);
+
+   // don't leave a half read lensmap behind
+   if (!ok && i > 0) {
+      memset(pixels, 0, area*sizeof(*pixels));
+   }
+
+   if (ok) {
+      uint32_t plates = get_u32(header + HEADER_PLATES_USED);
+      for (i=0; i<key->numplates; ++i) {
+         plate_used[i] = (plates >> i) & 1;
+      }
+   }
+   return ok;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           HELPERS                                            |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void pack_header(byte *header, const struct _lensmap_key *key, uint32_t plates_used)
+{
+   const uint32_t words[] = {
+      LENSMAP_VERSION, key->width, key->height, key->platesize, key->numplates,
+      key->zoom_type, key->fov, key->lens_hash, key->globe_hash, plates_used
+   };
+   int i;
+
+   memset(header, 0, HEADER_SIZE);
+   memcpy(header, LENSMAP_MAGIC, 4);
+   for (i=0; i<10; ++i) {
+      put_u32(header + 4 + 4*i, words[i]);
+   }
+   memcpy(header + HEADER_NAMES, key->lens, strnlen(key->lens, LENSMAP_NAMELEN-1));
+   memcpy(header + HEADER_NAMES + LENSMAP_NAMELEN, key->globe, strnlen(key->globe, LENSMAP_NAMELEN-1));
+}
+
+// FNV-1a of a file's contents, 0 if it can't be read
+static uint32_t hash_file(const char *filename)
+{
+   uint32_t hash = 2166136261u;
+   int c;
+
+   FILE *f = fopen(filename, "rb");
+   if (NULL == f) {
+      return 0;
+   }
+   while ((c = getc(f)) != EOF) {
+      hash = (hash ^ (byte)c) * 16777619u;
+   }
+   fclose(f);
+   return hash;
+}
+
+static void put_u32(byte *p, uint32_t value)
+{
+   p[0] = value;
+   p[1] = value >> 8;
+   p[2] = value >> 16;
+   p[3] = value >> 24;
+}
+
+static uint32_t get_u32(const byte *p)
+{
+   return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// vim: et:ts=3:sts=3:sw=3
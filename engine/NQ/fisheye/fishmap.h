@@ -0,0 +1,51 @@
+#include <stdint.h>
+#include "fisheye.h"
+
+#ifndef FISHMAP_H_
+#define FISHMAP_H_
+
+// Precomputed lensmaps, written by the fish_lensmapgen tool and picked up by
+// the engine instead of building the lens when one matches the view exactly.
+//
+// File layout (all integers are little endian uint32):
+//    "FLMP", version
+//    width, height, platesize, numplates, zoom type, zoom fov,
+//    lens script hash, globe script hash, plates used (bit per plate)
+//    lens name (64 bytes, zero padded), globe name (64 bytes, zero padded)
+//    width*height lensmap pixels (globe pixel indexes), row by row
+//
+// Bump the version whenever the layout or the lens builders' output changes.
+#define LENSMAP_MAGIC "FLMP"
+#define LENSMAP_VERSION 1
+#define LENSMAP_NAMELEN 64
+
+// everything a lensmap depends on
+struct _lensmap_key {
+   char lens[LENSMAP_NAMELEN];
+   char globe[LENSMAP_NAMELEN];
+   int zoom_type, fov;
+   int width, height, platesize, numplates;
+
+   // FNV-1a of the script sources, so edited scripts don't use stale maps
+   uint32_t lens_hash, globe_hash;
+};
+
+// fills in the key for a lens and zoom on a globe
+// (scripts are read from lua-scripts under the given base directory)
+void F_LensmapKey(struct _lensmap_key *key, const char *basedir,
+      const struct _lens *lens, const struct _zoom *zoom, const struct _globe *globe);
+
+// the file a lensmap is kept in, under dir
+void F_LensmapFilename(const struct _lensmap_key *key, const char *dir,
+      char *filename, size_t size);
+
+// writes width*height pixels and the plates they use (false on any error)
+qboolean F_WriteLensmap(const char *filename, const struct _lensmap_key *key,
+      const uint32_t *pixels, const qboolean *plate_used);
+
+// reads a lensmap, false if there is none or it was made for something else
+// (pixels are zeroed again if a bad file got partly read into them)
+qboolean F_ReadLensmap(const char *filename, const struct _lensmap_key *key,
+      uint32_t *pixels, qboolean *plate_used);
+
+#endif
@@ -0,0 +1,450 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#include "qtypes.h"
+#include "mathlib.h"
+#include "common.h"
+#include "console.h"
+#include "sys.h"
+
+#include "fisheye.h"
+#include "fishlens.h"
+#include "fishbuild.h"
+#include "fishmap.h"
+#include "fishzoom.h"
+#include "fishScript.h"
+
+// fish_lensmapgen: builds lensmaps ahead of time, outside of the engine
+//
+//    fish_lensmapgen [-b basedir] [-o dir] [-j jobs] [-f listfile] [lens,globe,zoom,WxH ...]
+//
+// zoom is fov<degrees>, vfov<degrees>, cover or contain (as f_fov, f_vfov, f_cover
+// and f_contain), WxH the size of the fisheye view (the screen less the status
+// bar).  A list file has one lens,globe,zoom,WxH per line, # starts a comment.
+// Lensmaps go to <basedir>/lensmaps unless -o says otherwise, which is where
+// the engine looks for them.  Jobs (default: one per core) are processes, each
+// with its own Lua state.
+
+#define MAX_LENSMAPS 1024
+#define MAX_PRINTMSG 4096
+
+// as long as the names the engine keeps, so the keys come out the same
+#define LENS_NAMELEN sizeof(((struct _lens *)NULL)->name)
+#define GLOBE_NAMELEN sizeof(((struct _globe *)NULL)->name)
+
+struct _lensmap_job {
+   char lens[LENS_NAMELEN];
+   char globe[GLOBE_NAMELEN];
+   int zoom_type, fov;
+   int width, height;
+};
+
+// where a lens pixel found by the builder goes
+struct _lensmap_target {
+   struct _lens *lens;
+   const struct _globe *globe;
+   qboolean plate_used[MAX_PLATES];
+};
+
+static struct _lensmap_job jobs[MAX_LENSMAPS];
+static int numjobs = 0;
+
+static qboolean parse_job(const char *text);
+static qboolean read_list(const char *filename);
+static int run_jobs(int first, int step, const char *outdir);
+static qboolean generate(const struct _lensmap_job *job, const char *outdir);
+static void plot_pixel(void *data, int lx, int ly, int px, int py, int plate_index);
+static int script_globe_plate(vec3_t ray);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           ENGINE STAND-INS                                   |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+char com_basedir[MAX_OSPATH] = ".";
+static fisheye_status last_status;
+static struct _globe globe;
+
+void fe_throw(fisheye_status status)
+{
+   last_status = status;
+}
+
+void fe_clear(void)
+{
+   last_status = FE_SUCCESS;
+}
+
+fisheye_status F_getLastStatus(void)
+{
+   return last_status;
+}
+
+struct _globe* F_getGlobe(void)
+{
+   return &globe;
+}
+
+void Con_Printf(const char *fmt, ...)
+{
+   va_list argptr;
+   char msg[MAX_PRINTMSG];
+
+   va_start(argptr, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, argptr);
+   va_end(argptr);
+
+   fprintf(stderr, "%s", msg);
+}
+
+void Sys_Error(const char *error, ...)
+{
+   va_list argptr;
+   char string[MAX_PRINTMSG];
+
+   va_start(argptr, error);
+   vsnprintf(string, sizeof(string), error, argptr);
+   va_end(argptr);
+   fprintf(stderr, "Error: %s\n", string);
+
+   exit(1);
+}
+
+int qsnprintf(char *str, size_t size, const char *format, ...)
+{
+   va_list argptr;
+   int ret;
+
+   va_start(argptr, format);
+   ret = vsnprintf(str, size, format, argptr);
+   va_end(argptr);
+
+   return ret;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           MAIN                                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+   char outdir[MAX_OSPATH] = "";
+   int numworkers = 1;
+   int failed = 0;
+   int i;
+
+#ifndef _WIN32
+   long cores = sysconf(_SC_NPROCESSORS_ONLN);
+   numworkers = cores > 0 ? (int)cores : 1;
+#endif
+
+   for (i=1; i<argc; ++i) {
+      if (!strcmp(argv[i], "-b") && i+1 < argc) {
+         snprintf(com_basedir, sizeof(com_basedir), "%s", argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-o") && i+1 < argc) {
+         snprintf(outdir, sizeof(outdir), "%s", argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-j") && i+1 < argc) {
+         numworkers = atoi(argv[++i]);
+      }
+      else if (!strcmp(argv[i], "-f") && i+1 < argc) {
+         if (!read_list(argv[++i])) {
+            return 1;
+         }
+      }
+      else if (argv[i][0] == '-' || !parse_job(argv[i])) {
+         fprintf(stderr, "usage: %s [-b basedir] [-o dir] [-j jobs] [-f listfile] "
+               "[lens,globe,fov<deg>|vfov<deg>|cover|contain,WxH ...]\n", argv[0]);
+         return 1;
+      }
+   }
+   if (numjobs == 0) {
+      fprintf(stderr, "no lensmaps to build\n");
+      return 1;
+   }
+   if (!outdir[0] &&
+         snprintf(outdir, sizeof(outdir), "%s/lensmaps", com_basedir) >= (int)sizeof(outdir)) {
+      fprintf(stderr, "%s/lensmaps is too long a path\n", com_basedir);
+      return 1;
+   }
+   if (numworkers < 1) numworkers = 1;
+   if (numworkers > numjobs) numworkers = numjobs;
+
+#ifdef _WIN32
+   numworkers = 1;
+#else
+   if (mkdir(outdir, 0777) && errno != EEXIST) {
+      fprintf(stderr, "could not create %s\n", outdir);
+      return 1;
+   }
+#endif
+
+   F_scriptInit();
+
+#ifndef _WIN32
+   // each worker takes every numworkers'th lensmap
+   if (numworkers > 1) {
+      pid_t *pids = calloc(numworkers, sizeof(*pids));
+      for (i=0; pids && i<numworkers; ++i) {
+         pids[i] = fork();
+         if (pids[i] == 0) {
+            exit(run_jobs(i, numworkers, outdir) ? 1 : 0);
+         }
+         if (pids[i] < 0) {
+            failed += run_jobs(i, numworkers, outdir);
+         }
+      }
+      for (i=0; pids && i<numworkers; ++i) {
+         int status;
+         if (pids[i] > 0 && (waitpid(pids[i], &status, 0) < 0
+                  || !WIFEXITED(status) || WEXITSTATUS(status))) {
+            failed++;
+         }
+      }
+      if (NULL == pids) {
+         failed += run_jobs(0, 1, outdir);
+      }
+      free(pids);
+   }
+   else
+#endif
+   {
+      failed = run_jobs(0, 1, outdir);
+   }
+
+   F_scriptShutdown();
+   free_lensmap_rows();
+   return failed ? 1 : 0;
+}
+
+// "lens,globe,zoom,WxH"
+static qboolean parse_job(const char *text)
+{
+   char lens[LENSMAP_NAMELEN], globe[LENSMAP_NAMELEN], zoom[32];
+   struct _lensmap_job job;
+
+   if (numjobs == MAX_LENSMAPS) {
+      fprintf(stderr, "no more than %d lensmaps at once\n", MAX_LENSMAPS);
+      return false;
+   }
+
+   memset(&job, 0, sizeof(job));
+   if (sscanf(text, "%63[^,],%63[^,],%31[^,],%dx%d", lens, globe, zoom,
+            &job.width, &job.height) != 5 || job.width <= 0 || job.height <= 0) {
+      fprintf(stderr, "\"%s\" is not lens,globe,zoom,WxH\n", text);
+      return false;
+   }
+
+   // the engine can't load anything with a longer name
+   if (strlen(lens) >= sizeof(job.lens)) {
+      fprintf(stderr, "%s: lens names are at most %d characters\n",
+            lens, (int)sizeof(job.lens) - 1);
+      return false;
+   }
+   if (strlen(globe) >= sizeof(job.globe)) {
+      fprintf(stderr, "%s: globe names are at most %d characters\n",
+            globe, (int)sizeof(job.globe) - 1);
+      return false;
+   }
+   memcpy(job.lens, lens, strlen(lens) + 1);
+   memcpy(job.globe, globe, strlen(globe) + 1);
+
+   if (sscanf(zoom, "fov%d", &job.fov) == 1) {
+      job.zoom_type = ZOOM_FOV;
+   }
+   else if (sscanf(zoom, "vfov%d", &job.fov) == 1) {
+      job.zoom_type = ZOOM_VFOV;
+   }
+   else if (!strcmp(zoom, "cover")) {
+      job.zoom_type = ZOOM_COVER;
+   }
+   else if (!strcmp(zoom, "contain")) {
+      job.zoom_type = ZOOM_CONTAIN;
+   }
+   else {
+      fprintf(stderr, "\"%s\" is not fov<deg>, vfov<deg>, cover or contain\n", zoom);
+      return false;
+   }
+
+   jobs[numjobs++] = job;
+   return true;
+}
+
+static qboolean read_list(const char *filename)
+{
+   char line[256];
+   FILE *f = fopen(filename, "r");
+   if (NULL == f) {
+      fprintf(stderr, "could not open %s\n", filename);
+      return false;
+   }
+   while (fgets(line, sizeof(line), f)) {
+      char *end = line + strcspn(line, "#\r\n");
+      *end = 0;
+      while (end > line && (end[-1] == ' ' || end[-1] == '\t')) {
+         *--end = 0;
+      }
+      char *start = line + strspn(line, " \t");
+      if (*start && !parse_job(start)) {
+         fclose(f);
+         return false;
+      }
+   }
+   fclose(f);
+   return true;
+}
+
+// builds every step'th lensmap from first, returns how many failed
+static int run_jobs(int first, int step, const char *outdir)
+{
+   int failed = 0;
+   int i;
+   for (i=first; i<numjobs; i+=step) {
+      if (!generate(&jobs[i], outdir)) {
+         failed++;
+      }
+   }
+   return failed;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           LENSMAPS                                           |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean generate(const struct _lensmap_job *job, const char *outdir)
+{
+   struct _lens lens;
+   struct _zoom zoom;
+   struct _lens_builder builder;
+   struct _lensmap_target target;
+   struct _lensmap_key key;
+   char filename[MAX_OSPATH];
+   qboolean ok = false;
+
+   memset(&globe, 0, sizeof(globe));
+   memset(&lens, 0, sizeof(lens));
+   memset(&zoom, 0, sizeof(zoom));
+   memset(&builder, 0, sizeof(builder));
+   memset(&target, 0, sizeof(target));
+
+   // the same sizes the engine uses for a view this big
+   snprintf(globe.name, sizeof(globe.name), "%s", job->globe);
+   snprintf(lens.name, sizeof(lens.name), "%s", job->lens);
+   lens.width_px = job->width;
+   lens.height_px = job->height;
+   globe.platesize = job->width < job->height ? job->width : job->height;
+
+   if (!F_load_globe(job->globe, &globe)) {
+      fprintf(stderr, "%s: not a valid globe\n", job->globe);
+      return false;
+   }
+   if (!F_load_lens(job->lens, &lens, &zoom, globe.numplates)) {
+      fprintf(stderr, "%s: not a valid lens\n", job->lens);
+      F_release_lens(&lens);
+      return false;
+   }
+   F_bind_lens(&lens);
+
+   zoom.type = job->zoom_type;
+   zoom.fov = job->fov;
+   if (!calc_zoom(&lens, &zoom)) {
+      fprintf(stderr, "%s: could not be initialized at this zoom\n", job->lens);
+      F_release_lens(&lens);
+      return false;
+   }
+
+   lens.pixels = calloc(job->width * job->height, sizeof(*lens.pixels));
+   if (NULL == lens.pixels) {
+      fprintf(stderr, "could not allocate a %dx%d lensmap\n", job->width, job->height);
+      F_release_lens(&lens);
+      return false;
+   }
+
+   // build it in one go
+   target.lens = &lens;
+   target.globe = &globe;
+   builder.seconds_per_frame = 1e30f;
+   struct _lensmap_build build = {
+      .builder = &builder,
+      .state = {
+         .forward = scriptToC_lens_forward,
+         .inverse = scriptToC_lens_inverse,
+         .globe = &globe,
+         .lens = &lens
+      },
+      .globe_plate = F_getScriptRef()->globe_plate != -1 ? script_globe_plate : NULL,
+      .plot = plot_pixel,
+      .data = &target
+   };
+   if (lens.map_type == MAP_NONE) {
+      fprintf(stderr, "%s: no inverse or forward map\n", job->lens);
+   }
+   else {
+      start_lensmap_build(&build);
+      while (builder.working) {
+         resume_lensmap_build(&build);
+      }
+
+      F_LensmapKey(&key, com_basedir, &lens, &zoom, &globe);
+      F_LensmapFilename(&key, outdir, filename, sizeof(filename));
+      ok = F_WriteLensmap(filename, &key, lens.pixels, target.plate_used);
+      if (ok) {
+         printf("%s\n", filename);
+      }
+      else {
+         fprintf(stderr, "could not write %s\n", filename);
+      }
+   }
+
+   free(lens.pixels);
+   F_release_lens(&lens);
+   return ok;
+}
+
+// set_lensmap_from_plate in fisheye.c, without the rubix tints
+static void plot_pixel(void *data, int lx, int ly, int px, int py, int plate_index)
+{
+   struct _lensmap_target *target = data;
+   const struct _lens *lens = target->lens;
+   int platesize = target->globe->platesize;
+
+   if (lx < 0 || lx >= lens->width_px || ly < 0 || ly >= lens->height_px) {
+      return;
+   }
+   if (px < 0 || px >= platesize || py < 0 || py >= platesize) {
+      return;
+   }
+
+   target->plate_used[plate_index] = true;
+   *LENSPIXEL(lens,lx,ly) = (plate_index*platesize + py)*platesize + px;
+}
+
+// the globe script's plate for a ray, as ray_to_plate_index in fisheye.c
+static int script_globe_plate(vec3_t ray)
+{
+   vec3_u ray_;
+   VectorCopy(ray, ray_.vec);
+
+   int plate_index = scriptToC_globe_plate(ray_);
+   if (last_status == FE_SUCCESS) {
+      return plate_index;
+   }
+   fe_throw(NONSENSE_VALUE);
+   return NONSENSE_VALUE;
+}
+
+// vim: et:ts=3:sts=3:sw=3
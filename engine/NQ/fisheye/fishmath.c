@@ -0,0 +1,278 @@
+#include <math.h>
+#include <stdint.h>
+#include "qtypes.h"
+#include "mathlib.h"
+#include "fishmath.h"
+
+// the batch functions work through their arrays in chunks this long,
+// keeping intermediates on the stack
+#define FMATH_CHUNK 64
+
+// pi in three parts for range reduction (Cody & Waite), each with few enough
+// significant bits that k*part is exact for the |x| <= 64pi we promise
+#define PI_A 3.140625f
+#define PI_B 9.67502593994140625e-4f
+#define PI_C 1.509957990978376432e-7f
+
+#define TAN_PI_8 0.414213562373095f
+
+static inline float rsqrt_approx(float x);
+static inline float select(int cond, float a, float b);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           ELEMENTARY FUNCTIONS                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void sincos_batch(const float *x, float *s, float *c, int n)
+{
+   int i;
+   for (i=0; i<n; ++i) {
+      float xi = x[i];
+
+      // reduce to r in [-pi/2,pi/2], x = r + k*pi
+      int k = (int)(xi * (float)M_1_PI + (xi < 0 ? -0.5f : 0.5f));
+      float r = ((xi - k*PI_A) - k*PI_B) - k*PI_C;
+      float r2 = r*r;
+
+      // taylor series, truncated past the float precision at pi/2
+      float sr = r + r*r2*(-1.f/6 + r2*(1.f/120 + r2*(-1.f/5040
+               + r2*(1.f/362880 + r2*(-1.f/39916800)))));
+      float cr = 1 + r2*(-1.f/2 + r2*(1.f/24 + r2*(-1.f/720
+               + r2*(1.f/40320 + r2*(-1.f/3628800 + r2*(1.f/479001600))))));
+
+      // odd k flips both
+      float sign = 1.0f - 2.0f*(k & 1);
+      s[i] = sign*sr;
+      c[i] = sign*cr;
+   }
+}
+
+void atan2_batch(const float *y, const float *x, float *out, int n)
+{
+   int i;
+   for (i=0; i<n; ++i) {
+      float xi = x[i], yi = y[i];
+      float ax = fabsf(xi), ay = fabsf(yi);
+
+      // atan of a in [0,1], reduced to |t| <= tan(pi/8) (cephes atanf)
+      float mx = select(ax > ay, ax, ay);
+      float mn = select(ax > ay, ay, ax);
+      float a = mn / select(mx > 0, mx, 1.0f);
+      float q = (a - 1.0f)/(a + 1.0f);
+      int big = a > TAN_PI_8;
+      float t = select(big, q, a);
+      float t2 = t*t;
+      float r = select(big, (float)M_PI_4, 0.0f) + t + t*t2*(-3.33329491539e-1f
+            + t2*(1.99777106478e-1f + t2*(-1.38776856032e-1f + t2*8.05374449538e-2f)));
+
+      // back to the right octant
+      r = select(ay > ax, (float)M_PI_2 - r, r);
+      r = select(xi < 0, (float)M_PI - r, r);
+      out[i] = select(yi < 0, -r, r);
+   }
+}
+
+void asin_batch(const float *x, float *out, int n)
+{
+   int i;
+   for (i=0; i<n; ++i) {
+      float xi = x[i];
+      float a = fabsf(xi);
+
+      // near 1, asin(a) = pi/2 - 2*asin(sqrt((1-a)/2)) (cephes asinf)
+      int big = a > 0.5f;
+      float z = select(big, 0.5f*(1.0f - a), a*a);
+      float s = select(big, z*rsqrt_approx(z), a);
+      float p = s + s*z*(1.6666752422e-1f + z*(7.4953002686e-2f
+            + z*(4.5470025998e-2f + z*(2.4181311049e-2f + z*4.2163199048e-2f))));
+
+      float r = select(big, (float)M_PI_2 - 2*p, p);
+      out[i] = select(xi < 0, -r, r);
+   }
+}
+
+void sqrt_batch(const float *x, float *out, int n)
+{
+   int i;
+   for (i=0; i<n; ++i) {
+      out[i] = x[i]*rsqrt_approx(x[i]);
+   }
+}
+
+// 1/sqrt(x) from the exponent trick and three newton steps
+// (x*rsqrt_approx(x) is 0 for x == 0)
+static inline float rsqrt_approx(float x)
+{
+   union { float f; uint32_t i; } bits = { .f = x };
+   bits.i = 0x5f375a86 - (bits.i >> 1);
+   float y = bits.f;
+   float hx = 0.5f*x;
+   y = y*(1.5f - hx*y*y);
+   y = y*(1.5f - hx*y*y);
+   y = y*(1.5f - hx*y*y);
+   return y;
+}
+
+// picks a or b by masking their bits
+// (a ?: on computed values gets turned back into a branch around the
+// computation, which stops the vectorizer)
+static inline float select(int cond, float a, float b)
+{
+   union { float f; uint32_t i; } ua = { .f = a }, ub = { .f = b }, out;
+   uint32_t mask = -(uint32_t)(cond != 0);
+   out.i = (ua.i & mask) | (ub.i & ~mask);
+   return out.f;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           RAY CONVERSIONS                                    |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void latlon_to_ray_batch(const float *lat, const float *lon,
+      float *x, float *y, float *z, int n)
+{
+   float slat[FMATH_CHUNK], clat[FMATH_CHUNK];
+   float slon[FMATH_CHUNK], clon[FMATH_CHUNK];
+   int i, j;
+
+   for (i=0; i<n; i+=FMATH_CHUNK) {
+      int m = n-i < FMATH_CHUNK ? n-i : FMATH_CHUNK;
+      sincos_batch(lat+i, slat, clat, m);
+      sincos_batch(lon+i, slon, clon, m);
+      for (j=0; j<m; ++j) {
+         x[i+j] = slon[j]*clat[j];
+         y[i+j] = slat[j];
+         z[i+j] = clon[j]*clat[j];
+      }
+   }
+}
+
+void ray_to_latlon_batch(const float *x, const float *y, const float *z,
+      float *lat, float *lon, int n)
+{
+   float lengthY[FMATH_CHUNK], outlat[FMATH_CHUNK], outlon[FMATH_CHUNK];
+   int i, j;
+
+   for (i=0; i<n; i+=FMATH_CHUNK) {
+      int m = n-i < FMATH_CHUNK ? n-i : FMATH_CHUNK;
+      for (j=0; j<m; ++j) {
+         float len2 = x[i+j]*x[i+j] + z[i+j]*z[i+j];
+         lengthY[j] = len2*rsqrt_approx(len2);
+      }
+      atan2_batch(x+i, z+i, outlon, m);
+      atan2_batch(y+i, lengthY, outlat, m);
+      for (j=0; j<m; ++j) {
+         lat[i+j] = outlat[j];
+         lon[i+j] = outlon[j];
+      }
+   }
+}
+
+void plate_uv_to_ray_batch(const struct _globe *globe, int plate_index,
+      const float *u, const float *v, float *x, float *y, float *z, int n)
+{
+   // copied out, so the compiler knows the outputs don't overwrite them
+   vec3_t f, r, up;
+   const float dist = globe->plates[plate_index].dist;
+   int i;
+
+   VectorScale(globe->plates[plate_index].forward, dist, f);
+   VectorCopy(globe->plates[plate_index].right, r);
+   VectorCopy(globe->plates[plate_index].up, up);
+
+   for (i=0; i<n; ++i) {
+      float iu = u[i] - 0.5f;
+      float iv = 0.5f - v[i];
+      float rx = f[0] + iu*r[0] + iv*up[0];
+      float ry = f[1] + iu*r[1] + iv*up[1];
+      float rz = f[2] + iu*r[2] + iv*up[2];
+      float len = rsqrt_approx(rx*rx + ry*ry + rz*rz);
+      x[i] = rx*len;
+      y[i] = ry*len;
+      z[i] = rz*len;
+   }
+}
+
+void ray_to_plate_index_batch(const struct _globe *globe,
+      const float *x, const float *y, const float *z, int *plate, int n)
+{
+   float best[FMATH_CHUNK];
+   int i, j, p;
+
+   for (i=0; i<n; i+=FMATH_CHUNK) {
+      int m = n-i < FMATH_CHUNK ? n-i : FMATH_CHUNK;
+      const float *cx = x+i, *cy = y+i, *cz = z+i;
+      int *cplate = plate+i;
+
+      for (j=0; j<m; ++j) {
+         best[j] = -2;
+         cplate[j] = 0;
+      }
+      for (p=0; p<globe->numplates; ++p) {
+         vec3_t f;
+         VectorCopy(globe->plates[p].forward, f);
+         for (j=0; j<m; ++j) {
+            float dp = f[0]*cx[j] + f[1]*cy[j] + f[2]*cz[j];
+            int better = dp > best[j];
+            cplate[j] = better ? p : cplate[j];
+            best[j] = select(better, dp, best[j]);
+         }
+      }
+   }
+}
+
+void ray_to_plate_uv_batch(const struct _globe *globe,
+      const float *x, const float *y, const float *z,
+      int *plate, float *u, float *v, int n)
+{
+   float best[FMATH_CHUNK], bx[FMATH_CHUNK], by[FMATH_CHUNK], bdist[FMATH_CHUNK];
+   int bplate[FMATH_CHUNK];
+   int i, j, p;
+
+   for (i=0; i<n; i+=FMATH_CHUNK) {
+      int m = n-i < FMATH_CHUNK ? n-i : FMATH_CHUNK;
+      const float *cx = x+i, *cy = y+i, *cz = z+i;
+
+      for (j=0; j<m; ++j) {
+         best[j] = -2;
+         bx[j] = by[j] = bdist[j] = 0;
+         bplate[j] = 0;
+      }
+
+      // the plate facing each ray, keeping the ray in that plate's frame
+      for (p=0; p<globe->numplates; ++p) {
+         vec3_t f, r, up;
+         const float dist = globe->plates[p].dist;
+         VectorCopy(globe->plates[p].forward, f);
+         VectorCopy(globe->plates[p].right, r);
+         VectorCopy(globe->plates[p].up, up);
+         for (j=0; j<m; ++j) {
+            float dp = f[0]*cx[j] + f[1]*cy[j] + f[2]*cz[j];
+            float rx = r[0]*cx[j] + r[1]*cy[j] + r[2]*cz[j];
+            float ry = up[0]*cx[j] + up[1]*cy[j] + up[2]*cz[j];
+            int better = dp > best[j];
+            bx[j] = select(better, rx, bx[j]);
+            by[j] = select(better, ry, by[j]);
+            bdist[j] = select(better, dist, bdist[j]);
+            bplate[j] = better ? p : bplate[j];
+            best[j] = select(better, dp, best[j]);
+         }
+      }
+
+      // project onto the plate
+      for (j=0; j<m; ++j) {
+         float pu = bx[j]/best[j]*bdist[j] + 0.5f;
+         float pv = -by[j]/best[j]*bdist[j] + 0.5f;
+         int valid = (pu>=0) & (pu<=1) & (pv>=0) & (pv<=1);
+         u[i+j] = pu;
+         v[i+j] = pv;
+         plate[i+j] = valid ? bplate[j] : -1;
+      }
+   }
+}
+
+// vim: et:ts=3:sts=3:sw=3
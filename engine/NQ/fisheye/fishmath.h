@@ -0,0 +1,54 @@
+#include "fisheye.h"
+
+#ifndef FISHMATH_H_
+#define FISHMATH_H_
+
+// Batch versions of the spherical helpers in fishlens, for building lenses
+// and saving globes a row at a time.  Arrays are structures of arrays
+// (separate x, y and z arrays) in single precision, and the loops have no
+// branches or libm calls so the compiler can vectorize them.  Outputs may
+// alias the inputs they are computed from (element by element).
+//
+// Maximum absolute errors against double precision libm (checked in the unit
+// tests over the ranges given):
+#define FMATH_SINCOS_ERROR 2.5e-7  // |x| <= 64pi
+#define FMATH_ATAN2_ERROR  4.0e-7  // all x, y
+#define FMATH_ASIN_ERROR   4.0e-7  // |x| <= 1
+#define FMATH_SQRT_ERROR   2.5e-7  // relative, 1e-30 <= x <= 1e30
+#define FMATH_RAY_ERROR    6.0e-7  // per component of a unit ray
+
+// sine and cosine
+void sincos_batch(const float *x, float *s, float *c, int n);
+
+// atan2(y,x) in [-pi,pi], 0 for (0,0)
+void atan2_batch(const float *y, const float *x, float *out, int n);
+
+// arcsine in [-pi/2,pi/2]
+void asin_batch(const float *x, float *out, int n);
+
+// square root of non-negative numbers
+void sqrt_batch(const float *x, float *out, int n);
+
+// latlon_to_ray for a batch of latitudes and longitudes
+void latlon_to_ray_batch(const float *lat, const float *lon,
+      float *x, float *y, float *z, int n);
+
+// ray_to_latlon for a batch of rays
+void ray_to_latlon_batch(const float *x, const float *y, const float *z,
+      float *lat, float *lon, int n);
+
+// plate_uv_to_ray for a batch of uvs on one plate
+void plate_uv_to_ray_batch(const struct _globe *globe, int plate_index,
+      const float *u, const float *v, float *x, float *y, float *z, int n);
+
+// ray_to_plate_index_ for a batch of rays
+void ray_to_plate_index_batch(const struct _globe *globe,
+      const float *x, const float *y, const float *z, int *plate, int n);
+
+// ray_to_plate_index_ and ray_to_plate_uv_ for a batch of rays
+// (plate is -1 where the ray misses the plate it faces)
+void ray_to_plate_uv_batch(const struct _globe *globe,
+      const float *x, const float *y, const float *z,
+      int *plate, float *u, float *v, int n);
+
+#endif
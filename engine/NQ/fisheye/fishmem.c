@@ -1,87 +1,198 @@
 #include "console.h"
 #include "zone.h"
-#include "mathlib.h"
+#include "common.h"
+#include "render.h"
+#include "sys.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
 
-#include <stdio.h>
 #include "fishmem.h"
 
-static int lastHighMark = 0;
-static int postVideoHighMark = 0;
-static size_t lastSize = 0;
+// The fisheye buffers live in an arena of their own instead of the high hunk,
+// so map changes and video restarts don't take them away.  The arena only ever
+// grows: anything that fits in the last one reuses it, and a bigger one replaces
+// it outright.
+
+// every buffer starts on a cache line
+#define ARENA_ALIGN 64
+
+// on linux the arena is mapped on huge page boundaries and offered to
+// transparent huge pages, since a globe is several megabytes walked a plate at
+// a time (2MB is the huge page on both x86-64 and arm64)
+#define HUGE_PAGE_SIZE ((size_t)2*1024*1024)
 
-const size_t MASK_LAST_BYTE_OF_ADDR = ~(0xFF);
-const size_t PADDING_TO_ADD = 0x100;
+static struct {
+   byte *base;
+   size_t capacity;
+   void *surfcache;  // handed to D_InitCaches, NULL under -surfcachesize
+   qboolean reported;
+} arena;
 
-static qboolean freeIfExtant(int mark, int lastHighMark, int lastSize);
-static size_t padToNext256bytes(size_t unpadded);
-static qboolean hasHighMemContracted(void);
-static qboolean hasResized(int width, int height);
+static byte *arena_alloc(size_t *size);
+static void arena_free(byte *base, size_t size);
+static size_t arena_footprint(void);
+static size_t align_up(size_t size, size_t alignment);
+static qboolean hasResized(int width, int height, int numplates, qboolean stereo,
+      qboolean pipelined);
 
 #define NIL -1
 
-qboolean hasResizedOrRestarted(int width, int height){
-   return hasResized(width, height) || hasHighMemContracted();
+qboolean hasResizedOrRestarted(int width, int height, int numplates,
+      qboolean stereo, qboolean pipelined){
+   // a video restart puts its own surface cache back
+   return hasResized(width, height, numplates, stereo, pipelined)
+      || (arena.surfcache && D_CacheBuffer() != arena.surfcache);
 }
 
 void createOrReallocBuffers(struct _globe* globe, struct _lens* lens,
-      int screenArea, int plateSideLength){
-   
-   qboolean needNewHunk = freeIfExtant(Hunk_HighMark(), lastHighMark,
-                                       (int)lastSize);
-   if(!needNewHunk){
-      return;
+      int screenArea, int plateSideLength, qboolean stereo,
+      struct _pipebuffers* pipe){
+
+   // surfaces point into the cache about to be carved up again
+   D_FlushCaches();
+
+   size_t globe_space = align_up(
+          plateSideLength * plateSideLength * MAX_PLATES * sizeof(*(globe->pixels)),
+          ARENA_ALIGN);
+
+   size_t lens_pixel_space = align_up(
+          screenArea * sizeof(*(lens->pixels)), ARENA_ALIGN);
+
+   size_t pixel_tints_space = align_up(
+          screenArea * sizeof(*(lens->pixel_tints)), ARENA_ALIGN);
+
+   // the plates share one surface cache, which has to hold what all of them
+   // see, so it replaces the video mode's (unless -surfcachesize fixed it)
+   // (sized for the globe's plates, so a globe with more carves it again)
+   int surfcache_size = D_SurfaceCacheForPlates(plateSideLength, globe->numplates);
+   size_t surfcache_space = COM_CheckParm("-surfcachesize")
+      ? 0 : align_up(surfcache_size, ARENA_ALIGN);
+
+   int eyes = stereo ? 2 : 1;
+   int globes = pipe ? 2*eyes : eyes;
+   size_t frame_space = pipe ? align_up(eyes*screenArea, ARENA_ALIGN) : 0;
+   size_t chonk_size = globes*globe_space + lens_pixel_space + pixel_tints_space
+                       + surfcache_space + frame_space;
+
+   if (chonk_size > arena.capacity) {
+      arena_free(arena.base, arena.capacity);
+      arena.capacity = chonk_size;
+      arena.base = arena_alloc(&arena.capacity);
+      if (NULL == arena.base) {
+         Sys_Error("%s: failed on allocation of %zu bytes", __func__, chonk_size);
+      }
    }
-   size_t globe_space = padToNext256bytes(
-          plateSideLength * plateSideLength * MAX_PLATES * sizeof(*(globe->pixels)) );
-     
-   size_t lens_pixel_space = padToNext256bytes(
-          screenArea * sizeof(*(lens->pixels)) );
-   
-   size_t pixel_tints_space = padToNext256bytes(
-          screenArea * sizeof(*(lens->pixel_tints)) );
-   
-   int chonk_size = (int)(globe_space + lens_pixel_space + pixel_tints_space);
-   
-   postVideoHighMark = Hunk_HighMark();
-   
-   void* basePtr = Hunk_HighAllocName(chonk_size, "fisheye");
-   void* lensPixelsPtr = basePtr + globe_space;
-   void* tintsPtr = lensPixelsPtr + lens_pixel_space;
-   
-   globe->pixels = (byte*)basePtr;
+   if (!arena.reported) {
+      Hunk_AddArena("fisheye", arena_footprint);
+      arena.reported = true;
+   }
+
+   byte* basePtr = arena.base;
+   byte* lensPixelsPtr = basePtr + globes*globe_space;
+   byte* tintsPtr = lensPixelsPtr + lens_pixel_space;
+   byte* surfcachePtr = tintsPtr + pixel_tints_space;
+   byte* framePtr = surfcachePtr + surfcache_space;
+
+   globe->pixels = basePtr;
+   globe->right_pixels = stereo ? basePtr + globe_space : NULL;
    lens->pixels = (uint32_t*)lensPixelsPtr;
-   lens->pixel_tints = (byte*)tintsPtr;
-	
-   lastHighMark = Hunk_HighMark();
-   lastSize = lastHighMark - postVideoHighMark;
+   lens->pixel_tints = tintsPtr;
+   if (pipe) {
+      pipe->pixels = basePtr + eyes*globe_space;
+      pipe->right_pixels = stereo ? pipe->pixels + globe_space : NULL;
+      pipe->frame = framePtr;
+   }
+
+   arena.surfcache = surfcache_space ? surfcachePtr : NULL;
+   if (arena.surfcache) {
+      D_InitCaches(arena.surfcache, surfcache_size);
+   }
 }
 
-static qboolean freeIfExtant(
-      int currentHighMark, int lastHighMark_, int lastSize_){
-   
-   qboolean needNewHunk = true;
-   if(lastHighMark_ != 0 && currentHighMark > lastHighMark_){
-      needNewHunk = false;
-   } else if (currentHighMark == lastHighMark_) {
-      Hunk_FreeToHighMark(lastHighMark_ - (int)lastSize_);
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           ARENA                                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+// rounds *size up to what was actually reserved
+static byte *arena_alloc(size_t *size){
+#ifdef _WIN32
+   *size = align_up(*size, ARENA_ALIGN);
+   return _aligned_malloc(*size, ARENA_ALIGN);
+#elif defined(__linux__)
+   *size = align_up(*size, HUGE_PAGE_SIZE);
+
+   // over-map by a huge page, then trim to a huge page boundary
+   size_t mapped = *size + HUGE_PAGE_SIZE;
+   byte *map = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (MAP_FAILED == map) {
+      return NULL;
+   }
+   byte *base = (byte*)align_up((uintptr_t)map, HUGE_PAGE_SIZE);
+   if (base > map) {
+      munmap(map, base - map);
    }
-   return needNewHunk;
+   if (map + mapped > base + *size) {
+      munmap(base + *size, map + mapped - (base + *size));
+   }
+#ifdef MADV_HUGEPAGE
+   // only a hint: without THP (or with it set to never) these are small pages
+   madvise(base, *size, MADV_HUGEPAGE);
+#endif
+   return base;
+#else
+   void *base = NULL;
+   *size = align_up(*size, ARENA_ALIGN);
+   return posix_memalign(&base, ARENA_ALIGN, *size) ? NULL : base;
+#endif
 }
 
-static qboolean hasResized(int width, int height){
-   static int prevWidth = NIL, prevHeight = NIL;
-   
-   qboolean hasResizedOrRestarted = prevWidth!=width || prevHeight!=height;
-   prevWidth = width;
-   prevHeight = height;
-   
-   return hasResizedOrRestarted;
+static void arena_free(byte *base, size_t size){
+   if (NULL == base) {
+      return;
+   }
+#ifdef _WIN32
+   _aligned_free(base);
+#elif defined(__linux__)
+   munmap(base, size);
+#else
+   free(base);
+#endif
 }
 
-static qboolean hasHighMemContracted(){
-   return lastHighMark > Hunk_HighMark();
+// for the hunk command
+static size_t arena_footprint(void){
+   return arena.capacity;
 }
 
-static size_t padToNext256bytes(size_t unpadded){
-   return (unpadded & MASK_LAST_BYTE_OF_ADDR) + PADDING_TO_ADD;
+// (sizes already aligned stay as they are)
+static size_t align_up(size_t size, size_t alignment){
+   return (size + alignment - 1) & ~(alignment - 1);
 }
+
+static qboolean hasResized(int width, int height, int numplates, qboolean stereo,
+      qboolean pipelined){
+   static int prevWidth = NIL, prevHeight = NIL, prevNumplates = NIL;
+   static qboolean prevStereo = false, prevPipelined = false;
+
+   qboolean hasResizedOrRestarted = prevWidth!=width || prevHeight!=height
+      || prevNumplates!=numplates
+      || prevStereo!=stereo || prevPipelined!=pipelined;
+   prevWidth = width;
+   prevHeight = height;
+   prevNumplates = numplates;
+   prevStereo = stereo;
+   prevPipelined = pipelined;
+
+   return hasResizedOrRestarted;
+}
+
+// vim: et:ts=3:sts=3:sw=3
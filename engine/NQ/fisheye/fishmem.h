@@ -3,9 +3,23 @@
 #ifndef FISHMEM_H_
 #define FISHMEM_H_
 
+// the second set of plates and the frame resolved from them when frames are
+// pipelined (see f_pipeline in fisheye.c)
+struct _pipebuffers {
+   byte *pixels;
+   byte *right_pixels;  // in stereo
+   byte *frame;         // the lens of each eye, laid out as on the screen
+};
+
+// points the globe and lens at the fisheye arena, growing it if they don't fit
+// (stereo also allocates the globe's right_pixels, and pipe, when given, gets
+// its buffers too)
 void createOrReallocBuffers(struct _globe* globe, struct _lens* lens,
-		int area, int platesize);
+		int area, int platesize, qboolean stereo, struct _pipebuffers* pipe);
 
-qboolean hasResizedOrRestarted(int width, int height);
+// true when the buffers have to be carved again
+// (the surface cache is sized for the globe's number of plates)
+qboolean hasResizedOrRestarted(int width, int height, int numplates,
+		qboolean stereo, qboolean pipelined);
 
 #endif
@@ -0,0 +1,103 @@
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+
+#include "console.h"
+
+#include "fishpipe.h"
+
+static struct {
+   SDL_Thread *thread;
+   SDL_sem *start;  // a job was handed over, or the worker should quit
+   SDL_sem *done;   // the job finished
+   pipe_job_t job;  // NULL tells the worker to quit
+   void *data;
+   qboolean busy;   // started and not finished yet (main thread only)
+   qboolean failed; // don't try to start the worker again
+} pipeline;
+
+static qboolean start_worker(void);
+static int pipe_worker(void *unused);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           JOBS                                               |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_PipeStart(pipe_job_t job, void *data)
+{
+   F_PipeFinish();
+   if (NULL == pipeline.thread && !start_worker()) {
+      return false;
+   }
+   pipeline.job = job;
+   pipeline.data = data;
+   pipeline.busy = true;
+   SDL_SemPost(pipeline.start);
+   return true;
+}
+
+void F_PipeFinish(void)
+{
+   if (pipeline.busy) {
+      SDL_SemWait(pipeline.done);
+      pipeline.busy = false;
+   }
+}
+
+void F_PipeShutdown(void)
+{
+   F_PipeFinish();
+   if (NULL == pipeline.thread) {
+      return;
+   }
+   pipeline.job = NULL;
+   SDL_SemPost(pipeline.start);
+   SDL_WaitThread(pipeline.thread, NULL);
+   SDL_DestroySemaphore(pipeline.done);
+   SDL_DestroySemaphore(pipeline.start);
+   pipeline.thread = NULL;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           WORKER                                             |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static qboolean start_worker(void)
+{
+   if (pipeline.failed) {
+      return false;
+   }
+   pipeline.start = SDL_CreateSemaphore(0);
+   pipeline.done = SDL_CreateSemaphore(0);
+   if (pipeline.start && pipeline.done) {
+      pipeline.thread = SDL_CreateThread(pipe_worker, "fishpipe", NULL);
+   }
+   if (NULL == pipeline.thread) {
+      Con_Printf("could not start the pipeline thread, frames are not pipelined\n");
+      if (pipeline.done) SDL_DestroySemaphore(pipeline.done);
+      if (pipeline.start) SDL_DestroySemaphore(pipeline.start);
+      pipeline.failed = true;
+      return false;
+   }
+   return true;
+}
+
+static int pipe_worker(void *unused)
+{
+   (void)unused;
+
+   while (1) {
+      SDL_SemWait(pipeline.start);
+      if (NULL == pipeline.job) {
+         break;
+      }
+      pipeline.job(pipeline.data);
+      SDL_SemPost(pipeline.done);
+   }
+   return 0;
+}
+
+// vim: et:ts=3:sts=3:sw=3
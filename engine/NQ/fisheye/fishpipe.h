@@ -0,0 +1,23 @@
+#include "fisheye.h"
+
+#ifndef FISHPIPE_H_
+#define FISHPIPE_H_
+
+// A worker thread that runs one job at a time alongside the main thread, used
+// to resolve the lens of one frame while the plates of the next are rendered
+// (see f_pipeline in fisheye.c).  The job must not touch anything the main
+// thread uses until F_PipeFinish returns.
+
+typedef void (*pipe_job_t)(void *data);
+
+// starts the job on the worker (false if there is no worker, in which case
+// the job has not run)
+qboolean F_PipeStart(pipe_job_t job, void *data);
+
+// waits for the job started last, if any
+void F_PipeFinish(void);
+
+// waits for the job and stops the worker
+void F_PipeShutdown(void);
+
+#endif
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "cvar.h"
+#include "draw.h"
+#include "r_local.h"
+#include "sys.h"
+
+#include "fishspeeds.h"
+
+// frames kept for the overlay average and the dumps
+#define FSPEEDS_HISTORY 256
+
+// frames averaged by the overlay
+#define FSPEEDS_OVERLAY_FRAMES 32
+
+struct _fspeeds_frame {
+   int number;
+   double total;  // F_RenderView
+   double stage[FSPEEDS_NUMSTAGES];
+   int lens_pixels;
+
+   int numplates;
+   struct {
+      qboolean rendered;
+      int pixels;
+      double total;
+      double phase[FSPEEDS_NUMPHASES];
+
+      // surface cache traffic and the mip scale it was rendered with
+      double mipscale;
+      int hits, misses, evictions;
+   } plates[MAX_PLATES];
+};
+
+// f_speeds 1 shows the fisheye stage times on screen (also turns on the
+// R_RenderView phase timestamps, like r_dspeeds but without the printout)
+static cvar_t f_speeds = { "f_speeds", "0" };
+
+qboolean fisheye_speeds = false;
+
+static struct _fspeeds_frame history[FSPEEDS_HISTORY];
+static int frames_recorded = 0; // frames ever recorded, history wraps around
+static struct _fspeeds_frame current;
+static double frame_start;
+
+static const char *phase_names[FSPEEDS_NUMPHASES] = {
+   "setup", "world", "bmodels", "scan", "entities", "viewmodel", "particles"
+};
+static const char *stage_names[FSPEEDS_NUMSTAGES] = {
+   "build", "lensmap", "tileclear", "vidupdate"
+};
+
+static void cmd_speedsdump(void);
+static struct _fspeeds_frame* recorded_frame(int age);
+static void average_frames(struct _fspeeds_frame *avg, int count);
+static qboolean dump_csv(const char *filename);
+static qboolean dump_json(const char *filename);
+
+void F_SpeedsInit(void)
+{
+   Cvar_RegisterVariable(&f_speeds);
+   Cmd_AddCommand("f_speedsdump", cmd_speedsdump);
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           RECORDING                                          |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_SpeedsBeginFrame(void)
+{
+   fisheye_speeds = f_speeds.value != 0;
+   if (!fisheye_speeds) {
+      return;
+   }
+   memset(&current, 0, sizeof(current));
+   memset(&d_surfcache_stats, 0, sizeof(d_surfcache_stats));
+   frame_start = Sys_DoubleTime();
+}
+
+void F_SpeedsPlate(int plate_index, double seconds, int pixels, double mipscale)
+{
+   if (!fisheye_speeds) {
+      return;
+   }
+   if (plate_index >= current.numplates) {
+      current.numplates = plate_index + 1;
+   }
+
+   current.plates[plate_index].rendered = true;
+   current.plates[plate_index].pixels += pixels;
+   current.plates[plate_index].total += seconds;
+   current.plates[plate_index].mipscale = mipscale;
+
+   double *phase = current.plates[plate_index].phase;
+   phase[FSPEEDS_SETUP] += rw_time1 - r_time1;
+   phase[FSPEEDS_WORLD] += rw_time2 - rw_time1;
+   phase[FSPEEDS_BMODELS] += db_time2 - db_time1;
+   phase[FSPEEDS_SCAN] += se_time2 - se_time1;
+   phase[FSPEEDS_ENTITIES] += de_time2 - de_time1;
+   phase[FSPEEDS_VIEWMODEL] += dv_time2 - dv_time1;
+   phase[FSPEEDS_PARTICLES] += dp_time2 - dp_time1;
+
+   current.plates[plate_index].hits += d_surfcache_stats.hits;
+   current.plates[plate_index].misses += d_surfcache_stats.misses;
+   current.plates[plate_index].evictions += d_surfcache_stats.evictions;
+   memset(&d_surfcache_stats, 0, sizeof(d_surfcache_stats));
+}
+
+void F_SpeedsStage(int stage, double seconds)
+{
+   if (fisheye_speeds) {
+      current.stage[stage] += seconds;
+   }
+}
+
+void F_SpeedsEndFrame(int lens_pixels)
+{
+   if (!fisheye_speeds) {
+      return;
+   }
+   current.total = Sys_DoubleTime() - frame_start;
+   current.lens_pixels = lens_pixels;
+   current.number = frames_recorded;
+   history[frames_recorded % FSPEEDS_HISTORY] = current;
+   frames_recorded++;
+}
+
+// VID_Update happens after F_RenderView, so it goes to the frame just recorded
+void F_SpeedsVidUpdate(double seconds)
+{
+   if (fisheye_speeds && frames_recorded > 0) {
+      recorded_frame(0)->stage[FSPEEDS_VIDUPDATE] += seconds;
+   }
+}
+
+// the frame recorded age frames ago
+static struct _fspeeds_frame* recorded_frame(int age)
+{
+   return &history[(frames_recorded - 1 - age) % FSPEEDS_HISTORY];
+}
+
+// the mean of the last count recorded frames
+static void average_frames(struct _fspeeds_frame *avg, int count)
+{
+   int i, j, k;
+
+   memset(avg, 0, sizeof(*avg));
+   if (count > frames_recorded) count = frames_recorded;
+   if (count > FSPEEDS_HISTORY) count = FSPEEDS_HISTORY;
+   if (count <= 0) {
+      return;
+   }
+
+   for (i=0; i<count; ++i) {
+      const struct _fspeeds_frame *f = recorded_frame(i);
+      avg->total += f->total / count;
+      for (j=0; j<FSPEEDS_NUMSTAGES; ++j) {
+         avg->stage[j] += f->stage[j] / count;
+      }
+      if (f->numplates > avg->numplates) {
+         avg->numplates = f->numplates;
+      }
+      for (j=0; j<f->numplates; ++j) {
+         if (!f->plates[j].rendered) {
+            continue;
+         }
+         avg->plates[j].rendered = true;
+         avg->plates[j].total += f->plates[j].total / count;
+         avg->plates[j].hits += f->plates[j].hits;
+         avg->plates[j].misses += f->plates[j].misses;
+         avg->plates[j].evictions += f->plates[j].evictions;
+         for (k=0; k<FSPEEDS_NUMPHASES; ++k) {
+            avg->plates[j].phase[k] += f->plates[j].phase[k] / count;
+         }
+      }
+   }
+
+   // sizes are from the latest frame, cache counts per frame
+   const struct _fspeeds_frame *last = recorded_frame(0);
+   avg->lens_pixels = last->lens_pixels;
+   for (j=0; j<avg->numplates; ++j) {
+      avg->plates[j].pixels = last->plates[j].pixels;
+      avg->plates[j].mipscale = last->plates[j].mipscale;
+      avg->plates[j].hits /= count;
+      avg->plates[j].misses /= count;
+      avg->plates[j].evictions /= count;
+   }
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           OVERLAY                                            |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_SpeedsDraw(void)
+{
+   struct _fspeeds_frame avg;
+   char st[80];
+   int i, y = 8;
+
+   if (!fisheye_speeds || frames_recorded == 0) {
+      return;
+   }
+   average_frames(&avg, FSPEEDS_OVERLAY_FRAMES);
+
+   qsnprintf(st, sizeof(st), "fisheye %5.2fms  lens %dpx", avg.total*1000, avg.lens_pixels);
+   Draw_String(8, y, st);
+   y += 8;
+
+   qsnprintf(st, sizeof(st), "build %4.2f map %4.2f clr %4.2f vid %4.2f",
+         avg.stage[FSPEEDS_BUILD]*1000, avg.stage[FSPEEDS_LENSMAP]*1000,
+         avg.stage[FSPEEDS_TILECLEAR]*1000, avg.stage[FSPEEDS_VIDUPDATE]*1000);
+   Draw_String(8, y, st);
+   y += 8;
+
+   Draw_String(8, y, "p   pixels  total setup world bmod scan ent view part");
+   y += 8;
+   for (i=0; i<avg.numplates; ++i) {
+      if (!avg.plates[i].rendered) {
+         continue;
+      }
+      const double *phase = avg.plates[i].phase;
+      qsnprintf(st, sizeof(st), "%d %6dpx %4.2f %4.2f %4.2f %4.2f %4.2f %4.2f %4.2f %4.2f",
+            i, avg.plates[i].pixels, avg.plates[i].total*1000,
+            phase[FSPEEDS_SETUP]*1000, phase[FSPEEDS_WORLD]*1000,
+            phase[FSPEEDS_BMODELS]*1000, phase[FSPEEDS_SCAN]*1000,
+            phase[FSPEEDS_ENTITIES]*1000, phase[FSPEEDS_VIEWMODEL]*1000,
+            phase[FSPEEDS_PARTICLES]*1000);
+      Draw_String(8, y, st);
+      y += 8;
+   }
+
+   Draw_String(8, y, "p  mip   hits misses evicts");
+   y += 8;
+   for (i=0; i<avg.numplates; ++i) {
+      if (!avg.plates[i].rendered) {
+         continue;
+      }
+      qsnprintf(st, sizeof(st), "%d %4.2f %6d %6d %6d", i, avg.plates[i].mipscale,
+            avg.plates[i].hits, avg.plates[i].misses, avg.plates[i].evictions);
+      Draw_String(8, y, st);
+      y += 8;
+   }
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           DUMPS                                              |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void cmd_speedsdump(void)
+{
+   if (Cmd_Argc() < 2) {
+      Con_Printf("f_speedsdump <file.csv|file.json>: write the last %d frames of f_speeds\n", FSPEEDS_HISTORY);
+      return;
+   }
+   if (frames_recorded == 0) {
+      Con_Printf("no frames recorded, set f_speeds 1 first\n");
+      return;
+   }
+
+   const char *filename = Cmd_Argv(1);
+   const char *ext = strrchr(filename, '.');
+   qboolean ok = ext && !strcmp(ext, ".json") ? dump_json(filename) : dump_csv(filename);
+   if (ok) {
+      Con_Printf("wrote %s\n", filename);
+   }
+   else {
+      Con_Printf("could not write %s\n", filename);
+   }
+}
+
+// one row per frame, times in milliseconds
+static qboolean dump_csv(const char *filename)
+{
+   FILE *f = fopen(filename, "w");
+   int i, j, k;
+
+   if (NULL == f) {
+      return false;
+   }
+
+   fprintf(f, "frame,total,lens_pixels");
+   for (j=0; j<FSPEEDS_NUMSTAGES; ++j) {
+      fprintf(f, ",%s", stage_names[j]);
+   }
+   for (i=0; i<MAX_PLATES; ++i) {
+      fprintf(f, ",plate%d_pixels,plate%d_total", i, i);
+      for (k=0; k<FSPEEDS_NUMPHASES; ++k) {
+         fprintf(f, ",plate%d_%s", i, phase_names[k]);
+      }
+      fprintf(f, ",plate%d_mipscale,plate%d_hits,plate%d_misses,plate%d_evictions", i, i, i, i);
+   }
+   fprintf(f, "\n");
+
+   int count = frames_recorded < FSPEEDS_HISTORY ? frames_recorded : FSPEEDS_HISTORY;
+   for (i=count-1; i>=0; --i) {
+      const struct _fspeeds_frame *fr = recorded_frame(i);
+      fprintf(f, "%d,%.4f,%d", fr->number, fr->total*1000, fr->lens_pixels);
+      for (j=0; j<FSPEEDS_NUMSTAGES; ++j) {
+         fprintf(f, ",%.4f", fr->stage[j]*1000);
+      }
+      for (j=0; j<MAX_PLATES; ++j) {
+         if (j >= fr->numplates || !fr->plates[j].rendered) {
+            fprintf(f, ",0,");
+            for (k=0; k<FSPEEDS_NUMPHASES; ++k) {
+               fprintf(f, ",");
+            }
+            fprintf(f, ",,,,");
+            continue;
+         }
+         fprintf(f, ",%d,%.4f", fr->plates[j].pixels, fr->plates[j].total*1000);
+         for (k=0; k<FSPEEDS_NUMPHASES; ++k) {
+            fprintf(f, ",%.4f", fr->plates[j].phase[k]*1000);
+         }
+         fprintf(f, ",%.3f,%d,%d,%d", fr->plates[j].mipscale, fr->plates[j].hits,
+               fr->plates[j].misses, fr->plates[j].evictions);
+      }
+      fprintf(f, "\n");
+   }
+
+   fclose(f);
+   return true;
+}
+
+// an array of frames, times in milliseconds
+static qboolean dump_json(const char *filename)
+{
+   FILE *f = fopen(filename, "w");
+   int i, j, k;
+
+   if (NULL == f) {
+      return false;
+   }
+
+   fprintf(f, "[\n");
+   int count = frames_recorded < FSPEEDS_HISTORY ? frames_recorded : FSPEEDS_HISTORY;
+   for (i=count-1; i>=0; --i) {
+      const struct _fspeeds_frame *fr = recorded_frame(i);
+      fprintf(f, "  {\"frame\": %d, \"total\": %.4f, \"lens_pixels\": %d",
+            fr->number, fr->total*1000, fr->lens_pixels);
+      for (j=0; j<FSPEEDS_NUMSTAGES; ++j) {
+         fprintf(f, ", \"%s\": %.4f", stage_names[j], fr->stage[j]*1000);
+      }
+      fprintf(f, ",\n   \"plates\": [");
+      qboolean first = true;
+      for (j=0; j<fr->numplates; ++j) {
+         if (!fr->plates[j].rendered) {
+            continue;
+         }
+         fprintf(f, "%s\n    {\"plate\": %d, \"pixels\": %d, \"total\": %.4f",
+               first ? "" : ",", j, fr->plates[j].pixels, fr->plates[j].total*1000);
+         for (k=0; k<FSPEEDS_NUMPHASES; ++k) {
+            fprintf(f, ", \"%s\": %.4f", phase_names[k], fr->plates[j].phase[k]*1000);
+         }
+         fprintf(f, ", \"mipscale\": %.3f, \"hits\": %d, \"misses\": %d, \"evictions\": %d}",
+               fr->plates[j].mipscale, fr->plates[j].hits,
+               fr->plates[j].misses, fr->plates[j].evictions);
+         first = false;
+      }
+      fprintf(f, "]}%s\n", i > 0 ? "," : "");
+   }
+   fprintf(f, "]\n");
+
+   fclose(f);
+   return true;
+}
+
+// vim: et:ts=3:sts=3:sw=3
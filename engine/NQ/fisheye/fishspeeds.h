@@ -0,0 +1,44 @@
+#include "fisheye.h"
+
+#ifndef FISHSPEEDS_H_
+#define FISHSPEEDS_H_
+
+// R_RenderView phases timed for each plate (the r_dspeeds timestamps)
+enum {
+   FSPEEDS_SETUP,     // frame setup, surface marking and culling
+   FSPEEDS_WORLD,     // world edges
+   FSPEEDS_BMODELS,   // brush entity edges
+   FSPEEDS_SCAN,      // edge scanning and span drawing
+   FSPEEDS_ENTITIES,  // alias models and sprites
+   FSPEEDS_VIEWMODEL,
+   FSPEEDS_PARTICLES, // particles and translucent surfaces
+   FSPEEDS_NUMPHASES
+};
+
+// stages of F_RenderView that are timed once per frame
+enum {
+   FSPEEDS_BUILD,     // lens builder slices
+   FSPEEDS_LENSMAP,   // render_lensmap for all views
+   FSPEEDS_TILECLEAR,
+   FSPEEDS_VIDUPDATE,
+   FSPEEDS_NUMSTAGES
+};
+
+void F_SpeedsInit(void);
+
+// frame boundaries (F_RenderView)
+void F_SpeedsBeginFrame(void);
+void F_SpeedsEndFrame(int lens_pixels);
+
+// records a rendered plate, reading the phase times left by R_RenderView
+// and the surface cache counts since the last plate
+// (a plate rendered for both stereo eyes adds up)
+void F_SpeedsPlate(int plate_index, double seconds, int pixels, double mipscale);
+
+// adds time to a stage of the current frame
+void F_SpeedsStage(int stage, double seconds);
+
+// draws the overlay, after the lens is in the vid buffer
+void F_SpeedsDraw(void);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmd.h"
+#include "common.h"
+#include "console.h"
+#include "sys.h"
+#include "vid.h"
+
+#include "fishtimedemo.h"
+
+#define MAX_TIMEDEMO_AXIS 16
+#define MAX_TIMEDEMO_NAME 32
+
+static const char *default_lenses = "panini,stereographic,equirect,quincuncial";
+static const char *default_globes = "cube,cube_edge,trism,tetra,fast";
+
+static struct {
+   qboolean running;
+   char demo[MAX_QPATH];
+   char filename[MAX_OSPATH];
+   FILE *out;
+
+   // the matrix (modes with width 0 keep the current one)
+   char lenses[MAX_TIMEDEMO_AXIS][MAX_TIMEDEMO_NAME];
+   char globes[MAX_TIMEDEMO_AXIS][MAX_TIMEDEMO_NAME];
+   struct { int width, height; } modes[MAX_TIMEDEMO_AXIS];
+   int numlenses, numglobes, nummodes;
+   int cell;
+   int written;
+
+   // the cell being measured
+   qboolean playing;    // first frame of the cell has been seen
+   double last_frame;
+   double *times;       // steady-state frame times
+   int numtimes, maxtimes;
+   double build_time;   // frames spent while the lens was being built
+   int build_frames;
+} timedemo;
+
+static int split_list(const char *list, char names[][MAX_TIMEDEMO_NAME]);
+static void start_cell(void);
+static void finish_cell(void);
+static int compare_times(const void *a, const void *b);
+static double percentile(const double *sorted, int count, double p);
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           MATRIX CONTROL                                     |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+qboolean F_StartTimedemo(const char *demo, const char *filename,
+      const char *lenses, const char *globes, const char *modes)
+{
+   int i;
+
+   if (timedemo.running) {
+      Con_Printf("a fisheye timedemo is already running\n");
+      return false;
+   }
+
+   free(timedemo.times);
+   memset(&timedemo, 0, sizeof(timedemo));
+   qsnprintf(timedemo.demo, sizeof(timedemo.demo), "%s", demo);
+   qsnprintf(timedemo.filename, sizeof(timedemo.filename), "%s", filename);
+
+   timedemo.numlenses = split_list(lenses ? lenses : default_lenses, timedemo.lenses);
+   timedemo.numglobes = split_list(globes ? globes : default_globes, timedemo.globes);
+
+   char names[MAX_TIMEDEMO_AXIS][MAX_TIMEDEMO_NAME];
+   int nummodes = modes ? split_list(modes, names) : 0;
+   for (i=0; i<nummodes; ++i) {
+      if (sscanf(names[i], "%dx%d", &timedemo.modes[i].width, &timedemo.modes[i].height) != 2) {
+         Con_Printf("\"%s\" is not a WxH mode\n", names[i]);
+         return false;
+      }
+   }
+   timedemo.nummodes = nummodes > 0 ? nummodes : 1;
+
+   if (timedemo.numlenses == 0 || timedemo.numglobes == 0) {
+      Con_Printf("no lenses or globes to time\n");
+      return false;
+   }
+
+   timedemo.out = fopen(filename, "w");
+   if (NULL == timedemo.out) {
+      Con_Printf("could not open %s for writing\n", filename);
+      return false;
+   }
+   fprintf(timedemo.out, "lens,globe,width,height,frames,mean_ms,p50_ms,p95_ms,p99_ms,build_frames,build_ms\n");
+
+   timedemo.running = true;
+   Cbuf_AddText("fisheye 1\n");
+   start_cell();
+   return true;
+}
+
+qboolean F_TimedemoRunning(void)
+{
+   return timedemo.running;
+}
+
+int F_TimedemoCellsWritten(void)
+{
+   return timedemo.written;
+}
+
+// splits a comma separated list, returns the number of names
+static int split_list(const char *list, char names[][MAX_TIMEDEMO_NAME])
+{
+   int count = 0;
+   while (*list && count < MAX_TIMEDEMO_AXIS) {
+      const char *end = strchr(list, ',');
+      int len = end ? end - list : (int)strlen(list);
+      if (len > 0) {
+         if (len >= MAX_TIMEDEMO_NAME) len = MAX_TIMEDEMO_NAME - 1;
+         memcpy(names[count], list, len);
+         names[count][len] = 0;
+         count++;
+      }
+      if (!end) {
+         break;
+      }
+      list = end + 1;
+   }
+   return count;
+}
+
+// queue the commands for the current cell
+// (lenses vary fastest, so modes only change every numlenses*numglobes cells)
+static void start_cell(void)
+{
+   int lens = timedemo.cell % timedemo.numlenses;
+   int globe = timedemo.cell / timedemo.numlenses % timedemo.numglobes;
+   int mode = timedemo.cell / (timedemo.numlenses * timedemo.numglobes);
+
+   if (lens == 0 && globe == 0 && timedemo.modes[mode].width > 0) {
+      Cbuf_AddText("vid_width %d\nvid_height %d\nvid_restart\n",
+            timedemo.modes[mode].width, timedemo.modes[mode].height);
+   }
+   Cbuf_AddText("f_globe %s\n", timedemo.globes[globe]);
+   Cbuf_AddText("f_lens %s\n", timedemo.lenses[lens]);
+   Cbuf_AddText("timedemo %s\n", timedemo.demo);
+
+   timedemo.playing = false;
+   timedemo.numtimes = 0;
+   timedemo.build_time = 0;
+   timedemo.build_frames = 0;
+}
+
+// write the current cell's row and move on to the next one
+static void finish_cell(void)
+{
+   int lens = timedemo.cell % timedemo.numlenses;
+   int globe = timedemo.cell / timedemo.numlenses % timedemo.numglobes;
+   int n = timedemo.numtimes;
+   double mean = 0;
+   int i;
+
+   qsort(timedemo.times, n, sizeof(*timedemo.times), compare_times);
+   for (i=0; i<n; ++i) {
+      mean += timedemo.times[i] / n;
+   }
+
+   fprintf(timedemo.out, "%s,%s,%d,%d,%d,%.4f,%.4f,%.4f,%.4f,%d,%.4f\n",
+         timedemo.lenses[lens], timedemo.globes[globe], vid.width, vid.height, n,
+         mean*1000, percentile(timedemo.times, n, 0.50)*1000,
+         percentile(timedemo.times, n, 0.95)*1000,
+         percentile(timedemo.times, n, 0.99)*1000,
+         timedemo.build_frames, timedemo.build_time*1000);
+   fflush(timedemo.out);
+   timedemo.written++;
+
+   if (++timedemo.cell < timedemo.numlenses * timedemo.numglobes * timedemo.nummodes) {
+      start_cell();
+      return;
+   }
+
+   fclose(timedemo.out);
+   timedemo.out = NULL;
+   timedemo.running = false;
+   Con_Printf("fisheye timedemo: wrote %d cells to %s\n", timedemo.written, timedemo.filename);
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           MEASUREMENT                                        |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+void F_TimedemoFrame(qboolean building)
+{
+   if (!timedemo.running) {
+      return;
+   }
+
+   // like timedemo, the first frame (loading) doesn't count
+   double now = Sys_DoubleTime();
+   if (!timedemo.playing) {
+      timedemo.playing = true;
+      timedemo.last_frame = now;
+      return;
+   }
+   double frametime = now - timedemo.last_frame;
+   timedemo.last_frame = now;
+
+   // keep lens building out of the steady state numbers
+   if (building) {
+      timedemo.build_time += frametime;
+      timedemo.build_frames++;
+      return;
+   }
+
+   if (timedemo.numtimes == timedemo.maxtimes) {
+      int maxtimes = timedemo.maxtimes ? 2*timedemo.maxtimes : 1024;
+      double *times = realloc(timedemo.times, maxtimes*sizeof(*times));
+      if (NULL == times) {
+         return;
+      }
+      timedemo.times = times;
+      timedemo.maxtimes = maxtimes;
+   }
+   timedemo.times[timedemo.numtimes++] = frametime;
+}
+
+void F_TimedemoDemoEnded(void)
+{
+   // only once our demo has rendered (starting it stops any previous one)
+   if (timedemo.running && timedemo.playing) {
+      finish_cell();
+   }
+}
+
+static int compare_times(const void *a, const void *b)
+{
+   double x = *(const double*)a, y = *(const double*)b;
+   return x < y ? -1 : x > y;
+}
+
+// nearest-rank percentile of sorted times
+static double percentile(const double *sorted, int count, double p)
+{
+   if (count == 0) {
+      return 0;
+   }
+   int rank = (int)(p * count + 0.999999);
+   if (rank < 1) rank = 1;
+   if (rank > count) rank = count;
+   return sorted[rank-1];
+}
+
+// vim: et:ts=3:sts=3:sw=3
@@ -0,0 +1,25 @@
+#include "fisheye.h"
+
+#ifndef FISHTIMEDEMO_H_
+#define FISHTIMEDEMO_H_
+
+// runs a demo as a timedemo for every lens x globe x resolution cell,
+// writing frame time statistics for each cell to a CSV file
+// (lenses, globes and modes are comma separated lists, NULL for the defaults;
+//  a mode is WxH, with no modes the current one is used)
+qboolean F_StartTimedemo(const char *demo, const char *filename,
+      const char *lenses, const char *globes, const char *modes);
+
+qboolean F_TimedemoRunning(void);
+
+// number of cells written by the last run
+int F_TimedemoCellsWritten(void);
+
+// called at the end of every F_RenderView
+// (building: a lens is still being built this frame)
+void F_TimedemoFrame(qboolean building);
+
+// called when a demo stops playing
+void F_TimedemoDemoEnded(void);
+
+#endif
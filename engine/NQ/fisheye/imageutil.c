@@ -7,6 +7,8 @@
 #include "console.h"
 #include <SDL_surface.h>
 #include <SDL_image.h>
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
 
 #define BITS_PER_PIXEL 8
 
@@ -86,44 +88,147 @@ byte* makePalmapForPlate(const byte *inPal, byte palleteLookup[256],
 // |                                                                              |
 // --------------------------------------------------------------------------------
 
-// write a plate
-void WritePNGplate_(struct _globe* globe, ray_to_plate_index_t ray_to_plate,
-      const byte* inPal, char *filename, int plate_index, int with_margins){
-    int platesize = globe->platesize;
-    byte *data = globe->pixels + plate_index * platesize * platesize;
-    int width = platesize;
-    int height = platesize;
-    int rowbytes = platesize;
-    byte *palette = (byte*)inPal;
-   
-    SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom(data, width, height,
-            BITS_PER_PIXEL, rowbytes, SDL_PIXELFORMAT_INDEX8);
-    SDL_Palette *pal = makePaddedPalette(palette);
-    SDL_SetSurfacePalette(surf, pal);
-    
-    SDL_Surface *maskedSurf = SDL_CreateRGBSurfaceWithFormat(0, width, height,
-            BITS_PER_PIXEL, SDL_PIXELFORMAT_INDEX8);
-    SDL_SetSurfacePalette(maskedSurf, pal);
-    
-    SDL_Rect getRekt = {.x=0,.y=0,.w=width,.h=height};
-    SDL_BlitSurface(surf, &getRekt, maskedSurf, NULL);
-    SDL_LockSurface(maskedSurf);
-    byte* pix = (byte*)maskedSurf->pixels;
-    for(int i=0; i < height; i++){
-       for(int j=0; j < width; j++){
-          const vec2_u uv = {.k = { (float)j/width, ((float)i)/height}};
-          vec3_u ray = plate_uv_to_ray(globe, plate_index, uv);
-          *pix = with_margins || plate_index == ray_to_plate(ray.vec)
-                  ? *pix : 0xFE;
-          pix++;
-       }
-    }
-    SDL_UnlockSurface(maskedSurf);
-    IMG_SavePNG(maskedSurf, filename);
-   
-    SDL_FreePalette(pal);
-    SDL_FreeSurface(maskedSurf);
-    SDL_FreeSurface(surf);
+// a globe snapshot being saved by a worker
+struct _globe_save {
+   struct _globe globe;  // plate layout, pixels point at the snapshot
+   byte *owner;          // owning plate of each pixel, NULL for the facing plate
+   byte palette[768];
+   char name[32];
+   int with_margins;
+   int written;          // plates saved
+   SDL_atomic_t done;
+   SDL_Thread *thread;
+   struct _globe_save *next;
+};
+
+static struct _globe_save *globe_saves = NULL;
+
+static int save_globe_worker(void *data){
+   struct _globe_save *save = data;
+   const struct _globe *globe = &save->globe;
+   int platesize = globe->platesize;
+   int area = platesize * platesize;
+   char pngname[48];
+   int i;
+
+   SDL_Palette *pal = makePaddedPalette(save->palette);
+   for (i=0; i<globe->numplates; ++i) {
+      byte *pix = globe->pixels + i*area;
+
+      // mask out what belongs to other plates
+      if (!save->with_margins) {
+         const byte *owner = save->owner ? save->owner + i*area : NULL;
+         for(int y=0; y < platesize; y++){
+            for(int x=0; x < platesize; x++, pix++){
+               int plate_index;
+               if (owner) {
+                  plate_index = *owner++;
+               }
+               else {
+                  const vec2_u uv = {.k = { (float)x/platesize, ((float)y)/platesize}};
+                  vec3_u ray = plate_uv_to_ray(globe, i, uv);
+                  plate_index = ray_to_plate_index_(globe, ray.vec);
+               }
+               if (plate_index != i) {
+                  *pix = 0xFE;
+               }
+            }
+         }
+         pix = globe->pixels + i*area;
+      }
+
+      SDL_Surface *surf = SDL_CreateRGBSurfaceWithFormatFrom(pix, platesize,
+            platesize, BITS_PER_PIXEL, platesize, SDL_PIXELFORMAT_INDEX8);
+      if (NULL == surf) {
+         continue;
+      }
+      SDL_SetSurfacePalette(surf, pal);
+      snprintf(pngname, sizeof(pngname), "%s%d.png", save->name, i);
+      if (!IMG_SavePNG(surf, pngname)) {
+         save->written++;
+      }
+      SDL_FreeSurface(surf);
+   }
+   SDL_FreePalette(pal);
+
+   SDL_AtomicSet(&save->done, 1);
+   return 0;
+}
+
+qboolean SaveGlobeAsync(const struct _globe* globe, const byte* owner,
+      const byte* inPal, const char *name, int with_margins){
+   int size = globe->numplates * globe->platesize * globe->platesize;
+
+   struct _globe_save *save = malloc(sizeof(*save));
+   if (NULL == save) {
+      return false;
+   }
+   save->globe = *globe;
+   save->globe.pixels = malloc(size);
+   save->owner = owner && !with_margins ? malloc(size) : NULL;
+   if (NULL == save->globe.pixels || (owner && !with_margins && NULL == save->owner)) {
+      free(save->globe.pixels);
+      free(save->owner);
+      free(save);
+      return false;
+   }
+   memcpy(save->globe.pixels, globe->pixels, size);
+   if (save->owner) {
+      memcpy(save->owner, owner, size);
+   }
+   memcpy(save->palette, inPal, sizeof(save->palette));
+   snprintf(save->name, sizeof(save->name), "%s", name);
+   save->with_margins = with_margins;
+   save->written = 0;
+   SDL_AtomicSet(&save->done, 0);
+
+   save->thread = SDL_CreateThread(save_globe_worker, "saveglobe", save);
+   if (NULL == save->thread) {
+      free(save->globe.pixels);
+      free(save->owner);
+      free(save);
+      return false;
+   }
+   save->next = globe_saves;
+   globe_saves = save;
+   return true;
+}
+
+static void finish_globe_save(struct _globe_save *save){
+   SDL_WaitThread(save->thread, NULL);
+   if (save->written == save->globe.numplates) {
+      Con_Printf("Wrote %s0.png to %s%d.png\n", save->name, save->name,
+            save->globe.numplates-1);
+   }
+   else {
+      Con_Printf("Wrote %d of %d plates of %s\n", save->written,
+            save->globe.numplates, save->name);
+   }
+   free(save->globe.pixels);
+   free(save->owner);
+   free(save);
+}
+
+void PollGlobeSaves(void){
+   struct _globe_save **link = &globe_saves;
+   while (*link) {
+      struct _globe_save *save = *link;
+      if (SDL_AtomicGet(&save->done)) {
+         *link = save->next;
+         finish_globe_save(save);
+      }
+      else {
+         link = &save->next;
+      }
+   }
+}
+
+void FinishGlobeSaves(void){
+   while (globe_saves) {
+      struct _globe_save *save = globe_saves;
+      globe_saves = save->next;
+      finish_globe_save(save);
+   }
 }
 
 void dumppal(const byte* inPal){
@@ -5,9 +5,18 @@
 byte* makePalmapForPlate(const byte* inPal, byte palleteLookup[256],
      int plateIdx);
 
-void WritePNGplate_(struct _globe* globe,
-        ray_to_plate_index_t ray_to_plate, const byte* inPal,
-	char *filename, int plate_index, int with_margins);
+// saves every plate of the globe on a worker thread
+// (plate pixels are copied, so rendering can go on right away)
+// owner gives the plate each globe pixel belongs to, or NULL to take the
+// plate facing it; it is only used when masking out the margins
+qboolean SaveGlobeAsync(const struct _globe* globe, const byte* owner,
+        const byte* inPal, const char *name, int with_margins);
+
+// reports finished saves to the console, call from the main thread
+void PollGlobeSaves(void);
+
+// waits for every save still in progress
+void FinishGlobeSaves(void);
 
 void dumppal(const byte* inPal);
 
@@ -521,7 +521,7 @@ Host_FilterTime(float time)
 {
     realtime += time;
 
-    if (!cls.timedemo && realtime - oldrealtime < 1.0 / 72.0)
+    if (!cls.timedemo && !fisheye_capturing && realtime - oldrealtime < 1.0 / 72.0)
 	return false;		// framerate is too high
 
     host_frametime = realtime - oldrealtime;
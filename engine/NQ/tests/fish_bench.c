@@ -0,0 +1,392 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "qtypes.h"
+#include "mathlib.h"
+#include "common.h"
+#include "console.h"
+#include "sys.h"
+
+#include "fisheye.h"
+#include "fishlens.h"
+#include "fishmath.h"
+#include "fishScript.h"
+//microbenchmarks for the fisheye kernels, outside of the engine
+//usage: fish_bench [repetitions] [globe] [lens]
+//prints one JSON object per kernel (times in nanoseconds per item)
+
+#define MAX_PRINTMSG 4096
+
+#define DEFAULT_REPS 31
+#define WARMUP_REPS 3
+
+#define LENS_WIDTH 640
+#define LENS_HEIGHT 480
+#define PLATE_SIZE 256
+#define NUM_RAYS 4096
+#define NUM_QUADS 4096
+
+//stand-ins for the engine pieces fishLua.c and fishlens.c lean on
+char com_basedir[MAX_OSPATH] = QBASEDIR;
+static fisheye_status last_status;
+static struct _globe globe;
+
+void fe_throw(fisheye_status status){
+	last_status = status;
+}
+
+void fe_clear(void){
+	last_status = FE_SUCCESS;
+}
+
+fisheye_status F_getLastStatus(void){
+	return last_status;
+}
+
+struct _globe* F_getGlobe(void){
+	return &globe;
+}
+
+void Con_Printf(const char* fmt, ...){
+	va_list argptr;
+	char msg[MAX_PRINTMSG];
+
+	va_start(argptr, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, argptr);
+	va_end(argptr);
+
+	fprintf(stderr, "%s", msg);
+}
+
+void Sys_Error(const char *error, ...){
+	va_list argptr;
+	char string[MAX_PRINTMSG];
+
+	va_start(argptr, error);
+	vsnprintf(string, sizeof(string), error, argptr);
+	va_end(argptr);
+	fprintf(stderr, "Error: %s\n", string);
+
+	exit(1);
+}
+
+int qsnprintf(char *str, size_t size, const char *format, ...){
+	va_list argptr;
+	int ret;
+
+	va_start(argptr, format);
+	ret = vsnprintf(str, size, format, argptr);
+	va_end(argptr);
+
+	return ret;
+}
+
+//the data every kernel works on
+static struct {
+	struct _lens lens;
+	struct _zoom zoom;
+	byte *dest;
+	vec3_u rays[NUM_RAYS];
+	vec2_u uvs[NUM_RAYS];
+	int plates[NUM_RAYS];
+	int quads[NUM_QUADS][4][2];
+	float x[NUM_RAYS], y[NUM_RAYS], z[NUM_RAYS]; //the rays again, as arrays
+	float u[NUM_RAYS], v[NUM_RAYS];
+	float out[4][NUM_RAYS];
+	int out_plate[NUM_RAYS];
+	volatile double sink; //keeps results from being optimized away
+} bench;
+
+typedef void (*kernel_t)(void);
+
+static double now(void);
+static double random_unit(void);
+static qboolean setup(int argc, char **argv);
+static void run(const char *name, kernel_t kernel, int items, int reps, qboolean *first);
+static int compare_doubles(const void *a, const void *b);
+
+static void kernel_render_lensmap(void);
+static void kernel_render_lensmap_tinted(void);
+static void kernel_ray_to_plate_index(void);
+static void kernel_ray_to_plate_uv(void);
+static void kernel_plate_uv_to_ray(void);
+static void kernel_latlon_round_trip(void);
+static void kernel_draw_quad(void);
+static void kernel_lens_inverse(void);
+static void kernel_ray_to_plate_uv_batch(void);
+static void kernel_plate_uv_to_ray_batch(void);
+static void kernel_latlon_round_trip_batch(void);
+
+int main(int argc, char **argv) {
+	int reps = argc > 1 ? atoi(argv[1]) : DEFAULT_REPS;
+	qboolean first = true;
+
+	if (reps < 1) {
+		reps = DEFAULT_REPS;
+	}
+	if (!setup(argc, argv)) {
+		return 1;
+	}
+
+	printf("[\n");
+	run("render_lensmap_8bit", kernel_render_lensmap, LENS_WIDTH*LENS_HEIGHT, reps, &first);
+	run("render_lensmap_8bit_rubix", kernel_render_lensmap_tinted, LENS_WIDTH*LENS_HEIGHT, reps, &first);
+	run("ray_to_plate_index", kernel_ray_to_plate_index, NUM_RAYS, reps, &first);
+	run("ray_to_plate_uv", kernel_ray_to_plate_uv, NUM_RAYS, reps, &first);
+	run("plate_uv_to_ray", kernel_plate_uv_to_ray, NUM_RAYS, reps, &first);
+	run("latlon_to_ray+ray_to_latlon", kernel_latlon_round_trip, NUM_RAYS, reps, &first);
+	run("ray_to_plate_uv_batch", kernel_ray_to_plate_uv_batch, NUM_RAYS, reps, &first);
+	run("plate_uv_to_ray_batch", kernel_plate_uv_to_ray_batch, NUM_RAYS, reps, &first);
+	run("latlon_to_ray_batch+ray_to_latlon_batch", kernel_latlon_round_trip_batch, NUM_RAYS, reps, &first);
+	run("draw_quad", kernel_draw_quad, NUM_QUADS, reps, &first);
+	if (F_getScriptRef()->lens_inverse != -1) {
+		run("scriptToC_lens_inverse", kernel_lens_inverse, NUM_RAYS, reps, &first);
+	}
+	printf("\n]\n");
+
+	F_release_lens(&bench.lens);
+	F_scriptShutdown();
+	free(bench.lens.pixels);
+	free(bench.lens.pixel_tints);
+	free(globe.pixels);
+	free(bench.dest);
+	return 0;
+}
+
+static qboolean setup(int argc, char **argv){
+	const char *globe_name = argc > 2 ? argv[2] : "cube";
+	const char *lens_name = argc > 3 ? argv[3] : "stereographic";
+	int i, j;
+
+	srand(1);
+	F_scriptInit();
+
+	if (!F_load_globe(globe_name, &globe)) {
+		fprintf(stderr, "could not load globe %s from %s\n", globe_name, com_basedir);
+		return false;
+	}
+	if (!F_load_lens(lens_name, &bench.lens, &bench.zoom, globe.numplates)) {
+		fprintf(stderr, "could not load lens %s from %s\n", lens_name, com_basedir);
+		return false;
+	}
+	F_bind_lens(&bench.lens);
+
+	//a noisy globe and a lensmap scattered all over it
+	globe.platesize = PLATE_SIZE;
+	int globe_pixels = globe.numplates*PLATE_SIZE*PLATE_SIZE;
+	globe.pixels = malloc(globe_pixels);
+	for (i=0; i<globe_pixels; ++i) {
+		globe.pixels[i] = rand() & 0xff;
+	}
+	for (i=0; i<globe.numplates; ++i) {
+		for (j=0; j<256; ++j) {
+			globe.plates[i].palette[j] = (j + i*16) & 0xff;
+		}
+	}
+
+	bench.lens.width_px = LENS_WIDTH;
+	bench.lens.height_px = LENS_HEIGHT;
+	bench.lens.pixels = malloc(LENS_WIDTH*LENS_HEIGHT*sizeof(*bench.lens.pixels));
+	bench.lens.pixel_tints = malloc(LENS_WIDTH*LENS_HEIGHT);
+	bench.dest = malloc(LENS_WIDTH*LENS_HEIGHT);
+	if (!globe.pixels || !bench.lens.pixels || !bench.lens.pixel_tints || !bench.dest) {
+		fprintf(stderr, "out of memory\n");
+		return false;
+	}
+	for (i=0; i<LENS_WIDTH*LENS_HEIGHT; ++i) {
+		bench.lens.pixels[i] = rand() % globe_pixels;
+		bench.lens.pixel_tints[i] = i % 3 ? 255 : rand() % globe.numplates;
+	}
+
+	//rays spread over the sphere, with their plates and uvs
+	for (i=0; i<NUM_RAYS; ++i) {
+		vec3_u *ray = &bench.rays[i];
+		do {
+			ray->xyz.x = random_unit()*2-1;
+			ray->xyz.y = random_unit()*2-1;
+			ray->xyz.z = random_unit()*2-1;
+		} while (VectorNormalize(ray->vec) == 0);
+		bench.plates[i] = ray_to_plate_index_(&globe, ray->vec);
+		bench.uvs[i].uv.u = random_unit();
+		bench.uvs[i].uv.v = random_unit();
+		bench.x[i] = ray->xyz.x;
+		bench.y[i] = ray->xyz.y;
+		bench.z[i] = ray->xyz.z;
+		bench.u[i] = bench.uvs[i].uv.u;
+		bench.v[i] = bench.uvs[i].uv.v;
+	}
+
+	//quads the size the forward builder sees, a few pixels across
+	for (i=0; i<NUM_QUADS; ++i) {
+		int x = rand() % (LENS_WIDTH-8), y = rand() % (LENS_HEIGHT-8);
+		int w = 1 + rand()%6, h = 1 + rand()%6;
+		int corners[4][2] = {{x,y}, {x+w,y+rand()%2}, {x+rand()%2,y+h}, {x+w,y+h}};
+		memcpy(bench.quads[i], corners, sizeof(corners));
+	}
+
+	return true;
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           MEASUREMENT                                        |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static double now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double random_unit(void){
+	return rand() / (double)RAND_MAX;
+}
+
+static int compare_doubles(const void *a, const void *b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+//times reps runs of the kernel after a warmup, reporting the median with its
+//median absolute deviation, which shrug off the odd preempted run
+static void run(const char *name, kernel_t kernel, int items, int reps, qboolean *first){
+	double *times = malloc(reps*sizeof(*times));
+	double *deviations = malloc(reps*sizeof(*deviations));
+	double mean = 0;
+	int i;
+
+	for (i=0; i<WARMUP_REPS; ++i) {
+		kernel();
+	}
+	for (i=0; i<reps; ++i) {
+		double start = now();
+		kernel();
+		times[i] = (now() - start) * 1e9 / items;
+		mean += times[i] / reps;
+	}
+
+	qsort(times, reps, sizeof(*times), compare_doubles);
+	double median = times[reps/2];
+	for (i=0; i<reps; ++i) {
+		deviations[i] = fabs(times[i] - median);
+	}
+	qsort(deviations, reps, sizeof(*deviations), compare_doubles);
+
+	printf("%s  {\"kernel\": \"%s\", \"items\": %d, \"reps\": %d, "
+			"\"median_ns\": %.3f, \"mad_ns\": %.3f, \"min_ns\": %.3f, "
+			"\"mean_ns\": %.3f, \"max_ns\": %.3f}",
+			*first ? "" : ",\n", name, items, reps,
+			median, deviations[reps/2], times[0], mean, times[reps-1]);
+	*first = false;
+
+	free(times);
+	free(deviations);
+}
+
+// --------------------------------------------------------------------------------
+// |                                                                              |
+// |                           KERNELS                                            |
+// |                                                                              |
+// --------------------------------------------------------------------------------
+
+static void kernel_render_lensmap(void){
+	resolve_lensmap_8bit(&bench.lens, &globe, bench.dest, LENS_WIDTH);
+	bench.sink += bench.dest[LENS_WIDTH*LENS_HEIGHT/2];
+}
+
+static void kernel_render_lensmap_tinted(void){
+	resolve_lensmap_8bit_tinted(&bench.lens, &globe, bench.dest, LENS_WIDTH);
+	bench.sink += bench.dest[LENS_WIDTH*LENS_HEIGHT/2];
+}
+
+static void kernel_ray_to_plate_index(void){
+	int i, sum = 0;
+	for (i=0; i<NUM_RAYS; ++i) {
+		sum += ray_to_plate_index_(&globe, bench.rays[i].vec);
+	}
+	bench.sink += sum;
+}
+
+static void kernel_ray_to_plate_uv(void){
+	int i;
+	double u, v, sum = 0;
+	for (i=0; i<NUM_RAYS; ++i) {
+		if (ray_to_plate_uv_(&globe, bench.plates[i], bench.rays[i].vec, &u, &v)) {
+			sum += u + v;
+		}
+	}
+	bench.sink += sum;
+}
+
+static void kernel_plate_uv_to_ray(void){
+	int i;
+	double sum = 0;
+	for (i=0; i<NUM_RAYS; ++i) {
+		vec3_u ray = plate_uv_to_ray(&globe, bench.plates[i], bench.uvs[i]);
+		sum += ray.xyz.x;
+	}
+	bench.sink += sum;
+}
+
+static void kernel_latlon_round_trip(void){
+	int i;
+	double sum = 0;
+	for (i=0; i<NUM_RAYS; ++i) {
+		vec3_u ray = latlon_to_ray(ray_to_latlon(bench.rays[i]));
+		sum += ray.xyz.y;
+	}
+	bench.sink += sum;
+}
+
+static void kernel_ray_to_plate_uv_batch(void){
+	ray_to_plate_uv_batch(&globe, bench.x, bench.y, bench.z,
+			bench.out_plate, bench.out[0], bench.out[1], NUM_RAYS);
+	bench.sink += bench.out[0][0];
+}
+
+//(all on plate 0, the scalar version spreads them over the plates)
+static void kernel_plate_uv_to_ray_batch(void){
+	plate_uv_to_ray_batch(&globe, 0, bench.u, bench.v,
+			bench.out[0], bench.out[1], bench.out[2], NUM_RAYS);
+	bench.sink += bench.out[0][0];
+}
+
+static void kernel_latlon_round_trip_batch(void){
+	ray_to_latlon_batch(bench.x, bench.y, bench.z, bench.out[0], bench.out[1], NUM_RAYS);
+	latlon_to_ray_batch(bench.out[0], bench.out[1], bench.out[1], bench.out[2], bench.out[3], NUM_RAYS);
+	bench.sink += bench.out[2][0];
+}
+
+static void plot_pixel(void *data, int lx, int ly, int px, int py, int plate_index){
+	(void)data;
+
+	bench.lens.pixels[lx + ly*LENS_WIDTH] = px + py*PLATE_SIZE;
+	bench.lens.pixel_tints[lx + ly*LENS_WIDTH] = plate_index;
+}
+
+static void kernel_draw_quad(void){
+	int i;
+	for (i=0; i<NUM_QUADS; ++i) {
+		int (*q)[2] = bench.quads[i];
+		draw_quad_(q[0], q[1], q[2], q[3], i % globe.numplates,
+				i % PLATE_SIZE, (i/PLATE_SIZE) % PLATE_SIZE, plot_pixel, NULL);
+	}
+	bench.sink += bench.lens.pixels[0];
+}
+
+static void kernel_lens_inverse(void){
+	int i;
+	double sum = 0;
+	for (i=0; i<NUM_RAYS; ++i) {
+		//lens coordinates in the lens' own units
+		vec2_u xy = {.xy = {bench.uvs[i].uv.u*2-1, bench.uvs[i].uv.v*2-1}};
+		vec3_u ray = scriptToC_lens_inverse(xy);
+		sum += ray.xyz.z;
+	}
+	bench.sink += sum;
+}
@@ -9,6 +9,9 @@
 #include <float.h>
 
 #include "fishzoom.h"
+#include "fishmath.h"
+#include "fishlens.h"
+#include "fishcapture.h"
 #include "fishScript.h" //mocked via build settings
 #include "console.h"
 
@@ -75,6 +78,19 @@ static void test_zoom_scale_negative(void **state);
 
 static struct _lens givenAGenricLensAndRefs(void);
 
+static void test_batch_sincos(void **state);
+static void test_batch_atan2(void **state);
+static void test_batch_asin(void **state);
+static void test_batch_sqrt(void **state);
+static void test_batch_latlon_rays(void **state);
+static void test_batch_plate_rays(void **state);
+static struct _globe givenACubeGlobe(void);
+
+static void test_lensmap_minification(void **state);
+static void test_capture_pipe(void **state);
+
+#define NUM_BATCH 4096
+
 static vec2_u mocked_Script_return= {{1,2}};
 
 static script_refs mock_refs = {
@@ -99,7 +115,15 @@ int main(void) {
 		cmocka_unit_test(test_zoom_FOV_invalid),
 		cmocka_unit_test(test_zoom_VFOV_invalid),
 		cmocka_unit_test(test_zoom_no_forward),
-		cmocka_unit_test(test_zoom_scale_negative)
+		cmocka_unit_test(test_zoom_scale_negative),
+		cmocka_unit_test(test_batch_sincos),
+		cmocka_unit_test(test_batch_atan2),
+		cmocka_unit_test(test_batch_asin),
+		cmocka_unit_test(test_batch_sqrt),
+		cmocka_unit_test(test_batch_latlon_rays),
+		cmocka_unit_test(test_batch_plate_rays),
+		cmocka_unit_test(test_lensmap_minification),
+		cmocka_unit_test(test_capture_pipe)
 	};
 	return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -326,6 +350,196 @@ static void test_zoom_scale_negative(void **state){
 	assert_false(result);
 }
 
+static void test_batch_sincos(void **state){
+	(void)state;
+	static float x[NUM_BATCH], s[NUM_BATCH], c[NUM_BATCH];
+	int i;
+	for (i=0; i<NUM_BATCH; ++i) {
+		x[i] = -64*M_PI + 128*M_PI*i/(NUM_BATCH-1);
+	}
+
+	sincos_batch(x, s, c, NUM_BATCH);
+
+	for (i=0; i<NUM_BATCH; ++i) {
+		assert_float_equal(sin((double)x[i]), s[i], FMATH_SINCOS_ERROR);
+		assert_float_equal(cos((double)x[i]), c[i], FMATH_SINCOS_ERROR);
+	}
+}
+
+static void test_batch_atan2(void **state){
+	(void)state;
+	static float y[NUM_BATCH], x[NUM_BATCH], out[NUM_BATCH];
+	int i;
+	for (i=0; i<NUM_BATCH; ++i) {
+		double angle = 2*M_PI*i/NUM_BATCH;
+		double radius = i%2 ? 1e-3 : 1e3;
+		y[i] = radius*sin(angle);
+		x[i] = radius*cos(angle);
+	}
+	y[0] = x[0] = 0;
+
+	atan2_batch(y, x, out, NUM_BATCH);
+
+	assert_float_equal(0, out[0], FMATH_ATAN2_ERROR);
+	for (i=1; i<NUM_BATCH; ++i) {
+		assert_float_equal(atan2((double)y[i], (double)x[i]), out[i], FMATH_ATAN2_ERROR);
+	}
+}
+
+static void test_batch_asin(void **state){
+	(void)state;
+	static float x[NUM_BATCH], out[NUM_BATCH];
+	int i;
+	for (i=0; i<NUM_BATCH; ++i) {
+		x[i] = -1 + 2.0*i/(NUM_BATCH-1);
+	}
+
+	asin_batch(x, out, NUM_BATCH);
+
+	for (i=0; i<NUM_BATCH; ++i) {
+		assert_float_equal(asin((double)x[i]), out[i], FMATH_ASIN_ERROR);
+	}
+}
+
+static void test_batch_sqrt(void **state){
+	(void)state;
+	static float x[NUM_BATCH], out[NUM_BATCH];
+	int i;
+	for (i=0; i<NUM_BATCH; ++i) {
+		x[i] = pow(10, -30 + 60.0*i/(NUM_BATCH-1));
+	}
+	x[0] = 0;
+
+	sqrt_batch(x, out, NUM_BATCH);
+
+	assert_float_equal(0, out[0], FLT_EPSILON);
+	for (i=1; i<NUM_BATCH; ++i) {
+		assert_float_equal(1, out[i]/sqrt((double)x[i]), FMATH_SQRT_ERROR);
+	}
+}
+
+static void test_batch_latlon_rays(void **state){
+	(void)state;
+	static float lat[NUM_BATCH], lon[NUM_BATCH];
+	static float x[NUM_BATCH], y[NUM_BATCH], z[NUM_BATCH];
+	static float lat2[NUM_BATCH], lon2[NUM_BATCH];
+	int i;
+	for (i=0; i<NUM_BATCH; ++i) {
+		lat[i] = -M_PI/2 + M_PI*(i%64)/63;
+		lon[i] = -M_PI + 2*M_PI*(i/64)/63;
+	}
+
+	latlon_to_ray_batch(lat, lon, x, y, z, NUM_BATCH);
+	ray_to_latlon_batch(x, y, z, lat2, lon2, NUM_BATCH);
+
+	for (i=0; i<NUM_BATCH; ++i) {
+		vec3_u ray = latlon_to_ray((vec2_u){.latlon = {.lat = lat[i], .lon = lon[i]}});
+		assert_float_equal(ray.xyz.x, x[i], FMATH_RAY_ERROR);
+		assert_float_equal(ray.xyz.y, y[i], FMATH_RAY_ERROR);
+		assert_float_equal(ray.xyz.z, z[i], FMATH_RAY_ERROR);
+
+		vec2_u latlon = ray_to_latlon((vec3_u){.vec = {x[i], y[i], z[i]}});
+		assert_float_equal(latlon.latlon.lat, lat2[i], FMATH_ATAN2_ERROR + FMATH_SQRT_ERROR);
+		assert_float_equal(latlon.latlon.lon, lon2[i], FMATH_ATAN2_ERROR);
+	}
+}
+
+static void test_batch_plate_rays(void **state){
+	(void)state;
+	struct _globe globe = givenACubeGlobe();
+	static float u[NUM_BATCH], v[NUM_BATCH], u2[NUM_BATCH], v2[NUM_BATCH];
+	static float x[NUM_BATCH], y[NUM_BATCH], z[NUM_BATCH];
+	static int plate[NUM_BATCH], facing[NUM_BATCH];
+	int i, p;
+	for (i=0; i<NUM_BATCH; ++i) {
+		u[i] = 0.05 + 0.9*(i%64)/63;
+		v[i] = 0.05 + 0.9*(i/64)/63;
+	}
+
+	for (p=0; p<globe.numplates; ++p) {
+		plate_uv_to_ray_batch(&globe, p, u, v, x, y, z, NUM_BATCH);
+		ray_to_plate_index_batch(&globe, x, y, z, facing, NUM_BATCH);
+		ray_to_plate_uv_batch(&globe, x, y, z, plate, u2, v2, NUM_BATCH);
+
+		for (i=0; i<NUM_BATCH; ++i) {
+			vec3_u ray = plate_uv_to_ray(&globe, p, (vec2_u){.uv = {.u = u[i], .v = v[i]}});
+			assert_float_equal(ray.xyz.x, x[i], FMATH_RAY_ERROR);
+			assert_float_equal(ray.xyz.y, y[i], FMATH_RAY_ERROR);
+			assert_float_equal(ray.xyz.z, z[i], FMATH_RAY_ERROR);
+
+			assert_int_equal(p, facing[i]);
+			assert_int_equal(p, plate[i]);
+			assert_float_equal(u[i], u2[i], FMATH_RAY_ERROR);
+			assert_float_equal(v[i], v2[i], FMATH_RAY_ERROR);
+		}
+	}
+}
+
+// the standard cubemap (see lua-scripts/globes/cube.lua)
+static struct _globe givenACubeGlobe(){
+	const vec3_t forward[6] = {{0,0,1}, {1,0,0}, {-1,0,0}, {0,0,-1}, {0,1,0}, {0,-1,0}};
+	const vec3_t up[6] = {{0,1,0}, {0,1,0}, {0,1,0}, {0,1,0}, {0,0,-1}, {0,0,1}};
+	struct _globe globe = { .numplates = 6 };
+	int i;
+	for (i=0; i<6; ++i) {
+		VectorCopy(forward[i], globe.plates[i].forward);
+		VectorCopy(up[i], globe.plates[i].up);
+		CrossProduct(globe.plates[i].up, globe.plates[i].forward, globe.plates[i].right);
+		globe.plates[i].fov = M_PI/2;
+		globe.plates[i].dist = 0.5/tan(globe.plates[i].fov/2);
+	}
+	return globe;
+}
+
+static void test_lensmap_minification(void **state){
+	(void)state;
+	const int platesize = 16;
+	uint32_t pixels[16*8];
+	float minification[3];
+	int x, y;
+
+	// plate 0 shown at full size on the left, plate 1 at half size on the right,
+	// plate 2 not at all
+	for (y=0; y<8; ++y) {
+		for (x=0; x<8; ++x) {
+			pixels[x + y*16] = (x+1) + (y+1)*platesize;
+			pixels[x+8 + y*16] = platesize*platesize + 2*x + 2*y*platesize;
+		}
+	}
+	struct _lens lens = {
+		.width_px = 16,
+		.height_px = 8,
+		.pixels = pixels
+	};
+
+	lensmap_plate_minification(&lens, platesize, 3, minification);
+	assert_float_equal(minification[0], 1, FLT_EPSILON);
+	assert_float_equal(minification[1], 2, 1e-5);
+	assert_float_equal(minification[2], 1, FLT_EPSILON);
+}
+
+// a raw capture's pipe opens for writing, takes a frame with every byte value
+// in it, and closes with the command's exit status
+static void test_capture_pipe(void **state){
+	(void)state;
+#ifdef _WIN32
+	const char *command = "sort > NUL";
+#else
+	const char *command = "cat > /dev/null";
+#endif
+	unsigned char frame[3*256];
+	int i;
+
+	for (i=0; i<(int)sizeof(frame); ++i) {
+		frame[i] = i;
+	}
+
+	FILE *pipe = F_OpenCapturePipe(command);
+	assert_non_null(pipe);
+	assert_int_equal(fwrite(frame, 1, sizeof(frame), pipe), sizeof(frame));
+	assert_int_equal(F_CloseCapturePipe(pipe), 0);
+}
+
 static struct _lens givenAGenricLensAndRefs(){
 	will_return_always(__wrap_F_getScriptRef, &mock_refs);
 	return (struct _lens){
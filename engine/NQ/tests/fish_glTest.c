@@ -0,0 +1,224 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <SDL.h>
+#include <SDL_opengl.h>
+
+#include "fishgl.h"
+#include "console.h"
+
+// Checks the GL lens against what the software lens would draw.  Needs a GL
+// context, but not a GPU: meson runs it on Mesa's llvmpipe (see meson.build).
+// Without a context every test fails, and with FISH_GL_RENDERER set they also
+// fail unless GL_RENDERER names it, so a run on the wrong driver can't pass.
+
+#define PLATESIZE 4
+#define NUMPLATES 2
+#define LENS_WIDTH 8
+#define LENS_HEIGHT 4
+
+void Con_Printf(const char* fmt, ...){
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	vprintf(fmt, argptr);
+	va_end(argptr);
+}
+
+static struct {
+	struct _globe globe;
+	struct _lens lens;
+	byte globe_pixels[NUMPLATES*PLATESIZE*PLATESIZE];
+	uint32_t lens_pixels[LENS_WIDTH*LENS_HEIGHT];
+	byte lens_tints[LENS_WIDTH*LENS_HEIGHT];
+	unsigned palette[256];
+} gltest;
+
+static int setup(void **state);
+static int teardown(void **state);
+static void test_uploaded_plates(void **state);
+static void test_tinted_plates(void **state);
+static void test_rendered_plates(void **state);
+
+static void read_lens(unsigned *rgba);
+static unsigned rgba(byte r, byte g, byte b);
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_uploaded_plates),
+		cmocka_unit_test(test_tinted_plates),
+		cmocka_unit_test(test_rendered_plates),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+static int setup(void **state) {
+	const char *wanted = getenv("FISH_GL_RENDERER");
+	const char *renderer;
+	int i, j, x, y;
+
+	(void)state;
+
+	// the same hidden context f_gllens uses
+	if (!F_GL_OpenOffscreen()) {
+		printf("no GL context\n");
+		return -1;
+	}
+	renderer = (const char*)glGetString(GL_RENDERER);
+	printf("GL_RENDERER: %s\n", renderer);
+	if (wanted && (NULL == renderer || NULL == strstr(renderer, wanted))) {
+		printf("not the %s renderer\n", wanted);
+		return -1;
+	}
+
+	// every globe pixel gets its own color
+	for (i=0; i<256; ++i) {
+		gltest.palette[i] = rgba(i, 255-i, i*7);
+	}
+	for (i=0; i<NUMPLATES*PLATESIZE*PLATESIZE; ++i) {
+		gltest.globe_pixels[i] = 16 + i;
+	}
+	gltest.globe.pixels = gltest.globe_pixels;
+	gltest.globe.platesize = PLATESIZE;
+	gltest.globe.numplates = NUMPLATES;
+
+	// each plate's palette map shifts colors by a different amount
+	for (i=0; i<NUMPLATES; ++i) {
+		for (j=0; j<256; ++j) {
+			gltest.globe.plates[i].palette[j] = (j + 64*(i+1)) & 255;
+		}
+	}
+
+	// plate 0 on the left, plate 1 mirrored on the right
+	for (y=0; y<LENS_HEIGHT; ++y) {
+		for (x=0; x<LENS_WIDTH; ++x) {
+			uint32_t index = x < PLATESIZE
+				? x + y*PLATESIZE
+				: PLATESIZE*PLATESIZE + (LENS_WIDTH-1-x) + y*PLATESIZE;
+			gltest.lens_pixels[x + y*LENS_WIDTH] = index;
+
+			// every other pixel is tinted by the plate it shows
+			gltest.lens_tints[x + y*LENS_WIDTH] = x & 1
+				? index / (PLATESIZE*PLATESIZE)
+				: 255;
+		}
+	}
+	gltest.lens.pixels = gltest.lens_pixels;
+	gltest.lens.pixel_tints = gltest.lens_tints;
+	gltest.lens.width_px = LENS_WIDTH;
+	gltest.lens.height_px = LENS_HEIGHT;
+
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	F_GL_CloseOffscreen();
+	SDL_Quit();
+	return 0;
+}
+
+// plates from the software renderer come out like resolve_lensmap_8bit
+static void test_uploaded_plates(void **state) {
+	unsigned actual[LENS_WIDTH*LENS_HEIGHT];
+	int i;
+
+	(void)state;
+
+	assert_true(F_GL_SetGlobe(PLATESIZE, NUMPLATES));
+	F_GL_UploadPlates(&gltest.globe, gltest.palette);
+	F_GL_SetLensmap(&gltest.lens, false);
+	read_lens(actual);
+
+	for (i=0; i<LENS_WIDTH*LENS_HEIGHT; ++i) {
+		byte pixel = gltest.globe_pixels[gltest.lens_pixels[i]];
+		assert_int_equal(actual[i], gltest.palette[pixel]);
+	}
+}
+
+// and tinted like resolve_lensmap_8bit_tinted
+static void test_tinted_plates(void **state) {
+	unsigned actual[LENS_WIDTH*LENS_HEIGHT];
+	int i;
+
+	(void)state;
+
+	assert_true(F_GL_SetGlobe(PLATESIZE, NUMPLATES));
+	F_GL_UploadPlates(&gltest.globe, gltest.palette);
+	F_GL_SetLensmap(&gltest.lens, true);
+	read_lens(actual);
+
+	for (i=0; i<LENS_WIDTH*LENS_HEIGHT; ++i) {
+		byte pixel = gltest.globe_pixels[gltest.lens_pixels[i]];
+		int tint = gltest.lens_tints[i];
+		if (tint != 255) {
+			pixel = gltest.globe.plates[tint].palette[pixel];
+		}
+		assert_int_equal(actual[i], gltest.palette[pixel]);
+	}
+}
+
+// plates drawn by GL keep the top of the picture at the top of the lens
+static void test_rendered_plates(void **state) {
+	unsigned actual[LENS_WIDTH*LENS_HEIGHT];
+	const unsigned top[NUMPLATES] = { rgba(255, 0, 0), rgba(0, 0, 255) };
+	const unsigned bottom[NUMPLATES] = { rgba(0, 255, 0), rgba(255, 255, 0) };
+	int i, x, y;
+
+	(void)state;
+
+	assert_true(F_GL_SetGlobe(PLATESIZE, NUMPLATES));
+	for (i=0; i<NUMPLATES; ++i) {
+		const byte *t = (const byte*)&top[i];
+		const byte *b = (const byte*)&bottom[i];
+
+		F_GL_BeginPlate(i);
+		glClearColor(t[0]/255.0, t[1]/255.0, t[2]/255.0, 1);
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		// bottom half of the plate
+		glColor3ub(b[0], b[1], b[2]);
+		glBegin(GL_QUADS);
+		glVertex2f(-1, -1);
+		glVertex2f(1, -1);
+		glVertex2f(1, 0);
+		glVertex2f(-1, 0);
+		glEnd();
+		F_GL_EndPlate();
+	}
+	F_GL_SetLensmap(&gltest.lens, false);
+	read_lens(actual);
+
+	for (y=0; y<LENS_HEIGHT; ++y) {
+		for (x=0; x<LENS_WIDTH; ++x) {
+			int plate = x < PLATESIZE ? 0 : 1;
+			unsigned expected = y < PLATESIZE/2 ? top[plate] : bottom[plate];
+			assert_int_equal(actual[x + y*LENS_WIDTH], expected);
+		}
+	}
+}
+
+// draws the lens and reads it back top down, as f_gllens does
+static void read_lens(unsigned *pixels) {
+	memset(pixels, 0, LENS_WIDTH*LENS_HEIGHT*sizeof(*pixels));
+	assert_true(F_GL_ResolveLens(pixels));
+}
+
+// laid out like d_8to24table
+static unsigned rgba(byte r, byte g, byte b) {
+	unsigned color;
+	byte *c = (byte*)&color;
+	c[0] = r;
+	c[1] = g;
+	c[2] = b;
+	c[3] = 255;
+	return color;
+}
@@ -17,6 +17,14 @@ qboolean F_load_lens(const char *name, struct _lens *lens, struct _zoom *zoom, i
 	return true;
 }
 
+void F_release_lens(struct _lens *lens){}
+
+void F_bind_lens(const struct _lens *lens){}
+
+const char* F_lens_onload(const struct _lens *lens){
+	return NULL;
+}
+
 qboolean F_load_globe(const char *name, struct _globe *globe){
 	return true;
 }
@@ -0,0 +1,88 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <cmocka.h>
+
+#include "qtypes.h"
+#include "quakedef.h"
+#include "client.h"
+#include "sys.h"
+#include "host.h"
+#include "cmd.h"
+#include "zone.h"
+
+#include "fishtimedemo.h"
+//runs the fisheye timedemo matrix unattended
+//FISH_TIMEDEMO_DEMO picks the demo (default demo1), FISH_TIMEDEMO_CSV the output
+//FISH_TIMEDEMO_LENSES, _GLOBES and _MODES override the matrix (comma separated)
+
+// frames to wait for a demo to start before giving up
+#define MAX_IDLE_FRAMES 200
+
+static int setup(void** state);
+static int teardown(void** state);
+
+static struct MyState {
+	quakeparms_t *params;
+} myState;
+
+static void test_timedemo_matrix_writes_every_cell(void** state);
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_timedemo_matrix_writes_every_cell)
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+static int setup(void** state){
+	myState.params = malloc(sizeof(quakeparms_t));
+	quakeparms_t *parms = myState.params;
+	parms->argc = 0;
+	parms->argv = NULL;
+	parms->basedir = QBASEDIR;
+	parms->memsize = (int)Memory_GetSize();
+	parms->membase = malloc((*parms).memsize);
+	Sys_Init();
+	Host_Init(parms);
+	return 0;
+}
+
+static int teardown(void** state){
+	Host_Shutdown();
+	quakeparms_t *parms = myState.params;
+	free(parms->membase);
+	free(parms);
+	return 0;
+}
+
+static const char* env_or(const char *name, const char *fallback){
+	const char *value = getenv(name);
+	return value && *value ? value : fallback;
+}
+
+static void test_timedemo_matrix_writes_every_cell(void** state){
+	(void)state;
+
+	assert_true(F_StartTimedemo(
+		env_or("FISH_TIMEDEMO_DEMO", "demo1"),
+		env_or("FISH_TIMEDEMO_CSV", "fish_timedemo.csv"),
+		getenv("FISH_TIMEDEMO_LENSES"),
+		getenv("FISH_TIMEDEMO_GLOBES"),
+		getenv("FISH_TIMEDEMO_MODES")));
+
+	int idle = 0;
+	double last = Sys_DoubleTime();
+	while (F_TimedemoRunning() && idle < MAX_IDLE_FRAMES) {
+		double now = Sys_DoubleTime();
+		Host_Frame(now - last);
+		last = now;
+		idle = cls.demoplayback ? 0 : idle + 1;
+	}
+
+	assert_false(F_TimedemoRunning());
+	assert_true(F_TimedemoCellsWritten() > 0);
+}
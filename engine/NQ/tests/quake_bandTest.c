@@ -0,0 +1,293 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmocka.h>
+
+#include <SDL_mutex.h>
+
+#include "quakedef.h"
+#include "d_local.h"
+#include "r_local.h"
+
+// Scans random sets of edges whole and in bands (r_bands), and checks that the
+// bands make the same spans, of the same surfaces, in the same passes as the
+// single scan.  Surfaces aren't drawn, their spans are recorded instead.
+
+#define WIDTH 320
+#define HEIGHT 200
+#define MAX_TEST_SURFACES 200
+#define NUM_SEEDS 500
+
+// what the scan needs from the rest of the renderer
+refdef_t r_refdef;
+cvar_t r_draworder = { "r_draworder", "0" };
+int r_surfalpha_flags;
+int r_drawnpolycount;
+BANDLOCAL int r_bmodelactive;
+
+void Con_Printf(const char *fmt, ...){
+	va_list argptr;
+
+	va_start(argptr, fmt);
+	vprintf(fmt, argptr);
+	va_end(argptr);
+}
+
+void Sys_Error(const char *error, ...){
+	va_list argptr;
+
+	va_start(argptr, error);
+	vprintf(error, argptr);
+	va_end(argptr);
+	fail_msg("Sys_Error");
+}
+
+void VID_LockBuffer(void){}
+void VID_UnlockBuffer(void){}
+void S_ExtraUpdate(void){}
+
+typedef struct {
+	int pass, surf, v, u, count;
+} spanrecord_t;
+
+typedef struct {
+	spanrecord_t *spans;
+	int count, size;
+} spanrecords_t;
+
+static struct {
+	edge_t edges[2*MAX_TEST_SURFACES];
+	surf_t surfaces[MAX_TEST_SURFACES+2];
+
+	// where the spans drawn go, and which pass drew them
+	spanrecords_t *records;
+	int pass;
+	SDL_mutex *lock;
+
+	// whether surfaces stay cached for the bands to draw side by side
+	qboolean cached;
+} bandtest;
+
+static int setup(void **state);
+static int teardown(void **state);
+static void test_bands_match_single_scan(void **state);
+
+static int scan(int seed, int bands, spanrecords_t *records);
+static void record_spans(const surf_t *base, const surf_t *end);
+static int compare_records(const void *a, const void *b);
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_bands_match_single_scan),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+static int setup(void **state) {
+	(void)state;
+
+	bandtest.lock = SDL_CreateMutex();
+	if (NULL == bandtest.lock) {
+		return -1;
+	}
+
+	r_refdef.vrect.x = 0;
+	r_refdef.vrect.y = 0;
+	r_refdef.vrect.width = WIDTH;
+	r_refdef.vrect.height = HEIGHT;
+	r_refdef.vrectright = WIDTH;
+	r_refdef.vrectbottom = HEIGHT;
+	r_surfalpha_flags = SURF_DRAWWATER | SURF_DRAWLAVA;
+
+	surfaces = bandtest.surfaces;
+	r_edges = bandtest.edges;
+	r_numedges = 2*MAX_TEST_SURFACES;
+	r_numsurfaces = MAX_TEST_SURFACES+2;
+	return 0;
+}
+
+static int teardown(void **state) {
+	(void)state;
+
+	SDL_DestroyMutex(bandtest.lock);
+	return 0;
+}
+
+// with surfaces cached for the whole frame or not, so both ways of drawing
+// the bands are covered
+static void test_bands_match_single_scan(void **state) {
+	const int bands[] = { 2, 3, 4, 8 };
+	spanrecords_t whole = {0}, banded = {0};
+	int i, seed;
+
+	(void)state;
+
+	for (i=0; i<(int)(sizeof(bands)/sizeof(bands[0])); ++i) {
+		for (seed=1; seed<=NUM_SEEDS; ++seed) {
+			bandtest.cached = seed & 1;
+			int found = scan(seed, 0, &whole);
+			assert_int_equal(scan(seed, bands[i], &banded), found);
+
+			assert_int_equal(banded.count, whole.count);
+			assert_memory_equal(banded.spans, whole.spans,
+				whole.count*sizeof(spanrecord_t));
+		}
+	}
+
+	free(whole.spans);
+	free(banded.spans);
+}
+
+// adds a surface between two edges to newedges and removeedges
+static void add_edge(edge_t *edge, int top, int bottom) {
+	edge_t **link = &newedges[top];
+
+	while (*link && (*link)->u < edge->u) {
+		link = &(*link)->next;
+	}
+	edge->next = *link;
+	*link = edge;
+	edge->nextremove = removeedges[bottom];
+	removeedges[bottom] = edge;
+}
+
+// scans a view of random surfaces, some of them fences and translucent, some
+// of their edges crossing, then draws the special surfaces as R_RenderView_
+// does; the spans drawn end up sorted in records
+static int scan(int seed, int bands, spanrecords_t *records) {
+	int i, numsurfaces, found;
+
+	r_bands.value = bands;
+	if (bands) {
+		assert_true(R_BandsActive());
+	}
+
+	srand(seed);
+	R_BeginEdgeFrame();
+	numsurfaces = 5 + rand() % (MAX_TEST_SURFACES - 5);
+	for (i=0; i<numsurfaces; ++i) {
+		surf_t *surf = &surfaces[2+i];
+		edge_t *left = edge_p++, *right = edge_p++;
+		int top = rand() % HEIGHT;
+		int bottom = top + rand() % (HEIGHT - top);
+		int lines = bottom - top + 1;
+		int x0 = rand() % WIDTH, x1 = x0 + 1 + rand() % (WIDTH - x0);
+		int e0 = rand() % WIDTH, e1 = e0 + 1 + rand() % (WIDTH - e0);
+		int kind = rand() % 10;
+
+		memset(surf, 0, sizeof(*surf));
+		surf->key = rand() % 1000;
+		surf->flags = kind < 5 ? 0
+			: kind < 7 ? SURF_DRAWFENCE
+			: kind < 8 ? SURF_DRAWWATER
+			: kind < 9 ? SURF_DRAWENTALPHA
+			: SURF_DRAWFENCE | SURF_DRAWENTALPHA;
+		surf->nearzi = rand();
+
+		if (rand() % 8 == 0) {
+			int swap = e0;
+			e0 = e1 - 1;
+			e1 = swap + 1;
+		}
+		memset(left, 0, sizeof(*left));
+		memset(right, 0, sizeof(*right));
+		left->u = (x0 << 20) + (rand() & 0xFFFFF);
+		right->u = (x1 << 20) + (rand() & 0xFFFFF);
+		left->u_step = ((long long)(e0 - x0) << 20) / lines;
+		right->u_step = ((long long)(e1 - x1) << 20) / lines;
+		left->surfs[1] = 2+i;
+		right->surfs[0] = 2+i;
+		add_edge(left, top, bottom);
+		add_edge(right, top, bottom);
+	}
+	surface_p = &surfaces[2+numsurfaces];
+	bmodel_surfaces = surface_p;
+
+	records->count = 0;
+	bandtest.records = records;
+	bandtest.pass = 0;
+	found = R_ScanEdges();
+	if (found & SURF_DRAWFENCE) {
+		bandtest.pass = 1;
+		R_DrawSpecialSpans(SURF_DRAWFENCE);
+	}
+	if (found & (r_surfalpha_flags | SURF_DRAWENTALPHA)) {
+		bandtest.pass = 2;
+		R_DrawSpecialSpans(r_surfalpha_flags | SURF_DRAWENTALPHA);
+	}
+
+	// bands draw their spans in no particular order
+	qsort(records->spans, records->count, sizeof(spanrecord_t), compare_records);
+	return found;
+}
+
+// mocks of the span drawing the scan hands its surfaces to
+void D_DrawSurfaces(qboolean sort_submodels) {
+	(void)sort_submodels;
+	record_spans(surfaces, surface_p);
+}
+
+qboolean D_SetupBandSurfaces(const byte *visible) {
+	(void)visible;
+	return bandtest.cached;
+}
+
+int D_DrawBandSurfaces(surf_t *bandsurfaces, surf_t *bmodels, surf_t *end,
+		qboolean sort_submodels) {
+	(void)bmodels;
+	(void)sort_submodels;
+	record_spans(bandsurfaces, end);
+	return 0;
+}
+
+static void record_spans(const surf_t *base, const surf_t *end) {
+	spanrecords_t *records = bandtest.records;
+	const surf_t *surf;
+	const espan_t *span;
+
+	SDL_LockMutex(bandtest.lock);
+	for (surf = &base[1]; surf < end; ++surf) {
+		for (span = surf->spans; span; span = span->pnext) {
+			if (records->count == records->size) {
+				records->size = records->size ? 2*records->size : 4096;
+				records->spans = realloc(records->spans,
+					records->size*sizeof(spanrecord_t));
+
+				// no asserts here, this can be a band's thread
+				if (NULL == records->spans) {
+					abort();
+				}
+			}
+			spanrecord_t *record = &records->spans[records->count++];
+			record->pass = bandtest.pass;
+			record->surf = surf - base;
+			record->v = span->v;
+			record->u = span->u;
+			record->count = span->count;
+		}
+	}
+	SDL_UnlockMutex(bandtest.lock);
+}
+
+static int compare_records(const void *a, const void *b) {
+	const spanrecord_t *ra = a, *rb = b;
+
+	if (ra->pass != rb->pass) {
+		return ra->pass - rb->pass;
+	}
+	if (ra->surf != rb->surf) {
+		return ra->surf - rb->surf;
+	}
+	if (ra->v != rb->v) {
+		return ra->v - rb->v;
+	}
+	if (ra->u != rb->u) {
+		return ra->u - rb->u;
+	}
+	return ra->count - rb->count;
+}
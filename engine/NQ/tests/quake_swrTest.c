@@ -32,9 +32,17 @@
 void __wrap_F_Init(void){}
 void __wrap_F_Shutdown(void){}
 void __wrap_F_RenderView(void){}
+void F_DemoStopped(void){}
+void F_DemoFailed(void){}
+void F_ScreenShotLens(void){}
+void F_SpeedsVidUpdate(double seconds){}
 
 double fisheye_plate_fov;
+double fisheye_plate_mipscale = 1;
 qboolean fisheye_enabled;
+const float *fisheye_pvs_origin;
+qboolean fisheye_capturing;
+qboolean fisheye_speeds;
 static int setup(void** state);
 static int teardown(void** state);
 
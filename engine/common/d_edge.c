@@ -20,10 +20,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #include <float.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "d_local.h"
 #include "quakedef.h"
 #include "r_local.h"
+#include "sys.h"
 
 #ifdef NQ_HACK
 #include "client.h"
@@ -36,6 +38,41 @@ float scale_for_mip;
 int screenwidth;
 int ubasestep, errorterm, erroradjustup, erroradjustdown;
 
+/*
+ * Everything the span drawers need for a surface, worked out by
+ * D_SetupSurface.  Drawing from a setup touches nothing shared but the
+ * screen and z-buffer, so bands of the view can draw the same surfaces on
+ * different threads.
+ */
+typedef enum {
+    DSURF_SKIP,			// completely transparent
+    DSURF_SKY,
+    DSURF_SOLID,		// background, or r_drawflat
+    DSURF_TURB,
+    DSURF_FENCE,
+    DSURF_TEXTURED
+} dsurfkind_t;
+
+typedef struct {
+    dsurfkind_t kind;
+    int color;
+    float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+    float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+    float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+    fixed16_t sadjust, tadjust, bbextents, bbextentt;
+    pixel_t *cacheblock;
+    int cachewidth, cacheheight;
+    const byte *transtable;
+    void (*turbspanfunc)(void);
+    surfcache_t *cache;		// NULL unless from the surface cache
+    surfcache_t **owner;	// where the cache is kept while it's valid
+    qboolean rebuilt;		// the cache had to be drawn again
+} dsurfsetup_t;
+
+// for the bands, indexed like surfaces[]
+static dsurfsetup_t *d_bandsetups;
+static int d_maxbandsetups;
+
 /*
 =============
 D_MipLevelForScale
@@ -71,14 +108,14 @@ D_DrawSolidSurface
 // FIXME: clean this up
 
 static void
-D_DrawSolidSurface(surf_t *surf, int color)
+D_DrawSolidSurface(espan_t *spans, int color)
 {
     espan_t *span;
     byte *pdest;
     int u, u2, pix;
 
     pix = (color << 24) | (color << 16) | (color << 8) | color;
-    for (span = surf->spans; span; span = span->pnext) {
+    for (span = spans; span; span = span->pnext) {
 	pdest = (byte *)d_viewbuffer + screenwidth * span->v;
 	u = span->u;
 	u2 = span->u + span->count - 1;
@@ -150,41 +187,65 @@ D_CalcGradients(msurface_t *pface)
     bbextentt = ((pface->extents[1] << 16) >> miplevel) - 1;
 }
 
-void
-D_DrawSurface(surf_t *surf, const entity_t *entity, vec3_t world_transformed_modelorg)
+
+
+/*
+==============
+D_SetupSurface
+==============
+*/
+static void
+D_SetupSurface(surf_t *surf, const entity_t *entity,
+	       vec3_t world_transformed_modelorg, dsurfsetup_t *setup)
 {
     msurface_t *pface;
     surfcache_t *pcurrentcache;
     vec3_t local_modelorg;
+    int misses;
 
-    d_zistepu = surf->d_zistepu;
-    d_zistepv = surf->d_zistepv;
-    d_ziorigin = surf->d_ziorigin;
+    setup->d_zistepu = surf->d_zistepu;
+    setup->d_zistepv = surf->d_zistepv;
+    setup->d_ziorigin = surf->d_ziorigin;
+    setup->transtable = surf->alphatable;
+    setup->cache = NULL;
 
     if (surf->flags & SURF_DRAWSKY) {
         if (!r_skymade) {
             R_MakeSky();
         }
+        setup->kind = DSURF_SKY;
+        return;
+    }
 
-        D_DrawSkyScans8(surf->spans);
-        D_DrawZSpans(surf->spans);
-    } else if (surf->flags & SURF_DRAWBACKGROUND) {
+    if (surf->flags & SURF_DRAWBACKGROUND) {
         // set up a gradient for the background surface that places it
         // effectively at infinity distance from the viewpoint
-        d_zistepu = 0;
-        d_zistepv = 0;
-        d_ziorigin = -0.9;
+        setup->d_zistepu = 0;
+        setup->d_zistepv = 0;
+        setup->d_ziorigin = -0.9;
+        setup->color = (int)r_clearcolor.value & 0xFF;
+        setup->kind = DSURF_SOLID;
+        return;
+    }
+
+    if ((surf->flags & SURF_DRAWTURB)
+        && (surf->flags & r_surfalpha_flags) && !surf->alphatable) {
+        setup->kind = DSURF_SKIP; // Completely transparent
+        return;
+    }
 
-        D_DrawSolidSurface(surf, (int)r_clearcolor.value & 0xFF);
-        D_DrawZSpans(surf->spans);
-    } else if (surf->flags & SURF_DRAWTURB) {
+    if (surf->insubmodel) {
+        // FIXME: we don't want to do all this for every polygon!
+        // TODO: store once at start of frame
+        VectorSubtract(r_origin, entity->origin, local_modelorg);
+        TransformVector(local_modelorg, transformed_modelorg);
 
-        // Set the translucency table to trigger alpha blending
-        if ((surf->flags & r_surfalpha_flags) && !surf->alphatable)
-            return; // Completely transparent
-        r_transtable = surf->alphatable;
+        R_RotateBmodel(entity); // FIXME: don't mess with the frustum
+    }
 
-        pface = surf->data;
+    pface = surf->data;
+    if (surf->flags & SURF_DRAWTURB) {
+        setup->kind = DSURF_TURB;
         miplevel = 0;
         cacheblock = (pixel_t *)((byte *)pface->texinfo->texture + pface->texinfo->texture->offsets[0]);
         cachewidth = pface->texinfo->texture->width;
@@ -192,170 +253,233 @@ D_DrawSurface(surf_t *surf, const entity_t *entity, vec3_t world_transformed_mod
 
         /* Set the appropriate span drawing function */
         if (cachewidth == 64 && cacheheight == 64) {
-            if (r_transtable)
-                D_DrawTurbSpanFunc = D_DrawTurbulentTranslucent8Span;
+            if (setup->transtable)
+                setup->turbspanfunc = D_DrawTurbulentTranslucent8Span;
             else
-                D_DrawTurbSpanFunc = D_DrawTurbulent8Span;
+                setup->turbspanfunc = D_DrawTurbulent8Span;
         } else {
-            if (r_transtable)
-                D_DrawTurbSpanFunc = D_DrawTurbulentTranslucent8Span_NonStd;
+            if (setup->transtable)
+                setup->turbspanfunc = D_DrawTurbulentTranslucent8Span_NonStd;
             else
-                D_DrawTurbSpanFunc = D_DrawTurbulent8Span_NonStd;
-        }
-
-            if (surf->insubmodel) {
-            // FIXME: we don't want to do all this for every polygon!
-            // TODO: store once at start of frame
-            VectorSubtract(r_origin, entity->origin, local_modelorg);
-            TransformVector(local_modelorg, transformed_modelorg);
-
-            R_RotateBmodel(entity); // FIXME: don't mess with the frustum
-        }
-
-        D_CalcGradients(pface);
-        Turbulent8(surf->spans);
-
-        // Only need to fill Z for opaque surfaces
-        if (!r_transtable)
-            D_DrawZSpans(surf->spans);
-
-        if (surf->insubmodel) {
-            //
-            // restore the old drawing state
-            // FIXME: we don't want to do this every time!
-            // TODO: speed up
-            //
-            VectorCopy(world_transformed_modelorg, transformed_modelorg);
-            VectorCopy(base_vpn, vpn);
-            VectorCopy(base_vup, vup);
-            VectorCopy(base_vright, vright);
-            VectorCopy(base_modelorg, modelorg);
-            R_TransformFrustum();
-        }
-    } else if (surf->flags & SURF_DRAWFENCE) {
-        if (surf->insubmodel) {
-            // FIXME: we don't want to do all this for every polygon!
-            // TODO: store once at start of frame
-            VectorSubtract(r_origin, entity->origin, local_modelorg);
-            TransformVector(local_modelorg, transformed_modelorg);
-
-            R_RotateBmodel(entity); // FIXME: don't mess with the frustum
+                setup->turbspanfunc = D_DrawTurbulent8Span_NonStd;
         }
-
-        r_transtable = surf->alphatable;
-        pface = surf->data;
+    } else {
+        setup->kind = (surf->flags & SURF_DRAWFENCE) ? DSURF_FENCE : DSURF_TEXTURED;
         miplevel = D_MipLevelForScale(surf->nearzi * scale_for_mip * pface->texinfo->mipadjust);
 
         // FIXME: make this passed in to D_CacheSurface
+        misses = d_surfcache_stats.misses;
         pcurrentcache = D_CacheSurface(entity, pface, miplevel);
+        setup->cache = pcurrentcache;
+        setup->owner = pcurrentcache->owner;
+        setup->rebuilt = d_surfcache_stats.misses != misses;
 
         cacheblock = (pixel_t *)pcurrentcache->data;
         cachewidth = pcurrentcache->width;
+    }
 
-        D_CalcGradients(pface);
-        if (r_transtable) {
-            D_DrawSpans8_Fence_Translucent(surf->spans);
-        } else {
-            D_DrawSpans8_Fence(surf->spans);
-        }
+    D_CalcGradients(pface);
+
+    setup->d_sdivzstepu = d_sdivzstepu;
+    setup->d_tdivzstepu = d_tdivzstepu;
+    setup->d_sdivzstepv = d_sdivzstepv;
+    setup->d_tdivzstepv = d_tdivzstepv;
+    setup->d_sdivzorigin = d_sdivzorigin;
+    setup->d_tdivzorigin = d_tdivzorigin;
+    setup->sadjust = sadjust;
+    setup->tadjust = tadjust;
+    setup->bbextents = bbextents;
+    setup->bbextentt = bbextentt;
+    setup->cacheblock = cacheblock;
+    setup->cachewidth = cachewidth;
+    setup->cacheheight = cacheheight;
+
+    if (surf->insubmodel) {
+        //
+        // restore the old drawing state
+        // FIXME: we don't want to do this every time!
+        // TODO: speed up
+        //
+        VectorCopy(world_transformed_modelorg, transformed_modelorg);
+        VectorCopy(base_vpn, vpn);
+        VectorCopy(base_vup, vup);
+        VectorCopy(base_vright, vright);
+        VectorCopy(base_modelorg, modelorg);
+        R_TransformFrustum();
+    }
+}
 
-        if (surf->insubmodel) {
-            //
-            // restore the old drawing state
-            // FIXME: we don't want to do this every time!
-            // TODO: speed up
-            //
-            VectorCopy(world_transformed_modelorg, transformed_modelorg);
-            VectorCopy(base_vpn, vpn);
-            VectorCopy(base_vup, vup);
-            VectorCopy(base_vright, vright);
-            VectorCopy(base_modelorg, modelorg);
-            R_TransformFrustum();
-        }
-    } else {
-        if (surf->insubmodel) {
-            // FIXME: we don't want to do all this for every polygon!
-            // TODO: store once at start of frame
-            VectorSubtract(r_origin, entity->origin, local_modelorg);
-            TransformVector(local_modelorg, transformed_modelorg);
+#ifdef R_THREADED
+/*
+==============
+D_PrebuildSurfaces
 
-            R_RotateBmodel(entity); // FIXME: don't mess with the frustum
-        }
+Builds the caches of the surfaces about to be drawn on the worker threads,
+so D_SetupSurface finds them ready.  Only the surfaces marked in visible
+(indexed like surfaces[]) if it's given, else those with spans.
+==============
+*/
+static void
+D_PrebuildSurfaces(const byte *visible)
+{
+    const entity_t *entity;
+    surf_t *surf;
+    msurface_t *pface;
+    int lmiplevel;
 
-        pface = surf->data;
-        miplevel = D_MipLevelForScale(surf->nearzi * scale_for_mip * pface->texinfo->mipadjust);
+    if (!D_BeginSurfaceBuilds())
+	return;
+
+    for (surf = &surfaces[1]; surf < surface_p; surf++) {
+	if (visible ? !visible[surf - surfaces] : !surf->spans)
+	    continue;
+	if (surf->flags & (SURF_DRAWSKY | SURF_DRAWBACKGROUND | SURF_DRAWTURB))
+	    continue;
+
+	entity = surf->insubmodel ? surf->entity : &r_worldentity;
+	pface = surf->data;
+	lmiplevel = D_MipLevelForScale(surf->nearzi * scale_for_mip
+				       * pface->texinfo->mipadjust);
+	if (!D_QueueSurface(entity, pface, lmiplevel))
+	    break;
+    }
 
-        // FIXME: make this passed in to D_CacheSurface
-        pcurrentcache = D_CacheSurface(entity, pface, miplevel);
+    D_BuildSurfaces();
+}
+#endif
 
-        cacheblock = (pixel_t *)pcurrentcache->data;
-        cachewidth = pcurrentcache->width;
+/*
+==============
+D_DrawSurfaceSpans
+==============
+*/
+static void
+D_DrawSurfaceSpans(espan_t *spans, const dsurfsetup_t *setup)
+{
+    d_zistepu = setup->d_zistepu;
+    d_zistepv = setup->d_zistepv;
+    d_ziorigin = setup->d_ziorigin;
+
+    switch (setup->kind) {
+    case DSURF_SKIP:
+        return;
+    case DSURF_SKY:
+        D_DrawSkyScans8(spans);
+        D_DrawZSpans(spans);
+        return;
+    case DSURF_SOLID:
+        D_DrawSolidSurface(spans, setup->color);
+        D_DrawZSpans(spans);
+        return;
+    default:
+        break;
+    }
 
-        D_CalcGradients(pface);
+    d_sdivzstepu = setup->d_sdivzstepu;
+    d_tdivzstepu = setup->d_tdivzstepu;
+    d_sdivzstepv = setup->d_sdivzstepv;
+    d_tdivzstepv = setup->d_tdivzstepv;
+    d_sdivzorigin = setup->d_sdivzorigin;
+    d_tdivzorigin = setup->d_tdivzorigin;
+    sadjust = setup->sadjust;
+    tadjust = setup->tadjust;
+    bbextents = setup->bbextents;
+    bbextentt = setup->bbextentt;
+    cacheblock = setup->cacheblock;
+    cachewidth = setup->cachewidth;
+    cacheheight = setup->cacheheight;
+    r_transtable = setup->transtable;
+
+    if (setup->kind == DSURF_TURB) {
+        D_DrawTurbSpanFunc = setup->turbspanfunc;
+        Turbulent8(spans);
 
-        r_transtable = surf->alphatable;
+        // Only need to fill Z for opaque surfaces
+        if (!r_transtable)
+            D_DrawZSpans(spans);
+    } else if (setup->kind == DSURF_FENCE) {
         if (r_transtable) {
-            D_DrawSpans8_Translucent(surf->spans);
+            D_DrawSpansFenceTranslucent(spans);
         } else {
-            D_DrawSpans(surf->spans);
-            D_DrawZSpans(surf->spans);
+            D_DrawSpansFence(spans);
         }
-
-        if (surf->insubmodel) {
-            //
-            // restore the old drawing state
-            // FIXME: we don't want to do this every time!
-            // TODO: speed up
-            //
-            VectorCopy(world_transformed_modelorg, transformed_modelorg);
-            VectorCopy(base_vpn, vpn);
-            VectorCopy(base_vup, vup);
-            VectorCopy(base_vright, vright);
-            VectorCopy(base_modelorg, modelorg);
-            R_TransformFrustum();
+    } else {
+        if (r_transtable) {
+            D_DrawSpansTranslucent(spans);
+        } else {
+            D_DrawSpans(spans);
+            D_DrawZSpans(spans);
         }
     }
+}
+
+void
+D_DrawSurface(surf_t *surf, const entity_t *entity, vec3_t world_transformed_modelorg)
+{
+    dsurfsetup_t setup;
 
+    D_SetupSurface(surf, entity, world_transformed_modelorg, &setup);
+    if (setup.kind == DSURF_SKIP)
+        return;
+
+    D_DrawSurfaceSpans(surf->spans, &setup);
     r_drawnpolycount++;
 }
 
 
 /*
 ==============
-D_DrawSurfaces
+D_DrawListedSurface
+
+Draws a surface of D_DrawSurfaceList, returning 1 if it was drawn from a setup
 ==============
 */
-void
-D_DrawSurfaces(qboolean sort_submodels)
+static inline int
+D_DrawListedSurface(surf_t *surf, const entity_t *entity, surf_t *surfs,
+		    const dsurfsetup_t *setups,
+		    vec3_t world_transformed_modelorg)
 {
-    const entity_t *entity;
-    surf_t *surf;
-    vec3_t world_transformed_modelorg;
+    const dsurfsetup_t *setup;
 
-    TransformVector(modelorg, transformed_modelorg);
-    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+    if (!setups) {
+	D_DrawSurface(surf, entity, world_transformed_modelorg);
+	return 0;
+    }
 
-// TODO: could preset a lot of this at mode set time
-    if (r_drawflat.value) {
-	for (surf = &surfaces[1]; surf < surface_p; surf++) {
-	    if (!surf->spans)
-		continue;
+    setup = &setups[surf - surfs];
+    if (setup->kind == DSURF_SKIP)
+	return 0;
 
-	    d_zistepu = surf->d_zistepu;
-	    d_zistepv = surf->d_zistepv;
-	    d_ziorigin = surf->d_ziorigin;
+    D_DrawSurfaceSpans(surf->spans, setup);
+    return 1;
+}
 
-	    D_DrawSolidSurface(surf, (intptr_t)surf->data & 0xFF);
-	    D_DrawZSpans(surf->spans);
-	}
-    } else if (sort_submodels && bmodel_surfaces < surface_p) {
+/*
+==============
+D_DrawSurfaceList
+
+Draws surfs[1] up to end back to front, each set up as it's drawn or from
+the setups already made for them
+==============
+*/
+static int
+D_DrawSurfaceList(surf_t *surfs, surf_t *bmodels, surf_t *end,
+		  qboolean sort_submodels, const dsurfsetup_t *setups,
+		  vec3_t world_transformed_modelorg)
+{
+    const entity_t *entity;
+    surf_t *surf;
+    int drawn;
+
+    drawn = 0;
+    if (sort_submodels && bmodels < end) {
         surf_t bsurfs;
         surf_t *surf2;
 
         /* Sort bmodel surfaces by depth */
         bsurfs.nearzi = FLT_MAX;
         bsurfs.next = bsurfs.prev = &bsurfs;
-        for (surf = bmodel_surfaces; surf < surface_p; surf++) {
+        for (surf = bmodels; surf < end; surf++) {
             if (!surf->spans)
                 continue;
             surf2 = bsurfs.next;
@@ -370,22 +494,160 @@ D_DrawSurfaces(qboolean sort_submodels)
         /* Draw the world back to front, inserting bmodel surfs at the correct depth */
         bsurfs.nearzi = -FLT_MAX;
         surf2 = bsurfs.next;
-	for (surf = bmodel_surfaces - 1; surf >= &surfaces[1]; surf--) {
+	for (surf = bmodels - 1; surf >= &surfs[1]; surf--) {
             while (surf2->nearzi > surf->nearzi) {
-                D_DrawSurface(surf2, surf2->entity, world_transformed_modelorg);
+                drawn += D_DrawListedSurface(surf2, surf2->entity, surfs, setups,
+					     world_transformed_modelorg);
                 surf2 = surf2->next;
             }
             if (!surf->spans)
 		continue;
-            D_DrawSurface(surf, &r_worldentity, world_transformed_modelorg);
+            drawn += D_DrawListedSurface(surf, &r_worldentity, surfs, setups,
+					 world_transformed_modelorg);
         }
     } else {
         /* Draw the world, back to front */
-	for (surf = surface_p - 1; surf >= &surfaces[1]; surf--) {
+	for (surf = end - 1; surf >= &surfs[1]; surf--) {
 	    if (!surf->spans)
 		continue;
             entity = surf->insubmodel ? surf->entity : &r_worldentity;
-            D_DrawSurface(surf, entity, world_transformed_modelorg);
+            drawn += D_DrawListedSurface(surf, entity, surfs, setups,
+					 world_transformed_modelorg);
         }
     }
+
+    return drawn;
+}
+
+
+/*
+==============
+D_DrawSurfaces
+==============
+*/
+void
+D_DrawSurfaces(qboolean sort_submodels)
+{
+    surf_t *surf;
+    vec3_t world_transformed_modelorg;
+
+    TransformVector(modelorg, transformed_modelorg);
+    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+
+// TODO: could preset a lot of this at mode set time
+    if (r_drawflat.value) {
+	for (surf = &surfaces[1]; surf < surface_p; surf++) {
+	    if (!surf->spans)
+		continue;
+
+	    d_zistepu = surf->d_zistepu;
+	    d_zistepv = surf->d_zistepv;
+	    d_ziorigin = surf->d_ziorigin;
+
+	    D_DrawSolidSurface(surf->spans, (intptr_t)surf->data & 0xFF);
+	    D_DrawZSpans(surf->spans);
+	}
+    } else {
+#ifdef R_THREADED
+	D_PrebuildSurfaces(NULL);
+#endif
+	D_DrawSurfaceList(surfaces, bmodel_surfaces, surface_p, sort_submodels,
+			  NULL, world_transformed_modelorg);
+    }
+}
+
+
+/*
+==============
+D_SetupBandSurfaces
+
+Sets up every surface with spans in any band of the view, from the frame's
+surfaces.  This is where surfaces get cached, so it has to happen before the
+bands are drawn, and on the thread that owns the surface cache.
+
+Returns false if the setups can't be drawn from: a surface cached later on
+pushed out the cache of an earlier one, or drew over it for another entity.
+Then the bands have to be drawn one after the other with D_DrawSurfaces.
+==============
+*/
+qboolean
+D_SetupBandSurfaces(const byte *visible)
+{
+    int numsurfaces;
+    const entity_t *entity;
+    surf_t *surf, *other;
+    dsurfsetup_t *setup;
+    vec3_t world_transformed_modelorg;
+
+    numsurfaces = surface_p - surfaces;
+    if (numsurfaces > d_maxbandsetups) {
+	d_bandsetups = realloc(d_bandsetups, numsurfaces * sizeof(dsurfsetup_t));
+	if (!d_bandsetups)
+	    Sys_Error("%s: out of memory", __func__);
+	d_maxbandsetups = numsurfaces;
+    }
+
+    TransformVector(modelorg, transformed_modelorg);
+    VectorCopy(transformed_modelorg, world_transformed_modelorg);
+
+#ifdef R_THREADED
+    if (!r_drawflat.value)
+	D_PrebuildSurfaces(visible);
+#endif
+
+    for (surf = &surfaces[1]; surf < surface_p; surf++) {
+	if (!visible[surf - surfaces])
+	    continue;
+
+	setup = &d_bandsetups[surf - surfaces];
+	if (r_drawflat.value) {
+	    setup->d_zistepu = surf->d_zistepu;
+	    setup->d_zistepv = surf->d_zistepv;
+	    setup->d_ziorigin = surf->d_ziorigin;
+	    setup->color = (intptr_t)surf->data & 0xFF;
+	    setup->cache = NULL;
+	    setup->kind = DSURF_SOLID;
+	    continue;
+	}
+
+	entity = surf->insubmodel ? surf->entity : &r_worldentity;
+	D_SetupSurface(surf, entity, world_transformed_modelorg, setup);
+
+	// instances of a brush model share their surfaces' caches
+	if (setup->cache && setup->rebuilt && entity != &r_worldentity) {
+	    for (other = bmodel_surfaces; other < surf; other++) {
+		if (visible[other - surfaces]
+		    && d_bandsetups[other - surfaces].cache == setup->cache)
+		    return false;
+	    }
+	}
+    }
+
+    for (surf = &surfaces[1]; surf < surface_p; surf++) {
+	setup = &d_bandsetups[surf - surfaces];
+	if (visible[surf - surfaces] && setup->cache
+	    && *setup->owner != setup->cache)
+	    return false;
+    }
+
+    return true;
+}
+
+
+/*
+==============
+D_DrawBandSurfaces
+
+D_DrawSurfaces for a band's copy of the frame's surfaces, from the setups
+made by D_SetupBandSurfaces.  Safe to call for several bands at once.
+Returns the number of surfaces drawn.
+==============
+*/
+int
+D_DrawBandSurfaces(surf_t *bandsurfaces, surf_t *bmodels, surf_t *end,
+		   qboolean sort_submodels)
+{
+    return D_DrawSurfaceList(bandsurfaces, bmodels, end,
+			     sort_submodels && !r_drawflat.value,
+			     d_bandsetups, NULL);
 }
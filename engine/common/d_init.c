@@ -27,6 +27,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 static cvar_t d_subdiv16 = { "d_subdiv16", "1" };
 static cvar_t d_mipcap = { "d_mipcap", "0" };
 static cvar_t d_mipscale = { "d_mipscale", "1" };
+static cvar_t d_simdspans = { "d_simdspans", "1" };
+static cvar_t d_simdpolysets = { "d_simdpolysets", "1" };
+static cvar_t d_simdparticles = { "d_simdparticles", "1" };
 
 surfcache_t *d_initial_rover;
 qboolean d_roverwrapped;
@@ -36,6 +39,13 @@ float d_scalemip[NUM_MIPS - 1];
 static float basemip[NUM_MIPS - 1] = { 1.0, 0.5 * 0.8, 0.25 * 0.8 };
 
 void (*D_DrawSpans)(espan_t *pspan);
+void (*D_DrawSpansTranslucent)(espan_t *pspan);
+void (*D_DrawSpansFence)(espan_t *pspan);
+void (*D_DrawSpansFenceTranslucent)(espan_t *pspan);
+void (*D_RasterizeAliasPoly)(void);
+#ifndef USE_X86_ASM
+int (*D_ProjectParticles)(const particleset_t *set, dparticle_t *projected);
+#endif
 
 /*
 ===============
@@ -51,6 +61,12 @@ D_Init(void)
     Cvar_RegisterVariable(&d_subdiv16);
     Cvar_RegisterVariable(&d_mipcap);
     Cvar_RegisterVariable(&d_mipscale);
+    Cvar_RegisterVariable(&d_simdspans);
+    Cvar_RegisterVariable(&d_simdpolysets);
+    Cvar_RegisterVariable(&d_simdparticles);
+#ifdef R_THREADED
+    Cvar_RegisterVariable(&d_cachethreads);
+#endif
 
     r_recursiveaffinetriangles = true;
     r_pixbytes = 1;
@@ -118,6 +134,7 @@ void
 D_SetupFrame(void)
 {
     int i;
+    float mipscale;
 
     if (r_dowarp)
 	d_viewbuffer = r_warpbuffer;
@@ -138,8 +155,15 @@ D_SetupFrame(void)
     else if (d_minmip < 0)
 	d_minmip = 0;
 
+// fisheye plates that the lens shrinks can use smaller mips
+    extern qboolean fisheye_enabled;
+    extern double fisheye_plate_mipscale;
+    mipscale = d_mipscale.value;
+    if (fisheye_enabled)
+	mipscale *= fisheye_plate_mipscale;
+
     for (i = 0; i < (NUM_MIPS - 1); i++)
-	d_scalemip[i] = basemip[i] * d_mipscale.value;
+	d_scalemip[i] = basemip[i] * mipscale;
 
 #ifdef USE_X86_ASM
     if (d_subdiv16.value)
@@ -148,6 +172,28 @@ D_SetupFrame(void)
 	D_DrawSpans = D_DrawSpans8;
 #else
     D_DrawSpans = D_DrawSpans8;
+#endif
+    D_DrawSpansTranslucent = D_DrawSpans8_Translucent;
+    D_DrawSpansFence = D_DrawSpans8_Fence;
+    D_DrawSpansFenceTranslucent = D_DrawSpans8_Fence_Translucent;
+
+#ifdef D_SIMD_SPANS
+    if (d_simdspans.value)
+	D_SIMDSpanDrawers();
+#endif
+
+    D_RasterizeAliasPoly = D_RasterizeAliasPolySmooth;
+#ifdef D_SIMD_POLYSETS
+    if (d_simdpolysets.value)
+	D_SIMDPolysetRasterizer();
+#endif
+
+#ifndef USE_X86_ASM
+    D_ProjectParticles = D_ProjectParticleSet;
+#endif
+#ifdef D_SIMD_PARTICLES
+    if (d_simdparticles.value)
+	D_SIMDParticleProjection();
 #endif
 }
 
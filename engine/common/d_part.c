@@ -19,8 +19,12 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // d_part.c: software driver module for drawing particles
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "quakedef.h"
 #include "d_local.h"
+#include "sys.h"
 
 
 /*
@@ -47,46 +51,86 @@ D_StartParticles(void)
 }
 
 
+/*
+ * Particles are projected a whole set at a time, then binned by the tile of
+ * the view they land in and drawn a tile at a time, so the parts of the
+ * z-buffer and the view each tile's particles touch stay in the cache.  They
+ * keep their order within a tile.
+ */
+#define PARTICLE_TILE_SHIFT	5
+#define PARTICLE_TILES_WIDE	((MAXWIDTH >> PARTICLE_TILE_SHIFT) + 1)
+#define PARTICLE_TILES_HIGH	((MAXHEIGHT >> PARTICLE_TILE_SHIFT) + 1)
+
 #ifndef USE_X86_ASM
 
+static dparticle_t *dparticles;
+static int *binned;
+static int maxprojected;
+static int tilestart[PARTICLE_TILES_WIDE * PARTICLE_TILES_HIGH + 1];
+
 /*
 ==============
-D_DrawParticle
+D_ProjectParticleSet
+
+Projects the particles that land in the view, returning how many do
 ==============
 */
-void
-D_DrawParticle(particle_t *pparticle)
+int
+D_ProjectParticleSet(const particleset_t *set, dparticle_t *projected)
 {
     vec3_t local, transformed;
     float zi;
-    byte *pdest;
-    short *pz;
-    int i, izi, pix, count, u, v;
-
-// transform point
-    VectorSubtract(pparticle->org, r_origin, local);
-
-    transformed[0] = DotProduct(local, r_pright);
-    transformed[1] = DotProduct(local, r_pup);
-    transformed[2] = DotProduct(local, r_ppn);
+    int i, u, v, count;
+
+    count = 0;
+    for (i = 0; i < set->count; i++) {
+	// transform point
+	local[0] = set->local[0][i];
+	local[1] = set->local[1][i];
+	local[2] = set->local[2][i];
+
+	transformed[0] = DotProduct(local, r_pright);
+	transformed[1] = DotProduct(local, r_pup);
+	transformed[2] = DotProduct(local, r_ppn);
+
+	if (transformed[2] < PARTICLE_Z_CLIP)
+	    continue;
+
+	// project the point
+	zi = 1.0 / transformed[2];
+	u = (int)(xcenter + zi * transformed[0] + 0.5);
+	v = (int)(ycenter - zi * transformed[1] + 0.5);
+
+	if ((v > d_vrectbottom_particle) ||
+	    (u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx)) {
+	    continue;
+	}
 
-    if (transformed[2] < PARTICLE_Z_CLIP)
-	return;
+	projected[count].u = u;
+	projected[count].v = v;
+	projected[count].izi = (int)(zi * 0x8000);
+	projected[count].color = set->color[i];
+	count++;
+    }
 
-// project the point
-// FIXME: preadjust xcenter and ycenter
-    zi = 1.0 / transformed[2];
-    u = (int)(xcenter + zi * transformed[0] + 0.5);
-    v = (int)(ycenter - zi * transformed[1] + 0.5);
+    return count;
+}
 
-    if ((v > d_vrectbottom_particle) ||
-	(u > d_vrectright_particle) || (v < d_vrecty) || (u < d_vrectx)) {
-	return;
-    }
+/*
+==============
+D_DrawParticlePixels
+==============
+*/
+static void
+D_DrawParticlePixels(const dparticle_t *particle)
+{
+    byte *pdest;
+    short *pz;
+    int i, izi, pix, count;
 
-    pz = d_pzbuffer + (d_zwidth * v) + u;
-    pdest = d_viewbuffer + d_scantable[v] + u;
-    izi = (int)(zi * 0x8000);
+    pz = d_pzbuffer + (d_zwidth * particle->v) + particle->u;
+    pdest = d_viewbuffer + d_scantable[particle->v] + particle->u;
+    izi = particle->izi;
 
     pix = izi >> d_pix_shift;
 
@@ -95,94 +139,76 @@ D_DrawParticle(particle_t *pparticle)
     else if (pix > d_pix_max)
 	pix = d_pix_max;
 
-    switch (pix) {
-    case 1:
-	count = 1 << d_y_aspect_shift;
-
-	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
-	    if (pz[0] <= izi) {
-		pz[0] = izi;
-		pdest[0] = pparticle->color;
-	    }
-	}
-	break;
-
-    case 2:
-	count = 2 << d_y_aspect_shift;
-
-	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
-	    if (pz[0] <= izi) {
-		pz[0] = izi;
-		pdest[0] = pparticle->color;
-	    }
-
-	    if (pz[1] <= izi) {
-		pz[1] = izi;
-		pdest[1] = pparticle->color;
-	    }
-	}
-	break;
-
-    case 3:
-	count = 3 << d_y_aspect_shift;
-
-	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
-	    if (pz[0] <= izi) {
-		pz[0] = izi;
-		pdest[0] = pparticle->color;
-	    }
-
-	    if (pz[1] <= izi) {
-		pz[1] = izi;
-		pdest[1] = pparticle->color;
-	    }
+    count = pix << d_y_aspect_shift;
 
-	    if (pz[2] <= izi) {
-		pz[2] = izi;
-		pdest[2] = pparticle->color;
+    for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
+	for (i = 0; i < pix; i++) {
+	    if (pz[i] <= izi) {
+		pz[i] = izi;
+		pdest[i] = particle->color;
 	    }
 	}
-	break;
-
-    case 4:
-	count = 4 << d_y_aspect_shift;
-
-	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
-	    if (pz[0] <= izi) {
-		pz[0] = izi;
-		pdest[0] = pparticle->color;
-	    }
+    }
+}
 
-	    if (pz[1] <= izi) {
-		pz[1] = izi;
-		pdest[1] = pparticle->color;
-	    }
+#endif /* USE_X86_ASM */
 
-	    if (pz[2] <= izi) {
-		pz[2] = izi;
-		pdest[2] = pparticle->color;
-	    }
+/*
+==============
+D_DrawParticles
+==============
+*/
+void
+D_DrawParticles(const particleset_t *set)
+{
+#ifdef USE_X86_ASM
+    particle_t particle;
+    int i;
+
+    for (i = 0; i < set->count; i++) {
+	particle.org[0] = set->org[0][i];
+	particle.org[1] = set->org[1][i];
+	particle.org[2] = set->org[2][i];
+	particle.color = set->color[i];
+	D_DrawParticle(&particle);
+    }
+#else
+    int i, count, tile, tileswide, numtiles;
+
+    if (set->count > maxprojected) {
+	free(dparticles);
+	free(binned);
+	dparticles = malloc(set->count * sizeof(dparticle_t));
+	binned = malloc(set->count * sizeof(int));
+	if (!dparticles || !binned)
+	    Sys_Error("%s: out of memory", __func__);
+	maxprojected = set->count;
+    }
 
-	    if (pz[3] <= izi) {
-		pz[3] = izi;
-		pdest[3] = pparticle->color;
-	    }
-	}
-	break;
+    count = D_ProjectParticles(set, dparticles);
+    if (!count)
+	return;
 
-    default:
-	count = pix << d_y_aspect_shift;
+    tileswide = ((d_vrectright_particle - d_vrectx) >> PARTICLE_TILE_SHIFT) + 1;
+    numtiles = tileswide *
+	(((d_vrectbottom_particle - d_vrecty) >> PARTICLE_TILE_SHIFT) + 1);
 
-	for (; count; count--, pz += d_zwidth, pdest += screenwidth) {
-	    for (i = 0; i < pix; i++) {
-		if (pz[i] <= izi) {
-		    pz[i] = izi;
-		    pdest[i] = pparticle->color;
-		}
-	    }
-	}
-	break;
+    // count the particles in each tile, then sort them by tile
+    memset(tilestart, 0, (numtiles + 1) * sizeof(int));
+    for (i = 0; i < count; i++) {
+	tile = ((dparticles[i].v - d_vrecty) >> PARTICLE_TILE_SHIFT) * tileswide +
+	    ((dparticles[i].u - d_vrectx) >> PARTICLE_TILE_SHIFT);
+	tilestart[tile + 1]++;
+    }
+    for (tile = 0; tile < numtiles; tile++)
+	tilestart[tile + 1] += tilestart[tile];
+    for (i = 0; i < count; i++) {
+	tile = ((dparticles[i].v - d_vrecty) >> PARTICLE_TILE_SHIFT) * tileswide +
+	    ((dparticles[i].u - d_vrectx) >> PARTICLE_TILE_SHIFT);
+	binned[tilestart[tile]++] = i;
     }
-}
 
-#endif /* USE_X86_ASM */
+    for (i = 0; i < count; i++)
+	D_DrawParticlePixels(&dparticles[binned[i]]);
+#endif
+}
@@ -0,0 +1,162 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_part_simd.c: AVX2 particle projection
+
+/*
+ * Eight particles at a time are rotated into the view, clipped and
+ * projected, then the ones that land in it are written out in order.  The
+ * arithmetic is D_ProjectParticleSet's, done in the same order: the rounding
+ * to the nearest pixel is done in double as C does it, so the same pixels
+ * come out.
+ */
+
+#include "quakedef.h"
+#include "d_local.h"
+
+#ifdef D_SIMD_PARTICLES
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+==============
+D_RoundParticle
+
+(int)(x + 0.5), with the add done in double
+==============
+*/
+static inline AVX2 __m256i
+D_RoundParticle(__m256 x)
+{
+    __m128i lo, hi;
+    __m256d half;
+
+    half = _mm256_set1_pd(0.5);
+    lo = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), half));
+    hi = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), half));
+
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+/*
+==============
+D_ProjectParticles_AVX2
+==============
+*/
+AVX2 int
+D_ProjectParticles_AVX2(const particleset_t *set, dparticle_t *projected)
+{
+    __m256 x, y, z, t0, t1, t2, zi, rows[3][3];
+    __m256i u, v, izi, outside;
+    float padded[3][8];
+    int i, j, k, lanes, visible, count;
+    int pu[8], pv[8], pizi[8];
+    const float *local[3];
+
+    for (j = 0; j < 3; j++) {
+	rows[0][j] = _mm256_set1_ps(r_pright[j]);
+	rows[1][j] = _mm256_set1_ps(r_pup[j]);
+	rows[2][j] = _mm256_set1_ps(r_ppn[j]);
+    }
+
+    count = 0;
+    for (i = 0; i < set->count; i += 8) {
+	lanes = set->count - i;
+	if (lanes >= 8) {
+	    lanes = 8;
+	    for (k = 0; k < 3; k++)
+		local[k] = set->local[k] + i;
+	} else {
+	    // the ones past the end are in front of the eye, so never drawn
+	    for (k = 0; k < 3; k++) {
+		for (j = 0; j < 8; j++)
+		    padded[k][j] = j < lanes ? set->local[k][i + j] : 0;
+		local[k] = padded[k];
+	    }
+	}
+	x = _mm256_loadu_ps(local[0]);
+	y = _mm256_loadu_ps(local[1]);
+	z = _mm256_loadu_ps(local[2]);
+
+	// transform point
+	t0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, rows[0][0]),
+					 _mm256_mul_ps(y, rows[0][1])),
+			   _mm256_mul_ps(z, rows[0][2]));
+	t1 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, rows[1][0]),
+					 _mm256_mul_ps(y, rows[1][1])),
+			   _mm256_mul_ps(z, rows[1][2]));
+	t2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, rows[2][0]),
+					 _mm256_mul_ps(y, rows[2][1])),
+			   _mm256_mul_ps(z, rows[2][2]));
+
+	visible = _mm256_movemask_ps(_mm256_cmp_ps(t2, _mm256_set1_ps(PARTICLE_Z_CLIP), _CMP_NLT_UQ));
+	if (!visible)
+	    continue;
+
+	// project the point
+	zi = _mm256_div_ps(_mm256_set1_ps(1), t2);
+	u = D_RoundParticle(_mm256_add_ps(_mm256_set1_ps(xcenter),
+					  _mm256_mul_ps(zi, t0)));
+	v = D_RoundParticle(_mm256_sub_ps(_mm256_set1_ps(ycenter),
+					  _mm256_mul_ps(zi, t1)));
+	izi = _mm256_cvttps_epi32(_mm256_mul_ps(zi, _mm256_set1_ps(0x8000)));
+
+	outside = _mm256_or_si256(
+	    _mm256_or_si256(_mm256_cmpgt_epi32(v, _mm256_set1_epi32(d_vrectbottom_particle)),
+			    _mm256_cmpgt_epi32(u, _mm256_set1_epi32(d_vrectright_particle))),
+	    _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(d_vrecty), v),
+			    _mm256_cmpgt_epi32(_mm256_set1_epi32(d_vrectx), u)));
+	visible &= ~_mm256_movemask_ps(_mm256_castsi256_ps(outside));
+	if (!visible)
+	    continue;
+
+	_mm256_storeu_si256((__m256i *)pu, u);
+	_mm256_storeu_si256((__m256i *)pv, v);
+	_mm256_storeu_si256((__m256i *)pizi, izi);
+	for (j = 0; j < lanes; j++) {
+	    if (!(visible & (1 << j)))
+		continue;
+	    projected[count].u = pu[j];
+	    projected[count].v = pv[j];
+	    projected[count].izi = pizi[j];
+	    projected[count].color = set->color[i + j];
+	    count++;
+	}
+    }
+
+    return count;
+}
+
+/*
+==============
+D_SIMDParticleProjection
+
+Switches particle projection to the AVX2 version if the CPU has it
+==============
+*/
+void
+D_SIMDParticleProjection(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+	D_ProjectParticles = D_ProjectParticles_AVX2;
+}
+
+#endif /* D_SIMD_PARTICLES */
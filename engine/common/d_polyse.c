@@ -297,7 +297,7 @@ D_DrawNonSubdiv(void)
 	}
 
 	D_PolysetSetEdgeTable();
-	D_RasterizeAliasPolySmooth();
+	D_RasterizeAliasPoly();
     }
 }
 
@@ -0,0 +1,398 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_polyse_simd.c: AVX2 alias model triangle rasterizer
+
+/*
+ * D_RasterizeAliasPolySmooth walks down a triangle's left edge into span
+ * packages, then down its right edge to draw them.  Here each edge is a
+ * function of the pixel instead, which is negative just off the triangle,
+ * and each row of the triangle's bounding box is tested against all three
+ * edges eight pixels at a time.  The same eight are depth tested and have
+ * their skin texels and colormap entries gathered at once.
+ *
+ * s, t, light and 1/z come straight from the triangle's gradients, started
+ * from the left edge's vertices as the edge walk starts them, so the pixels
+ * drawn and what they're drawn with are exactly those of the C version.
+ */
+
+#include "quakedef.h"
+#include "d_local.h"
+#include "r_local.h"
+
+#ifdef D_SIMD_POLYSETS
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+ * An edge as a function of the pixel: its value at the left of the
+ * triangle's bounding box on the row being drawn, and how much it changes a
+ * pixel to the right and a row down.  Pixels on a left edge are in the
+ * triangle, pixels on a right edge aren't, as with the edge walk.
+ */
+typedef struct {
+    int value;
+    int ustep, vstep;
+} polyedge_t;
+
+/*
+ * Where a stretch of the left edge starts and what the edge walk starts s,
+ * t, light and 1/z on there.  Going left, the walk steps light by one less a
+ * pixel, biasing it toward overflow.
+ */
+typedef struct {
+    int u, v;
+    int s, t, light, zi;
+    qboolean leftward;
+} polysection_t;
+
+/*
+=============
+D_PolysetEdge
+
+Sets up the edge from p0 to p1, returning whether it's on the left of the
+triangle, whose third vertex is pother.  Flat edges are left out by the
+rows the triangle is drawn on, so they let every pixel through.
+=============
+*/
+static qboolean
+D_PolysetEdge(polyedge_t *edge, const int *p0, const int *p1,
+	      const int *pother, int left, int top, const int **ptop)
+{
+    const int *pbottom;
+    int du, dv;
+
+    if (p0[1] == p1[1]) {
+	edge->value = edge->ustep = edge->vstep = 0;
+	return false;
+    }
+
+    if (p0[1] < p1[1]) {
+	*ptop = p0;
+	pbottom = p1;
+    } else {
+	*ptop = p1;
+	pbottom = p0;
+    }
+    du = pbottom[0] - (*ptop)[0];
+    dv = pbottom[1] - (*ptop)[1];
+    edge->value = (left - (*ptop)[0]) * dv - (top - (*ptop)[1]) * du;
+
+    if ((pother[0] - (*ptop)[0]) * dv - (pother[1] - (*ptop)[1]) * du > 0) {
+	edge->ustep = dv;
+	edge->vstep = -du;
+	return true;
+    }
+
+    edge->value = -edge->value - 1;
+    edge->ustep = -dv;
+    edge->vstep = du;
+    return false;
+}
+
+/*
+=============
+D_PolysetSection
+
+The edge walk starts the bottom stretch of a two part left edge on the
+whole texel of its top vertex
+=============
+*/
+static void
+D_PolysetSection(polysection_t *section, const int *ptop, const int *pbottom,
+		 qboolean lower)
+{
+    section->u = ptop[0];
+    section->v = ptop[1];
+    section->s = lower ? ptop[2] & ~0xFFFF : ptop[2];
+    section->t = lower ? ptop[3] & ~0xFFFF : ptop[3];
+    section->light = ptop[4];
+    section->zi = ptop[5];
+    section->leftward = pbottom[0] < ptop[0];
+}
+
+/*
+=============
+D_PolysetDrawLanes
+
+The pixels in mask one at a time, as D_PolysetDrawSpans8 draws them, for
+blocks running off the edge of the view
+=============
+*/
+static inline AVX2 void
+D_PolysetDrawLanes(byte *pdest, short *pz, __m256i svec, __m256i tvec,
+		   __m256i lightvec, __m256i zivec, int mask)
+{
+    int s[8], t[8], light[8], zi[8];
+    int i, pixel;
+    const byte *pskin = r_affinetridesc.pskin;
+
+    _mm256_storeu_si256((__m256i *)s, svec);
+    _mm256_storeu_si256((__m256i *)t, tvec);
+    _mm256_storeu_si256((__m256i *)light, lightvec);
+    _mm256_storeu_si256((__m256i *)zi, zivec);
+    for (i = 0; mask; i++, mask >>= 1) {
+	if (!(mask & 1) || (zi[i] >> 16) < pz[i])
+	    continue;
+	pixel = pskin[(s[i] >> 16) + (t[i] >> 16) * r_affinetridesc.skinwidth];
+	pixel = ((byte *)acolormap)[pixel + (light[i] & 0xFF00)];
+	if (r_transtable) {
+	    pdest[i] = r_transtable[(((int)pdest[i]) << 8) + pixel];
+	} else {
+	    pdest[i] = pixel;
+	    pz[i] = zi[i] >> 16;
+	}
+    }
+}
+
+/*
+=============
+D_PolysetDrawBlock
+
+Eight pixels from pdest, drawing those in front of the z-buffer out of the
+ones inside the triangle
+=============
+*/
+static inline AVX2 void
+D_PolysetDrawBlock(byte *pdest, short *pz, __m256i inside, __m256i svec,
+		   __m256i tvec, __m256i lightvec, __m256i zivec)
+{
+    __m256i zi, drawn, offsets, texels, pixels;
+    __m128i zvals, zmask, dest, z, packed;
+    int pixel[8];
+    int i, mask;
+
+    zi = _mm256_srai_epi32(zivec, 16);
+    z = _mm_loadu_si128((const __m128i *)pz);
+    drawn = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_cvtepi16_epi32(z), zi),
+				inside);
+    mask = _mm256_movemask_ps(_mm256_castsi256_ps(drawn));
+    if (!mask)
+	return;
+
+    /*
+     * Each byte is read as the top of an int, so the gathers read from just
+     * before the skin and the colormap, which are always further on in the
+     * cache or the hunk than their headers.  Lanes not drawn aren't read.
+     */
+    offsets = _mm256_add_epi32(_mm256_srai_epi32(svec, 16),
+			       _mm256_mullo_epi32(_mm256_srai_epi32(tvec, 16),
+						  _mm256_set1_epi32(r_affinetridesc.skinwidth)));
+    texels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+					 (const int *)((const byte *)r_affinetridesc.pskin - 3),
+					 offsets, drawn, 1);
+    offsets = _mm256_add_epi32(_mm256_srli_epi32(texels, 24),
+			       _mm256_and_si256(lightvec, _mm256_set1_epi32(0xFF00)));
+    pixels = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(),
+					 (const int *)((const byte *)acolormap - 3),
+					 offsets, drawn, 1);
+    pixels = _mm256_srli_epi32(pixels, 24);
+
+    if (r_transtable) {
+	_mm256_storeu_si256((__m256i *)pixel, pixels);
+	for (i = 0; mask; i++, mask >>= 1) {
+	    if (mask & 1)
+		pdest[i] = r_transtable[(((int)pdest[i]) << 8) + pixel[i]];
+	}
+	return;
+    }
+
+    zmask = _mm_packs_epi32(_mm256_castsi256_si128(drawn),
+			    _mm256_extracti128_si256(drawn, 1));
+    packed = _mm_packus_epi32(_mm256_castsi256_si128(pixels),
+			      _mm256_extracti128_si256(pixels, 1));
+    packed = _mm_packus_epi16(packed, packed);
+    dest = _mm_loadl_epi64((const __m128i *)pdest);
+    dest = _mm_blendv_epi8(dest, packed, _mm_packs_epi16(zmask, zmask));
+    _mm_storel_epi64((__m128i *)pdest, dest);
+
+    // the z-buffer keeps the low 16 bits, as a short assignment does
+    zi = _mm256_and_si256(zi, _mm256_set1_epi32(0xFFFF));
+    zvals = _mm_packus_epi32(_mm256_castsi256_si128(zi),
+			     _mm256_extracti128_si256(zi, 1));
+    z = _mm_blendv_epi8(z, zvals, zmask);
+    _mm_storeu_si128((__m128i *)pz, z);
+}
+
+/*
+=============
+D_PolysetDrawRow
+
+Tests the row from left to right eight pixels at a time, drawing from the
+first block with any of the triangle in it until the triangle runs out
+=============
+*/
+static inline AVX2 void
+D_PolysetDrawRow(int v, int left, int right, const polyedge_t *edges,
+		 const polysection_t *section)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i e0, e1, e2, inside;
+    __m256i svec, tvec, lightvec, zivec;
+    __m256i sstep, tstep, lightstep, zistep;
+    int u, du, dv, mask, light;
+    qboolean started;
+    byte *pdest;
+    short *pz;
+
+    e0 = _mm256_add_epi32(_mm256_set1_epi32(edges[0].value),
+			  _mm256_mullo_epi32(lane, _mm256_set1_epi32(edges[0].ustep)));
+    e1 = _mm256_add_epi32(_mm256_set1_epi32(edges[1].value),
+			  _mm256_mullo_epi32(lane, _mm256_set1_epi32(edges[1].ustep)));
+    e2 = _mm256_add_epi32(_mm256_set1_epi32(edges[2].value),
+			  _mm256_mullo_epi32(lane, _mm256_set1_epi32(edges[2].ustep)));
+
+    pdest = (byte *)d_viewbuffer + v * screenwidth;
+    pz = d_pzbuffer + v * d_zwidth;
+    svec = tvec = lightvec = zivec = _mm256_setzero_si256();
+    started = false;
+
+    for (u = left; u < right; u += 8) {
+	inside = _mm256_cmpgt_epi32(_mm256_or_si256(e0, _mm256_or_si256(e1, e2)),
+				    _mm256_set1_epi32(-1));
+	mask = _mm256_movemask_ps(_mm256_castsi256_ps(inside));
+	if (!mask) {
+	    if (started)
+		break;
+	    e0 = _mm256_add_epi32(e0, _mm256_set1_epi32(edges[0].ustep * 8));
+	    e1 = _mm256_add_epi32(e1, _mm256_set1_epi32(edges[1].ustep * 8));
+	    e2 = _mm256_add_epi32(e2, _mm256_set1_epi32(edges[2].ustep * 8));
+	    continue;
+	}
+
+	if (!started) {
+	    // where the edge walk would have this block start
+	    dv = v - section->v;
+	    du = u - section->u;
+	    light = section->light + dv * r_lstepy + du * r_lstepx;
+	    if (section->leftward)
+		light -= u + __builtin_ctz(mask) - section->u;
+
+	    sstep = _mm256_set1_epi32(r_sstepx);
+	    tstep = _mm256_set1_epi32(r_tstepx);
+	    lightstep = _mm256_set1_epi32(r_lstepx);
+	    zistep = _mm256_set1_epi32(r_zistepx);
+	    svec = _mm256_add_epi32(_mm256_set1_epi32(section->s + dv * r_sstepy + du * r_sstepx),
+				    _mm256_mullo_epi32(lane, sstep));
+	    tvec = _mm256_add_epi32(_mm256_set1_epi32(section->t + dv * r_tstepy + du * r_tstepx),
+				    _mm256_mullo_epi32(lane, tstep));
+	    lightvec = _mm256_add_epi32(_mm256_set1_epi32(light),
+					_mm256_mullo_epi32(lane, lightstep));
+	    zivec = _mm256_add_epi32(_mm256_set1_epi32(section->zi + dv * r_zistepy + du * r_zistepx),
+				     _mm256_mullo_epi32(lane, zistep));
+	    sstep = _mm256_slli_epi32(sstep, 3);
+	    tstep = _mm256_slli_epi32(tstep, 3);
+	    lightstep = _mm256_slli_epi32(lightstep, 3);
+	    zistep = _mm256_slli_epi32(zistep, 3);
+	    started = true;
+	}
+
+	if (u >= r_refdef.vrect.x && u + 8 <= r_refdef.vrectright)
+	    D_PolysetDrawBlock(pdest + u, pz + u, inside, svec, tvec, lightvec,
+			       zivec);
+	else
+	    D_PolysetDrawLanes(pdest + u, pz + u, svec, tvec, lightvec, zivec,
+			       mask);
+
+	e0 = _mm256_add_epi32(e0, _mm256_set1_epi32(edges[0].ustep * 8));
+	e1 = _mm256_add_epi32(e1, _mm256_set1_epi32(edges[1].ustep * 8));
+	e2 = _mm256_add_epi32(e2, _mm256_set1_epi32(edges[2].ustep * 8));
+	svec = _mm256_add_epi32(svec, sstep);
+	tvec = _mm256_add_epi32(tvec, tstep);
+	lightvec = _mm256_add_epi32(lightvec, lightstep);
+	zivec = _mm256_add_epi32(zivec, zistep);
+    }
+}
+
+/*
+=============
+D_RasterizeAliasPoly_AVX2
+
+Draws the triangle in r_p0, r_p1 and r_p2 as D_RasterizeAliasPolySmooth
+does
+=============
+*/
+AVX2 void
+D_RasterizeAliasPoly_AVX2(void)
+{
+    const int *pverts[3] = { r_p0, r_p1, r_p2 };
+    const int *lefttop[2], *leftbottom[2], *ptop, *swap;
+    polyedge_t edges[3];
+    polysection_t sections[2];
+    int i, v, numleft, split, left, right, top, bottom;
+
+    D_PolysetCalcGradients(r_affinetridesc.skinwidth);
+
+    left = qmin(r_p0[0], qmin(r_p1[0], r_p2[0]));
+    right = qmax(r_p0[0], qmax(r_p1[0], r_p2[0]));
+    top = qmin(r_p0[1], qmin(r_p1[1], r_p2[1]));
+    bottom = qmax(r_p0[1], qmax(r_p1[1], r_p2[1]));
+
+    numleft = 0;
+    for (i = 0; i < 3; i++) {
+	if (D_PolysetEdge(&edges[i], pverts[i], pverts[(i + 1) % 3],
+			  pverts[(i + 2) % 3], left, top, &ptop)) {
+	    lefttop[numleft] = ptop;
+	    leftbottom[numleft] = (ptop == pverts[i]) ? pverts[(i + 1) % 3] :
+		pverts[i];
+	    numleft++;
+	}
+    }
+    if (!numleft)
+	return;
+
+    if (numleft == 2 && lefttop[1][1] < lefttop[0][1]) {
+	swap = lefttop[0];
+	lefttop[0] = lefttop[1];
+	lefttop[1] = swap;
+	swap = leftbottom[0];
+	leftbottom[0] = leftbottom[1];
+	leftbottom[1] = swap;
+    }
+    D_PolysetSection(&sections[0], lefttop[0], leftbottom[0], false);
+    split = bottom;
+    if (numleft == 2) {
+	D_PolysetSection(&sections[1], lefttop[1], leftbottom[1], true);
+	split = lefttop[1][1];
+    }
+
+    for (v = top; v < bottom; v++) {
+	D_PolysetDrawRow(v, left, right, edges, &sections[v >= split]);
+	for (i = 0; i < 3; i++)
+	    edges[i].value += edges[i].vstep;
+    }
+}
+
+/*
+=============
+D_SIMDPolysetRasterizer
+
+Switches the alias triangle rasterizer to the AVX2 one if the CPU has it
+=============
+*/
+void
+D_SIMDPolysetRasterizer(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+	D_RasterizeAliasPoly = D_RasterizeAliasPoly_AVX2;
+}
+
+#endif /* D_SIMD_POLYSETS */
@@ -27,10 +27,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "d_local.h"
 
-unsigned char *r_turb_pbase, *r_turb_pdest;
-fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
-int *r_turb_turb;
-int r_turb_spancount;
+BANDLOCAL unsigned char *r_turb_pbase, *r_turb_pdest;
+BANDLOCAL fixed16_t r_turb_s, r_turb_t, r_turb_sstep, r_turb_tstep;
+BANDLOCAL int *r_turb_turb;
+BANDLOCAL int r_turb_spancount;
 
 /*
 =============
@@ -142,10 +142,10 @@ D_DrawTurbulent8Span_NonStd(void)
     } while (--r_turb_spancount > 0);
 }
 
-static int r_turb_izi;
-static int r_turb_izistep;
-static short *r_turb_pz;
-const byte *r_transtable;
+static BANDLOCAL int r_turb_izi;
+static BANDLOCAL int r_turb_izistep;
+static BANDLOCAL short *r_turb_pz;
+BANDLOCAL const byte *r_transtable;
 
 void
 D_DrawTurbulentTranslucent8Span()
@@ -193,7 +193,7 @@ D_DrawTurbulentTranslucent8Span_NonStd()
     } while (--r_turb_spancount > 0);
 }
 
-void (*D_DrawTurbSpanFunc)(void);
+BANDLOCAL void (*D_DrawTurbSpanFunc)(void);
 
 /*
 =============
@@ -0,0 +1,643 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// d_scan_simd.c: SSE4.1 and AVX2 span drawers
+
+/*
+ * The C span drawers (d_scan.c) work out s and t with a divide at the end of
+ * every 8 pixel segment, then step them across it.  Here the ends of all of a
+ * span's segments are worked out first, four divides at a time, doing the
+ * same float operations in the same order so the same texels come out.  The
+ * AVX2 drawers then fetch a whole segment's texels with one gather.
+ *
+ * Built with per-function target attributes, so nothing else needs compiling
+ * for these instruction sets; D_SIMDSpanDrawers only picks them when the CPU
+ * has them.
+ */
+
+#include <stdint.h>
+
+#include "quakedef.h"
+#include "d_local.h"
+
+#ifdef D_SIMD_SPANS
+
+#include <immintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+// the most segments a span can have, plus room for a vector's worth over
+#define MAX_SEGMENTS ((MAXWIDTH + 7) / 8 + 4)
+
+/*
+ * Where s and t start on each segment of a span, and how they step across
+ * it.  Every segment is 8 pixels long, but the last (lastcount pixels).
+ */
+typedef struct {
+    int numsegments;
+    int lastcount;
+    int izi, izistep;
+    fixed16_t s[MAX_SEGMENTS], t[MAX_SEGMENTS];
+    fixed16_t sstep[MAX_SEGMENTS], tstep[MAX_SEGMENTS];
+} spansegs_t;
+
+/*
+=============
+D_SpanSegments
+
+Works out the segments of a span the way D_DrawSpans8 does.  The fence
+drawers keep 1/z as a double, which wide_zi does the same.
+=============
+*/
+static SSE41 void
+D_SpanSegments(const espan_t *pspan, spansegs_t *segs, qboolean wide_zi)
+{
+    int i, n, count, spancount;
+    float sdivz, tdivz, z, du, dv, spancountminus1;
+    float fzi;
+    double dzi;
+    float sdivz_end[MAX_SEGMENTS], tdivz_end[MAX_SEGMENTS];
+    float zi_end[MAX_SEGMENTS];
+    double dzi_end[MAX_SEGMENTS];
+    fixed16_t s, t;
+    __m128 zvec;
+    __m128i snext, tnext;
+    const __m128i lowclamp = _mm_set1_epi32(8);
+    const __m128i sclamp = _mm_set1_epi32(bbextents);
+    const __m128i tclamp = _mm_set1_epi32(bbextentt);
+
+    // calculate the initial s/z, t/z, 1/z, s, and t and clamp
+    du = (float)pspan->u;
+    dv = (float)pspan->v;
+
+    sdivz = d_sdivzorigin + dv * d_sdivzstepv + du * d_sdivzstepu;
+    tdivz = d_tdivzorigin + dv * d_tdivzstepv + du * d_tdivzstepu;
+    if (wide_zi) {
+	dzi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+	z = (float)0x10000 / dzi;	// prescale to 16.16 fixed-point
+	segs->izi = (int)(dzi * 0x8000 * 0x10000);
+	fzi = 0;
+    } else {
+	fzi = d_ziorigin + dv * d_zistepv + du * d_zistepu;
+	z = (float)0x10000 / fzi;	// prescale to 16.16 fixed-point
+	segs->izi = (int)(fzi * 0x8000 * 0x10000);
+	dzi = 0;
+    }
+    segs->izistep = (int)(d_zistepu * 0x8000 * 0x10000);
+
+    s = (int)(sdivz * z) + sadjust;
+    if (s > bbextents)
+	s = bbextents;
+    else if (s < 0)
+	s = 0;
+
+    t = (int)(tdivz * z) + tadjust;
+    if (t > bbextentt)
+	t = bbextentt;
+    else if (t < 0)
+	t = 0;
+
+    segs->s[0] = s;
+    segs->t[0] = t;
+
+    // s/z, t/z and 1/z at the far end of each segment (at its last pixel
+    // for the last one, so it can't step off the polygon)
+    n = 0;
+    count = pspan->count;
+    do {
+	spancount = count >= 8 ? 8 : count;
+	count -= spancount;
+	if (count) {
+	    sdivz += d_sdivzstepu * 8;
+	    tdivz += d_tdivzstepu * 8;
+	    if (wide_zi)
+		dzi += d_zistepu * 8;
+	    else
+		fzi += d_zistepu * 8;
+	} else {
+	    spancountminus1 = (float)(spancount - 1);
+	    sdivz += d_sdivzstepu * spancountminus1;
+	    tdivz += d_tdivzstepu * spancountminus1;
+	    if (wide_zi)
+		dzi += d_zistepu * spancountminus1;
+	    else
+		fzi += d_zistepu * spancountminus1;
+	}
+	sdivz_end[n] = sdivz;
+	tdivz_end[n] = tdivz;
+	zi_end[n] = fzi;
+	dzi_end[n] = dzi;
+	n++;
+    } while (count > 0);
+
+    segs->numsegments = n;
+    segs->lastcount = spancount;
+
+    // keep the lanes past the end away from zero
+    for (i = n; i < ((n + 3) & ~3); i++) {
+	zi_end[i] = dzi_end[i] = 1;
+	sdivz_end[i] = tdivz_end[i] = 0;
+    }
+
+    // the divides, and s and t clamped, four segments at a time
+    for (i = 0; i < n; i += 4) {
+	if (wide_zi) {
+	    const __m128d scale = _mm_set1_pd((float)0x10000);
+	    __m128 lo = _mm_cvtpd_ps(_mm_div_pd(scale, _mm_loadu_pd(&dzi_end[i])));
+	    __m128 hi = _mm_cvtpd_ps(_mm_div_pd(scale, _mm_loadu_pd(&dzi_end[i + 2])));
+	    zvec = _mm_movelh_ps(lo, hi);
+	} else {
+	    zvec = _mm_div_ps(_mm_set1_ps((float)0x10000), _mm_loadu_ps(&zi_end[i]));
+	}
+
+	snext = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&sdivz_end[i]), zvec));
+	snext = _mm_add_epi32(snext, _mm_set1_epi32(sadjust));
+	snext = _mm_max_epi32(_mm_min_epi32(snext, sclamp), lowclamp);
+	tnext = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&tdivz_end[i]), zvec));
+	tnext = _mm_add_epi32(tnext, _mm_set1_epi32(tadjust));
+	tnext = _mm_max_epi32(_mm_min_epi32(tnext, tclamp), lowclamp);
+
+	_mm_storeu_si128((__m128i *)&segs->s[i + 1], snext);
+	_mm_storeu_si128((__m128i *)&segs->t[i + 1], tnext);
+    }
+
+    // steps by shifting across whole segments
+    for (i = 0; i < n - 1; i += 4) {
+	__m128i s0 = _mm_loadu_si128((const __m128i *)&segs->s[i]);
+	__m128i s1 = _mm_loadu_si128((const __m128i *)&segs->s[i + 1]);
+	__m128i t0 = _mm_loadu_si128((const __m128i *)&segs->t[i]);
+	__m128i t1 = _mm_loadu_si128((const __m128i *)&segs->t[i + 1]);
+
+	_mm_storeu_si128((__m128i *)&segs->sstep[i],
+			 _mm_srai_epi32(_mm_sub_epi32(s1, s0), 3));
+	_mm_storeu_si128((__m128i *)&segs->tstep[i],
+			 _mm_srai_epi32(_mm_sub_epi32(t1, t0), 3));
+    }
+
+    // and by division across the last one, biased low so we don't run off
+    // the texture
+    n--;
+    if (spancount > 1) {
+	segs->sstep[n] = (segs->s[n + 1] - segs->s[n]) / (spancount - 1);
+	segs->tstep[n] = (segs->t[n + 1] - segs->t[n]) / (spancount - 1);
+    } else {
+	segs->sstep[n] = 0;
+	segs->tstep[n] = 0;
+    }
+}
+
+/*
+ * One segment at a time, as the C drawers do it
+ */
+
+static inline void
+D_SegmentPlain(byte *pdest, const byte *pbase, fixed16_t s, fixed16_t t,
+	       fixed16_t sstep, fixed16_t tstep, int spancount)
+{
+    do {
+	*pdest++ = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+	s += sstep;
+	t += tstep;
+    } while (--spancount > 0);
+}
+
+static inline void
+D_SegmentTranslucent(byte *pdest, short *pz, const byte *pbase, fixed16_t s,
+		     fixed16_t t, fixed16_t sstep, fixed16_t tstep, int izi,
+		     int izistep, int spancount)
+{
+    do {
+	if ((izi >> 16) >= *pz) {
+	    int pixel = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+	    *pdest = r_transtable[(((int)*pdest) << 8) + pixel];
+	}
+	izi += izistep;
+	pdest++;
+	pz++;
+	s += sstep;
+	t += tstep;
+    } while (--spancount > 0);
+}
+
+static inline void
+D_SegmentFence(byte *pdest, short *pz, const byte *pbase, fixed16_t s,
+	       fixed16_t t, fixed16_t sstep, fixed16_t tstep, int izi,
+	       int izistep, int spancount)
+{
+    do {
+	unsigned char pixel = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+	if (pixel != 255) {
+	    *pdest = pixel;
+	    *pz = (short)(izi >> 16);
+	}
+	izi += izistep;
+	pdest++;
+	pz++;
+	s += sstep;
+	t += tstep;
+    } while (--spancount > 0);
+}
+
+static inline void
+D_SegmentFenceTranslucent(byte *pdest, short *pz, const byte *pbase,
+			  fixed16_t s, fixed16_t t, fixed16_t sstep,
+			  fixed16_t tstep, int izi, int izistep, int spancount)
+{
+    do {
+	unsigned char pixel = *(pbase + (s >> 16) + (t >> 16) * cachewidth);
+	if (pixel != 255 && *pz <= (izi >> 16)) {
+	    *pdest = r_transtable[(((int)*pdest) << 8) + pixel];
+	}
+	izi += izistep;
+	pdest++;
+	pz++;
+	s += sstep;
+	t += tstep;
+    } while (--spancount > 0);
+}
+
+/*
+ * SSE4.1: the divides are vectorized, the pixels drawn as in C
+ */
+
+#define SEGMENT_COUNT(segs, i) \
+    ((i) < (segs).numsegments - 1 ? 8 : (segs).lastcount)
+
+SSE41 void
+D_DrawSpans8_SSE41(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    int i, spancount;
+
+    do {
+	D_SpanSegments(pspan, &segs, false);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    D_SegmentPlain(pdest, cacheblock, segs.s[i], segs.t[i],
+			   segs.sstep[i], segs.tstep[i], spancount);
+	    pdest += spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+SSE41 void
+D_DrawSpans8_Translucent_SSE41(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi;
+
+    do {
+	D_SpanSegments(pspan, &segs, false);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    D_SegmentTranslucent(pdest, pz, cacheblock, segs.s[i], segs.t[i],
+				 segs.sstep[i], segs.tstep[i], izi,
+				 segs.izistep, spancount);
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+SSE41 void
+D_DrawSpans8_Fence_SSE41(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi;
+
+    do {
+	D_SpanSegments(pspan, &segs, true);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    D_SegmentFence(pdest, pz, cacheblock, segs.s[i], segs.t[i],
+			   segs.sstep[i], segs.tstep[i], izi, segs.izistep,
+			   spancount);
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+SSE41 void
+D_DrawSpans8_Fence_Translucent_SSE41(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi;
+
+    do {
+	D_SpanSegments(pspan, &segs, true);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    D_SegmentFenceTranslucent(pdest, pz, cacheblock, segs.s[i],
+				      segs.t[i], segs.sstep[i], segs.tstep[i],
+				      izi, segs.izistep, spancount);
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+ * AVX2: whole segments are drawn 8 pixels at once, with their texels
+ * gathered from the surface cache (a segment cut short at the end of a span
+ * is drawn as in C)
+ */
+
+/*
+=============
+D_GatherTexels
+
+The texels of a whole segment, one to each 32-bit lane
+=============
+*/
+static inline AVX2 __m256i
+D_GatherTexels(const byte *pbase, fixed16_t s, fixed16_t t, fixed16_t sstep,
+	       fixed16_t tstep)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i svec, tvec, offsets;
+
+    svec = _mm256_add_epi32(_mm256_set1_epi32(s),
+			    _mm256_mullo_epi32(lane, _mm256_set1_epi32(sstep)));
+    tvec = _mm256_add_epi32(_mm256_set1_epi32(t),
+			    _mm256_mullo_epi32(lane, _mm256_set1_epi32(tstep)));
+    offsets = _mm256_add_epi32(_mm256_srai_epi32(svec, 16),
+			       _mm256_mullo_epi32(_mm256_srai_epi32(tvec, 16),
+						  _mm256_set1_epi32(cachewidth)));
+
+    // each texel is read as an int: the bytes past the last one in the
+    // cache are the next block's, or the cache's guard at the end
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int *)pbase, offsets, 1),
+			    _mm256_set1_epi32(0xFF));
+}
+
+/*
+=============
+D_PackTexels
+
+Eight lanes of texels down to eight bytes, in the low half
+=============
+*/
+static inline AVX2 __m128i
+D_PackTexels(__m256i texels)
+{
+    const __m256i low_bytes = _mm256_setr_epi8(
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i bytes = _mm256_shuffle_epi8(texels, low_bytes);
+
+    return _mm_unpacklo_epi32(_mm256_castsi256_si128(bytes),
+			      _mm256_extracti128_si256(bytes, 1));
+}
+
+/*
+=============
+D_SegmentZ
+
+1/z of a whole segment, as the z-buffer keeps it
+=============
+*/
+static inline AVX2 __m256i
+D_SegmentZ(int izi, int izistep)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i izivec;
+
+    izivec = _mm256_add_epi32(_mm256_set1_epi32(izi),
+			      _mm256_mullo_epi32(lane, _mm256_set1_epi32(izistep)));
+    return _mm256_srai_epi32(izivec, 16);
+}
+
+/*
+=============
+D_BlendLanes
+
+Looks up the translucency table for the pixels in mask
+=============
+*/
+static inline AVX2 void
+D_BlendLanes(byte *pdest, __m256i texels, int mask)
+{
+    int texel[8];
+    int i;
+
+    _mm256_storeu_si256((__m256i *)texel, texels);
+    for (i = 0; mask; i++, mask >>= 1) {
+	if (mask & 1)
+	    pdest[i] = r_transtable[(((int)pdest[i]) << 8) + texel[i]];
+    }
+}
+
+AVX2 void
+D_DrawSpans8_AVX2(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    int i, spancount;
+
+    do {
+	D_SpanSegments(pspan, &segs, false);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    if (spancount == 8) {
+		__m256i texels = D_GatherTexels(cacheblock, segs.s[i], segs.t[i],
+						segs.sstep[i], segs.tstep[i]);
+		_mm_storel_epi64((__m128i *)pdest, D_PackTexels(texels));
+	    } else {
+		D_SegmentPlain(pdest, cacheblock, segs.s[i], segs.t[i],
+			       segs.sstep[i], segs.tstep[i], spancount);
+	    }
+	    pdest += spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+AVX2 void
+D_DrawSpans8_Translucent_AVX2(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi, mask;
+    __m256i texels, zbuffer;
+
+    do {
+	D_SpanSegments(pspan, &segs, false);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    if (spancount == 8) {
+		// in front of what's there already
+		zbuffer = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)pz));
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+		    _mm256_cmpgt_epi32(zbuffer, D_SegmentZ(izi, segs.izistep))));
+		mask = ~mask & 0xFF;
+		if (mask) {
+		    texels = D_GatherTexels(cacheblock, segs.s[i], segs.t[i],
+					    segs.sstep[i], segs.tstep[i]);
+		    D_BlendLanes(pdest, texels, mask);
+		}
+	    } else {
+		D_SegmentTranslucent(pdest, pz, cacheblock, segs.s[i],
+				     segs.t[i], segs.sstep[i], segs.tstep[i],
+				     izi, segs.izistep, spancount);
+	    }
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+AVX2 void
+D_DrawSpans8_Fence_AVX2(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi;
+    __m128i pixels, opaque, dest, z, zvals;
+    __m256i izivec;
+
+    do {
+	D_SpanSegments(pspan, &segs, true);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    if (spancount == 8) {
+		pixels = D_PackTexels(D_GatherTexels(cacheblock, segs.s[i],
+						     segs.t[i], segs.sstep[i],
+						     segs.tstep[i]));
+
+		// 255 is see-through
+		opaque = _mm_cmpeq_epi8(pixels, _mm_set1_epi8(-1));
+		opaque = _mm_xor_si128(opaque, _mm_set1_epi8(-1));
+
+		dest = _mm_loadl_epi64((const __m128i *)pdest);
+		dest = _mm_blendv_epi8(dest, pixels, opaque);
+		_mm_storel_epi64((__m128i *)pdest, dest);
+
+		izivec = D_SegmentZ(izi, segs.izistep);
+		zvals = _mm_packs_epi32(_mm256_castsi256_si128(izivec),
+					_mm256_extracti128_si256(izivec, 1));
+		z = _mm_loadu_si128((const __m128i *)pz);
+		z = _mm_blendv_epi8(z, zvals, _mm_cvtepi8_epi16(opaque));
+		_mm_storeu_si128((__m128i *)pz, z);
+	    } else {
+		D_SegmentFence(pdest, pz, cacheblock, segs.s[i], segs.t[i],
+			       segs.sstep[i], segs.tstep[i], izi, segs.izistep,
+			       spancount);
+	    }
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+AVX2 void
+D_DrawSpans8_Fence_Translucent_AVX2(espan_t *pspan)
+{
+    spansegs_t segs;
+    byte *pdest;
+    short *pz;
+    int i, spancount, izi, mask;
+    __m256i texels, zbuffer, hidden, seethrough;
+
+    do {
+	D_SpanSegments(pspan, &segs, true);
+	pdest = (byte *)d_viewbuffer + (screenwidth * pspan->v) + pspan->u;
+	pz = d_pzbuffer + (d_zwidth * pspan->v) + pspan->u;
+	izi = segs.izi;
+	for (i = 0; i < segs.numsegments; i++) {
+	    spancount = SEGMENT_COUNT(segs, i);
+	    if (spancount == 8) {
+		texels = D_GatherTexels(cacheblock, segs.s[i], segs.t[i],
+					segs.sstep[i], segs.tstep[i]);
+		zbuffer = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)pz));
+		hidden = _mm256_cmpgt_epi32(zbuffer, D_SegmentZ(izi, segs.izistep));
+		seethrough = _mm256_cmpeq_epi32(texels, _mm256_set1_epi32(255));
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+		    _mm256_or_si256(hidden, seethrough)));
+		mask = ~mask & 0xFF;
+		if (mask)
+		    D_BlendLanes(pdest, texels, mask);
+	    } else {
+		D_SegmentFenceTranslucent(pdest, pz, cacheblock, segs.s[i],
+					  segs.t[i], segs.sstep[i],
+					  segs.tstep[i], izi, segs.izistep,
+					  spancount);
+	    }
+	    pdest += spancount;
+	    pz += spancount;
+	    izi += segs.izistep * spancount;
+	}
+    } while ((pspan = pspan->pnext) != NULL);
+}
+
+/*
+=============
+D_SIMDSpanDrawers
+
+Switches the span drawers to the best versions the CPU can run
+=============
+*/
+void
+D_SIMDSpanDrawers(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+	D_DrawSpans = D_DrawSpans8_AVX2;
+	D_DrawSpansTranslucent = D_DrawSpans8_Translucent_AVX2;
+	D_DrawSpansFence = D_DrawSpans8_Fence_AVX2;
+	D_DrawSpansFenceTranslucent = D_DrawSpans8_Fence_Translucent_AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+	D_DrawSpans = D_DrawSpans8_SSE41;
+	D_DrawSpansTranslucent = D_DrawSpans8_Translucent_SSE41;
+	D_DrawSpansFence = D_DrawSpans8_Fence_SSE41;
+	D_DrawSpansFenceTranslucent = D_DrawSpans8_Fence_Translucent_SSE41;
+    }
+}
+
+#endif /* D_SIMD_SPANS */
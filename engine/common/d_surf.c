@@ -21,6 +21,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 /* rasterization driver surface heap manager */
 
 #include <stdint.h>
+#include <stdlib.h>
+
+#include <SDL_atomic.h>
 
 #include "console.h"
 #include "d_local.h"
@@ -38,6 +41,8 @@ qboolean r_cache_thrash;	// set if surface cache is thrashing
 int sc_size;
 surfcache_t *sc_rover, *sc_base;
 
+surfcache_stats_t d_surfcache_stats;
+
 #define GUARDSIZE       4
 
 
@@ -61,6 +66,27 @@ D_SurfaceCacheForRes(int width, int height)
     return size;
 }
 
+/*
+================
+D_SurfaceCacheForPlates
+
+The fisheye renders several square plates each frame, which between them see
+far more surfaces than one screen does, so they need a cache for each plate.
+================
+*/
+int
+D_SurfaceCacheForPlates(int platesize, int numplates)
+{
+    int size, screen;
+
+    screen = D_SurfaceCacheForRes(vid.width, vid.height);
+    if (COM_CheckParm("-surfcachesize"))
+	return screen;
+
+    size = numplates * D_SurfaceCacheForRes(platesize, platesize);
+    return qmax(size, screen);
+}
+
 void
 D_CheckCacheGuard(void)
 {
@@ -101,11 +127,26 @@ D_InitCaches(void *buffer, int size)
 
     sc_base->next = NULL;
     sc_base->owner = NULL;
+    sc_base->queued = false;
+    sc_base->builtframe = 0;
     sc_base->size = sc_size;
 
     D_ClearCacheGuard();
 }
 
+/*
+================
+D_CacheBuffer
+
+the buffer given to the last D_InitCaches
+================
+*/
+void *
+D_CacheBuffer(void)
+{
+    return sc_base;
+}
+
 
 /*
 ==================
@@ -164,16 +205,20 @@ D_SCAlloc(int width, int size)
     }
 // colect and free surfcache_t blocks until the rover block is large enough
     new = sc_rover;
-    if (sc_rover->owner)
+    if (sc_rover->owner) {
 	*sc_rover->owner = NULL;
+	d_surfcache_stats.evictions++;
+    }
 
     while (new->size < size) {
 	// free another
 	sc_rover = sc_rover->next;
 	if (!sc_rover)
 	    Sys_Error("%s: hit the end of memory", __func__);
-	if (sc_rover->owner)
+	if (sc_rover->owner) {
 	    *sc_rover->owner = NULL;
+	    d_surfcache_stats.evictions++;
+	}
 
 	new->size += sc_rover->size;
 	new->next = sc_rover->next;
@@ -197,6 +242,8 @@ D_SCAlloc(int width, int size)
 	new->height = (size - sizeof(*new) + sizeof(new->data)) / width;
 
     new->owner = NULL;		// should be set properly after return
+    new->queued = false;
+    new->builtframe = 0;
 
     if (d_roverwrapped) {
 	if (wrapped_this_time || (sc_rover >= d_initial_rover))
@@ -261,13 +308,17 @@ D_log2(int num)
 
 /*
 ================
-D_CacheSurface
+D_SurfaceCached
+
+Sets up r_drawsurf for the surface, returning its cache if that still holds
+what it should
 ================
 */
-surfcache_t *
-D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
+static surfcache_t *
+D_SurfaceCached(const entity_t *e, msurface_t *surface, int miplevel)
 {
     surfcache_t *cache;
+    qboolean dlit;
 
 //
 // if the surface is animating or flashing, flush the cache
@@ -282,8 +333,15 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
 // see if the cache holds apropriate data
 //
     cache = surface->cachespots[miplevel];
+    dlit = surface->dlightframe == r_dlightframecount;
 
-    if (cache && !cache->dlight && surface->dlightframe != r_framecount
+//
+// world surfaces lit by this frame's dynamic lights can be reused by every
+// view rendered with them (e.g. each fisheye plate), but brush models may be
+// instanced, lit differently for each entity
+//
+    if (cache && (dlit ? cache->dlight == r_dlightframecount
+		  && e == &r_worldentity : !cache->dlight)
 	&& cache->texture == r_drawsurf.texture
 	&& cache->lightadj[0] == r_drawsurf.lightadj[0]
 	&& cache->lightadj[1] == r_drawsurf.lightadj[1]
@@ -299,10 +357,28 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
     r_drawsurf.surfwidth = surface->extents[0] >> miplevel;
     r_drawsurf.rowbytes = r_drawsurf.surfwidth;
     r_drawsurf.surfheight = surface->extents[1] >> miplevel;
+    r_drawsurf.surf = surface;
+
+    return NULL;
+}
+
+/*
+================
+D_SurfaceCache
+
+Makes the cache for the surface set up by D_SurfaceCached ready to be drawn
+into
+================
+*/
+static void
+D_SurfaceCache(msurface_t *surface, int miplevel)
+{
+    surfcache_t *cache;
 
 //
 // allocate memory if needed
 //
+    cache = surface->cachespots[miplevel];
     if (!cache)			// if a texture just animated, don't reallocate it
     {
 	cache = D_SCAlloc(r_drawsurf.surfwidth,
@@ -312,10 +388,8 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
 	cache->mipscale = surfscale;
     }
 
-    if (surface->dlightframe == r_framecount)
-	cache->dlight = 1;
-    else
-	cache->dlight = 0;
+    cache->dlight = surface->dlightframe == r_dlightframecount
+	? r_dlightframecount : 0;
 
     r_drawsurf.surfdat = (pixel_t *)cache->data;
 
@@ -325,13 +399,209 @@ D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
     cache->lightadj[2] = r_drawsurf.lightadj[2];
     cache->lightadj[3] = r_drawsurf.lightadj[3];
 
+    c_surf++;
+}
+
+/*
+================
+D_CacheSurface
+================
+*/
+surfcache_t *
+D_CacheSurface(const entity_t *e, msurface_t *surface, int miplevel)
+{
+    surfcache_t *cache;
+
+    cache = D_SurfaceCached(e, surface, miplevel);
+    if (cache) {
+	// a build queued for this view was counted as a miss already
+	if (cache->builtframe == r_framecount)
+	    cache->builtframe = 0;
+	else
+	    d_surfcache_stats.hits++;
+	return cache;
+    }
+    d_surfcache_stats.misses++;
+
+    D_SurfaceCache(surface, miplevel);
+
 //
 // draw and light the surface texture
 //
-    r_drawsurf.surf = surface;
-
-    c_surf++;
     R_DrawSurface();
 
     return surface->cachespots[miplevel];
 }
+
+#ifdef R_THREADED
+
+/*
+ * Surfaces the view is about to draw can be built on the worker threads
+ * before any spans are drawn (d_cachethreads sets how many threads).  Their
+ * cache is allocated up front on the main thread, then each thread draws
+ * into blocks of its own.  Anything that doesn't get built this way is
+ * still built as it's drawn.
+ */
+
+cvar_t d_cachethreads = { "d_cachethreads", "0", CVAR_CONFIG };
+
+typedef struct {
+    drawsurf_t drawsurf;
+    surfcache_t *cache;
+} scbuild_t;
+
+// the builds queued since D_BeginSurfaceBuilds
+static struct {
+    scbuild_t *builds;
+    int numbuilds, maxbuilds;
+    SDL_atomic_t next;		// the next build for a thread to take
+} scbuilds;
+
+/*
+================
+D_SCFits
+
+Whether D_SCAlloc can find size bytes without evicting a queued build
+================
+*/
+static qboolean
+D_SCFits(int size)
+{
+    surfcache_t *c;
+    int found;
+
+    size = offsetof(surfcache_t, data[size]);
+    size = (size + 3) & ~3;
+    if (size > sc_size)
+	return false;
+
+    c = sc_rover;
+    if (!c || (byte *)c - (byte *)sc_base > sc_size - size)
+	c = sc_base;
+
+    for (found = 0; c; c = c->next) {
+	if (c->owner && c->queued)
+	    return false;
+	found += c->size;
+	if (found >= size)
+	    return true;
+    }
+
+    return false;
+}
+
+/*
+================
+D_BeginSurfaceBuilds
+
+Returns false if surfaces should just be built as they're drawn
+================
+*/
+qboolean
+D_BeginSurfaceBuilds(void)
+{
+    if (R_StartWorkers(d_cachethreads.value) < 2)
+	return false;
+
+    scbuilds.numbuilds = 0;
+
+    return true;
+}
+
+/*
+================
+D_QueueSurface
+
+D_CacheSurface, leaving the drawing to D_BuildSurfaces.  A queued build
+counts as a miss here and not again when it's drawn; a surface found cached
+counts as a hit once it's drawn.  Returns false once the cache can't take
+any more builds.
+================
+*/
+qboolean
+D_QueueSurface(const entity_t *e, msurface_t *surface, int miplevel)
+{
+    surfcache_t *cache;
+
+    if (D_SurfaceCached(e, surface, miplevel))
+	return true;
+
+    // brush model instances share caches, so leave any other to be built
+    // when it's drawn (and blocks being built can't be moved or evicted)
+    cache = surface->cachespots[miplevel];
+    if (cache && cache->queued)
+	return true;
+    if (!cache && !D_SCFits(r_drawsurf.surfwidth * r_drawsurf.surfheight))
+	return false;
+
+    d_surfcache_stats.misses++;
+    D_SurfaceCache(surface, miplevel);
+    cache = surface->cachespots[miplevel];
+    cache->queued = true;
+
+    if (scbuilds.numbuilds == scbuilds.maxbuilds) {
+	scbuilds.maxbuilds = scbuilds.maxbuilds ? scbuilds.maxbuilds * 2 : 256;
+	scbuilds.builds = realloc(scbuilds.builds,
+				  scbuilds.maxbuilds * sizeof(scbuild_t));
+	if (!scbuilds.builds)
+	    Sys_Error("%s: out of memory", __func__);
+    }
+    scbuilds.builds[scbuilds.numbuilds].drawsurf = r_drawsurf;
+    scbuilds.builds[scbuilds.numbuilds].cache = cache;
+    scbuilds.numbuilds++;
+
+    return true;
+}
+
+/*
+================
+D_BuildQueuedSurfaces
+================
+*/
+static void
+D_BuildQueuedSurfaces(int index)
+{
+    int build;
+
+    (void)index;
+
+    for (;;) {
+	build = SDL_AtomicAdd(&scbuilds.next, 1);
+	if (build >= scbuilds.numbuilds)
+	    break;
+	r_drawsurf = scbuilds.builds[build].drawsurf;
+	R_DrawSurface();
+    }
+}
+
+/*
+================
+D_BuildSurfaces
+
+Draws every surface queued since D_BeginSurfaceBuilds, on the worker threads
+================
+*/
+void
+D_BuildSurfaces(void)
+{
+    int i, threads;
+
+    if (!scbuilds.numbuilds)
+	return;
+
+    threads = R_StartWorkers(d_cachethreads.value);
+    if (threads > scbuilds.numbuilds)
+	threads = scbuilds.numbuilds;
+
+    SDL_AtomicSet(&scbuilds.next, 0);
+    R_RunWorkers(threads, D_BuildQueuedSurfaces);
+
+    for (i = 0; i < scbuilds.numbuilds; i++) {
+	scbuilds.builds[i].cache->queued = false;
+	scbuilds.builds[i].cache->builtframe = r_framecount;
+    }
+
+    D_CheckCacheGuard();	// DEBUG
+}
+
+#endif /* R_THREADED */
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 #ifndef USE_X86_ASM
 
+#include "d_local.h"
 #include "mathlib.h"
 #include "quakedef.h"
 #include "vid.h"
@@ -35,15 +36,15 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // FIXME: make into one big structure, like cl or sv
 // FIXME: do separately for refresh engine and driver
 
-float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+BANDLOCAL float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+BANDLOCAL float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+BANDLOCAL float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-fixed16_t sadjust, tadjust, bbextents, bbextentt;
+BANDLOCAL fixed16_t sadjust, tadjust, bbextents, bbextentt;
 
-pixel_t *cacheblock;
-int cachewidth;
-int cacheheight;
+BANDLOCAL pixel_t *cacheblock;
+BANDLOCAL int cachewidth;
+BANDLOCAL int cacheheight;
 pixel_t *d_viewbuffer;
 short *d_pzbuffer;
 unsigned int d_zrowbytes;
@@ -19,6 +19,8 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_alias.c: routines for setting up to draw alias models
 
+#include <float.h>
+
 #include "console.h"
 #include "cvar.h"
 #include "model.h"
@@ -50,6 +52,7 @@ static model_t *pmodel;
 static vec3_t alias_forward, alias_right, alias_up;
 
 int r_amodels_drawn;
+int r_amodels_occluded;
 int a_skinwidth;
 int r_anumverts;
 
@@ -66,6 +69,18 @@ typedef struct {
 cvar_t r_lerpmodels = { "r_lerpmodels", "1", false };
 cvar_t r_lerpmove = { "r_lerpmove", "1", false };
 
+// poses are blended in fixed point, with this many fraction bits
+#define BLEND_SHIFT 22
+
+#ifdef R_SIMD_ALIAS
+cvar_t r_simdalias = { "r_simdalias", "1" };
+
+// whether the AVX2 loops are used for the frame, and the pose they read
+// (NULL for a model drawn with the C loops)
+static qboolean r_aliassimd;
+static const byte *r_apsoaverts;
+#endif
+
 static aedge_t aedges[12] = {
     {0, 1}, {1, 2}, {2, 3}, {3, 0},
     {4, 5}, {5, 6}, {6, 7}, {7, 4},
@@ -126,6 +141,10 @@ SW_LoadMeshData(const model_t *model, aliashdr_t *hdr,
     trivertx_t *verts;
     stvert_t *stverts;
     mtriangle_t *triangles;
+#ifdef R_SIMD_ALIAS
+    int j, stride;
+    byte *planes;
+#endif
 
     /*
      * Save the pose vertex data
@@ -137,6 +156,24 @@ SW_LoadMeshData(const model_t *model, aliashdr_t *hdr,
 	verts += hdr->numverts;
     }
 
+#ifdef R_SIMD_ALIAS
+    /*
+     * And again for the AVX2 loops, each pose as planes of x, y, z and light
+     * normal index, padded with zeros to whole blocks of eight verts
+     */
+    stride = ALIAS_SOA_STRIDE(hdr->numverts);
+    planes = Hunk_AllocName(hdr->numposes * stride * 4, "modeltmp");
+    SW_Aliashdr(hdr)->soaposes = planes - (byte *)hdr;
+    for (i = 0; i < hdr->numposes; i++, planes += stride * 4) {
+	for (j = 0; j < hdr->numverts; j++) {
+	    planes[j] = posedata->verts[i][j].v[0];
+	    planes[stride + j] = posedata->verts[i][j].v[1];
+	    planes[stride * 2 + j] = posedata->verts[i][j].v[2];
+	    planes[stride * 3 + j] = posedata->verts[i][j].lightnormalindex;
+	}
+    }
+#endif
+
     /*
      * Save the s/t verts
      * => put s and t in 16.16 format
@@ -324,6 +361,56 @@ R_AliasCheckBBox(entity_t *entity, aliashdr_t *aliashdr)
     return true;
 }
 
+/*
+================
+R_AliasOccluded
+
+Whether the world hides the model.  Tests the bounds of all its poses, so
+lerping between frames can't reach outside them.
+================
+*/
+static qboolean
+R_AliasOccluded(const entity_t *entity, const aliashdr_t *aliashdr)
+{
+    const model_t *model = entity->model;
+    int i, j;
+    float zi, u, v, minz;
+    float left, top, right, bottom;
+    vec3_t corner, view;
+
+    // the view model is drawn with a z of its own
+    if (entity == &cl.viewent)
+	return false;
+
+    left = top = FLT_MAX;
+    right = bottom = -FLT_MAX;
+    minz = FLT_MAX;
+    for (i = 0; i < 8; i++) {
+	// aliastransform takes the pose data's scaled coordinates
+	for (j = 0; j < 3; j++) {
+	    corner[j] = (i & (1 << j)) ? model->maxs[j] : model->mins[j];
+	    corner[j] = (corner[j] - aliashdr->scale_origin[j]) / aliashdr->scale[j];
+	}
+	R_AliasTransformVector(corner, view);
+	if (view[2] < ALIAS_Z_CLIP_PLANE)
+	    return false;
+
+	zi = 1.0 / view[2];
+	u = (view[0] * xscale * zi) + xcenter;
+	v = (view[1] * yscale * zi) + ycenter;
+	left = qmin(left, u);
+	right = qmax(right, u);
+	top = qmin(top, v);
+	bottom = qmax(bottom, v);
+	minz = qmin(minz, view[2]);
+    }
+
+    // a pixel of slack for rounding, and 1/z scaled like D_PolysetDraw's
+    return R_OccludedRect(floorf(left) - 1, floorf(top) - 1,
+			  ceilf(right) + 1, ceilf(bottom) + 1,
+			  (int)((float)0x8000 / minz) + 1);
+}
+
 
 /*
 ================
@@ -341,26 +428,13 @@ R_AliasTransformVector(const vec3_t in, vec3_t out)
 
 /*
 ================
-R_AliasPreparePoints
-
-General clipped case
+R_AliasTransformFinalVerts
 ================
 */
 static void
-R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
-		     auxvert_t *pauxverts)
+R_AliasTransformFinalVerts(finalvert_t *fv, auxvert_t *av, stvert_t *pstverts)
 {
     int i;
-    stvert_t *pstverts;
-    finalvert_t *fv;
-    auxvert_t *av;
-    mtriangle_t *ptri;
-    finalvert_t *pfv[3];
-
-    pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
-    r_anumverts = pahdr->numverts;
-    fv = pfinalverts;
-    av = pauxverts;
 
     for (i = 0; i < r_anumverts; i++, fv++, av++, r_apverts++, pstverts++) {
 	R_AliasTransformFinalVert(fv, av, r_apverts, pstverts);
@@ -378,6 +452,37 @@ R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
 		fv->flags |= ALIAS_BOTTOM_CLIP;
 	}
     }
+}
+
+
+/*
+================
+R_AliasPreparePoints
+
+General clipped case
+================
+*/
+static void
+R_AliasPreparePoints(aliashdr_t *pahdr, finalvert_t *pfinalverts,
+		     auxvert_t *pauxverts)
+{
+    int i;
+    stvert_t *pstverts;
+    mtriangle_t *ptri;
+    finalvert_t *pfv[3];
+
+    pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
+    r_anumverts = pahdr->numverts;
+
+#ifdef R_SIMD_ALIAS
+    if (r_apsoaverts)
+	R_AliasTransformFinalVerts_AVX2(pfinalverts, pauxverts, pstverts,
+					r_apsoaverts,
+					ALIAS_SOA_STRIDE(r_anumverts),
+					r_anumverts, ziscale);
+    else
+#endif
+	R_AliasTransformFinalVerts(pfinalverts, pauxverts, pstverts);
 
 //
 // clip and draw all triangles
@@ -613,7 +718,15 @@ R_AliasPrepareUnclippedPoints(aliashdr_t *pahdr, finalvert_t *pfinalverts)
     pstverts = (stvert_t *)((byte *)pahdr + SW_Aliashdr(pahdr)->stverts);
     r_anumverts = pahdr->numverts;
 
-    R_AliasTransformAndProjectFinalVerts(pfinalverts, pstverts);
+#ifdef R_SIMD_ALIAS
+    if (r_apsoaverts)
+	R_AliasTransformAndProjectFinalVerts_AVX2(pfinalverts, pstverts,
+						  r_apsoaverts,
+						  ALIAS_SOA_STRIDE(r_anumverts),
+						  r_anumverts);
+    else
+#endif
+	R_AliasTransformAndProjectFinalVerts(pfinalverts, pstverts);
 
     if (r_affinetridesc.drawtype) {
         if (r_transtable) {
@@ -743,9 +856,8 @@ R_AliasBlendPoseVerts(const entity_t *entity, aliashdr_t *aliashdr, lerpdata_t *
     trivertx_t *poseverts, *pv0, *pv1, *light;
     int i, blend0, blend1;
 
-#define SHIFT 22
-    blend1 = lerpdata->blend * (1 << SHIFT);
-    blend0 = (1 << SHIFT) - blend1;
+    blend1 = lerpdata->blend * (1 << BLEND_SHIFT);
+    blend0 = (1 << BLEND_SHIFT) - blend1;
 
     poseverts = (trivertx_t *)((byte *)aliashdr + aliashdr->posedata);
     pv0 = poseverts + lerpdata->pose0 * aliashdr->numverts;
@@ -754,21 +866,53 @@ R_AliasBlendPoseVerts(const entity_t *entity, aliashdr_t *aliashdr, lerpdata_t *
     poseverts = blendverts;
 
     for (i = 0; i < aliashdr->numverts; i++, poseverts++, pv0++, pv1++, light++) {
-	poseverts->v[0] = (pv0->v[0] * blend0 + pv1->v[0] * blend1) >> SHIFT;
-	poseverts->v[1] = (pv0->v[1] * blend0 + pv1->v[1] * blend1) >> SHIFT;
-	poseverts->v[2] = (pv0->v[2] * blend0 + pv1->v[2] * blend1) >> SHIFT;
+	poseverts->v[0] = (pv0->v[0] * blend0 + pv1->v[0] * blend1) >> BLEND_SHIFT;
+	poseverts->v[1] = (pv0->v[1] * blend0 + pv1->v[1] * blend1) >> BLEND_SHIFT;
+	poseverts->v[2] = (pv0->v[2] * blend0 + pv1->v[2] * blend1) >> BLEND_SHIFT;
 	poseverts->lightnormalindex = light->lightnormalindex;
     }
-#undef SHIFT
 
     return blendverts;
 }
 
+#ifdef R_SIMD_ALIAS
+/*
+=================
+R_AliasSoAPoseVerts
+
+The pose planes for the AVX2 loops, blended like R_AliasBlendPoseVerts when
+lerping
+=================
+*/
+static const byte *
+R_AliasSoAPoseVerts(aliashdr_t *aliashdr, const lerpdata_t *lerpdata)
+{
+    static byte blendverts[MAXALIASVERTS * 4];
+    const byte *poses, *pose0, *pose1;
+    int stride, blend0, blend1;
+
+    stride = ALIAS_SOA_STRIDE(aliashdr->numverts);
+    poses = (const byte *)aliashdr + SW_Aliashdr(aliashdr)->soaposes;
+    pose0 = poses + lerpdata->pose0 * stride * 4;
+    if (!r_lerpmodels.value)
+	return pose0;
+
+    pose1 = poses + lerpdata->pose1 * stride * 4;
+    blend1 = lerpdata->blend * (1 << BLEND_SHIFT);
+    blend0 = (1 << BLEND_SHIFT) - blend1;
+    R_AliasBlendPoses_AVX2(blendverts, pose0, pose1,
+			   (lerpdata->blend < 0.5f) ? pose0 : pose1,
+			   stride, blend0, blend1, BLEND_SHIFT);
+
+    return blendverts;
+}
+#endif
+
 /*
 =================
 R_AliasSetupFrame
 
-set r_apverts
+set r_apsoaverts for the AVX2 loops, or r_apverts for the C ones
 =================
 */
 static void
@@ -776,6 +920,15 @@ R_AliasSetupFrame(entity_t *entity, aliashdr_t *aliashdr, lerpdata_t *lerpdata)
 {
     R_AliasSetupAnimationLerp(entity, aliashdr, lerpdata);
 
+#ifdef R_SIMD_ALIAS
+    // a model without pose planes (soaposes 0) is left to the C loops
+    r_apsoaverts = NULL;
+    if (r_aliassimd && SW_Aliashdr(aliashdr)->soaposes) {
+	r_apsoaverts = R_AliasSoAPoseVerts(aliashdr, lerpdata);
+	return;
+    }
+#endif
+
     if (r_lerpmodels.value) {
         r_apverts = R_AliasBlendPoseVerts(entity, aliashdr, lerpdata);
     } else {
@@ -808,6 +961,11 @@ R_AliasDrawModel(entity_t *entity)
     if (entity->alpha == ENTALPHA_ZERO)
         return;
 
+    if (R_AliasOccluded(entity, aliashdr)) {
+	r_amodels_occluded++;
+	return;
+    }
+
     r_amodels_drawn++;
 
 // cache align
@@ -849,3 +1007,18 @@ R_AliasDrawModel(entity_t *entity)
     else
 	R_AliasPreparePoints(aliashdr, pfinalverts, pauxverts);
 }
+
+/*
+================
+R_SetupAliasLoops
+
+Picks the loops alias verts are set up with for the frame
+================
+*/
+void
+R_SetupAliasLoops(void)
+{
+#ifdef R_SIMD_ALIAS
+    r_aliassimd = r_simdalias.value && R_SIMDAliasLoops();
+#endif
+}
@@ -0,0 +1,342 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_alias_simd.c: AVX2 alias model vertex loops
+
+/*
+ * These work on eight vertices at a time, read from the SoA copy of the
+ * poses that SW_LoadMeshData makes: for each pose, a plane of x, y, z and
+ * light normal index bytes, each padded to a multiple of eight.  The
+ * arithmetic is the C versions' (r_alias.c), done in the same order, so the
+ * same finalverts come out.  Built with per-function target attributes;
+ * R_SIMDAliasLoops only says to use them when the CPU has AVX2.
+ */
+
+#include <string.h>
+
+#include "quakedef.h"
+#include "r_local.h"
+
+#ifdef R_SIMD_ALIAS
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+typedef struct {
+    __m256 x, y, z;
+    __m256i normal;
+} aliasverts8_t;
+
+/*
+================
+R_AliasLoadVerts
+================
+*/
+static inline AVX2 void
+R_AliasLoadVerts(aliasverts8_t *verts, const byte *pose, int stride)
+{
+    verts->x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+	_mm_loadl_epi64((const __m128i *)pose)));
+    verts->y = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+	_mm_loadl_epi64((const __m128i *)(pose + stride))));
+    verts->z = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+	_mm_loadl_epi64((const __m128i *)(pose + stride * 2))));
+    verts->normal = _mm256_cvtepu8_epi32(
+	_mm_loadl_epi64((const __m128i *)(pose + stride * 3)));
+}
+
+/*
+================
+R_AliasTransformRow
+
+DotProduct(v, aliastransform[row]) + aliastransform[row][3]
+================
+*/
+static inline AVX2 __m256
+R_AliasTransformRow(const aliasverts8_t *verts, int row)
+{
+    const float *m = aliastransform[row];
+    __m256 out;
+
+    out = _mm256_add_ps(_mm256_mul_ps(verts->x, _mm256_set1_ps(m[0])),
+			_mm256_mul_ps(verts->y, _mm256_set1_ps(m[1])));
+    out = _mm256_add_ps(out, _mm256_mul_ps(verts->z, _mm256_set1_ps(m[2])));
+
+    return _mm256_add_ps(out, _mm256_set1_ps(m[3]));
+}
+
+/*
+================
+R_AliasLightVerts
+================
+*/
+static inline AVX2 __m256i
+R_AliasLightVerts(const aliasverts8_t *verts)
+{
+    const float *normals = &r_avertexnormals[0][0];
+    __m256i index, light, shaded;
+    __m256 lightcos;
+
+    index = _mm256_add_epi32(verts->normal, _mm256_slli_epi32(verts->normal, 1));
+    lightcos = _mm256_add_ps(
+	_mm256_mul_ps(_mm256_i32gather_ps(normals, index, 4),
+		      _mm256_set1_ps(r_plightvec[0])),
+	_mm256_mul_ps(_mm256_i32gather_ps(normals + 1, index, 4),
+		      _mm256_set1_ps(r_plightvec[1])));
+    lightcos = _mm256_add_ps(
+	lightcos,
+	_mm256_mul_ps(_mm256_i32gather_ps(normals + 2, index, 4),
+		      _mm256_set1_ps(r_plightvec[2])));
+
+    // only the sides facing away from the light are shaded, and no darker
+    // than zero
+    light = _mm256_set1_epi32(r_ambientlight);
+    shaded = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_set1_ps(r_shadelight),
+					       lightcos));
+    shaded = _mm256_max_epi32(_mm256_add_epi32(light, shaded),
+			      _mm256_setzero_si256());
+
+    return _mm256_blendv_epi8(light, shaded, _mm256_castps_si256(
+	_mm256_cmp_ps(lightcos, _mm256_setzero_ps(), _CMP_LT_OQ)));
+}
+
+/*
+================
+R_AliasStoreFinalVerts
+
+Transposes the fields of eight verts into count finalverts
+================
+*/
+static inline AVX2 void
+R_AliasStoreFinalVerts(finalvert_t *fv, int count, const __m256i fields[7])
+{
+    finalvert_t tail[8], *out;
+    __m256 t[8], s[8], rows[8];
+    int i;
+
+    // reserved comes out zero
+    for (i = 0; i < 7; i++)
+	rows[i] = _mm256_castsi256_ps(fields[i]);
+    rows[7] = _mm256_setzero_ps();
+
+    for (i = 0; i < 8; i += 2) {
+	t[i] = _mm256_unpacklo_ps(rows[i], rows[i + 1]);
+	t[i + 1] = _mm256_unpackhi_ps(rows[i], rows[i + 1]);
+    }
+    for (i = 0; i < 8; i += 4) {
+	s[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+	s[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xee);
+	s[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+	s[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xee);
+    }
+
+    out = (count < 8) ? tail : fv;
+    for (i = 0; i < 4; i++) {
+	_mm256_storeu_ps((float *)&out[i],
+			 _mm256_permute2f128_ps(s[i], s[i + 4], 0x20));
+	_mm256_storeu_ps((float *)&out[i + 4],
+			 _mm256_permute2f128_ps(s[i], s[i + 4], 0x31));
+    }
+    if (out == tail)
+	memcpy(fv, tail, count * sizeof(*fv));
+}
+
+/*
+================
+R_AliasLoadStVerts
+
+The s, t and onseam flags of count stverts, into fields[2], [3] and [6]
+================
+*/
+static inline AVX2 void
+R_AliasLoadStVerts(const stvert_t *pstverts, int count, __m256i fields[7])
+{
+    const __m256i index = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    stvert_t tail[8];
+
+    // don't gather past the last one
+    if (count < 8) {
+	memset(tail, 0, sizeof(tail));
+	memcpy(tail, pstverts, count * sizeof(*pstverts));
+	pstverts = tail;
+    }
+
+    fields[2] = _mm256_i32gather_epi32(&pstverts->s, index, 4);
+    fields[3] = _mm256_i32gather_epi32(&pstverts->t, index, 4);
+    fields[6] = _mm256_i32gather_epi32(&pstverts->onseam, index, 4);
+}
+
+/*
+================
+R_AliasBlendPoses_AVX2
+
+R_AliasBlendPoseVerts for the SoA poses: x, y and z blended by blend0 and
+blend1, scaled up by 1 << shift, and the light normals of light
+================
+*/
+AVX2 void
+R_AliasBlendPoses_AVX2(byte *out, const byte *pose0, const byte *pose1,
+		       const byte *light, int stride, int blend0, int blend1,
+		       int shift)
+{
+    const __m256i vblend0 = _mm256_set1_epi32(blend0);
+    const __m256i vblend1 = _mm256_set1_epi32(blend1);
+    const __m128i vshift = _mm_cvtsi32_si128(shift);
+    const __m256i low_bytes = _mm256_setr_epi8(
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i v0, v1, v;
+    int i;
+
+    // the three planes of coordinates are one after the other
+    for (i = 0; i < stride * 3; i += 8) {
+	v0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pose0 + i)));
+	v1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pose1 + i)));
+	v = _mm256_add_epi32(_mm256_mullo_epi32(v0, vblend0),
+			     _mm256_mullo_epi32(v1, vblend1));
+	v = _mm256_shuffle_epi8(_mm256_sra_epi32(v, vshift), low_bytes);
+	_mm_storel_epi64((__m128i *)(out + i),
+			 _mm_unpacklo_epi32(_mm256_castsi256_si128(v),
+					    _mm256_extracti128_si256(v, 1)));
+    }
+    memcpy(out + stride * 3, light + stride * 3, stride);
+}
+
+/*
+================
+R_AliasTransformAndProjectFinalVerts_AVX2
+================
+*/
+AVX2 void
+R_AliasTransformAndProjectFinalVerts_AVX2(finalvert_t *fv,
+					  const stvert_t *pstverts,
+					  const byte *pose, int stride,
+					  int numverts)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    aliasverts8_t verts;
+    __m256i fields[7];
+    __m256 zi;
+    int i;
+
+    for (i = 0; i < numverts; i += 8) {
+	R_AliasLoadVerts(&verts, pose + i, stride);
+
+	// x, y, and z are scaled down by 1/2**31 in the transform, so 1/z is
+	// scaled up by 1/2**31, and the scaling cancels out for x and y in the
+	// projection
+	zi = _mm256_div_ps(one, R_AliasTransformRow(&verts, 2));
+	fields[5] = _mm256_cvttps_epi32(zi);
+	fields[0] = _mm256_cvttps_epi32(
+	    _mm256_add_ps(_mm256_mul_ps(R_AliasTransformRow(&verts, 0), zi),
+			  _mm256_set1_ps(aliasxcenter)));
+	fields[1] = _mm256_cvttps_epi32(
+	    _mm256_add_ps(_mm256_mul_ps(R_AliasTransformRow(&verts, 1), zi),
+			  _mm256_set1_ps(aliasycenter)));
+
+	fields[4] = R_AliasLightVerts(&verts);
+	R_AliasLoadStVerts(pstverts + i, qmin(numverts - i, 8), fields);
+	R_AliasStoreFinalVerts(fv + i, qmin(numverts - i, 8), fields);
+    }
+}
+
+/*
+================
+R_AliasTransformFinalVerts_AVX2
+
+The first loop of R_AliasPreparePoints: transformed into pauxverts, and
+projected with their clip flags into pfinalverts unless they're behind the
+near clip plane
+================
+*/
+AVX2 void
+R_AliasTransformFinalVerts_AVX2(finalvert_t *pfinalverts, auxvert_t *pauxverts,
+				const stvert_t *pstverts, const byte *pose,
+				int stride, int numverts, float ziscale)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    aliasverts8_t verts;
+    __m256i fields[7], flags, zclip;
+    __m256 x, y, z, zi;
+    float aux[3][8];
+    int i, j, count;
+
+    for (i = 0; i < numverts; i += 8) {
+	count = qmin(numverts - i, 8);
+	R_AliasLoadVerts(&verts, pose + i, stride);
+
+	x = R_AliasTransformRow(&verts, 0);
+	y = R_AliasTransformRow(&verts, 1);
+	z = R_AliasTransformRow(&verts, 2);
+	_mm256_storeu_ps(aux[0], x);
+	_mm256_storeu_ps(aux[1], y);
+	_mm256_storeu_ps(aux[2], z);
+	for (j = 0; j < count; j++) {
+	    pauxverts[i + j].fv[0] = aux[0][j];
+	    pauxverts[i + j].fv[1] = aux[1][j];
+	    pauxverts[i + j].fv[2] = aux[2][j];
+	}
+
+	zi = _mm256_div_ps(one, z);
+	fields[5] = _mm256_cvttps_epi32(_mm256_mul_ps(zi, _mm256_set1_ps(ziscale)));
+	x = _mm256_mul_ps(_mm256_mul_ps(x, _mm256_set1_ps(aliasxscale)), zi);
+	y = _mm256_mul_ps(_mm256_mul_ps(y, _mm256_set1_ps(aliasyscale)), zi);
+	fields[0] = _mm256_cvttps_epi32(_mm256_add_ps(x, _mm256_set1_ps(aliasxcenter)));
+	fields[1] = _mm256_cvttps_epi32(_mm256_add_ps(y, _mm256_set1_ps(aliasycenter)));
+
+	fields[4] = R_AliasLightVerts(&verts);
+	R_AliasLoadStVerts(pstverts + i, count, fields);
+
+	// the screen edges only matter for verts in front of the near plane
+	flags = _mm256_and_si256(
+	    _mm256_cmpgt_epi32(_mm256_set1_epi32(r_refdef.aliasvrect.x), fields[0]),
+	    _mm256_set1_epi32(ALIAS_LEFT_CLIP));
+	flags = _mm256_or_si256(flags, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(_mm256_set1_epi32(r_refdef.aliasvrect.y), fields[1]),
+	    _mm256_set1_epi32(ALIAS_TOP_CLIP)));
+	flags = _mm256_or_si256(flags, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(fields[0], _mm256_set1_epi32(r_refdef.aliasvrectright)),
+	    _mm256_set1_epi32(ALIAS_RIGHT_CLIP)));
+	flags = _mm256_or_si256(flags, _mm256_and_si256(
+	    _mm256_cmpgt_epi32(fields[1], _mm256_set1_epi32(r_refdef.aliasvrectbottom)),
+	    _mm256_set1_epi32(ALIAS_BOTTOM_CLIP)));
+	zclip = _mm256_castps_si256(
+	    _mm256_cmp_ps(z, _mm256_set1_ps(ALIAS_Z_CLIP_PLANE), _CMP_LT_OQ));
+	flags = _mm256_blendv_epi8(flags, _mm256_set1_epi32(ALIAS_Z_CLIP), zclip);
+	fields[6] = _mm256_or_si256(fields[6], flags);
+
+	R_AliasStoreFinalVerts(pfinalverts + i, count, fields);
+    }
+}
+
+/*
+================
+R_SIMDAliasLoops
+
+Whether the CPU can run the loops here
+================
+*/
+qboolean
+R_SIMDAliasLoops(void)
+{
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* R_SIMD_ALIAS */
@@ -0,0 +1,274 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_bands.c: scanning and drawing the world a horizontal band per thread
+
+/*
+ * With r_bands set to 2 or more, R_ScanEdges splits the view into that many
+ * bands of scanlines.  Each band scans its own copy of the frame's edges and
+ * surfaces on a worker thread of its own (the main thread takes the first
+ * band).  Surfaces are cached once all the bands have been scanned, then the
+ * bands draw their spans side by side, as they do the spans of their fence
+ * and translucent surfaces later on.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "console.h"
+#include "d_local.h"
+#include "quakedef.h"
+#include "r_local.h"
+#include "sys.h"
+
+cvar_t r_bands = { "r_bands", "0", CVAR_CONFIG };
+
+#ifdef R_THREADED
+
+#define MAX_BANDS 8
+
+// bands need a few lines each to be worth it
+#define MIN_BAND_LINES 16
+
+typedef enum {
+    BAND_SCAN,
+    BAND_DRAW
+} bandjob_t;
+
+static rband_t bands[MAX_BANDS];
+static int numbands;
+
+// the job handed to every band, set before the workers are started
+static struct {
+    bandjob_t job;
+    qboolean sort_submodels;
+    const surf_t *framesurfaces;
+    int firstbmodel, numsurfaces;
+} bandwork;
+
+// surfaces with spans in any band, indexed like surfaces[]
+static byte *bandvisible;
+static int maxbandvisible;
+
+/*
+==============
+R_DoBand
+==============
+*/
+static void
+R_DoBand(int index)
+{
+    rband_t *band = &bands[index];
+    surf_t *bandsurfaces;
+
+    if (bandwork.job == BAND_SCAN) {
+	R_ScanBand(band, bandwork.framesurfaces);
+    } else {
+	bandsurfaces = band->surfaces;
+	band->drawn = D_DrawBandSurfaces(bandsurfaces,
+					 bandsurfaces + bandwork.firstbmodel,
+					 bandsurfaces + bandwork.numsurfaces,
+					 bandwork.sort_submodels);
+    }
+}
+
+/*
+==============
+R_RunBands
+
+Does the job for every band, returning once they're all done
+==============
+*/
+static void
+R_RunBands(bandjob_t job)
+{
+    bandwork.job = job;
+    R_RunWorkers(numbands, R_DoBand);
+}
+
+/*
+==============
+R_BandsActive
+
+Splits the view into bands for R_ScanBands, unless it's better drawn whole
+==============
+*/
+qboolean
+R_BandsActive(void)
+{
+    int i, count, lines;
+
+    count = (int)r_bands.value;
+    if (count > MAX_BANDS)
+	count = MAX_BANDS;
+
+    lines = r_refdef.vrectbottom - r_refdef.vrect.y;
+    if (count > lines / MIN_BAND_LINES)
+	count = lines / MIN_BAND_LINES;
+    if (count < 2)
+	return false;
+
+    numbands = R_StartWorkers(count);
+    if (numbands < 2)
+	return false;
+
+    for (i = 0; i < numbands; i++) {
+	bands[i].top = r_refdef.vrect.y + lines * i / numbands;
+	bands[i].bottom = r_refdef.vrect.y + lines * (i + 1) / numbands;
+    }
+
+    return true;
+}
+
+/*
+==============
+R_BandBuffers
+
+Makes room in every band for the frame's edges and surfaces
+==============
+*/
+static void
+R_BandBuffers(int numedges, int numsurfaces)
+{
+    rband_t *band;
+    int i;
+
+    for (i = 0; i < numbands; i++) {
+	band = &bands[i];
+	if (numedges > band->maxedges) {
+	    free(band->edges);
+	    band->edges = malloc(numedges * sizeof(edge_t));
+	    band->maxedges = numedges;
+	}
+	if (numsurfaces > band->maxsurfaces) {
+	    free(band->surfaces);
+	    band->surfaces = malloc(numsurfaces * sizeof(surf_t));
+	    band->maxsurfaces = numsurfaces;
+	}
+	if (!band->edges || !band->surfaces)
+	    Sys_Error("%s: out of memory", __func__);
+    }
+
+    if (numsurfaces > maxbandvisible) {
+	free(bandvisible);
+	bandvisible = malloc(numsurfaces);
+	if (!bandvisible)
+	    Sys_Error("%s: out of memory", __func__);
+	maxbandvisible = numsurfaces;
+    }
+}
+
+/*
+==============
+R_DrawBands
+
+Draws the spans the bands' surfaces have, side by side if they can be
+==============
+*/
+static void
+R_DrawBands(qboolean sort_submodels)
+{
+    int i, s, numsurfaces;
+    surf_t *framesurfaces, *framebmodels, *framesurface_p;
+
+    numsurfaces = bandwork.numsurfaces;
+    memset(bandvisible, 0, numsurfaces);
+    for (i = 0; i < numbands; i++) {
+	for (s = 1; s < numsurfaces; s++) {
+	    if (bands[i].surfaces[s].spans)
+		bandvisible[s] = 1;
+	}
+    }
+
+    bandwork.sort_submodels = sort_submodels;
+    if (D_SetupBandSurfaces(bandvisible)) {
+	R_RunBands(BAND_DRAW);
+	for (i = 0; i < numbands; i++)
+	    r_drawnpolycount += bands[i].drawn;
+	return;
+    }
+
+    /*
+     * Some surfaces couldn't stay cached for the whole frame, so draw the
+     * bands one after the other, caching surfaces as they're drawn.
+     */
+    framesurfaces = surfaces;
+    framebmodels = bmodel_surfaces;
+    framesurface_p = surface_p;
+    for (i = 0; i < numbands; i++) {
+	surfaces = bands[i].surfaces;
+	bmodel_surfaces = surfaces + bandwork.firstbmodel;
+	surface_p = surfaces + numsurfaces;
+	D_DrawSurfaces(sort_submodels);
+    }
+    surfaces = framesurfaces;
+    bmodel_surfaces = framebmodels;
+    surface_p = framesurface_p;
+}
+
+/*
+==============
+R_ScanBands
+
+R_ScanEdges for the bands set up by R_BandsActive
+==============
+*/
+int
+R_ScanBands(void)
+{
+    int i, found, numsurfaces;
+
+    numsurfaces = surface_p - surfaces;
+    R_BandBuffers(edge_p - r_edges, numsurfaces);
+
+    bandwork.framesurfaces = surfaces;
+    bandwork.firstbmodel = bmodel_surfaces - surfaces;
+    bandwork.numsurfaces = numsurfaces;
+    R_RunBands(BAND_SCAN);
+
+    found = 0;
+    for (i = 0; i < numbands; i++)
+	found |= bands[i].found;
+
+    R_DrawBands(false);
+
+    return found;
+}
+
+/*
+==============
+R_DrawBandSpecialSpans
+
+R_DrawSpecialSpans for a view scanned by R_ScanBands
+==============
+*/
+void
+R_DrawBandSpecialSpans(int drawflags)
+{
+    int i;
+    surf_t *surf, *end;
+
+    for (i = 0; i < numbands; i++) {
+	end = bands[i].surfaces + bandwork.numsurfaces;
+	for (surf = &bands[i].surfaces[1]; surf < end; surf++)
+	    surf->spans = (surf->flags & drawflags) ? surf->specialspans : NULL;
+    }
+
+    R_DrawBands(true);
+}
+
+#endif /* R_THREADED */
@@ -477,6 +477,7 @@ R_RenderFace(const entity_t *e, msurface_t *surf, int clipflags)
     surface_p->entity = e;
     surface_p->key = r_currentkey++;
     surface_p->spans = NULL;
+    surface_p->specialspans = NULL;
 
     /* Flag alpha surfs */
     surface_p->alphatable = Alpha_Transtable(R_GetSurfAlpha(surf->flags));
@@ -585,6 +586,7 @@ R_RenderBmodelFace(const entity_t *entity, bedge_t *pedges, msurface_t *psurf)
     surface_p->entity = entity;
     surface_p->key = r_currentbkey;
     surface_p->spans = NULL;
+    surface_p->specialspans = NULL;
 
     /* Flag alpha surfs */
     alpha = R_GetSurfAlpha(psurf->flags);
@@ -19,19 +19,22 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 // r_edge.c
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "quakedef.h"
 #include "r_local.h"
 #include "render.h"
 #include "sound.h"
+#include "sys.h"
 
 int r_numedges;
 int r_numsurfaces;
 
-edge_t *auxedges;
 edge_t *r_edges, *edge_p, *edge_max;
 
-surf_t *auxsurfaces;
-surf_t *surfaces, *surface_p, *surf_max, *bmodel_surfaces;
+BANDLOCAL surf_t *surfaces;
+surf_t *surface_p, *surf_max, *bmodel_surfaces;
 
 // surfaces are generated in back to front order by the bsp, so if a surf
 // pointer is greater than another one, it should be drawn in front
@@ -40,24 +43,38 @@ surf_t *surfaces, *surface_p, *surf_max, *bmodel_surfaces;
 edge_t *newedges[MAXHEIGHT];
 edge_t *removeedges[MAXHEIGHT];
 
-espan_t *span_p;
-static espan_t *max_span_p;
+BANDLOCAL espan_t *span_p;
+static BANDLOCAL espan_t *max_span_p;
+
+/*
+ * Spans of fence and translucent surfaces are generated along with the rest
+ * of the view's, but kept in the surfaces' specialspans until the passes
+ * that draw them (R_DrawSpecialSpans).
+ */
+static spanchunks_t r_specialchunks;
+static BANDLOCAL spanchunks_t *specialchunks;
+static BANDLOCAL int specialchunk;
+static BANDLOCAL espan_t *special_span_p, *max_special_span_p;
+
+#ifdef R_THREADED
+static qboolean r_scannedbands;	// the view was scanned in bands
+#endif
 
 int r_currentkey;
 
-int current_iv;
+BANDLOCAL int current_iv;
 
-int edge_head_u_shift20, edge_tail_u_shift20;
+BANDLOCAL int edge_head_u_shift20, edge_tail_u_shift20;
 
 static int (*GenerateSpans)();
 static void (*GenerateSpansWithFlag)(int);
 
-edge_t edge_head;
-edge_t edge_tail;
-edge_t edge_aftertail;
-edge_t edge_sentinel;
+BANDLOCAL edge_t edge_head;
+BANDLOCAL edge_t edge_tail;
+BANDLOCAL edge_t edge_aftertail;
+BANDLOCAL edge_t edge_sentinel;
 
-float fv;
+BANDLOCAL float fv;
 
 int R_GenerateSpans();
 static int R_GenerateSpansBackward();
@@ -91,6 +108,7 @@ R_BeginEdgeFrame(void)
 
     surface_p = &surfaces[2];	// background is surface 1, surface 0 is a dummy
     surfaces[1].spans = NULL;	// no background spans yet
+    surfaces[1].specialspans = NULL;
     surfaces[1].flags = SURF_DRAWBACKGROUND;
 
 // put the background behind everything in the world
@@ -582,12 +600,61 @@ R_GenerateSpansBackward(void)
  * ==========================================================
  */
 
+/*
+==============
+R_SpanChunk
+
+One of the span buffers kept in chunks, allocated the first time it's needed
+==============
+*/
+static espan_t *
+R_SpanChunk(spanchunks_t *chunks, int chunk)
+{
+    if (chunk == chunks->numchunks) {
+	chunks->chunks = realloc(chunks->chunks, (chunk + 1) * sizeof(espan_t *));
+	if (!chunks->chunks)
+	    Sys_Error("%s: out of memory", __func__);
+	chunks->chunks[chunk] = malloc(MAXSPANS * sizeof(espan_t));
+	if (!chunks->chunks[chunk])
+	    Sys_Error("%s: out of memory", __func__);
+	chunks->numchunks++;
+    }
+
+    return chunks->chunks[chunk];
+}
+
+static void
+R_BeginSpecialSpans(spanchunks_t *chunks)
+{
+    specialchunks = chunks;
+    specialchunk = 0;
+    special_span_p = R_SpanChunk(chunks, 0);
+    max_special_span_p = special_span_p + MAXSPANS;
+}
+
+static inline void
+R_EmitSpecialSpan(surf_t *surf, int iu)
+{
+    espan_t *span;
+
+    if (special_span_p == max_special_span_p) {
+	special_span_p = R_SpanChunk(specialchunks, ++specialchunk);
+	max_special_span_p = special_span_p + MAXSPANS;
+    }
+
+    span = special_span_p++;
+    span->u = surf->last_u;
+    span->count = iu - span->u;
+    span->v = current_iv;
+    span->pnext = surf->specialspans;
+    surf->specialspans = span;
+}
+
 static void
 R_CleanupSpanWithFlag(int flags)
 {
     surf_t *surf;
     int iu;
-    espan_t *span;
 
 // now that we've reached the right edge of the screen, we're done with any
 // unfinished surfaces, so emit a span for whatever's on top
@@ -595,14 +662,8 @@ R_CleanupSpanWithFlag(int flags)
     iu = edge_tail_u_shift20;
 
     while (surf->flags & r_translucent_flags) {
-        if ((surf->flags & flags) && iu > surf->last_u) {
-            span = span_p++;
-            span->u = surf->last_u;
-            span->count = iu - span->u;
-            span->v = current_iv;
-            span->pnext = surf->spans;
-            surf->spans = span;
-        }
+        if ((surf->flags & flags) && iu > surf->last_u)
+            R_EmitSpecialSpan(surf, iu);
         surf = surf->next;
     }
 
@@ -617,7 +678,6 @@ R_CleanupSpanWithFlag(int flags)
 static void
 R_TrailingEdgeWithFlag(surf_t *surf, edge_t *edge, int flags)
 {
-    espan_t *span;
     surf_t *surf2;
     int iu;
     qboolean visible;
@@ -637,16 +697,8 @@ R_TrailingEdgeWithFlag(surf_t *surf, edge_t *edge, int flags)
     while (1) {
         if (surf2 == surf) {
             iu = edge->u >> 20;
-            if (surf->flags & flags) {
-                if (iu > surf->last_u) {
-                    span = span_p++;
-                    span->u = surf->last_u;
-                    span->count = iu - span->u;
-                    span->v = current_iv;
-                    span->pnext = surf->spans;
-                    surf->spans = span;
-                }
-            }
+            if ((surf->flags & flags) && iu > surf->last_u)
+                R_EmitSpecialSpan(surf, iu);
             visible = true;
             break;
         }
@@ -675,7 +727,6 @@ R_TrailingEdgeWithFlag(surf_t *surf, edge_t *edge, int flags)
 static void
 R_LeadingEdgeWithFlag(surf_t *surf, edge_t *edge, int flags)
 {
-    espan_t *span;
     surf_t *surf2, *search;
     int iu;
     double fu, newzi, testzi, newzitop, newzibottom;
@@ -750,14 +801,8 @@ R_LeadingEdgeWithFlag(surf_t *surf, edge_t *edge, int flags)
         if (!(surf->flags & r_translucent_flags)) {
             surf_t *emit = surf2;
             while (emit->flags & r_translucent_flags) {
-                if ((emit->flags & flags) && iu > emit->last_u) {
-                    span = span_p++;
-                    span->u = emit->last_u;
-                    span->count = iu - span->u;
-                    span->v = current_iv;
-                    span->pnext = emit->spans;
-                    emit->spans = span;
-                }
+                if ((emit->flags & flags) && iu > emit->last_u)
+                    R_EmitSpecialSpan(emit, iu);
                 emit = emit->next;
             }
         }
@@ -798,31 +843,38 @@ R_GenerateSpansWithFlag(int flags)
 
 /*
 ==============
-R_ScanEdges
-
-Input:
-newedges[] array
-	this has links to edges, which have links to surfaces
+R_GenerateLineSpans
 
-Output:
-Each surface has a linked list of its visible spans
-Scanlines having fence surfaces are flagged in the scanline flags struct.
+Generates the spans of the current line, and if it has any fence or
+translucent surfaces, the spans of those as well while the line's edges are
+still to hand.  Returns the flags of the special surfaces found.
 ==============
 */
-void
-R_ScanEdges(int drawflags, scanflags_t *scanflags)
+static int
+R_GenerateLineSpans(void)
 {
-    int iv, bottom;
-    espan_t basespans[CACHE_PAD_ARRAY(MAXSPANS, espan_t)];
-    espan_t *basespan_p;
-    surf_t *s;
+    int flags;
 
-    basespan_p = CACHE_ALIGN_PTR(basespans);
-    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
+    flags = GenerateSpans();
+    if (flags) {
+	// the background span is pre-included again
+	surfaces[1].spanstate = 1;
+	GenerateSpansWithFlag(flags);
+    }
 
-    span_p = basespan_p;
+    return flags;
+}
 
-// clear active edges to just the background edges around the whole screen
+/*
+==============
+R_ClearActiveEdges
+
+Clears the active edges to just the background edges around the whole screen
+==============
+*/
+static void
+R_ClearActiveEdges(void)
+{
 // FIXME: most of this only needs to be set up once
     edge_head.u = r_refdef.vrect.x << 20;
     edge_head_u_shift20 = edge_head.u >> 20;
@@ -848,6 +900,44 @@ R_ScanEdges(int drawflags, scanflags_t *scanflags)
 // FIXME: do we need this now that we clamp x in r_draw.c?
     edge_sentinel.u = FIXED16_MAX;	// make sure nothing sorts past this
     edge_sentinel.prev = &edge_aftertail;
+}
+
+/*
+==============
+R_ScanEdges
+
+Input:
+newedges[] array
+	this has links to edges, which have links to surfaces
+
+Output:
+Each surface has a linked list of its visible spans, drawn as the list fills.
+Fence and translucent surfaces have theirs in specialspans instead, to be
+drawn by R_DrawSpecialSpans.  Returns the flags of the special surfaces found.
+==============
+*/
+int
+R_ScanEdges(void)
+{
+    int iv, bottom, found;
+    espan_t basespans[CACHE_PAD_ARRAY(MAXSPANS, espan_t)];
+    espan_t *basespan_p;
+    surf_t *s;
+
+#ifdef R_THREADED
+    r_scannedbands = R_BandsActive();
+    if (r_scannedbands)
+	return R_ScanBands();
+#endif
+
+    basespan_p = CACHE_ALIGN_PTR(basespans);
+    max_span_p = &basespan_p[MAXSPANS - r_refdef.vrect.width];
+
+    span_p = basespan_p;
+    R_BeginSpecialSpans(&r_specialchunks);
+    found = 0;
+
+    R_ClearActiveEdges();
 
 //
 // process all scan lines
@@ -865,13 +955,7 @@ R_ScanEdges(int drawflags, scanflags_t *scanflags)
 	    R_InsertNewEdges(newedges[iv], edge_head.next);
 	}
 
-        if (!drawflags) {
-            int flags = GenerateSpans();
-            scanflags->lines[iv] = flags;
-            scanflags->found |= flags;
-        } else if (scanflags->lines[iv] & drawflags) {
-            GenerateSpansWithFlag(drawflags);
-        }
+	found |= R_GenerateLineSpans();
 
 	// flush the span list if we can't be sure we have enough spans left
 	// for the next scan
@@ -880,7 +964,7 @@ R_ScanEdges(int drawflags, scanflags_t *scanflags)
 	    S_ExtraUpdate();	// don't let sound get messed up if going slow
 	    VID_LockBuffer();
 
-	    D_DrawSurfaces(!!drawflags);
+	    D_DrawSurfaces(false);
 
 	    // clear the surface span pointers
 	    for (s = &surfaces[1]; s < surface_p; s++)
@@ -907,14 +991,146 @@ R_ScanEdges(int drawflags, scanflags_t *scanflags)
     if (newedges[iv])
 	R_InsertNewEdges(newedges[iv], edge_head.next);
 
-    if (!drawflags) {
-        int flags = GenerateSpans();
-        scanflags->lines[iv] = flags;
-        scanflags->found |= flags;
-    } else if (scanflags->lines[iv] & drawflags) {
-        GenerateSpansWithFlag(drawflags);
-    }
+    found |= R_GenerateLineSpans();
 
 // draw whatever's left in the span list
-    D_DrawSurfaces(!!drawflags);
+    D_DrawSurfaces(false);
+
+    return found;
+}
+
+/*
+==============
+R_DrawSpecialSpans
+
+Draws the spans R_ScanEdges kept for the surfaces with any of drawflags
+==============
+*/
+void
+R_DrawSpecialSpans(int drawflags)
+{
+    surf_t *s;
+
+#ifdef R_THREADED
+    if (r_scannedbands) {
+	R_DrawBandSpecialSpans(drawflags);
+	return;
+    }
+#endif
+
+    for (s = &surfaces[1]; s < surface_p; s++)
+	s->spans = (s->flags & drawflags) ? s->specialspans : NULL;
+
+    D_DrawSurfaces(true);
+}
+
+#ifdef R_THREADED
+
+/*
+==============
+R_BandEdge
+
+Finds the band's copy of an edge (anything outside r_edges stays as it is)
+==============
+*/
+static inline edge_t *
+R_BandEdge(const rband_t *band, edge_t *edge)
+{
+    if (edge >= r_edges && edge < edge_p)
+	return band->edges + (edge - r_edges);
+    return edge;
 }
+
+/*
+==============
+R_BandSpans
+
+Starts filling one of the band's span buffers
+==============
+*/
+static void
+R_BandSpans(rband_t *band, int chunk)
+{
+    span_p = R_SpanChunk(&band->spans, chunk);
+    max_span_p = &span_p[MAXSPANS - r_refdef.vrect.width];
+}
+
+/*
+==============
+R_ScanBand
+
+R_ScanEdges for the scanlines of one band, on the band's own copy of the
+frame's edges and surfaces so other bands can be scanned at the same time.
+The active edges are brought down to the top of the band by replaying the
+lines above it without generating spans.  Instead of being drawn when they
+fill up, the spans carry on in another buffer, since the surfaces they're
+drawn with are only set up once every band has been scanned (r_bands.c).
+==============
+*/
+void
+R_ScanBand(rband_t *band, const surf_t *framesurfaces)
+{
+    int iv, chunk;
+    int numedges, numsurfaces;
+    edge_t *edge;
+    surf_t *savedsurfaces;
+
+    numedges = edge_p - r_edges;
+    memcpy(band->edges, r_edges, numedges * sizeof(edge_t));
+    for (edge = band->edges; edge < band->edges + numedges; edge++) {
+	edge->next = R_BandEdge(band, edge->next);
+	edge->nextremove = R_BandEdge(band, edge->nextremove);
+    }
+
+    numsurfaces = surface_p - framesurfaces;
+    memcpy(band->surfaces + 1, framesurfaces + 1,
+	   (numsurfaces - 1) * sizeof(surf_t));
+    savedsurfaces = surfaces;
+    surfaces = band->surfaces;
+
+    R_ClearActiveEdges();
+
+    for (iv = r_refdef.vrect.y; iv < band->top; iv++) {
+	if (newedges[iv])
+	    R_InsertNewEdges(R_BandEdge(band, newedges[iv]), edge_head.next);
+	if (removeedges[iv])
+	    R_RemoveEdges(R_BandEdge(band, removeedges[iv]));
+	if (edge_head.next != &edge_tail)
+	    R_StepActiveU(edge_head.next);
+    }
+
+    chunk = 0;
+    R_BandSpans(band, chunk);
+    R_BeginSpecialSpans(&band->specialspans);
+    band->found = 0;
+
+    for (iv = band->top; iv < band->bottom; iv++) {
+	current_iv = iv;
+	fv = (float)iv;
+
+	// mark that the head (background start) span is pre-included
+	surfaces[1].spanstate = 1;
+
+	if (newedges[iv])
+	    R_InsertNewEdges(R_BandEdge(band, newedges[iv]), edge_head.next);
+
+	band->found |= R_GenerateLineSpans();
+
+	if (span_p >= max_span_p)
+	    R_BandSpans(band, ++chunk);
+
+	// no need to step or sort or remove after the band's last scan
+	if (iv == band->bottom - 1)
+	    break;
+
+	if (removeedges[iv])
+	    R_RemoveEdges(R_BandEdge(band, removeedges[iv]));
+
+	if (edge_head.next != &edge_tail)
+	    R_StepActiveU(edge_head.next);
+    }
+
+    surfaces = savedsurfaces;
+}
+
+#endif /* R_THREADED */
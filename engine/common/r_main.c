@@ -20,9 +20,13 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 // r_main.c
 
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "cmd.h"
 #include "console.h"
+#ifdef NQ_HACK
+#include "host.h"
+#endif
 #include "protocol.h"
 #include "quakedef.h"
 #include "r_local.h"
@@ -32,8 +36,6 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "sys.h"
 #include "view.h"
 
-int r_maphunkmark;
-
 void *colormap;
 float r_time1;
 
@@ -44,9 +46,6 @@ float r_aliasuvscale = 1.0;
 qboolean r_surfaces_overflow;
 qboolean r_edges_overflow;
 
-edge_t *saveedges;
-surf_t *savesurfs;
-
 qboolean r_dowarp, r_dowarpold, r_viewchanged;
 
 int c_surf;
@@ -128,8 +127,13 @@ static cvar_t r_zgraph = { "r_zgraph", "0" };
 static cvar_t r_timegraph = { "r_timegraph", "0" };
 static cvar_t r_aliasstats = { "r_polymodelstats", "0" };
 static cvar_t r_dspeeds = { "r_dspeeds", "0" };
+
+/* fisheye's f_speeds reads the same phase timestamps, without the printout */
+extern qboolean fisheye_speeds;
+#define R_DSPEEDS() (r_dspeeds.value || fisheye_speeds)
 static cvar_t r_maxsurfs = { "r_maxsurfs", stringify(MINSURFACES) };
 static cvar_t r_maxedges = { "r_maxedges", stringify(MINEDGES) };
+static cvar_t r_edgestats = { "r_edgestats", "0" };
 static cvar_t r_aliastransbase = { "r_aliastransbase", "200" };
 static cvar_t r_aliastransadj = { "r_aliastransadj", "100" };
 
@@ -186,6 +190,166 @@ R_InitTurb(void)
 }
 
 
+/*
+ * The view's edges and surfaces come from pools kept for the whole map.  At
+ * the start of each frame the pools grow to keep a quarter spare above the
+ * most any view of the frame before used, so a view rarely runs out.  One
+ * that does grows them and is prepared again, which r_edgestats counts.
+ */
+static struct {
+    edge_t *edges;			// as allocated
+    surf_t *surfaces;
+    int numedges, numsurfaces;		// room allocated
+    int frame;				// host_framecount the pools were sized for
+    int frameedges, framesurfaces;	// most used by a view this frame
+    int peakedges, peaksurfaces;	// most used by a view on this map
+    int views, redone;			// views prepared, and prepared again
+} edgepools;
+
+/*
+===============
+R_PoolSize
+
+Doubles size until it has a quarter spare above peak, up to max
+===============
+*/
+static int
+R_PoolSize(int size, int peak, int max)
+{
+    while (size < max && peak + peak / 4 > size)
+	size *= 2;
+
+    return qmin(size, max);
+}
+
+/*
+===============
+R_FreeEdgePools
+===============
+*/
+static void
+R_FreeEdgePools(void)
+{
+    free(edgepools.edges);
+    free(edgepools.surfaces);
+    edgepools.edges = NULL;
+    edgepools.surfaces = NULL;
+    edgepools.numedges = edgepools.numsurfaces = 0;
+}
+
+/*
+===============
+R_EdgePools
+
+Grows the pools if the views counted in frameedges/framesurfaces came close
+to filling them
+===============
+*/
+static void
+R_EdgePools(void)
+{
+    qboolean moved = false;
+
+    r_numedges = R_PoolSize(r_numedges, edgepools.frameedges, MAXEDGES);
+    r_numsurfaces = R_PoolSize(r_numsurfaces, edgepools.framesurfaces,
+			       MAXSURFACES);
+
+    if (r_numedges != edgepools.numedges) {
+	if (edgepools.numedges)
+	    Con_DPrintf("edge limit bumped to %d\n", r_numedges);
+	free(edgepools.edges);
+	edgepools.edges =
+	    malloc(CACHE_PAD_ARRAY(r_numedges, edge_t) * sizeof(edge_t));
+	if (!edgepools.edges)
+	    Sys_Error("%s: out of memory", __func__);
+	edgepools.numedges = r_numedges;
+    }
+    if (r_numsurfaces != edgepools.numsurfaces) {
+	if (edgepools.numsurfaces)
+	    Con_DPrintf("surface limit bumped to %d\n", r_numsurfaces);
+	free(edgepools.surfaces);
+	edgepools.surfaces =
+	    malloc(CACHE_PAD_ARRAY(r_numsurfaces, surf_t) * sizeof(surf_t));
+	if (!edgepools.surfaces)
+	    Sys_Error("%s: out of memory", __func__);
+	edgepools.numsurfaces = r_numsurfaces;
+	moved = true;
+    }
+
+    r_edges = CACHE_ALIGN_PTR(edgepools.edges);
+
+    // surface 0 doesn't really exist; it's just a dummy because index 0
+    // is used to indicate no edge attached to surface
+    surfaces = CACHE_ALIGN_PTR(edgepools.surfaces) - 1;
+    surf_max = &surfaces[r_numsurfaces + 1];
+    if (moved)
+	R_SurfacePatch();
+}
+
+/*
+===============
+R_EdgePoolsFull
+
+Records what the view used, or if it ran out of room, makes sure the pools
+grow before it's prepared again.  Returns false once a view fits (or the
+pools can't grow any more).
+===============
+*/
+static qboolean
+R_EdgePoolsFull(void)
+{
+    qboolean full = false;
+    int usededges, usedsurfaces;
+
+    usededges = r_edges_overflow ? r_numedges : edge_p - r_edges;
+    usedsurfaces = r_surfaces_overflow ? r_numsurfaces : surface_p - surfaces;
+    if (r_edges_overflow) {
+	full = r_numedges < MAXEDGES;
+	r_edges_overflow = false;
+    }
+    if (r_surfaces_overflow) {
+	full |= r_numsurfaces < MAXSURFACES;
+	r_surfaces_overflow = false;
+    }
+
+    edgepools.frameedges = qmax(edgepools.frameedges, usededges);
+    edgepools.framesurfaces = qmax(edgepools.framesurfaces, usedsurfaces);
+    edgepools.peakedges = qmax(edgepools.peakedges, usededges);
+    edgepools.peaksurfaces = qmax(edgepools.peaksurfaces, usedsurfaces);
+
+    return full;
+}
+
+/*
+===============
+R_EdgePoolsSize
+===============
+*/
+static size_t
+R_EdgePoolsSize(void)
+{
+    if (!edgepools.edges)
+	return 0;
+
+    return CACHE_PAD_ARRAY(edgepools.numedges, edge_t) * sizeof(edge_t)
+	+ CACHE_PAD_ARRAY(edgepools.numsurfaces, surf_t) * sizeof(surf_t);
+}
+
+/*
+===============
+R_PrintEdgeStats
+===============
+*/
+static void
+R_PrintEdgeStats(void)
+{
+    Con_Printf("%5i/%5i edges %5i/%5i surfs, peak %i/%i, %i/%i views redone\n",
+	       (int)(edge_p - r_edges), r_numedges,
+	       (int)(surface_p - surfaces), r_numsurfaces,
+	       edgepools.peakedges, edgepools.peaksurfaces,
+	       edgepools.redone, edgepools.views);
+}
+
 /*
 ===============
 R_Init
@@ -205,6 +369,7 @@ R_Init(void)
     Cmd_AddCommand("pointfile", R_ReadPointFile_f);
 
     Cvar_RegisterVariable(&r_draworder);
+    Cvar_RegisterVariable(&r_bands);
     Cvar_RegisterVariable(&r_speeds);
     Cvar_RegisterVariable(&r_graphheight);
     Cvar_RegisterVariable(&r_clearcolor);
@@ -213,6 +378,7 @@ R_Init(void)
     Cvar_RegisterVariable(&r_drawviewmodel);
     Cvar_RegisterVariable(&r_drawflat);
     Cvar_RegisterVariable(&r_ambient);
+    Cvar_RegisterVariable(&r_occlusion);
 
     Cvar_RegisterVariable(&r_lerpmodels);
     Cvar_RegisterVariable(&r_lerpmove);
@@ -220,12 +386,22 @@ R_Init(void)
     Cvar_RegisterVariable(&r_lockfrustum);
 
     Cvar_RegisterVariable(&r_fullbright);
+#ifdef R_SIMD_SURFACES
+    Cvar_RegisterVariable(&r_simdsurfaces);
+#endif
+#ifdef R_SIMD_ALIAS
+    Cvar_RegisterVariable(&r_simdalias);
+#endif
+#ifdef R_SIMD_PARTICLES
+    Cvar_RegisterVariable(&r_simdparticles);
+#endif
 
     Cvar_RegisterVariable(&r_timegraph);
     Cvar_RegisterVariable(&r_aliasstats);
     Cvar_RegisterVariable(&r_dspeeds);
     Cvar_RegisterVariable(&r_maxsurfs);
     Cvar_RegisterVariable(&r_maxedges);
+    Cvar_RegisterVariable(&r_edgestats);
     Cvar_RegisterVariable(&r_aliastransbase);
     Cvar_RegisterVariable(&r_aliastransadj);
 
@@ -247,6 +423,8 @@ R_Init(void)
     r_refdef.xOrigin = XCENTERING;
     r_refdef.yOrigin = YCENTERING;
 
+    Hunk_AddArena("edges", R_EdgePoolsSize);
+
     R_InitParticles();
     R_InitTranslationTable();
 
@@ -258,22 +436,6 @@ R_Init(void)
     D_Init();
 }
 
-static void
-R_HunkAllocSurfaces()
-{
-    auxsurfaces = Hunk_AllocName(r_numsurfaces * sizeof(surf_t), "surfaces");
-    surface_p = surfaces;
-    surf_max = &surfaces[r_numsurfaces];
-    surfaces = auxsurfaces - 1;
-    R_SurfacePatch();
-}
-
-static void
-R_HunkAllocEdges()
-{
-    auxedges = Hunk_AllocName(r_numedges * sizeof(edge_t), "edges");
-}
-
 /*
 ===============
 R_NewMap
@@ -295,9 +457,14 @@ R_NewMap(void)
     r_viewleaf = NULL;
     R_ClearParticles();
 
-    /* Edge rendering resources */
-    r_numsurfaces = qmax((int)r_maxsurfs.value, MINSURFACES);
-    r_numedges = qmax((int)r_maxedges.value, MINEDGES);
+    /* Edge rendering resources, allocated by the first view */
+    R_FreeEdgePools();
+    r_numsurfaces = qclamp((int)r_maxsurfs.value, MINSURFACES, MAXSURFACES);
+    r_numedges = qclamp((int)r_maxedges.value, MINEDGES, MAXEDGES);
+    edgepools.frame = -1;		// allocated by the next view
+    edgepools.frameedges = edgepools.framesurfaces = 0;
+    edgepools.peakedges = edgepools.peaksurfaces = 0;
+    edgepools.views = edgepools.redone = 0;
 
     /* brushmodel clipping */
     r_numbclipverts = MIN_STACK_BMODEL_VERTS;
@@ -307,20 +474,6 @@ R_NewMap(void)
     r_viewchanged = false;
 
     Alpha_NewMap();
-
-    r_maphunkmark = Hunk_LowMark();
-
-    auxsurfaces = NULL;
-    if (r_numsurfaces > MAXSTACKSURFACES)
-        R_HunkAllocSurfaces();
-
-    auxedges = NULL;
-    if (r_numedges > MAXSTACKEDGES)
-        R_HunkAllocEdges();
-
-    /* extra space for saving surfs/edges for translucent surface rendering */
-    savesurfs = Hunk_AllocName(r_numsurfaces * sizeof(surf_t), "savesurf");
-    saveedges = Hunk_AllocName(r_numedges * sizeof(edge_t), "saveedge");
 }
 
 
@@ -982,7 +1135,6 @@ R_DrawBEntitiesOnList(void)
 	return;
 
     VectorCopy(modelorg, oldorigin);
-    r_dlightframecount = r_framecount;
 
     for (i = 0; i < cl_numvisedicts; i++) {
 	entity = cl_visedicts[i];
@@ -1059,7 +1211,7 @@ R_EdgeDrawingPrepare()
 {
     R_BeginEdgeFrame();
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	rw_time1 = Sys_DoubleTime();
     }
 
@@ -1072,19 +1224,19 @@ R_EdgeDrawingPrepare()
     // just z writes, so have the driver turn z compares on now
     D_TurnZOn();
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	rw_time2 = Sys_DoubleTime();
 	db_time1 = rw_time2;
     }
 
     R_DrawBEntitiesOnList();
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	db_time2 = Sys_DoubleTime();
 	se_time1 = db_time2;
     }
 
-    if (!r_dspeeds.value) {
+    if (!R_DSPEEDS()) {
 	VID_UnlockBuffer();
 	S_ExtraUpdate();	// don't let sound get messed up if going slow
 	VID_LockBuffer();
@@ -1104,13 +1256,11 @@ static void
 R_RenderView_(void)
 {
     byte warpbuffer[WARP_WIDTH * WARP_HEIGHT];
-    scanflags_t scanflags;
-    int numsavesurfs, numsaveedges;
-    qboolean realloc, nostack;
+    int found;
 
     r_warpbuffer = warpbuffer;
 
-    if (r_timegraph.value || r_speeds.value || r_dspeeds.value)
+    if (r_timegraph.value || r_speeds.value || R_DSPEEDS())
 	r_time1 = Sys_DoubleTime();
 
     R_SetupFrame();
@@ -1126,125 +1276,60 @@ R_RenderView_(void)
     if (!r_worldentity.model || !cl.worldmodel)
 	Sys_Error("%s: NULL worldmodel", __func__);
 
-    if (!r_dspeeds.value) {
+    if (!R_DSPEEDS()) {
 	VID_UnlockBuffer();
 	S_ExtraUpdate();	// don't let sound get messed up if going slow
 	VID_LockBuffer();
     }
 
-    /*
-     * If we have to retry with more resources, we can't use the
-     * stack again on the second and subsequent passes. May be
-     * possible to go back to stack based next frame if we're still
-     * below MAX_STACK_*
-     */
-    nostack = false;
-
- moar_surfedges:
-    // If we ran out of surfs/edges previously, bump the limits
-    realloc = false;
-    if (r_edges_overflow) {
-        if (r_numedges < MAX_EDGES_INCREMENT)
-            r_numedges *= 2;
-        else
-            r_numedges += MAX_EDGES_INCREMENT;
-
-        Con_DPrintf("edge limit bumped to %d\n", r_numedges);
-        r_edges_overflow = false;
-        realloc = true;
-    }
-    if (r_surfaces_overflow) {
-        if (r_numsurfaces < MAX_SURFACES_INCREMENT)
-            r_numsurfaces *= 2;
-        else
-            r_numsurfaces += MAX_SURFACES_INCREMENT;
-
-        Con_DPrintf("surface limit bumped to %d\n", r_numsurfaces);
-        r_surfaces_overflow = false;
-        realloc = true;
-    }
-
-    // Redo heap allocations it needed...
-    if (realloc) {
-        Hunk_FreeToLowMark(r_maphunkmark);
-
-        auxsurfaces = NULL;
-        if (r_numsurfaces > MAXSTACKSURFACES || nostack)
-            R_HunkAllocSurfaces();
-
-        auxedges = NULL;
-        if (r_numedges > MAXSTACKEDGES || nostack)
-            R_HunkAllocEdges();
-
-        /* surfs/edges for transparency */
-        savesurfs = Hunk_AllocName(r_numsurfaces * sizeof(surf_t), "savesurf");
-        saveedges = Hunk_AllocName(r_numedges * sizeof(edge_t), "saveedge");
+    /* Size the pools for the frame from what the frame before used */
+    if (edgepools.frame != host_framecount) {
+	R_EdgePools();
+	edgepools.frame = host_framecount;
+	edgepools.frameedges = edgepools.framesurfaces = 0;
     }
 
-    /* If we can fit edges/surfs on the stack, allocate them now */
-    if (auxedges) {
-        r_edges = auxedges;
-    } else {
-        edge_t *stackedges = alloca(CACHE_PAD_ARRAY(r_numedges, edge_t) * sizeof(edge_t));
-        r_edges = CACHE_ALIGN_PTR(stackedges);
-    }
-    if (auxsurfaces) {
-        surfaces = auxsurfaces - 1;
-    } else {
-        surf_t *stacksurfs = alloca(CACHE_PAD_ARRAY(r_numsurfaces, surf_t) * sizeof(surf_t));
-        surfaces = CACHE_ALIGN_PTR(stacksurfs);
-        surf_max = &surfaces[r_numsurfaces];
-	// surface 0 doesn't really exist; it's just a dummy because index 0
-	// is used to indicate no edge attached to surface
-        surfaces--;
-        R_SurfacePatch();
-    }
-
-    R_EdgeDrawingPrepare();
-
-    if (r_edges_overflow || r_surfaces_overflow) {
-        nostack = true;
-        goto moar_surfedges;
+    /* Prepare the edges and surfaces, growing the pools if they run out */
+    edgepools.views++;
+    for (;;) {
+	R_EdgeDrawingPrepare();
+	if (!R_EdgePoolsFull())
+	    break;
+	edgepools.redone++;
+	R_EdgePools();
     }
 
-    /* Save a copy of the sorted surfs/edges for special surface passes */
-    numsavesurfs = surface_p - (surfaces + 1);
-    memcpy(savesurfs, surfaces + 1, numsavesurfs * sizeof(*surfaces));
-    numsaveedges = edge_p - r_edges;
-    memcpy(saveedges, r_edges, numsaveedges * sizeof(*r_edges));
-
-    /* Draw the world (zero flags) and collect scanline flags for special surfaces */
-    memset(&scanflags, 0, sizeof(scanflags));
-    R_ScanEdges(0, &scanflags);
+    /* Draw the world, keeping the spans of special surfaces for later */
+    found = R_ScanEdges();
 
     /* Now draw fence(mask) surfaces over the top */
-    if (scanflags.found & SURF_DRAWFENCE) {
-        memcpy(surfaces + 1, savesurfs, numsavesurfs * sizeof(*surfaces));
-        memcpy(r_edges, saveedges, numsaveedges * sizeof(*r_edges));
-        R_ScanEdges(SURF_DRAWFENCE, &scanflags);
-    }
+    if (found & SURF_DRAWFENCE)
+        R_DrawSpecialSpans(SURF_DRAWFENCE);
 
-    if (!r_dspeeds.value) {
+    /* The world's z-buffer is done, entities behind it can be skipped */
+    R_BeginOcclusion();
+
+    if (!R_DSPEEDS()) {
 	VID_UnlockBuffer();
 	S_ExtraUpdate();	// don't let sound get messed up if going slow
 	VID_LockBuffer();
     }
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	se_time2 = Sys_DoubleTime();
 	de_time1 = se_time2;
     }
 
     R_DrawEntitiesOnList();
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	de_time2 = Sys_DoubleTime();
 	dv_time1 = de_time2;
     }
 
     R_DrawViewModel();
 
-    if (r_dspeeds.value) {
+    if (R_DSPEEDS()) {
 	dv_time2 = Sys_DoubleTime();
 	dp_time1 = Sys_DoubleTime();
     }
@@ -1252,17 +1337,15 @@ R_RenderView_(void)
     R_DrawParticles();
 
     /* Now translucent brush models */
-    if (scanflags.found & (r_surfalpha_flags | SURF_DRAWENTALPHA)) {
-        memcpy(surfaces + 1, savesurfs, numsavesurfs * sizeof(*surfaces));
-        memcpy(r_edges, saveedges, numsaveedges * sizeof(*r_edges));
+    if (found & (r_surfalpha_flags | SURF_DRAWENTALPHA)) {
         VectorCopy(r_origin, modelorg);
-        R_ScanEdges(r_surfalpha_flags | SURF_DRAWENTALPHA, &scanflags);
+        R_DrawSpecialSpans(r_surfalpha_flags | SURF_DRAWENTALPHA);
     }
 
     /* Now translucent aliasmodels/sprites */
     R_DrawEntitiesOnList_Translucent();
 
-    if (r_dspeeds.value)
+    if (R_DSPEEDS())
 	dp_time2 = Sys_DoubleTime();
 
     if (r_dowarp)
@@ -1284,6 +1367,9 @@ R_RenderView_(void)
     if (r_aliasstats.value)
 	R_PrintAliasStats();
 
+    if (r_edgestats.value)
+	R_PrintEdgeStats();
+
     if (r_speeds.value)
 	R_PrintTimes();
 
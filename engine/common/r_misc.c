@@ -322,7 +322,8 @@ R_PrintAliasStats
 void
 R_PrintAliasStats(void)
 {
-    Con_Printf("%3i polygon model drawn\n", r_amodels_drawn);
+    Con_Printf("%3i polygon model drawn, %i occluded\n", r_amodels_drawn,
+	       r_amodels_occluded);
 }
 
 void
@@ -456,6 +457,8 @@ R_SetupFrame(void)
     R_CheckVariables();
 
     R_AnimateLight();
+    R_SetupSurfaceBuilders();
+    R_SetupAliasLoops();
 
     r_framecount++;
 
@@ -484,8 +487,13 @@ R_SetupFrame(void)
     }
 
 // current viewleaf
+// (fisheye stereo eyes share the PVS of the point between them)
+    extern const float *fisheye_pvs_origin;
     r_oldviewleaf = r_viewleaf;
-    r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
+    if (fisheye_enabled && fisheye_pvs_origin)
+	r_viewleaf = Mod_PointInLeaf(cl.worldmodel, fisheye_pvs_origin);
+    else
+	r_viewleaf = Mod_PointInLeaf(cl.worldmodel, r_origin);
 
     r_dowarpold = r_dowarp;
     if (fisheye_enabled) {
@@ -556,6 +564,7 @@ R_SetupFrame(void)
     r_polycount = 0;
     r_drawnpolycount = 0;
     r_amodels_drawn = 0;
+    r_amodels_occluded = 0;
 
     D_SetupFrame();
 }
@@ -0,0 +1,182 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_occlude.c: skipping entities the world has already covered
+
+/*
+ * Once the world is drawn, the z-buffer holds 1/z of whatever is nearest at
+ * every pixel of the view, and nothing drawn later makes a pixel further
+ * away.  The pyramid keeps the smallest 1/z (the furthest depth) of each
+ * 8x8 tile of it, then of each 2x2 block of tiles and so on up.  Something
+ * with a smaller 1/z than every tile its screen rectangle touches can't pass
+ * the z test anywhere in it.  The pyramid is built the first time an entity
+ * is tested after R_BeginOcclusion, so views without any don't pay for it.
+ */
+
+#include <limits.h>
+
+#include "d_local.h"
+#include "quakedef.h"
+#include "r_local.h"
+
+cvar_t r_occlusion = { "r_occlusion", "1" };
+
+#define ZTILE_SHIFT	3
+#define ZTILE_SIZE	(1 << ZTILE_SHIFT)
+
+#define ZTILES_WIDE	((MAXWIDTH + ZTILE_SIZE - 1) >> ZTILE_SHIFT)
+#define ZTILES_HIGH	((MAXHEIGHT + ZTILE_SIZE - 1) >> ZTILE_SHIFT)
+#define MAX_ZLEVELS	12
+
+// each level is at most a quarter of the one below, with rounding up
+static short zpyramid[ZTILES_WIDE * ZTILES_HIGH * 2];
+
+static struct {
+    short *tiles;
+    int width, height;
+} zlevels[MAX_ZLEVELS];
+static int numzlevels;
+static qboolean zpyramid_built;
+
+/*
+==============
+R_BeginOcclusion
+
+The world is drawn into the z-buffer, entities can be tested from here on
+==============
+*/
+void
+R_BeginOcclusion(void)
+{
+    zpyramid_built = false;
+}
+
+/*
+==============
+R_BuildZPyramid
+==============
+*/
+static void
+R_BuildZPyramid(void)
+{
+    int x, y, tx, ty, width, height, level;
+    short *tiles, *row, *below, z;
+    const short *pz;
+
+    width = r_refdef.vrect.width;
+    height = r_refdef.vrect.height;
+    zlevels[0].tiles = zpyramid;
+    zlevels[0].width = (width + ZTILE_SIZE - 1) >> ZTILE_SHIFT;
+    zlevels[0].height = (height + ZTILE_SIZE - 1) >> ZTILE_SHIFT;
+
+    // the furthest of each tile of the view
+    tiles = zlevels[0].tiles;
+    for (y = 0; y < height; y++) {
+	row = tiles + (y >> ZTILE_SHIFT) * zlevels[0].width;
+	if (!(y & (ZTILE_SIZE - 1))) {
+	    for (tx = 0; tx < zlevels[0].width; tx++)
+		row[tx] = SHRT_MAX;
+	}
+	pz = d_pzbuffer + (r_refdef.vrect.y + y) * d_zwidth + r_refdef.vrect.x;
+	for (x = 0; x < width; x++) {
+	    if (pz[x] < row[x >> ZTILE_SHIFT])
+		row[x >> ZTILE_SHIFT] = pz[x];
+	}
+    }
+
+    // then the furthest of each 2x2 of the level below
+    for (level = 1; level < MAX_ZLEVELS; level++) {
+	if (zlevels[level - 1].width == 1 && zlevels[level - 1].height == 1)
+	    break;
+	zlevels[level].tiles = zlevels[level - 1].tiles +
+	    zlevels[level - 1].width * zlevels[level - 1].height;
+	zlevels[level].width = (zlevels[level - 1].width + 1) >> 1;
+	zlevels[level].height = (zlevels[level - 1].height + 1) >> 1;
+
+	tiles = zlevels[level].tiles;
+	for (ty = 0; ty < zlevels[level].height; ty++) {
+	    for (tx = 0; tx < zlevels[level].width; tx++) {
+		z = SHRT_MAX;
+		for (y = ty * 2; y < ty * 2 + 2; y++) {
+		    if (y >= zlevels[level - 1].height)
+			break;
+		    below = zlevels[level - 1].tiles + y * zlevels[level - 1].width;
+		    for (x = tx * 2; x < tx * 2 + 2; x++) {
+			if (x < zlevels[level - 1].width && below[x] < z)
+			    z = below[x];
+		    }
+		}
+		tiles[ty * zlevels[level].width + tx] = z;
+	    }
+	}
+    }
+    numzlevels = level;
+    zpyramid_built = true;
+}
+
+/*
+==============
+R_OccludedRect
+
+Whether the world covers every pixel from left, top to right, bottom
+(inclusive, in screen coordinates) with something nearer than zi, which is
+on the scale of the z-buffer's 1/z
+==============
+*/
+qboolean
+R_OccludedRect(int left, int top, int right, int bottom, int zi)
+{
+    int level, x, y;
+    const short *row;
+
+    if (!r_occlusion.value || zi >= SHRT_MAX)
+	return false;
+
+    left = qmax(left, r_refdef.vrect.x) - r_refdef.vrect.x;
+    top = qmax(top, r_refdef.vrect.y) - r_refdef.vrect.y;
+    right = qmin(right, r_refdef.vrectright - 1) - r_refdef.vrect.x;
+    bottom = qmin(bottom, r_refdef.vrectbottom - 1) - r_refdef.vrect.y;
+    if (left > right || top > bottom)
+	return false;
+
+    if (!zpyramid_built)
+	R_BuildZPyramid();
+
+    // go up until a few tiles cover it
+    left >>= ZTILE_SHIFT;
+    top >>= ZTILE_SHIFT;
+    right >>= ZTILE_SHIFT;
+    bottom >>= ZTILE_SHIFT;
+    for (level = 0; level < numzlevels - 1; level++) {
+	if (right - left < 4 && bottom - top < 4)
+	    break;
+	left >>= 1;
+	top >>= 1;
+	right >>= 1;
+	bottom >>= 1;
+    }
+
+    for (y = top; y <= bottom; y++) {
+	row = zlevels[level].tiles + y * zlevels[level].width;
+	for (x = left; x <= right; x++) {
+	    if (row[x] <= zi)
+		return false;
+	}
+    }
+
+    return true;
+}
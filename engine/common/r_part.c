@@ -41,13 +41,71 @@ int ramp1[8] = { 0x6f, 0x6d, 0x6b, 0x69, 0x67, 0x65, 0x63, 0x61 };
 int ramp2[8] = { 0x6f, 0x6e, 0x6d, 0x6c, 0x6b, 0x6a, 0x68, 0x66 };
 int ramp3[8] = { 0x6d, 0x6b, 6, 5, 4, 3 };
 
-particle_t *active_particles, *free_particles;
+#define NUM_PARTICLE_TYPES	(pt_blob2 + 1)
 
-particle_t *particles;
-int r_numparticles;
+/*
+ * Particles are kept a field to an array rather than a struct each, so they
+ * can be run and drawn a vector's worth at a time.  New ones go on the end
+ * of the pool.  Once a frame CL_RunParticles drops the dead and sorts the
+ * rest by type, so each type is run over a stretch of the pool of its own.
+ */
+typedef struct {
+    float *org[3];
+    float *vel[3];
+    float *ramp;
+    float *die;
+    byte *color;
+    byte *type;
+} particlepool_t;
+
+static particlepool_t particles, sortedparticles;
+static int numparticles;	// in use, from the start of the pool
+int r_numparticles;		// room in the pool
+
+// where each type starts in the pool once it's sorted, and where it ends
+static int typestart[NUM_PARTICLE_TYPES + 1];
+
+// changes whenever particles are added, moved or dropped
+static int particleserial;
 
 vec3_t r_pright, r_pup, r_ppn;
 
+#ifdef R_SIMD_PARTICLES
+cvar_t r_simdparticles = { "r_simdparticles", "1" };
+static qboolean r_particlesimd;
+#endif
+
+#ifndef GLQUAKE
+/*
+ * Each particle's offset from r_origin, worked out once for all the views
+ * drawn from the same place (the plates of a fisheye view), until the
+ * particles change
+ */
+static float *particlelocal[3];
+static int localserial = -1;
+static vec3_t localorigin;
+#endif
+
+
+/*
+===============
+R_AllocParticlePool
+===============
+*/
+static void
+R_AllocParticlePool(particlepool_t *pool, int size)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	pool->org[i] = Hunk_AllocName(size * sizeof(float), "particles");
+	pool->vel[i] = Hunk_AllocName(size * sizeof(float), "particles");
+    }
+    pool->ramp = Hunk_AllocName(size * sizeof(float), "particles");
+    pool->die = Hunk_AllocName(size * sizeof(float), "particles");
+    pool->color = Hunk_AllocName(size, "particles");
+    pool->type = Hunk_AllocName(size, "particles");
+}
 
 /*
 ===============
@@ -69,8 +127,31 @@ R_InitParticles(void)
 	r_numparticles = MAX_PARTICLES;
     }
 
-    particles = (particle_t *)
-	Hunk_AllocName(r_numparticles * sizeof(particle_t), "particles");
+    R_AllocParticlePool(&particles, r_numparticles);
+    R_AllocParticlePool(&sortedparticles, r_numparticles);
+#ifndef GLQUAKE
+    for (i = 0; i < 3; i++)
+	particlelocal[i] = Hunk_AllocName(r_numparticles * sizeof(float),
+					  "particles");
+#endif
+}
+
+/*
+===============
+R_AllocParticle
+
+Adds a particle to the end of the pool, returning where it is, or -1 if
+there's no room
+===============
+*/
+static int
+R_AllocParticle(void)
+{
+    if (numparticles == r_numparticles)
+	return -1;
+
+    particleserial++;
+    return numparticles++;
 }
 
 #ifdef NQ_HACK
@@ -91,7 +172,7 @@ void
 R_EntityParticles(const entity_t *ent)
 {
     int i;
-    particle_t *p;
+    int p;
     float angle;
     float sp, sy, cp, cy;
     vec3_t forward;
@@ -117,24 +198,21 @@ R_EntityParticles(const entity_t *ent)
 	forward[1] = cp * sy;
 	forward[2] = -sp;
 
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 
-	p->die = cl.time + 0.01;
-	p->color = 0x6f;
-	p->type = pt_explode;
+	particles.die[p] = cl.time + 0.01;
+	particles.color[p] = 0x6f;
+	particles.type[p] = pt_explode;
 
-	p->org[0] =
+	particles.org[0][p] =
 	    ent->origin[0] + r_avertexnormals[i][0] * dist +
 	    forward[0] * beamlength;
-	p->org[1] =
+	particles.org[1][p] =
 	    ent->origin[1] + r_avertexnormals[i][1] * dist +
 	    forward[1] * beamlength;
-	p->org[2] =
+	particles.org[2][p] =
 	    ent->origin[2] + r_avertexnormals[i][2] * dist +
 	    forward[2] * beamlength;
     }
@@ -149,14 +227,8 @@ R_ClearParticles
 void
 R_ClearParticles(void)
 {
-    int i;
-
-    free_particles = &particles[0];
-    active_particles = NULL;
-
-    for (i = 0; i < r_numparticles; i++)
-	particles[i].next = &particles[i + 1];
-    particles[r_numparticles - 1].next = NULL;
+    numparticles = 0;
+    particleserial++;
 }
 
 
@@ -167,7 +239,7 @@ R_ReadPointFile_f(void)
     vec3_t org;
     int r;
     int c;
-    particle_t *p;
+    int i, p;
     char name[MAX_OSPATH];
 
 #ifdef NQ_HACK
@@ -192,20 +264,19 @@ R_ReadPointFile_f(void)
 	    break;
 	c++;
 
-	if (!free_particles) {
+	p = R_AllocParticle();
+	if (p < 0) {
 	    Con_Printf("Not enough free particles\n");
 	    break;
 	}
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = 99999;
-	p->color = (-c) & 15;
-	p->type = pt_static;
-	VectorCopy(vec3_origin, p->vel);
-	VectorCopy(org, p->org);
+
+	particles.die[p] = 99999;
+	particles.color[p] = (-c) & 15;
+	particles.type[p] = pt_static;
+	for (i = 0; i < 3; i++) {
+	    particles.vel[i][p] = 0;
+	    particles.org[i][p] = org[i];
+	}
     }
 
     fclose(f);
@@ -252,30 +323,27 @@ void
 R_ParticleExplosion(vec3_t org)
 {
     int i, j;
-    particle_t *p;
+    int p;
 
     for (i = 0; i < 1024; i++) {
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
-
-	p->die = cl.time + 5;
-	p->color = ramp1[0];
-	p->ramp = rand() & 3;
+
+	particles.die[p] = cl.time + 5;
+	particles.color[p] = ramp1[0];
+	particles.ramp[p] = rand() & 3;
 	if (i & 1) {
-	    p->type = pt_explode;
+	    particles.type[p] = pt_explode;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		particles.vel[j][p] = (rand() % 512) - 256;
 	    }
 	} else {
-	    p->type = pt_explode2;
+	    particles.type[p] = pt_explode2;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		particles.vel[j][p] = (rand() % 512) - 256;
 	    }
 	}
     }
@@ -292,25 +360,22 @@ void
 R_ParticleExplosion2(vec3_t org, int colorStart, int colorLength)
 {
     int i, j;
-    particle_t *p;
+    int p;
     int colorMod = 0;
 
     for (i = 0; i < 512; i++) {
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 
-	p->die = cl.time + 0.3;
-	p->color = colorStart + (colorMod % colorLength);
+	particles.die[p] = cl.time + 0.3;
+	particles.color[p] = colorStart + (colorMod % colorLength);
 	colorMod++;
 
-	p->type = pt_blob;
+	particles.type[p] = pt_blob;
 	for (j = 0; j < 3; j++) {
-	    p->org[j] = org[j] + ((rand() % 32) - 16);
-	    p->vel[j] = (rand() % 512) - 256;
+	    particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+	    particles.vel[j][p] = (rand() % 512) - 256;
 	}
     }
 }
@@ -326,31 +391,28 @@ void
 R_BlobExplosion(vec3_t org)
 {
     int i, j;
-    particle_t *p;
+    int p;
 
     for (i = 0; i < 1024; i++) {
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 
-	p->die = cl.time + 1 + (rand() & 8) * 0.05;
+	particles.die[p] = cl.time + 1 + (rand() & 8) * 0.05;
 
 	if (i & 1) {
-	    p->type = pt_blob;
-	    p->color = 66 + rand() % 6;
+	    particles.type[p] = pt_blob;
+	    particles.color[p] = 66 + rand() % 6;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		particles.vel[j][p] = (rand() % 512) - 256;
 	    }
 	} else {
-	    p->type = pt_blob2;
-	    p->color = 150 + rand() % 6;
+	    particles.type[p] = pt_blob2;
+	    particles.color[p] = 150 + rand() % 6;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() % 32) - 16);
-		p->vel[j] = (rand() % 512) - 256;
+		particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		particles.vel[j][p] = (rand() % 512) - 256;
 	    }
 	}
     }
@@ -366,7 +428,7 @@ void
 R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 {
     int i, j;
-    particle_t *p;
+    int p;
 #ifdef QW_HACK
     int scale;
 
@@ -379,48 +441,45 @@ R_RunParticleEffect(vec3_t org, vec3_t dir, int color, int count)
 #endif
 
     for (i = 0; i < count; i++) {
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 
 #ifdef NQ_HACK
 	if (count == 1024) {	// rocket explosion
-	    p->die = cl.time + 5;
-	    p->color = ramp1[0];
-	    p->ramp = rand() & 3;
+	    particles.die[p] = cl.time + 5;
+	    particles.color[p] = ramp1[0];
+	    particles.ramp[p] = rand() & 3;
 	    if (i & 1) {
-		p->type = pt_explode;
+		particles.type[p] = pt_explode;
 		for (j = 0; j < 3; j++) {
-		    p->org[j] = org[j] + ((rand() % 32) - 16);
-		    p->vel[j] = (rand() % 512) - 256;
+		    particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		    particles.vel[j][p] = (rand() % 512) - 256;
 		}
 	    } else {
-		p->type = pt_explode2;
+		particles.type[p] = pt_explode2;
 		for (j = 0; j < 3; j++) {
-		    p->org[j] = org[j] + ((rand() % 32) - 16);
-		    p->vel[j] = (rand() % 512) - 256;
+		    particles.org[j][p] = org[j] + ((rand() % 32) - 16);
+		    particles.vel[j][p] = (rand() % 512) - 256;
 		}
 	    }
 	} else {
-	    p->die = cl.time + 0.1 * (rand() % 5);
-	    p->color = (color & ~7) + (rand() & 7);
-	    p->type = pt_slowgrav;
+	    particles.die[p] = cl.time + 0.1 * (rand() % 5);
+	    particles.color[p] = (color & ~7) + (rand() & 7);
+	    particles.type[p] = pt_slowgrav;
 	    for (j = 0; j < 3; j++) {
-		p->org[j] = org[j] + ((rand() & 15) - 8);
-		p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+		particles.org[j][p] = org[j] + ((rand() & 15) - 8);
+		particles.vel[j][p] = dir[j] * 15;	// + (rand()%300)-150;
 	    }
 	}
 #endif
 #ifdef QW_HACK
-	p->die = cl.time + 0.1 * (rand() % 5);
-	p->color = (color & ~7) + (rand() & 7);
-	p->type = pt_grav;
+	particles.die[p] = cl.time + 0.1 * (rand() % 5);
+	particles.color[p] = (color & ~7) + (rand() & 7);
+	particles.type[p] = pt_grav;
 	for (j = 0; j < 3; j++) {
-	    p->org[j] = org[j] + scale * ((rand() & 15) - 8);
-	    p->vel[j] = dir[j] * 15;	// + (rand()%300)-150;
+	    particles.org[j][p] = org[j] + scale * ((rand() & 15) - 8);
+	    particles.vel[j][p] = dir[j] * 15;	// + (rand()%300)-150;
 	}
 #endif
     }
@@ -437,35 +496,34 @@ void
 R_LavaSplash(vec3_t org)
 {
     int i, j, k;
-    particle_t *p;
+    int p;
     float vel;
     vec3_t dir;
 
     for (i = -16; i < 16; i++)
 	for (j = -16; j < 16; j++)
 	    for (k = 0; k < 1; k++) {
-		if (!free_particles)
+		p = R_AllocParticle();
+		if (p < 0)
 		    return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
-		p->die = cl.time + 2 + (rand() & 31) * 0.02;
-		p->color = 224 + (rand() & 7);
-		p->type = pt_grav;
+		particles.die[p] = cl.time + 2 + (rand() & 31) * 0.02;
+		particles.color[p] = 224 + (rand() & 7);
+		particles.type[p] = pt_grav;
 
 		dir[0] = j * 8 + (rand() & 7);
 		dir[1] = i * 8 + (rand() & 7);
 		dir[2] = 256;
 
-		p->org[0] = org[0] + dir[0];
-		p->org[1] = org[1] + dir[1];
-		p->org[2] = org[2] + (rand() & 63);
+		particles.org[0][p] = org[0] + dir[0];
+		particles.org[1][p] = org[1] + dir[1];
+		particles.org[2][p] = org[2] + (rand() & 63);
 
 		VectorNormalize(dir);
 		vel = 50 + (rand() & 63);
-		VectorScale(dir, vel, p->vel);
+		particles.vel[0][p] = dir[0] * vel;
+		particles.vel[1][p] = dir[1] * vel;
+		particles.vel[2][p] = dir[2] * vel;
 	    }
 }
 
@@ -479,35 +537,34 @@ void
 R_TeleportSplash(vec3_t org)
 {
     int i, j, k;
-    particle_t *p;
+    int p;
     float vel;
     vec3_t dir;
 
     for (i = -16; i < 16; i += 4)
 	for (j = -16; j < 16; j += 4)
 	    for (k = -24; k < 32; k += 4) {
-		if (!free_particles)
+		p = R_AllocParticle();
+		if (p < 0)
 		    return;
-		p = free_particles;
-		free_particles = p->next;
-		p->next = active_particles;
-		active_particles = p;
 
-		p->die = cl.time + 0.2 + (rand() & 7) * 0.02;
-		p->color = 7 + (rand() & 7);
-		p->type = pt_grav;
+		particles.die[p] = cl.time + 0.2 + (rand() & 7) * 0.02;
+		particles.color[p] = 7 + (rand() & 7);
+		particles.type[p] = pt_grav;
 
 		dir[0] = j * 8;
 		dir[1] = i * 8;
 		dir[2] = k * 8;
 
-		p->org[0] = org[0] + i + (rand() & 3);
-		p->org[1] = org[1] + j + (rand() & 3);
-		p->org[2] = org[2] + k + (rand() & 3);
+		particles.org[0][p] = org[0] + i + (rand() & 3);
+		particles.org[1][p] = org[1] + j + (rand() & 3);
+		particles.org[2][p] = org[2] + k + (rand() & 3);
 
 		VectorNormalize(dir);
 		vel = 50 + (rand() & 63);
-		VectorScale(dir, vel, p->vel);
+		particles.vel[0][p] = dir[0] * vel;
+		particles.vel[1][p] = dir[1] * vel;
+		particles.vel[2][p] = dir[2] * vel;
 	    }
 }
 
@@ -518,7 +575,7 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
     vec3_t vec;
     float len;
     int j;
-    particle_t *p;
+    int p;
 #ifdef NQ_HACK
     int dec;
 #endif
@@ -541,74 +598,73 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
 #ifdef QW_HACK
 	len -= 3;
 #endif
-	if (!free_particles)
+	p = R_AllocParticle();
+	if (p < 0)
 	    return;
-	p = free_particles;
-	free_particles = p->next;
-	p->next = active_particles;
-	active_particles = p;
 
-	VectorCopy(vec3_origin, p->vel);
-	p->die = cl.time + 2;
+	for (j = 0; j < 3; j++)
+	    particles.vel[j][p] = 0;
+	particles.die[p] = cl.time + 2;
 
 	switch (type) {
 	case 0:		// rocket trail
-	    p->ramp = (rand() & 3);
-	    p->color = ramp3[(int)p->ramp];
-	    p->type = pt_fire;
+	    particles.ramp[p] = (rand() & 3);
+	    particles.color[p] = ramp3[(int)particles.ramp[p]];
+	    particles.type[p] = pt_fire;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		particles.org[j][p] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 1:		// smoke smoke
-	    p->ramp = (rand() & 3) + 2;
-	    p->color = ramp3[(int)p->ramp];
-	    p->type = pt_fire;
+	    particles.ramp[p] = (rand() & 3) + 2;
+	    particles.color[p] = ramp3[(int)particles.ramp[p]];
+	    particles.type[p] = pt_fire;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		particles.org[j][p] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 2:		// blood
-	    p->type = pt_grav;
-	    p->color = 67 + (rand() & 3);
+	    particles.type[p] = pt_grav;
+	    particles.color[p] = 67 + (rand() & 3);
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		particles.org[j][p] = start[j] + ((rand() % 6) - 3);
 	    break;
 
 	case 3:
 	case 5:		// tracer
-	    p->die = cl.time + 0.5;
-	    p->type = pt_static;
+	    particles.die[p] = cl.time + 0.5;
+	    particles.type[p] = pt_static;
 	    if (type == 3)
-		p->color = 52 + ((tracercount & 4) << 1);
+		particles.color[p] = 52 + ((tracercount & 4) << 1);
 	    else
-		p->color = 230 + ((tracercount & 4) << 1);
+		particles.color[p] = 230 + ((tracercount & 4) << 1);
 
 	    tracercount++;
-	    VectorCopy(start, p->org);
+	    for (j = 0; j < 3; j++)
+		particles.org[j][p] = start[j];
 	    if (tracercount & 1) {
-		p->vel[0] = 30 * vec[1];
-		p->vel[1] = 30 * -vec[0];
+		particles.vel[0][p] = 30 * vec[1];
+		particles.vel[1][p] = 30 * -vec[0];
 	    } else {
-		p->vel[0] = 30 * -vec[1];
-		p->vel[1] = 30 * vec[0];
+		particles.vel[0][p] = 30 * -vec[1];
+		particles.vel[1][p] = 30 * vec[0];
 	    }
 	    break;
 
 	case 4:		// slight blood
-	    p->type = pt_grav;
-	    p->color = 67 + (rand() & 3);
+	    particles.type[p] = pt_grav;
+	    particles.color[p] = 67 + (rand() & 3);
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() % 6) - 3);
+		particles.org[j][p] = start[j] + ((rand() % 6) - 3);
 	    len -= 3;
 	    break;
 
 	case 6:		// voor trail
-	    p->color = 9 * 16 + 8 + (rand() & 3);
-	    p->type = pt_static;
-	    p->die = cl.time + 0.3;
+	    particles.color[p] = 9 * 16 + 8 + (rand() & 3);
+	    particles.type[p] = pt_static;
+	    particles.die[p] = cl.time + 0.3;
 	    for (j = 0; j < 3; j++)
-		p->org[j] = start[j] + ((rand() & 15) - 8);
+		particles.org[j][p] = start[j] + ((rand() & 15) - 8);
 	    break;
 	}
 
@@ -616,6 +672,135 @@ R_RocketTrail(vec3_t start, vec3_t end, int type)
     }
 }
 
+/*
+===============
+R_SortParticles
+
+Drops the particles that have died and sorts the rest by type, keeping
+their order within each type
+===============
+*/
+static void
+R_SortParticles(void)
+{
+    particlepool_t swap;
+    int i, j, type, next[NUM_PARTICLE_TYPES];
+
+    for (type = 0; type <= NUM_PARTICLE_TYPES; type++)
+	typestart[type] = 0;
+    for (i = 0; i < numparticles; i++) {
+	if (!(particles.die[i] < cl.time))
+	    typestart[particles.type[i] + 1]++;
+    }
+    for (type = 0; type < NUM_PARTICLE_TYPES; type++) {
+	typestart[type + 1] += typestart[type];
+	next[type] = typestart[type];
+    }
+
+    for (i = 0; i < numparticles; i++) {
+	if (particles.die[i] < cl.time)
+	    continue;
+	j = next[particles.type[i]]++;
+	sortedparticles.org[0][j] = particles.org[0][i];
+	sortedparticles.org[1][j] = particles.org[1][i];
+	sortedparticles.org[2][j] = particles.org[2][i];
+	sortedparticles.vel[0][j] = particles.vel[0][i];
+	sortedparticles.vel[1][j] = particles.vel[1][i];
+	sortedparticles.vel[2][j] = particles.vel[2][i];
+	sortedparticles.ramp[j] = particles.ramp[i];
+	sortedparticles.die[j] = particles.die[i];
+	sortedparticles.color[j] = particles.color[i];
+	sortedparticles.type[j] = particles.type[i];
+    }
+
+    swap = particles;
+    particles = sortedparticles;
+    sortedparticles = swap;
+    numparticles = typestart[NUM_PARTICLE_TYPES];
+    particleserial++;
+}
+
+/*
+===============
+R_ParticleScaleAdd
+
+dst += src * scale, for count particles
+===============
+*/
+static void
+R_ParticleScaleAdd(float *dst, const float *src, float scale, int count)
+{
+    int i;
+
+#ifdef R_SIMD_PARTICLES
+    if (r_particlesimd) {
+	R_ParticleScaleAdd_AVX2(dst, src, scale, count);
+	return;
+    }
+#endif
+
+    for (i = 0; i < count; i++)
+	dst[i] += src[i] * scale;
+}
+
+/*
+===============
+R_ParticleAdd
+
+dst += value, for count particles
+===============
+*/
+static void
+R_ParticleAdd(float *dst, float value, int count)
+{
+    int i;
+
+#ifdef R_SIMD_PARTICLES
+    if (r_particlesimd) {
+	R_ParticleAdd_AVX2(dst, value, count);
+	return;
+    }
+#endif
+
+    for (i = 0; i < count; i++)
+	dst[i] += value;
+}
+
+/*
+===============
+R_ParticleRamp
+
+Steps count particles along a color ramp, killing those that run off the
+end of it
+===============
+*/
+static void
+R_ParticleRamp(int first, int count, float step, float end, const int *ramp)
+{
+    float *pramp, *pdie;
+    byte *pcolor;
+    int i;
+
+    pramp = particles.ramp + first;
+    pdie = particles.die + first;
+    pcolor = particles.color + first;
+
+#ifdef R_SIMD_PARTICLES
+    if (r_particlesimd) {
+	R_ParticleRamp_AVX2(pramp, pdie, pcolor, count, step, end, ramp);
+	return;
+    }
+#endif
+
+    for (i = 0; i < count; i++) {
+	pramp[i] += step;
+	if (pramp[i] >= end)
+	    pdie[i] = -1;
+	else
+	    pcolor[i] = ramp[(int)pramp[i]];
+    }
+}
+
 /*
 ===============
 CL_RunParticles
@@ -624,12 +809,12 @@ CL_RunParticles
 void
 CL_RunParticles(void)
 {
-    particle_t *p, *kill;
     float grav;
     float time1, time2, time3;
     float frametime;
     float dvel;
-    int i;
+    float *vel[3];
+    int i, type, first, count;
 
 #ifdef NQ_HACK
     frametime = cl.time - cl.oldtime;
@@ -644,87 +829,91 @@ CL_RunParticles(void)
     time1 = frametime * 5;
     dvel = 4 * frametime;
 
-    for (;;) {
-	kill = active_particles;
-	if (kill && kill->die < cl.time) {
-	    active_particles = kill->next;
-	    kill->next = free_particles;
-	    free_particles = kill;
-	    continue;
-	}
-	break;
-    }
+#ifdef R_SIMD_PARTICLES
+    r_particlesimd = r_simdparticles.value && R_SIMDParticleLoops();
+#endif
 
-    for (p = active_particles; p; p = p->next) {
-	for (;;) {
-	    kill = p->next;
-	    if (kill && kill->die < cl.time) {
-		p->next = kill->next;
-		kill->next = free_particles;
-		free_particles = kill;
-		continue;
-	    }
-	    break;
-	}
+    R_SortParticles();
 
-	p->org[0] += p->vel[0] * frametime;
-	p->org[1] += p->vel[1] * frametime;
-	p->org[2] += p->vel[2] * frametime;
+    for (i = 0; i < 3; i++)
+	R_ParticleScaleAdd(particles.org[i], particles.vel[i], frametime,
+			   numparticles);
 
-	switch (p->type) {
+    for (type = 0; type < NUM_PARTICLE_TYPES; type++) {
+	first = typestart[type];
+	count = typestart[type + 1] - first;
+	if (!count)
+	    continue;
+	for (i = 0; i < 3; i++)
+	    vel[i] = particles.vel[i] + first;
+
+	switch (type) {
 	case pt_static:
 	    break;
 	case pt_fire:
-	    p->ramp += time1;
-	    if (p->ramp >= 6)
-		p->die = -1;
-	    else
-		p->color = ramp3[(int)p->ramp];
-	    p->vel[2] += grav;
+	    R_ParticleRamp(first, count, time1, 6, ramp3);
+	    R_ParticleAdd(vel[2], grav, count);
 	    break;
 
 	case pt_explode:
-	    p->ramp += time2;
-	    if (p->ramp >= 8)
-		p->die = -1;
-	    else
-		p->color = ramp1[(int)p->ramp];
+	    R_ParticleRamp(first, count, time2, 8, ramp1);
 	    for (i = 0; i < 3; i++)
-		p->vel[i] += p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+		R_ParticleScaleAdd(vel[i], vel[i], dvel, count);
+	    R_ParticleAdd(vel[2], -grav, count);
 	    break;
 
 	case pt_explode2:
-	    p->ramp += time3;
-	    if (p->ramp >= 8)
-		p->die = -1;
-	    else
-		p->color = ramp2[(int)p->ramp];
+	    R_ParticleRamp(first, count, time3, 8, ramp2);
 	    for (i = 0; i < 3; i++)
-		p->vel[i] -= p->vel[i] * frametime;
-	    p->vel[2] -= grav;
+		R_ParticleScaleAdd(vel[i], vel[i], -frametime, count);
+	    R_ParticleAdd(vel[2], -grav, count);
 	    break;
 
 	case pt_blob:
 	    for (i = 0; i < 3; i++)
-		p->vel[i] += p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+		R_ParticleScaleAdd(vel[i], vel[i], dvel, count);
+	    R_ParticleAdd(vel[2], -grav, count);
 	    break;
 
 	case pt_blob2:
 	    for (i = 0; i < 2; i++)
-		p->vel[i] -= p->vel[i] * dvel;
-	    p->vel[2] -= grav;
+		R_ParticleScaleAdd(vel[i], vel[i], -dvel, count);
+	    R_ParticleAdd(vel[2], -grav, count);
 	    break;
 
 	case pt_slowgrav:
 	case pt_grav:
-	    p->vel[2] -= grav;
+	    R_ParticleAdd(vel[2], -grav, count);
 	    break;
 	}
     }
 }
 
+#ifndef GLQUAKE
+/*
+===============
+R_ParticleOffsets
+
+Works out each particle's offset from r_origin, unless it's already done
+===============
+*/
+static void
+R_ParticleOffsets(void)
+{
+    int i, p;
+
+    if (localserial == particleserial && VectorCompare(localorigin, r_origin))
+	return;
+
+    for (i = 0; i < 3; i++) {
+	for (p = 0; p < numparticles; p++)
+	    particlelocal[i][p] = particles.org[i][p] - r_origin[i];
+    }
+    localserial = particleserial;
+    VectorCopy(r_origin, localorigin);
+}
+#endif
+
 /*
 ===============
 R_DrawParticles
@@ -733,15 +922,14 @@ R_DrawParticles
 void
 R_DrawParticles(void)
 {
-    particle_t *p;
-
 #ifdef GLQUAKE
+    int p;
 #ifdef QW_HACK
     unsigned char *at;
     unsigned char theAlpha;
 #endif
     qboolean alphaTestEnabled;
-    vec3_t up, right;
+    vec3_t org, up, right;
     float scale;
 
 #ifdef NQ_HACK
@@ -765,52 +953,42 @@ R_DrawParticles(void)
 
     VectorScale(vup, 1.5, up);
     VectorScale(vright, 1.5, right);
-#else
-    D_StartParticles();
-
-    VectorScale(vright, xscaleshrink, r_pright);
-    VectorScale(vup, yscaleshrink, r_pup);
-    VectorCopy(vpn, r_ppn);
-#endif
 
-    for (p = active_particles; p; p = p->next) {
+    for (p = 0; p < numparticles; p++) {
+	org[0] = particles.org[0][p];
+	org[1] = particles.org[1][p];
+	org[2] = particles.org[2][p];
 
-#ifdef GLQUAKE
 	// hack a scale up to keep particles from disapearing
 	scale =
-	    (p->org[0] - r_origin[0]) * vpn[0] + (p->org[1] -
-						  r_origin[1]) * vpn[1]
-	    + (p->org[2] - r_origin[2]) * vpn[2];
+	    (org[0] - r_origin[0]) * vpn[0] + (org[1] - r_origin[1]) * vpn[1]
+	    + (org[2] - r_origin[2]) * vpn[2];
 	if (scale < 20)
 	    scale = 1;
 	else
 	    scale = 1 + scale * 0.004;
 #ifdef QW_HACK
-	at = (byte *)&d_8to24table[(int)p->color];
-	if (p->type == pt_fire)
-	    theAlpha = 255 * (6 - p->ramp) / 6;
+	at = (byte *)&d_8to24table[particles.color[p]];
+	if (particles.type[p] == pt_fire)
+	    theAlpha = 255 * (6 - particles.ramp[p]) / 6;
 	else
 	    theAlpha = 255;
 	glColor4ub(*at, *(at + 1), *(at + 2), theAlpha);
 #endif
 #ifdef NQ_HACK
-	glColor3ubv((byte *)&d_8to24table[(int)p->color]);
+	glColor3ubv((byte *)&d_8to24table[particles.color[p]]);
 #endif
 	glTexCoord2f(0, 0);
-	glVertex3fv(p->org);
+	glVertex3fv(org);
 	glTexCoord2f(1, 0);
-	glVertex3f(p->org[0] + up[0] * scale, p->org[1] + up[1] * scale,
-		   p->org[2] + up[2] * scale);
+	glVertex3f(org[0] + up[0] * scale, org[1] + up[1] * scale,
+		   org[2] + up[2] * scale);
 	glTexCoord2f(0, 1);
-	glVertex3f(p->org[0] + right[0] * scale,
-		   p->org[1] + right[1] * scale,
-		   p->org[2] + right[2] * scale);
-#else
-	D_DrawParticle(p);
-#endif
+	glVertex3f(org[0] + right[0] * scale,
+		   org[1] + right[1] * scale,
+		   org[2] + right[2] * scale);
     }
 
-#ifdef GLQUAKE
     glEnd();
     glDepthMask(GL_TRUE);
     glDisable(GL_BLEND);
@@ -818,6 +996,24 @@ R_DrawParticles(void)
 	glEnable(GL_ALPHA_TEST);
     glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 #else
+    particleset_t set;
+    int i;
+
+    D_StartParticles();
+
+    VectorScale(vright, xscaleshrink, r_pright);
+    VectorScale(vup, yscaleshrink, r_pup);
+    VectorCopy(vpn, r_ppn);
+
+    R_ParticleOffsets();
+    set.count = numparticles;
+    for (i = 0; i < 3; i++) {
+	set.org[i] = particles.org[i];
+	set.local[i] = particlelocal[i];
+    }
+    set.color = particles.color;
+    D_DrawParticles(&set);
+
     D_EndParticles();
 #endif
 }
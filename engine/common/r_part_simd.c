@@ -0,0 +1,136 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_part_simd.c: AVX2 particle loops
+
+/*
+ * These run along one field of a stretch of particles of the same type,
+ * eight at a time, with the odd ones at the end done as the C versions in
+ * r_part.c do them.  Each particle gets the same arithmetic it would there,
+ * so they move, fade and die exactly as they would without these.
+ */
+
+#include "quakedef.h"
+#include "r_local.h"
+
+#ifdef R_SIMD_PARTICLES
+
+#include <immintrin.h>
+
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+===============
+R_ParticleScaleAdd_AVX2
+===============
+*/
+AVX2 void
+R_ParticleScaleAdd_AVX2(float *dst, const float *src, float scale, int count)
+{
+    __m256 vscale;
+    int i;
+
+    vscale = _mm256_set1_ps(scale);
+    for (i = 0; i + 8 <= count; i += 8) {
+	// a separate multiply and add, rounded as the C version rounds them
+	__m256 product = _mm256_mul_ps(_mm256_loadu_ps(src + i), vscale);
+	_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), product));
+    }
+    for (; i < count; i++)
+	dst[i] += src[i] * scale;
+}
+
+/*
+===============
+R_ParticleAdd_AVX2
+===============
+*/
+AVX2 void
+R_ParticleAdd_AVX2(float *dst, float value, int count)
+{
+    __m256 vvalue;
+    int i;
+
+    vvalue = _mm256_set1_ps(value);
+    for (i = 0; i + 8 <= count; i += 8)
+	_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), vvalue));
+    for (; i < count; i++)
+	dst[i] += value;
+}
+
+/*
+===============
+R_ParticleRamp_AVX2
+===============
+*/
+AVX2 void
+R_ParticleRamp_AVX2(float *ramp, float *die, byte *color, int count,
+		    float step, float end, const int *table)
+{
+    __m256 vstep, vend, vramp, live;
+    __m256i colors;
+    int i, j, alive, lanes[8];
+
+    vstep = _mm256_set1_ps(step);
+    vend = _mm256_set1_ps(end);
+    for (i = 0; i + 8 <= count; i += 8) {
+	vramp = _mm256_add_ps(_mm256_loadu_ps(ramp + i), vstep);
+	_mm256_storeu_ps(ramp + i, vramp);
+
+	// those not yet at the end of the ramp, the rest die
+	live = _mm256_cmp_ps(vramp, vend, _CMP_NGE_UQ);
+	_mm256_storeu_ps(die + i, _mm256_blendv_ps(_mm256_set1_ps(-1),
+						    _mm256_loadu_ps(die + i),
+						    live));
+
+	alive = _mm256_movemask_ps(live);
+	if (!alive)
+	    continue;
+	colors = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), table,
+					     _mm256_cvttps_epi32(vramp),
+					     _mm256_castps_si256(live), 4);
+	_mm256_storeu_si256((__m256i *)lanes, colors);
+	for (j = 0; j < 8; j++) {
+	    if (alive & (1 << j))
+		color[i + j] = lanes[j];
+	}
+    }
+    for (; i < count; i++) {
+	ramp[i] += step;
+	if (ramp[i] >= end)
+	    die[i] = -1;
+	else
+	    color[i] = table[(int)ramp[i]];
+    }
+}
+
+/*
+===============
+R_SIMDParticleLoops
+
+Whether the CPU can run the loops here
+===============
+*/
+qboolean
+R_SIMDParticleLoops(void)
+{
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* R_SIMD_PARTICLES */
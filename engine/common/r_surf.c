@@ -23,22 +23,23 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "r_local.h"
 #include "sys.h"
 
-drawsurf_t r_drawsurf;
-
-int lightleft, sourcesstep, blocksize, sourcetstep;
-int lightdelta, lightdeltastep;
-int lightright, lightleftstep, lightrightstep, blockdivshift;
-unsigned blockdivmask;
-void *prowdestbase;
-unsigned char *pbasesource;
-int surfrowbytes;		// used by ASM files
-unsigned *r_lightptr;
-int r_stepback;
-int r_lightwidth;
-unsigned char *r_source, *r_sourcemax;
-
-static int r_numhblocks;
-int r_numvblocks;
+// surfaces can be built on several threads at once (d_surf.c)
+BANDLOCAL drawsurf_t r_drawsurf;
+
+BANDLOCAL int lightleft, sourcesstep, blocksize, sourcetstep;
+BANDLOCAL int lightdelta, lightdeltastep;
+BANDLOCAL int lightright, lightleftstep, lightrightstep, blockdivshift;
+BANDLOCAL unsigned blockdivmask;
+BANDLOCAL void *prowdestbase;
+BANDLOCAL unsigned char *pbasesource;
+BANDLOCAL int surfrowbytes;	// used by ASM files
+BANDLOCAL unsigned *r_lightptr;
+BANDLOCAL int r_stepback;
+BANDLOCAL int r_lightwidth;
+BANDLOCAL unsigned char *r_source, *r_sourcemax;
+
+static BANDLOCAL int r_numhblocks;
+BANDLOCAL int r_numvblocks;
 
 #ifndef USE_X86_ASM
 void R_DrawSurfaceBlock8_mip0(void);
@@ -47,14 +48,118 @@ void R_DrawSurfaceBlock8_mip2(void);
 void R_DrawSurfaceBlock8_mip3(void);
 #endif
 
-static void (*surfmiptable[4]) (void) = {
+void (*surfmiptable[4]) (void) = {
     R_DrawSurfaceBlock8_mip0,
     R_DrawSurfaceBlock8_mip1,
     R_DrawSurfaceBlock8_mip2,
     R_DrawSurfaceBlock8_mip3
 };
 
-static unsigned blocklights[18 * 18];
+void (*R_AddLightmap)(unsigned *blocklights, const byte *lightmap,
+		      unsigned scale, int size) = R_AddLightmap_C;
+void (*R_AddLightFalloff)(unsigned *blocklights, int smax, int tmax,
+			  const float local[2], float rad,
+			  float minlight) = R_AddLightFalloff_C;
+void (*R_InvertLightmap)(unsigned *blocklights, int size) = R_InvertLightmap_C;
+
+#ifdef R_SIMD_SURFACES
+cvar_t r_simdsurfaces = { "r_simdsurfaces", "1" };
+#endif
+
+static BANDLOCAL unsigned blocklights[18 * 18];
+
+/*
+===============
+R_AddLightmap_C
+===============
+*/
+void
+R_AddLightmap_C(unsigned *blocklights, const byte *lightmap, unsigned scale,
+		int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+	blocklights[i] += lightmap[i] * scale;
+}
+
+/*
+===============
+R_AddLightFalloff_C
+
+Adds a dynamic light at local (in the surface's texels) to blocklights
+===============
+*/
+void
+R_AddLightFalloff_C(unsigned *blocklights, int smax, int tmax,
+		    const float local[2], float rad, float minlight)
+{
+    int s, t, sd, td;
+    float dist;
+
+    for (t = 0; t < tmax; t++) {
+	td = local[1] - t * 16;
+	if (td < 0)
+	    td = -td;
+	for (s = 0; s < smax; s++) {
+	    sd = local[0] - s * 16;
+	    if (sd < 0)
+		sd = -sd;
+	    if (sd > td)
+		dist = sd + (td >> 1);
+	    else
+		dist = td + (sd >> 1);
+	    if (dist < minlight)
+		blocklights[t * smax + s] += (rad - dist) * 256;
+	}
+    }
+}
+
+/*
+===============
+R_InvertLightmap_C
+
+Bounds, inverts, and shifts blocklights into light levels for the colormap
+===============
+*/
+void
+R_InvertLightmap_C(unsigned *blocklights, int size)
+{
+    int i, t;
+
+    for (i = 0; i < size; i++) {
+	t = (255 * 256 - (int)blocklights[i]) >> (8 - VID_CBITS);
+
+	if (t < (1 << 6))
+	    t = (1 << 6);
+
+	blocklights[i] = t;
+    }
+}
+
+/*
+===============
+R_SetupSurfaceBuilders
+
+Picks the loops surfaces are built with for the frame
+===============
+*/
+void
+R_SetupSurfaceBuilders(void)
+{
+#ifndef USE_X86_ASM
+    surfmiptable[0] = R_DrawSurfaceBlock8_mip0;
+    surfmiptable[1] = R_DrawSurfaceBlock8_mip1;
+#endif
+    R_AddLightmap = R_AddLightmap_C;
+    R_AddLightFalloff = R_AddLightFalloff_C;
+    R_InvertLightmap = R_InvertLightmap_C;
+
+#ifdef R_SIMD_SURFACES
+    if (r_simdsurfaces.value)
+	R_SIMDSurfaceBuilders();
+#endif
+}
 
 /*
 ===============
@@ -66,10 +171,9 @@ R_AddDynamicLights(void)
 {
     msurface_t *surf;
     int lnum;
-    int sd, td;
     float dist, rad, minlight;
-    vec3_t impact, local;
-    int s, t;
+    vec3_t impact;
+    float local[2];
     int i;
     int smax, tmax;
     mtexinfo_t *tex;
@@ -103,22 +207,7 @@ R_AddDynamicLights(void)
 	local[0] -= surf->texturemins[0];
 	local[1] -= surf->texturemins[1];
 
-	for (t = 0; t < tmax; t++) {
-	    td = local[1] - t * 16;
-	    if (td < 0)
-		td = -td;
-	    for (s = 0; s < smax; s++) {
-		sd = local[0] - s * 16;
-		if (sd < 0)
-		    sd = -sd;
-		if (sd > td)
-		    dist = sd + (td >> 1);
-		else
-		    dist = td + (sd >> 1);
-		if (dist < minlight)
-		    blocklights[t * smax + s] += (rad - dist) * 256;
-	    }
-	}
+	R_AddLightFalloff(blocklights, smax, tmax, local, rad, minlight);
     }
 }
 
@@ -133,7 +222,6 @@ static void
 R_BuildLightMap(void)
 {
     int smax, tmax;
-    int t;
     int i, size;
     byte *lightmap;
     unsigned scale;
@@ -162,23 +250,15 @@ R_BuildLightMap(void)
 	for (maps = 0; maps < MAXLIGHTMAPS && surf->styles[maps] != 255;
 	     maps++) {
 	    scale = r_drawsurf.lightadj[maps];	// 8.8 fraction
-	    for (i = 0; i < size; i++)
-		blocklights[i] += lightmap[i] * scale;
+	    R_AddLightmap(blocklights, lightmap, scale, size);
 	    lightmap += size;	// skip to next lightmap
 	}
 // add all the dynamic lights
-    if (surf->dlightframe == r_framecount)
+    if (surf->dlightframe == r_dlightframecount)
 	R_AddDynamicLights();
 
 // bound, invert, and shift
-    for (i = 0; i < size; i++) {
-	t = (255 * 256 - (int)blocklights[i]) >> (8 - VID_CBITS);
-
-	if (t < (1 << 6))
-	    t = (1 << 6);
-
-	blocklights[i] = t;
-    }
+    R_InvertLightmap(blocklights, size);
 }
 
 
@@ -0,0 +1,306 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_surf_simd.c: SSE4.1 lightmap loops and AVX2 surface block drawers
+
+/*
+ * Lighting a surface works four luxels at a time, and the mip 0 and 1 block
+ * drawers light eight texels at a time, looking them up in the colormap with
+ * a gather.  The arithmetic is the C versions' (r_surf.c), so the same
+ * surfaces come out.  Built with per-function target attributes;
+ * R_SIMDSurfaceBuilders only picks them when the CPU has them.
+ */
+
+#include <string.h>
+
+#include "quakedef.h"
+#include "r_local.h"
+
+#ifdef R_SIMD_SURFACES
+
+#include <immintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+===============
+R_AddLightmap_SSE41
+===============
+*/
+SSE41 void
+R_AddLightmap_SSE41(unsigned *blocklights, const byte *lightmap,
+		    unsigned scale, int size)
+{
+    const __m128i vscale = _mm_set1_epi32(scale);
+    __m128i light;
+    int i, samples;
+
+    for (i = 0; i + 4 <= size; i += 4) {
+	memcpy(&samples, lightmap + i, sizeof(samples));
+	light = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(samples));
+	light = _mm_mullo_epi32(light, vscale);
+	light = _mm_add_epi32(light,
+			      _mm_loadu_si128((const __m128i *)&blocklights[i]));
+	_mm_storeu_si128((__m128i *)&blocklights[i], light);
+    }
+    for (; i < size; i++)
+	blocklights[i] += lightmap[i] * scale;
+}
+
+/*
+===============
+R_AddLightFalloff_SSE41
+===============
+*/
+SSE41 void
+R_AddLightFalloff_SSE41(unsigned *blocklights, int smax, int tmax,
+			const float local[2], float rad, float minlight)
+{
+    const __m128 vlocal = _mm_set1_ps(local[0]);
+    const __m128 vrad = _mm_set1_ps(rad);
+    const __m128 vminlight = _mm_set1_ps(minlight);
+    const __m128 v256 = _mm_set1_ps(256);
+    __m128i vs, vsd, vtd, vdist, vlights, vlit;
+    __m128 vdistf, vnear;
+    int s, t, sd, td;
+    float dist;
+    unsigned *row;
+
+    for (t = 0; t < tmax; t++) {
+	td = local[1] - t * 16;
+	if (td < 0)
+	    td = -td;
+	vtd = _mm_set1_epi32(td);
+	row = &blocklights[t * smax];
+
+	vs = _mm_setr_epi32(0, 16, 32, 48);
+	for (s = 0; s + 4 <= smax; s += 4) {
+	    vsd = _mm_cvttps_epi32(_mm_sub_ps(vlocal, _mm_cvtepi32_ps(vs)));
+	    vsd = _mm_abs_epi32(vsd);
+
+	    // the larger distance and half the smaller
+	    vdist = _mm_blendv_epi8(_mm_add_epi32(vtd, _mm_srai_epi32(vsd, 1)),
+				    _mm_add_epi32(vsd, _mm_srai_epi32(vtd, 1)),
+				    _mm_cmpgt_epi32(vsd, vtd));
+	    vdistf = _mm_cvtepi32_ps(vdist);
+	    vnear = _mm_cmplt_ps(vdistf, vminlight);
+	    if (_mm_movemask_ps(vnear)) {
+		vlights = _mm_loadu_si128((const __m128i *)&row[s]);
+		vlit = _mm_cvttps_epi32(
+		    _mm_add_ps(_mm_cvtepi32_ps(vlights),
+			       _mm_mul_ps(_mm_sub_ps(vrad, vdistf), v256)));
+		vlights = _mm_blendv_epi8(vlights, vlit, _mm_castps_si128(vnear));
+		_mm_storeu_si128((__m128i *)&row[s], vlights);
+	    }
+	    vs = _mm_add_epi32(vs, _mm_set1_epi32(64));
+	}
+	for (; s < smax; s++) {
+	    sd = local[0] - s * 16;
+	    if (sd < 0)
+		sd = -sd;
+	    if (sd > td)
+		dist = sd + (td >> 1);
+	    else
+		dist = td + (sd >> 1);
+	    if (dist < minlight)
+		row[s] += (rad - dist) * 256;
+	}
+    }
+}
+
+/*
+===============
+R_InvertLightmap_SSE41
+===============
+*/
+SSE41 void
+R_InvertLightmap_SSE41(unsigned *blocklights, int size)
+{
+    const __m128i full = _mm_set1_epi32(255 * 256);
+    const __m128i darkest = _mm_set1_epi32(1 << 6);
+    __m128i light;
+    int i, t;
+
+    for (i = 0; i + 4 <= size; i += 4) {
+	light = _mm_loadu_si128((const __m128i *)&blocklights[i]);
+	light = _mm_srai_epi32(_mm_sub_epi32(full, light), 8 - VID_CBITS);
+	light = _mm_max_epi32(light, darkest);
+	_mm_storeu_si128((__m128i *)&blocklights[i], light);
+    }
+    for (; i < size; i++) {
+	t = (255 * 256 - (int)blocklights[i]) >> (8 - VID_CBITS);
+	if (t < (1 << 6))
+	    t = (1 << 6);
+	blocklights[i] = t;
+    }
+}
+
+/*
+===============
+R_LightTexels
+
+Eight texels from psource lit by light, light + lightstep and so on, as
+colormap entries packed into the low half
+===============
+*/
+static inline AVX2 __m128i
+R_LightTexels(const byte *colormap, const byte *psource, int light,
+	      int lightstep)
+{
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i low_bytes = _mm256_setr_epi8(
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i lights, pixels, texels;
+
+    lights = _mm256_add_epi32(_mm256_set1_epi32(light),
+			      _mm256_mullo_epi32(lane,
+						 _mm256_set1_epi32(lightstep)));
+    lights = _mm256_and_si256(lights, _mm256_set1_epi32(0xFF00));
+    pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)psource));
+
+    // the colormap is hunk memory, which has room past its last entry for
+    // reading it as an int
+    texels = _mm256_i32gather_epi32((const int *)colormap,
+				    _mm256_add_epi32(lights, pixels), 1);
+    texels = _mm256_shuffle_epi8(texels, low_bytes);
+
+    return _mm_unpacklo_epi32(_mm256_castsi256_si128(texels),
+			      _mm256_extracti128_si256(texels, 1));
+}
+
+/*
+================
+R_DrawSurfaceBlock8_mip0_AVX2
+================
+*/
+AVX2 void
+R_DrawSurfaceBlock8_mip0_AVX2(void)
+{
+    const byte *colormap = vid.colormap;
+    int v, i, lightstep, lightleft, lightright;
+    int lightleftstep, lightrightstep;
+    unsigned char *psource, *prowdest;
+    unsigned *lightptr;
+
+    psource = pbasesource;
+    prowdest = prowdestbase;
+    lightptr = r_lightptr;
+
+    for (v = 0; v < r_numvblocks; v++) {
+	lightleft = lightptr[0];
+	lightright = lightptr[1];
+	lightptr += r_lightwidth;
+	lightleftstep = (lightptr[0] - lightleft) >> 4;
+	lightrightstep = (lightptr[1] - lightright) >> 4;
+
+	for (i = 0; i < 16; i++) {
+	    // the C version lights from the right, so texel b gets
+	    // lightright + (15 - b) * lightstep
+	    lightstep = (lightleft - lightright) >> 4;
+	    _mm_storel_epi64((__m128i *)(prowdest + 8),
+			     R_LightTexels(colormap, psource + 8,
+					   lightright + 7 * lightstep,
+					   -lightstep));
+	    _mm_storel_epi64((__m128i *)prowdest,
+			     R_LightTexels(colormap, psource,
+					   lightright + 15 * lightstep,
+					   -lightstep));
+
+	    psource += sourcetstep;
+	    lightright += lightrightstep;
+	    lightleft += lightleftstep;
+	    prowdest += surfrowbytes;
+	}
+
+	if (psource >= r_sourcemax)
+	    psource -= r_stepback;
+    }
+
+    r_lightptr = lightptr;
+}
+
+/*
+================
+R_DrawSurfaceBlock8_mip1_AVX2
+================
+*/
+AVX2 void
+R_DrawSurfaceBlock8_mip1_AVX2(void)
+{
+    const byte *colormap = vid.colormap;
+    int v, i, lightstep, lightleft, lightright;
+    int lightleftstep, lightrightstep;
+    unsigned char *psource, *prowdest;
+    unsigned *lightptr;
+
+    psource = pbasesource;
+    prowdest = prowdestbase;
+    lightptr = r_lightptr;
+
+    for (v = 0; v < r_numvblocks; v++) {
+	lightleft = lightptr[0];
+	lightright = lightptr[1];
+	lightptr += r_lightwidth;
+	lightleftstep = (lightptr[0] - lightleft) >> 3;
+	lightrightstep = (lightptr[1] - lightright) >> 3;
+
+	for (i = 0; i < 8; i++) {
+	    lightstep = (lightleft - lightright) >> 3;
+	    _mm_storel_epi64((__m128i *)prowdest,
+			     R_LightTexels(colormap, psource,
+					   lightright + 7 * lightstep,
+					   -lightstep));
+
+	    psource += sourcetstep;
+	    lightright += lightrightstep;
+	    lightleft += lightleftstep;
+	    prowdest += surfrowbytes;
+	}
+
+	if (psource >= r_sourcemax)
+	    psource -= r_stepback;
+    }
+
+    r_lightptr = lightptr;
+}
+
+/*
+===============
+R_SIMDSurfaceBuilders
+
+Switches the surface building loops to the best versions the CPU can run
+===============
+*/
+void
+R_SIMDSurfaceBuilders(void)
+{
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse4.1")) {
+	R_AddLightmap = R_AddLightmap_SSE41;
+	R_AddLightFalloff = R_AddLightFalloff_SSE41;
+	R_InvertLightmap = R_InvertLightmap_SSE41;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+	surfmiptable[0] = R_DrawSurfaceBlock8_mip0_AVX2;
+	surfmiptable[1] = R_DrawSurfaceBlock8_mip1_AVX2;
+    }
+}
+
+#endif /* R_SIMD_SURFACES */
@@ -0,0 +1,129 @@
+/*
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+
+*/
+// r_threads.c: worker threads for the software renderer
+
+#include <stdint.h>
+
+#include <SDL_thread.h>
+#include <SDL_mutex.h>
+
+#include "console.h"
+#include "quakedef.h"
+#include "r_shared.h"
+
+#ifdef R_THREADED
+
+#define MAX_WORKERS 8
+
+// workers[0] stays empty, the main thread takes the first index (workers
+// wait for work until the program exits)
+static struct {
+    SDL_Thread *thread;
+    SDL_sem *start;
+} workers[MAX_WORKERS];
+static SDL_sem *workers_done;
+static int numworkers = 1;
+static qboolean workers_failed;
+
+// what R_RunWorkers hands out, set before the workers are started
+static void (*workers_work)(int index);
+
+/*
+==============
+R_Worker
+==============
+*/
+static int
+R_Worker(void *data)
+{
+    int index = (int)(intptr_t)data;
+
+    for (;;) {
+	SDL_SemWait(workers[index].start);
+	workers_work(index);
+	SDL_SemPost(workers_done);
+    }
+
+    return 0;
+}
+
+/*
+==============
+R_StartWorkers
+==============
+*/
+int
+R_StartWorkers(int count)
+{
+    if (count > MAX_WORKERS)
+	count = MAX_WORKERS;
+    if (count <= numworkers || workers_failed)
+	return count < numworkers ? count : numworkers;
+
+    if (!workers_done) {
+	workers_done = SDL_CreateSemaphore(0);
+	if (!workers_done) {
+	    Con_Printf("%s: %s\n", __func__, SDL_GetError());
+	    workers_failed = true;
+	    return numworkers;
+	}
+    }
+
+    while (numworkers < count) {
+	workers[numworkers].start = SDL_CreateSemaphore(0);
+	if (workers[numworkers].start) {
+	    workers[numworkers].thread =
+		SDL_CreateThread(R_Worker, "render",
+				 (void *)(intptr_t)numworkers);
+	}
+	if (!workers[numworkers].thread) {
+	    Con_Printf("%s: %s\n", __func__, SDL_GetError());
+	    if (workers[numworkers].start) {
+		SDL_DestroySemaphore(workers[numworkers].start);
+		workers[numworkers].start = NULL;
+	    }
+	    workers_failed = true;
+	    break;
+	}
+	numworkers++;
+    }
+
+    return numworkers;
+}
+
+/*
+==============
+R_RunWorkers
+==============
+*/
+void
+R_RunWorkers(int count, void (*work)(int index))
+{
+    int i;
+
+    workers_work = work;
+    for (i = 1; i < count; i++)
+	SDL_SemPost(workers[i].start);
+
+    work(0);
+
+    for (i = 1; i < count; i++)
+	SDL_SemWait(workers_done);
+}
+
+#endif /* R_THREADED */
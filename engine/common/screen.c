@@ -44,6 +44,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #endif
 
 #ifdef NQ_HACK
+#include "fisheye.h"
 #include "host.h"
 #endif
 #ifdef QW_HACK
@@ -1110,6 +1111,10 @@ SCR_ScreenShot_f(void)
 //
     D_EnableBackBufferAccess();	// enable direct drawing of console to back buffer
 
+#ifdef NQ_HACK
+    if (fisheye_enabled)
+	F_ScreenShotLens();
+#endif
     WritePCXfile(pcxname, vid.buffer, vid.width, vid.height, vid.rowbytes,
 		 host_basepal, false);
 
@@ -1390,6 +1395,11 @@ SCR_UpdateScreen(void)
 #ifdef GLQUAKE
     GL_EndRendering();
 #else
+#ifdef NQ_HACK
+    /* nobody watches a headless fisheye capture */
+    if (fisheye_capturing)
+	return;
+#endif
     /*
      * update one of three areas
      */
@@ -1398,23 +1408,26 @@ SCR_UpdateScreen(void)
 	vrect.y = 0;
 	vrect.width = vid.width;
 	vrect.height = vid.height;
-        vrect.pnext = NULL;
-	VID_Update(&vrect);
     } else if (scr_copytop) {
 	vrect.x = 0;
 	vrect.y = 0;
 	vrect.width = vid.width;
 	vrect.height = vid.height - sb_lines;
-        vrect.pnext = NULL;
-	VID_Update(&vrect);
     } else {
 	vrect.x = scr_vrect.x;
 	vrect.y = scr_vrect.y;
 	vrect.width = scr_vrect.width;
 	vrect.height = scr_vrect.height;
-        vrect.pnext = NULL;
-	VID_Update(&vrect);
     }
+    vrect.pnext = NULL;
+#ifdef NQ_HACK
+    if (fisheye_speeds) {
+	double time = Sys_DoubleTime();
+	VID_Update(&vrect);
+	F_SpeedsVidUpdate(Sys_DoubleTime() - time);
+    } else
+#endif
+    VID_Update(&vrect);
 #endif
 }
 
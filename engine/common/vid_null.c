@@ -72,6 +72,12 @@ VID_Update(vrect_t *rects)
 {
 }
 
+qboolean
+VID_SetDirectSource(const vrect_t *rect, vid_fillrow32_t fillrow)
+{
+    return !rect || !fillrow;
+}
+
 /*
 ================
 D_BeginDirectRect
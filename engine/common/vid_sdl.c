@@ -104,6 +104,10 @@ void VID_Shutdown(void)
 
 static qboolean palette_changed;
 
+/* Optional 32-bit source for part of the screen, consumed by VID_Update */
+static vrect_t direct_rect;
+static vid_fillrow32_t direct_fillrow;
+
 void
 VID_ShiftPalette(const byte *palette)
 {
@@ -320,6 +324,59 @@ VID_SetPalette(const byte *palette)
     palette_changed = true;
 }
 
+qboolean
+VID_SetDirectSource(const vrect_t *rect, vid_fillrow32_t fillrow)
+{
+    if (!rect || !fillrow) {
+	direct_fillrow = NULL;
+	return true;
+    }
+    if (SDL_PIXELTYPE(sdl_format->format) != SDL_PIXELTYPE_PACKED32) {
+	direct_fillrow = NULL;
+	return false;
+    }
+
+    direct_rect = *rect;
+    direct_fillrow = fillrow;
+
+    return true;
+}
+
+/*
+ * Expand one row of the view buffer into the texture.  Inside the direct
+ * source rectangle the row is filled from the source first, then any
+ * overlay pixels drawn into the view buffer are expanded on top of it.
+ */
+static void
+VID_ExpandRow32(Uint32 *dst, const byte *src, int x, int y, int width)
+{
+    int i, start, end;
+
+    start = end = 0;
+    if (direct_fillrow && y >= direct_rect.y
+	&& y < direct_rect.y + direct_rect.height) {
+	start = qmax(x, direct_rect.x) - x;
+	end = qmin(x + width, direct_rect.x + direct_rect.width) - x;
+    }
+
+    if (start >= end) {
+	for (i = 0; i < width; i++)
+	    dst[i] = d_8to24table[src[i]];
+	return;
+    }
+
+    for (i = 0; i < start; i++)
+	dst[i] = d_8to24table[src[i]];
+    direct_fillrow(x + start - direct_rect.x, y - direct_rect.y, end - start,
+		   dst + start, d_8to24table);
+    for (i = start; i < end; i++) {
+	if (src[i] != TRANSPARENT_COLOR)
+	    dst[i] = d_8to24table[src[i]];
+    }
+    for (i = end; i < width; i++)
+	dst[i] = d_8to24table[src[i]];
+}
+
 void
 VID_ProcessEvents()
 {
@@ -431,9 +488,8 @@ VID_Update(vrect_t *rects)
 	switch (SDL_PIXELTYPE(sdl_format->format)) {
 	case SDL_PIXELTYPE_PACKED32:
 	    dst32 = dst;
-	    while (height--) {
-		for (i = 0; i < rect->width; i++)
-		    dst32[i] = d_8to24table[src[i]];
+	    for (i = 0; i < height; i++) {
+		VID_ExpandRow32(dst32, src, rect->x, rect->y + i, rect->width);
 		dst32 += pitch / sizeof(*dst32);
 		src += vid.width;
 	    }
@@ -453,6 +509,8 @@ VID_Update(vrect_t *rects)
 	}
 	SDL_UnlockTexture(texture);
     }
+    direct_fillrow = NULL;
+
     err = SDL_RenderCopy(renderer, texture, NULL, NULL);
     if (err)
 	Sys_Error("%s: unable to render texture (%s)", __func__, SDL_GetError());
@@ -1111,6 +1111,12 @@ D_EndDirectRect(int x, int y, int width, int height)
     FlipScreen(&rect);
 }
 
+qboolean
+VID_SetDirectSource(const vrect_t *rect, vid_fillrow32_t fillrow)
+{
+    return !rect || !fillrow;
+}
+
 void
 VID_Update(vrect_t *rects)
 {
@@ -1087,6 +1087,12 @@ HandleEvents(void)
 	IN_CenterMouse();
 }
 
+qboolean
+VID_SetDirectSource(const vrect_t *rect, vid_fillrow32_t fillrow)
+{
+    return !rect || !fillrow;
+}
+
 // flushes the given rectangles from the view buffer to the screen
 
 void
@@ -397,6 +397,24 @@ static struct {
     int tempmark;
 } hunkstate;
 
+#define MAX_ARENAS 4
+
+static struct {
+    const char *name;
+    size_t (*size)(void);
+} arenas[MAX_ARENAS];
+static int numarenas;
+
+void
+Hunk_AddArena(const char *name, size_t (*size)(void))
+{
+    if (numarenas == MAX_ARENAS)
+	Sys_Error("%s: too many arenas", __func__);
+    arenas[numarenas].name = name;
+    arenas[numarenas].size = size;
+    numarenas++;
+}
+
 /*
  * ==============
  * Hunk_Check
@@ -516,6 +534,15 @@ Hunk_Print(qboolean all)
     }
     Con_Printf("-------------------------\n");
     Con_Printf("%8i total blocks\n", totalblocks);
+
+    if (numarenas) {
+	int i;
+
+	Con_Printf("-------------------------\n");
+	for (i = 0; i < numarenas; i++)
+	    Con_Printf("%*s :%10zu %-*s (ARENA)\n", pwidth, "",
+		       arenas[i].size(), HUNK_NAMELEN, arenas[i].name);
+    }
 }
 
 static void
@@ -65,6 +65,17 @@ typedef struct particle_s {
 
 #define PARTICLE_Z_CLIP	8.0
 
+/*
+ * The particles D_DrawParticles draws, a field to an array: where they are,
+ * their offsets from r_origin and their colors
+ */
+typedef struct {
+    int count;
+    const float *org[3];
+    const float *local[3];
+    const byte *color;
+} particleset_t;
+
 // !!! if this is changed, it must be changed in d_ifacea.h too !!!
 typedef struct finalvert_s {
     int v[6];			// u, v, s, t, l, 1/z
@@ -138,6 +149,7 @@ void D_DrawNonSubdiv();
 void D_PolysetDrawFinalVerts(finalvert_t *fv, int numverts);
 void D_PolysetDrawFinalVerts_Translucent(finalvert_t *fv, int numverts);
 void D_DrawParticle(particle_t *pparticle);
+void D_DrawParticles(const particleset_t *set);
 void D_DrawSprite(void);
 void D_DrawSurfaces(qboolean sort_submodels);
 void D_EnableBackBufferAccess(void);
@@ -188,8 +200,6 @@ typedef struct {
     int surfheight;		// in mipmapped texels
 } drawsurf_t;
 
-extern drawsurf_t r_drawsurf;
-
 void R_DrawSurface(void);
 
 
@@ -49,6 +49,8 @@ typedef struct surfcache_s {
     unsigned height;		// DEBUG only needed for debug
     float mipscale;
     struct texture_s *texture;	// checked for animating textures
+    qboolean queued;		// waiting for D_BuildSurfaces
+    int builtframe;		// r_framecount it was built there, until drawn
     byte data[4];		// width*height elements
 } surfcache_t;
 
@@ -63,12 +65,12 @@ extern qboolean d_roverwrapped;
 extern surfcache_t *sc_rover;
 extern surfcache_t *d_initial_rover;
 
-extern float d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern BANDLOCAL float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern BANDLOCAL float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern BANDLOCAL float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern BANDLOCAL fixed16_t sadjust, tadjust;
+extern BANDLOCAL fixed16_t bbextents, bbextentt;
 
 void D_DrawSpans8(espan_t *pspans);
 void D_DrawSpans8_Translucent(espan_t *pspans);
@@ -76,6 +78,67 @@ void D_DrawSpans8_Fence(espan_t *pspans);
 void D_DrawSpans8_Fence_Translucent(espan_t *pspans);
 void D_DrawSpans16(espan_t *pspans);
 extern void (*D_DrawSpans)(espan_t *pspan);
+extern void (*D_DrawSpansTranslucent)(espan_t *pspan);
+extern void (*D_DrawSpansFence)(espan_t *pspan);
+extern void (*D_DrawSpansFenceTranslucent)(espan_t *pspan);
+
+/*
+ * SSE4.1 and AVX2 versions of the span drawers, used when the CPU has them
+ * (d_scan_simd.c).  They draw exactly what the C versions do.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define D_SIMD_SPANS
+void D_DrawSpans8_SSE41(espan_t *pspans);
+void D_DrawSpans8_Translucent_SSE41(espan_t *pspans);
+void D_DrawSpans8_Fence_SSE41(espan_t *pspans);
+void D_DrawSpans8_Fence_Translucent_SSE41(espan_t *pspans);
+void D_DrawSpans8_AVX2(espan_t *pspans);
+void D_DrawSpans8_Translucent_AVX2(espan_t *pspans);
+void D_DrawSpans8_Fence_AVX2(espan_t *pspans);
+void D_DrawSpans8_Fence_Translucent_AVX2(espan_t *pspans);
+void D_SIMDSpanDrawers(void);
+#endif
+
+// the alias triangle rasterizer (d_polyse.c) and what it works from
+extern int r_p0[6], r_p1[6], r_p2[6];
+extern int r_lstepx, r_lstepy, r_sstepx, r_sstepy, r_tstepx, r_tstepy;
+extern int r_zistepx, r_zistepy;
+void D_PolysetCalcGradients(int skinwidth);
+void D_RasterizeAliasPolySmooth(void);
+extern void (*D_RasterizeAliasPoly)(void);
+
+/*
+ * An AVX2 version of D_RasterizeAliasPolySmooth, used when the CPU has it
+ * (d_polyse_simd.c).  It draws exactly what the C version does.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define D_SIMD_POLYSETS
+void D_RasterizeAliasPoly_AVX2(void);
+void D_SIMDPolysetRasterizer(void);
+#endif
+
+// a particle projected onto the view, for D_DrawParticles to bin (d_part.c)
+typedef struct {
+    int u, v;
+    int izi;
+    int color;
+} dparticle_t;
+
+#ifndef USE_X86_ASM
+int D_ProjectParticleSet(const particleset_t *set, dparticle_t *projected);
+extern int (*D_ProjectParticles)(const particleset_t *set,
+				 dparticle_t *projected);
+#endif
+
+/*
+ * An AVX2 version of D_ProjectParticleSet, used when the CPU has it
+ * (d_part_simd.c).  It projects exactly as the C version does.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define D_SIMD_PARTICLES
+int D_ProjectParticles_AVX2(const particleset_t *set, dparticle_t *projected);
+void D_SIMDParticleProjection(void);
+#endif
 
 void D_DrawZSpans(espan_t *pspans);
 void D_SpriteDrawSpans(sspan_t * pspan);
@@ -94,6 +157,19 @@ extern void (*prealspandrawer) (void);
 surfcache_t *D_CacheSurface(const entity_t *e, msurface_t *surface,
 			    int miplevel);
 
+#ifdef R_THREADED
+// building surfaces on the worker threads before they're drawn (d_surf.c)
+extern cvar_t d_cachethreads;
+qboolean D_BeginSurfaceBuilds(void);
+qboolean D_QueueSurface(const entity_t *e, msurface_t *surface, int miplevel);
+void D_BuildSurfaces(void);
+#endif
+
+// drawing the view a band at a time (r_bands.c)
+qboolean D_SetupBandSurfaces(const byte *visible);
+int D_DrawBandSurfaces(surf_t *bandsurfaces, surf_t *bmodels, surf_t *end,
+		       qboolean sort_submodels);
+
 #ifdef USE_X86_ASM
 void D_PolysetAff8Start(void);
 void D_PolysetAff8End(void);
@@ -102,8 +178,8 @@ void D_PolysetDrawSpans8_Translucent();
 
 extern short *d_pzbuffer;
 extern unsigned int d_zrowbytes, d_zwidth;
-extern const byte *r_transtable;
-extern void (*D_DrawTurbSpanFunc)(void);
+extern BANDLOCAL const byte *r_transtable;
+extern BANDLOCAL void (*D_DrawTurbSpanFunc)(void);
 
 extern int *d_pscantable;
 extern int d_scantable[MAXHEIGHT];
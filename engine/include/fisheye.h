@@ -7,9 +7,27 @@
 
 extern qboolean fisheye_enabled;
 
+// set while a demo is being captured headless (see f_capture)
+extern qboolean fisheye_capturing;
+void F_StopCapture(void);
+
+// called when a demo stops playing (ends captures and timedemo cells)
+void F_DemoStopped(void);
+
+// called when a demo could not be started (ends a capture waiting for it)
+void F_DemoFailed(void);
+
+// set while f_speeds is profiling the fisheye stages
+extern qboolean fisheye_speeds;
+void F_SpeedsVidUpdate(double seconds);
+
 void F_Init(void);
 void F_Shutdown(void);
 void F_RenderView(void);
+
+// resolves a lens the video driver drew straight into the vid buffer, so the
+// screenshot command can save it
+void F_ScreenShotLens(void);
 void F_WriteConfig(FILE *f);
 
 typedef enum fe_status {
@@ -39,6 +57,9 @@ struct _globe {
    // the environment map
    // a large array of pixels that hold all rendered views
    byte *pixels;
+
+   // the same for the right eye when rendering in stereo (NULL otherwise)
+   byte *right_pixels;
    
    // retrieves the _realative index_ of a pixel in the platemap
    #define RELATIVE_GLOBEPIXEL(plate, x, y) ((plate)*(globe.platesize)*(globe.platesize) + (x) + (y)*(globe.platesize))
@@ -124,7 +145,7 @@ struct _lens {
    uint32_t *pixels;
 
    // retrieves a pointer to a lens pixel
-   #define LENSPIXEL(x,y) (lens.pixels + (x) + (y)*lens.width_px)
+   #define LENSPIXEL(l,x,y) ((l)->pixels + (x) + (y)*(l)->width_px)
 
    // a color tint index (i) for each pixel (255 = no filter)
    // (new color = globe.plates[i].palette[old color])
@@ -143,12 +164,38 @@ struct _lens {
    byte *pixel_tints;
 
    // retrieves a pointer to a lens pixel tint
-   #define LENSPIXELTINT(x,y) (lens.pixel_tints + (x) + (y)*lens.width_px)
+   #define LENSPIXELTINT(l,x,y) ((l)->pixel_tints + (x) + (y)*(l)->width_px)
+
+   // references to this lens' script environment and map functions
+   // (several lenses can be loaded at once, each keeps its own script globals)
+   struct {
+      int env;
+      int forward;
+      int inverse;
+      int numplates;  // the globe's numplates when the script was run
+
+      // the compiled script, kept to run again for a globe with another
+      // number of plates without reading the file (NULL if there is none)
+      void *chunk;
+      size_t chunk_size;
+   } script;
 
 };
 
 struct _lens* F_getLens(void);
 
+// Extra lens views built from the same globe as the main view, so each one
+// costs a lensmap blit rather than another set of plate renders.  A view is
+// drawn as an inset over the main view, or into a caller-provided 8-bit
+// buffer (e.g. for recording) once it has been given a target.
+#define MAX_LENSVIEWS 4
+
+int F_OpenLensView(const char *name, int width, int height);
+void F_MoveLensView(int view, int x, int y);
+void F_SetLensViewTarget(int view, byte *buffer, int rowbytes);
+void F_CloseLensView(int view);
+struct _lens* F_getLensView(int view);
+
 struct _zoom {
 
    qboolean changed;
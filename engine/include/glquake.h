@@ -119,19 +119,6 @@ typedef enum {
     pt_blob, pt_blob2
 } ptype_t;
 
-// !!! if this is changed, it must be changed in d_ifacea.h too !!!
-typedef struct particle_s {
-// driver-usable fields
-    vec3_t org;
-    float color;
-// drivers never touch the following fields
-    struct particle_s *next;
-    vec3_t vel;
-    float ramp;
-    float die;
-    ptype_t type;
-} particle_t;
-
 
 //====================================================
 
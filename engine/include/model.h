@@ -413,6 +413,7 @@ GL_Aliashdr(aliashdr_t *h)
 typedef struct {
     int stverts;
     int triangles;
+    int soaposes;            // Offset to the poses as planes, or 0
     aliashdr_t ahdr;
 } sw_aliashdr_t;
 
@@ -62,6 +62,7 @@ extern cvar_t r_fullbright;
 extern cvar_t r_drawentities;
 extern cvar_t r_drawflat;
 extern cvar_t r_ambient;
+extern cvar_t r_bands;
 
 #define XCENTERING	(1.0 / 2.0)
 #define YCENTERING	(1.0 / 2.0)
@@ -120,6 +121,52 @@ void R_DrawSurfaceBlock8_mip3(void);
 
 #endif
 
+/*
+ * The loops surfaces are lit and drawn into the surface cache with
+ * (r_surf.c), set up for each frame by R_SetupSurfaceBuilders.
+ */
+extern void (*surfmiptable[4]) (void);
+extern void (*R_AddLightmap)(unsigned *blocklights, const byte *lightmap,
+			     unsigned scale, int size);
+extern void (*R_AddLightFalloff)(unsigned *blocklights, int smax, int tmax,
+				 const float local[2], float rad,
+				 float minlight);
+extern void (*R_InvertLightmap)(unsigned *blocklights, int size);
+
+void R_AddLightmap_C(unsigned *blocklights, const byte *lightmap,
+		     unsigned scale, int size);
+void R_AddLightFalloff_C(unsigned *blocklights, int smax, int tmax,
+			 const float local[2], float rad, float minlight);
+void R_InvertLightmap_C(unsigned *blocklights, int size);
+void R_SetupSurfaceBuilders(void);
+
+// what R_DrawSurface hands the block drawers
+extern BANDLOCAL void *prowdestbase;
+extern BANDLOCAL unsigned char *pbasesource;
+extern BANDLOCAL unsigned *r_lightptr;
+extern BANDLOCAL int r_lightwidth, r_numvblocks;
+extern BANDLOCAL int sourcetstep, surfrowbytes;
+extern BANDLOCAL unsigned char *r_sourcemax;
+extern BANDLOCAL int r_stepback;
+
+/*
+ * SSE4.1 versions of the lightmap loops and AVX2 versions of the mip 0 and 1
+ * block drawers, used when the CPU has them (r_surf_simd.c).  They build
+ * exactly what the C versions do.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define R_SIMD_SURFACES
+extern cvar_t r_simdsurfaces;
+void R_AddLightmap_SSE41(unsigned *blocklights, const byte *lightmap,
+			 unsigned scale, int size);
+void R_AddLightFalloff_SSE41(unsigned *blocklights, int smax, int tmax,
+			     const float local[2], float rad, float minlight);
+void R_InvertLightmap_SSE41(unsigned *blocklights, int size);
+void R_DrawSurfaceBlock8_mip0_AVX2(void);
+void R_DrawSurfaceBlock8_mip1_AVX2(void);
+void R_SIMDSurfaceBuilders(void);
+#endif
+
 void R_GenSkyTile(void *pdest);
 void R_GenSkyTile16(void *pdest);
 void R_Surf8Patch(void);
@@ -127,12 +174,36 @@ void R_Surf16Patch(void);
 void R_DrawSubmodelPolygons(const entity_t *entity, int clipflags);
 void R_DrawSolidClippedSubmodelPolygons(const entity_t *entity);
 
+int R_ScanEdges(void);
+void R_DrawSpecialSpans(int drawflags);
+
+// span buffers of MAXSPANS, kept between frames
 typedef struct {
-    int found;
-    int lines[MAXHEIGHT + 1];
-} scanflags_t;
+    espan_t **chunks;
+    int numchunks;
+} spanchunks_t;
 
-void R_ScanEdges(int drawflags, scanflags_t *scanflags);
+/*
+ * A horizontal band of the view, scanned from its own copy of the frame's
+ * edges and surfaces so bands can be rendered side by side (r_bands.c)
+ */
+typedef struct {
+    int top, bottom;		// scanlines top to bottom - 1
+    edge_t *edges;		// copy of r_edges
+    surf_t *surfaces;		// copy of surfaces, so [1] is the background
+    int maxedges, maxsurfaces;
+    spanchunks_t spans;		// spans of the band's surfaces
+    spanchunks_t specialspans;	// and of its fence/translucent surfaces
+    int found;			// special surface flags found in the band
+    int drawn;			// surfaces drawn, for r_drawnpolycount
+} rband_t;
+
+#ifdef R_THREADED
+void R_ScanBand(rband_t *band, const surf_t *framesurfaces);
+int R_ScanBands(void);
+void R_DrawBandSpecialSpans(int drawflags);
+qboolean R_BandsActive(void);
+#endif
 
 void R_AddPolygonEdges(emitpoint_t *pverts, int numverts, int miplevel);
 surf_t *R_GetSurf(void);
@@ -162,8 +233,8 @@ extern int r_polycount;
 
 extern int ubasestep, errorterm, erroradjustup, erroradjustdown;
 
-extern fixed16_t sadjust, tadjust;
-extern fixed16_t bbextents, bbextentt;
+extern BANDLOCAL fixed16_t sadjust, tadjust;
+extern BANDLOCAL fixed16_t bbextents, bbextentt;
 
 #define MAXBVERTINDEXES	1000	// new clipped vertices when clipping bmodels
 				// to the world BSP
@@ -188,6 +259,39 @@ extern float leftclip, topclip, rightclip, bottomclip;
 extern int r_acliptype;
 extern float r_avertexnormals[][3];
 
+// what the vertex loops transform and light with
+extern float aliastransform[3][4];
+extern vec3_t r_plightvec;
+extern int r_ambientlight;
+extern float r_shadelight;
+
+void R_SetupAliasLoops(void);
+
+/*
+ * AVX2 versions of the alias vertex loops, used when the CPU has it
+ * (r_alias_simd.c).  They read a copy of the poses made at load time, as
+ * planes of x, y, z and light normal index bytes padded to eight verts, and
+ * come out exactly as the C versions do.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define R_SIMD_ALIAS
+#define ALIAS_SOA_STRIDE(numverts) (((numverts) + 7) & ~7)
+extern cvar_t r_simdalias;
+void R_AliasBlendPoses_AVX2(byte *out, const byte *pose0, const byte *pose1,
+			    const byte *light, int stride, int blend0,
+			    int blend1, int shift);
+void R_AliasTransformAndProjectFinalVerts_AVX2(finalvert_t *fv,
+					       const stvert_t *pstverts,
+					       const byte *pose, int stride,
+					       int numverts);
+void R_AliasTransformFinalVerts_AVX2(finalvert_t *pfinalverts,
+				     auxvert_t *pauxverts,
+				     const stvert_t *pstverts,
+				     const byte *pose, int stride,
+				     int numverts, float ziscale);
+qboolean R_SIMDAliasLoops(void);
+#endif
+
 //=========================================================
 // turbulence stuff
 
@@ -204,11 +308,30 @@ void R_ClearParticles(void);
 void R_ReadPointFile_f(void);
 void R_SurfacePatch(void);
 
+/*
+ * AVX2 versions of the loops particles are run with, used when the CPU has
+ * it (r_part_simd.c).  They come out exactly as the C loops do.
+ */
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(USE_X86_ASM)
+#define R_SIMD_PARTICLES
+extern cvar_t r_simdparticles;
+void R_ParticleScaleAdd_AVX2(float *dst, const float *src, float scale,
+			     int count);
+void R_ParticleAdd_AVX2(float *dst, float value, int count);
+void R_ParticleRamp_AVX2(float *ramp, float *die, byte *color, int count,
+			 float step, float end, const int *table);
+qboolean R_SIMDParticleLoops(void);
+#endif
+
 extern int r_amodels_drawn;
-extern edge_t *auxedges;
-extern surf_t *auxsurfaces;
-extern edge_t *saveedges;
-extern surf_t *savesurfs;
+extern int r_amodels_occluded;
+
+/*
+ * Testing entities against a pyramid of the world's z-buffer (r_occlude.c)
+ */
+extern cvar_t r_occlusion;
+void R_BeginOcclusion(void);
+qboolean R_OccludedRect(int left, int top, int right, int bottom, int zi);
 extern edge_t *r_edges, *edge_p, *edge_max;
 
 extern edge_t *newedges[MAXHEIGHT];
@@ -217,10 +340,10 @@ extern edge_t *removeedges[MAXHEIGHT];
 extern int screenwidth;
 
 // FIXME: make stack vars when debugging done
-extern edge_t edge_head;
-extern edge_t edge_tail;
-extern edge_t edge_aftertail;
-extern int r_bmodelactive;
+extern BANDLOCAL edge_t edge_head;
+extern BANDLOCAL edge_t edge_tail;
+extern BANDLOCAL edge_t edge_aftertail;
+extern BANDLOCAL int r_bmodelactive;
 
 extern float aliasxscale, aliasyscale, aliasxcenter, aliasycenter;
 extern float r_aliastransition, r_resfudge;
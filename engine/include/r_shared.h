@@ -31,6 +31,36 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 // FIXME: clean up and move into d_iface.h
 
+/*
+ * Scan, span and surface building state that each thread keeps for itself
+ * when the world is rendered a band per thread (r_bands.c), or surfaces are
+ * cached on the worker threads (d_surf.c).  The x86 asm keeps that state in
+ * plain globals, so the renderer stays on one thread in asm builds.
+ */
+#ifdef USE_X86_ASM
+#define BANDLOCAL
+#else
+#define R_THREADED
+#ifdef _MSC_VER
+#define BANDLOCAL __declspec(thread)
+#else
+#define BANDLOCAL __thread
+#endif
+#endif
+
+#ifdef R_THREADED
+/*
+ * Worker threads shared by the renderer (r_threads.c).  R_StartWorkers
+ * returns how many of count threads there are (the main thread is the
+ * first), R_RunWorkers calls work with each index below count, one per
+ * thread, and returns once every call has.
+ */
+int R_StartWorkers(int count);
+void R_RunWorkers(int count, void (*work)(int index));
+#endif
+
+extern BANDLOCAL drawsurf_t r_drawsurf;
+
 #define	MAXVERTS	16	// max points in a surface polygon
 #define MAXWORKINGVERTS	(MAXVERTS+4)	// max points in an intermediate
 					//  polygon (while processing)
@@ -50,9 +80,9 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 
 //===================================================================
 
-extern int cachewidth;
-extern int cacheheight;
-extern pixel_t *cacheblock;
+extern BANDLOCAL int cachewidth;
+extern BANDLOCAL int cacheheight;
+extern BANDLOCAL pixel_t *cacheblock;
 extern int screenwidth;
 
 extern float pixelAspect;
@@ -69,11 +99,6 @@ extern vec3_t vup, base_vup;
 extern vec3_t vpn, base_vpn;
 extern vec3_t vright, base_vright;
 
-// This marks the top of the hunk after map initialisation
-// Surfaces, etc. are allocated on top of this...
-extern int r_maphunkmark;
-
-
 /*
  * Min edges/surfaces are just a reasonable number to play the
  * original id/hipnotic/rouge maps.  Surfaces we want to reference
@@ -87,30 +112,12 @@ extern int r_maphunkmark;
 #define MAXEDGES (MAXSURFACES << 2)
 
 /*
- * Maxs for stack allocated edges/surfs here are based on having at
- * least 1MB of available stack size on a 32-bit platform.  This could
- * be tweaked per-target, but for now this will do.  Alias model
- * rendering still needs to use the stack on top of this, so don't go
- * crazy.
- *
- * Automated formula would be something like 1:3 surf:edge ratio
- *
- * edge_t  = 32 bytes * 15360 =   491520
- * surf_t  = 64 bytes *  6400 =   409600
- * espan_t = 16 bytes *  3000 =    48000
- *                            =>  949120
+ * Edges and surfaces are allocated for each map, growing as views need
+ * more of them (r_main.c).  Spans are generated on the stack, MAXSPANS at
+ * a time: espan_t = 16 bytes * 3000 = 48000.
  */
-#define MAXSTACKEDGES    15360
-#define MAXSTACKSURFACES  6400
 #define MAXSPANS          3000
 
-/*
- * Bump the max by this amount if we overflow.  Shouldn't be too many
- * frames before we converge on the right limit.
- */
-#define MAX_SURFACES_INCREMENT   5120
-#define MAX_EDGES_INCREMENT     10240
-
 extern int r_numsurfaces;
 extern int r_numedges;
 
@@ -160,10 +167,11 @@ typedef struct surf_s {
     float d_ziorigin, d_zistepu, d_zistepv;
 
     const byte *alphatable;     // For entity alpha
-    int pad[1];                 // to 64 bytes
+    struct espan_s *specialspans; // fence/translucent spans (to 64 bytes)
 } surf_t;
 
-extern surf_t *surfaces, *surface_p, *surf_max, *bmodel_surfaces;
+extern BANDLOCAL surf_t *surfaces;
+extern surf_t *surface_p, *surf_max, *bmodel_surfaces;
 
 // surfaces are generated in back to front order by the bsp, so if a surf
 // pointer is greater than another one, it should be drawn in front
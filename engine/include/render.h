@@ -250,10 +250,21 @@ const brush_loader_t *R_BrushModelLoader(void);
 //
 extern qboolean r_cache_thrash;	// set if thrashing the surface cache
 
+// surface cache traffic, counted until someone clears it
+typedef struct {
+    int hits;			// D_CacheSurface found the surface built
+    int misses;			// D_CacheSurface had to build it
+    int evictions;		// D_SCAlloc threw out another surface to make room
+} surfcache_stats_t;
+
+extern surfcache_stats_t d_surfcache_stats;
+
 int D_SurfaceCacheForRes(int width, int height);
+int D_SurfaceCacheForPlates(int platesize, int numplates);
 void D_FlushCaches(void);
 void D_DeleteSurfaceCache(void);
 void D_InitCaches(void *buffer, int size);
+void *D_CacheBuffer(void);
 void R_SetVrect(const vrect_t *in, vrect_t *out, int lineadj);
 
 //
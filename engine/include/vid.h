@@ -142,6 +142,18 @@ void VID_Update(vrect_t *rects);
 
 // flushes the given rectangles from the view buffer to the screen
 
+typedef void (*vid_fillrow32_t)(int x, int y, int width, unsigned *dest,
+				const unsigned *palette);
+
+qboolean VID_SetDirectSource(const vrect_t *rect, vid_fillrow32_t fillrow);
+
+// Registers a 32-bit source for a screen rectangle, used by the next
+// VID_Update only.  Pixels inside rect which are still TRANSPARENT_COLOR in
+// the view buffer are fetched from fillrow (rect relative coordinates) so
+// the renderer can skip the 8-bit intermediate, while anything drawn over
+// it afterwards (HUD, console) still shows.  Returns false if the driver
+// can't do this for the current pixel format; pass NULL to clear.
+
 void VID_LockBuffer(void);
 void VID_UnlockBuffer(void);
 
@@ -115,6 +115,12 @@ void *Hunk_TempAllocExtend(int size);
 
 void Hunk_Check(void);
 
+/*
+ * Memory that a subsystem keeps in an arena of its own, outside the hunk.
+ * The hunk command lists each one with the size the callback reports.
+ */
+void Hunk_AddArena(const char *name, size_t (*size)(void));
+
 typedef struct cache_user_s {
     void (*destructor)(struct cache_user_s *self);
     void *data;